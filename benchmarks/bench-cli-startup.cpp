@@ -0,0 +1,145 @@
+/*
+ * Startup-to-exit time of the headless command-line actions. Builds a
+ * throwaway home with its own settings and a folder of small generated
+ * images, imports it once, then times repeated `wally --apply` runs on the
+ * unchanged library and `wally --status` runs.
+ *
+ * Usage: bench-cli-startup WALLY GLIB_COMPILE_SCHEMAS SCHEMA_DIR [images] [runs]
+ */
+#include "config.h"
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+static gboolean
+generate_images(const char *folder, guint count)
+{
+    g_mkdir_with_parents(folder, 0755);
+    
+    for (guint i = 0; i < count; i++) {
+        g_autoptr(GdkPixbuf) pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, 32, 18);
+        gdk_pixbuf_fill(pixbuf, (i * 2654435761u) | 0xff);
+        
+        g_autofree char *name = g_strdup_printf("wallpaper-%05u.png", i);
+        g_autofree char *path = g_build_filename(folder, name, NULL);
+        if (!gdk_pixbuf_save(pixbuf, path, "png", NULL, NULL)) {
+            return FALSE;
+        }
+    }
+    
+    return TRUE;
+}
+
+// Wall-clock milliseconds from spawning wally to its exit, or -1 on failure
+static double
+time_run(const char *wally, const char *action)
+{
+    const char *argv[] = {wally, action, NULL};
+    int wait_status = 0;
+    
+    gint64 start = g_get_monotonic_time();
+    gboolean spawned = g_spawn_sync(NULL, (char **)argv, NULL, G_SPAWN_STDOUT_TO_DEV_NULL,
+                                    NULL, NULL, NULL, NULL, &wait_status, NULL);
+    gint64 elapsed_us = g_get_monotonic_time() - start;
+    
+    if (!spawned || !g_spawn_check_wait_status(wait_status, NULL)) {
+        return -1;
+    }
+    
+    return elapsed_us / 1000.0;
+}
+
+static gboolean
+report(const char *wally, const char *action, guint runs)
+{
+    std::vector<double> times;
+    for (guint i = 0; i < runs; i++) {
+        double ms = time_run(wally, action);
+        if (ms < 0) {
+            fprintf(stderr, "wally %s failed\n", action);
+            return FALSE;
+        }
+        times.push_back(ms);
+    }
+    
+    std::sort(times.begin(), times.end());
+    printf("%-10s %6u %10.2f %10.2f %10.2f\n", action, runs,
+           times.front(), times[times.size() / 2], times.back());
+    return TRUE;
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s WALLY GLIB_COMPILE_SCHEMAS SCHEMA_DIR [images] [runs]\n", argv[0]);
+        return 1;
+    }
+    
+    const char *wally = argv[1];
+    guint count = argc > 4 ? (guint)strtoul(argv[4], NULL, 10) : 2000;
+    guint runs = argc > 5 ? (guint)strtoul(argv[5], NULL, 10) : 20;
+    
+    g_autofree char *tmp_dir = g_dir_make_tmp("wally-bench-XXXXXX", NULL);
+    if (tmp_dir == NULL) {
+        return 1;
+    }
+    
+    // Everything wally touches lives under the temporary home, settings included
+    g_autofree char *home = g_build_filename(tmp_dir, "home", NULL);
+    g_autofree char *config = g_build_filename(tmp_dir, "config", NULL);
+    g_autofree char *cache = g_build_filename(tmp_dir, "cache", NULL);
+    g_autofree char *schemas = g_build_filename(tmp_dir, "schemas", NULL);
+    g_autofree char *source = g_build_filename(home, "Wallpapers", NULL);
+    g_mkdir_with_parents(home, 0755);
+    g_mkdir_with_parents(schemas, 0755);
+    
+    g_autofree char *target_dir = g_strconcat("--targetdir=", schemas, NULL);
+    const char *compile_argv[] = {argv[2], target_dir, argv[3], NULL};
+    int wait_status = 0;
+    if (!g_spawn_sync(NULL, (char **)compile_argv, NULL, G_SPAWN_DEFAULT, NULL, NULL, NULL, NULL,
+                      &wait_status, NULL) ||
+        !g_spawn_check_wait_status(wait_status, NULL)) {
+        fprintf(stderr, "Failed to compile the settings schema\n");
+        return 1;
+    }
+    
+    g_setenv("HOME", home, TRUE);
+    g_setenv("XDG_CONFIG_HOME", config, TRUE);
+    g_setenv("XDG_CACHE_HOME", cache, TRUE);
+    g_setenv("GSETTINGS_SCHEMA_DIR", schemas, TRUE);
+    g_setenv("GSETTINGS_BACKEND", "keyfile", TRUE);
+    
+    if (!generate_images(source, count)) {
+        fprintf(stderr, "Failed to generate test images\n");
+        return 1;
+    }
+    
+    g_autoptr(GSettings) settings = g_settings_new(APP_ID);
+    g_settings_set_string(settings, "day-folder-path", source);
+    g_settings_set_boolean(settings, "use-same-folder", TRUE);
+    g_settings_sync();
+    
+    double first_ms = time_run(wally, "--apply");
+    if (first_ms < 0) {
+        fprintf(stderr, "wally --apply failed\n");
+        return 1;
+    }
+    
+    printf("%u images, first import %.2f ms\n\n", count, first_ms);
+    printf("%-10s %6s %10s %10s %10s\n", "action", "runs", "min ms", "median ms", "max ms");
+    gboolean success = report(wally, "--apply", runs) && report(wally, "--status", runs);
+    
+    g_autofree char *rm_argv0 = g_find_program_in_path("rm");
+    if (rm_argv0 != NULL) {
+        const char *rm_argv[] = {rm_argv0, "-rf", tmp_dir, NULL};
+        g_spawn_sync(NULL, (char **)rm_argv, NULL, G_SPAWN_DEFAULT, NULL, NULL, NULL, NULL, NULL, NULL);
+    }
+    
+    return success ? 0 : 1;
+}
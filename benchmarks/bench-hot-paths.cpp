@@ -0,0 +1,303 @@
+/*
+ * Time, peak memory and I/O of the library hot paths on synthetic wallpaper
+ * trees: listing the folders, importing them into the store and writing the
+ * slideshow, each first on a fresh library and then again unchanged.
+ * Results go to stdout as JSON so two builds can be compared key by key.
+ *
+ * read_syscalls and write_syscalls are the kernel's syscr and syscw from
+ * /proc/self/io: calls of the read and write families only, for every
+ * thread, including the few this benchmark makes reading /proc. stat(),
+ * open() and getdents() are not in them. The scan stages also report the
+ * scanner's own stat_calls and directories_read, which cover those.
+ *
+ * Everything runs under a temporary $HOME, so the real library and caches
+ * are never touched.
+ *
+ * Usage: bench-hot-paths [max files] [output.json]
+ */
+#include "directory-scanner.h"
+#include "slideshow-manager.h"
+#include "config.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <utime.h>
+#include <string>
+#include <vector>
+
+#define FILES_PER_FOLDER 1000
+
+typedef struct
+{
+    long rss_kb;
+    guint64 read_syscalls;
+    guint64 write_syscalls;
+    guint64 read_bytes;
+    guint64 write_bytes;
+    guint stat_calls;
+    guint directories_read;
+    gint64 time_us;
+} Sample;
+
+static guint64
+read_field(const char *text, const char *name)
+{
+    const char *field = strstr(text, name);
+    return field != NULL ? g_ascii_strtoull(field + strlen(name), NULL, 10) : 0;
+}
+
+// Resets the peak RSS, then records where this process and @scanner, if
+// any, stand
+static void
+take_sample(Sample *sample, WallyDirectoryScanner *scanner)
+{
+    g_autofree char *status = NULL;
+    g_autofree char *io = NULL;
+    
+    g_file_set_contents("/proc/self/clear_refs", "5", 1, NULL);
+    
+    memset(sample, 0, sizeof(*sample));
+    if (g_file_get_contents("/proc/self/status", &status, NULL, NULL)) {
+        sample->rss_kb = (long)read_field(status, "VmRSS:");
+    }
+    // Counts every thread of the process, the import workers included
+    if (g_file_get_contents("/proc/self/io", &io, NULL, NULL)) {
+        sample->read_syscalls = read_field(io, "syscr:");
+        sample->write_syscalls = read_field(io, "syscw:");
+        sample->read_bytes = read_field(io, "rchar:");
+        sample->write_bytes = read_field(io, "wchar:");
+    }
+    if (scanner != NULL) {
+        sample->stat_calls = wally_directory_scanner_get_stat_count(scanner);
+        sample->directories_read = wally_directory_scanner_get_dir_read_count(scanner);
+    }
+    sample->time_us = g_get_monotonic_time();
+}
+
+static void
+add_result(GString *json, const char *stage, guint files, const Sample *start, WallyDirectoryScanner *scanner,
+           gboolean success)
+{
+    gint64 elapsed_us = g_get_monotonic_time() - start->time_us;
+    
+    g_autofree char *status = NULL;
+    g_autofree char *io = NULL;
+    long hwm_kb = 0;
+    guint64 syscr = 0, syscw = 0, rchar = 0, wchar = 0;
+    if (g_file_get_contents("/proc/self/status", &status, NULL, NULL)) {
+        hwm_kb = (long)read_field(status, "VmHWM:");
+    }
+    if (g_file_get_contents("/proc/self/io", &io, NULL, NULL)) {
+        syscr = read_field(io, "syscr:");
+        syscw = read_field(io, "syscw:");
+        rchar = read_field(io, "rchar:");
+        wchar = read_field(io, "wchar:");
+    }
+    
+    double ms = elapsed_us / 1000.0;
+    double per_second = elapsed_us > 0 ? files * 1e6 / elapsed_us : 0;
+    char ms_text[G_ASCII_DTOSTR_BUF_SIZE];
+    char rate_text[G_ASCII_DTOSTR_BUF_SIZE];
+    g_ascii_formatd(ms_text, sizeof(ms_text), "%.3f", ms);
+    g_ascii_formatd(rate_text, sizeof(rate_text), "%.1f", per_second);
+    
+    if (json->str[json->len - 1] == '}') {
+        g_string_append(json, ",");
+    }
+    g_string_append_printf(json,
+        "\n    {\"stage\": \"%s\", \"files\": %u, \"success\": %s, \"ms\": %s, \"files_per_second\": %s, "
+        "\"peak_rss_delta_kb\": %ld, \"read_syscalls\": %" G_GUINT64_FORMAT ", "
+        "\"write_syscalls\": %" G_GUINT64_FORMAT ", \"read_bytes\": %" G_GUINT64_FORMAT ", "
+        "\"write_bytes\": %" G_GUINT64_FORMAT,
+        stage, files, success ? "true" : "false", ms_text, rate_text,
+        MAX(hwm_kb - start->rss_kb, 0L), syscr - start->read_syscalls, syscw - start->write_syscalls,
+        rchar - start->read_bytes, wchar - start->write_bytes);
+    if (scanner != NULL) {
+        g_string_append_printf(json, ", \"stat_calls\": %u, \"directories_read\": %u",
+                               wally_directory_scanner_get_stat_count(scanner) - start->stat_calls,
+                               wally_directory_scanner_get_dir_read_count(scanner) - start->directories_read);
+    }
+    g_string_append(json, "}");
+    
+    fprintf(stderr, "%-18s %8u %10.1f ms %12.0f files/s%s\n", stage, files, ms, per_second,
+            success ? "" : "  (failed)");
+}
+
+static guint32
+crc32_update(guint32 crc, const guint8 *data, gsize length)
+{
+    crc = ~crc;
+    for (gsize i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static void
+append_chunk(std::string& png, const char *type, const std::string& data)
+{
+    guint32 length = GUINT32_TO_BE((guint32)data.size());
+    png.append(reinterpret_cast<const char*>(&length), 4);
+    
+    std::string body = std::string(type, 4) + data;
+    png += body;
+    
+    guint32 crc = GUINT32_TO_BE(crc32_update(0, reinterpret_cast<const guint8*>(body.data()), body.size()));
+    png.append(reinterpret_cast<const char*>(&crc), 4);
+}
+
+// A valid 1x1 PNG whose bytes, and so content hash, are unique to @index
+static std::string
+make_png(guint index)
+{
+    static const guint8 ihdr[] = {0, 0, 0, 1, 0, 0, 0, 1, 8, 2, 0, 0, 0};
+    static const guint8 idat[] = {0x78, 0x9c, 0x63, 0x60, 0x60, 0x60, 0x00, 0x00, 0x00, 0x04, 0x00, 0x01};
+    
+    std::string png("\x89PNG\r\n\x1a\n", 8);
+    append_chunk(png, "IHDR", std::string(reinterpret_cast<const char*>(ihdr), sizeof(ihdr)));
+    g_autofree char *text = g_strdup_printf("Comment%cwallpaper %u", '\0', index);
+    append_chunk(png, "tEXt", std::string(text, 8 + strlen(text + 8)));
+    append_chunk(png, "IDAT", std::string(reinterpret_cast<const char*>(idat), sizeof(idat)));
+    append_chunk(png, "IEND", std::string());
+    return png;
+}
+
+static gboolean
+generate_tree(const char *root, guint count)
+{
+    for (guint i = 0; i < count; i++) {
+        g_autofree char *folder_name = g_strdup_printf("set-%04u", i / FILES_PER_FOLDER);
+        g_autofree char *folder = g_build_filename(root, folder_name, NULL);
+        if (i % FILES_PER_FOLDER == 0 && g_mkdir_with_parents(folder, 0755) != 0) {
+            return FALSE;
+        }
+        
+        g_autofree char *name = g_strdup_printf("wallpaper-%07u.png", i);
+        g_autofree char *path = g_build_filename(folder, name, NULL);
+        std::string png = make_png(i);
+        if (!g_file_set_contents(path, png.data(), png.size(), NULL)) {
+            return FALSE;
+        }
+    }
+    
+    // The scanner doesn't cache folders changed in the last few seconds, so
+    // the tree is aged for the warm scan to find it cached
+    struct utimbuf times;
+    times.actime = times.modtime = time(NULL) - 60;
+    for (guint i = 0; i < count; i += FILES_PER_FOLDER) {
+        g_autofree char *folder_name = g_strdup_printf("set-%04u", i / FILES_PER_FOLDER);
+        g_autofree char *folder = g_build_filename(root, folder_name, NULL);
+        g_utime(folder, &times);
+    }
+    g_utime(root, &times);
+    
+    return TRUE;
+}
+
+static void
+remove_tree(const char *path)
+{
+    g_autofree char *rm = g_find_program_in_path("rm");
+    if (rm != NULL) {
+        const char *argv[] = {rm, "-rf", path, NULL};
+        g_spawn_sync(NULL, (char **)argv, NULL, G_SPAWN_DEFAULT, NULL, NULL, NULL, NULL, NULL, NULL);
+    }
+}
+
+static void
+run_size(GString *json, const char *home, guint count)
+{
+    g_autofree char *size_name = g_strdup_printf("%u", count);
+    g_autofree char *source = g_build_filename(home, "Source", size_name, NULL);
+    g_autofree char *dest = g_build_filename(home, "Pictures", "Wally", "DayWallpapers", NULL);
+    g_autofree char *xml = g_build_filename(home, "Pictures", "Wally", "day-slideshow.xml", NULL);
+    Sample start;
+    
+    if (!generate_tree(source, count)) {
+        fprintf(stderr, "Failed to generate %u files\n", count);
+        return;
+    }
+    
+    // A scanner without a cache file lists from scratch, then from its mtime cache
+    g_autoptr(WallyDirectoryScanner) scanner = wally_directory_scanner_new(NULL);
+    take_sample(&start, scanner);
+    gboolean listed = wally_directory_scanner_scan(scanner, source, TRUE).size() == count;
+    add_result(json, "scan-cold", count, &start, scanner, listed);
+    
+    take_sample(&start, scanner);
+    listed = wally_directory_scanner_scan(scanner, source, TRUE).size() == count;
+    add_result(json, "scan-warm", count, &start, scanner, listed);
+    
+    g_autoptr(WallySlideshowManager) manager = wally_slideshow_manager_new();
+    wally_slideshow_manager_set_recursive(manager, TRUE);
+    wally_slideshow_manager_set_deduplicate(manager, TRUE);
+    wally_slideshow_manager_set_import_mode(manager, WALLY_IMPORT_MODE_COPY);
+    
+    WallySyncStats stats{};
+    take_sample(&start, NULL);
+    gboolean imported = wally_slideshow_manager_copy_wallpapers(manager, source, dest, &stats, NULL, NULL);
+    add_result(json, "import-initial", count, &start, NULL, imported && stats.copied == count);
+    
+    WallySyncStats unchanged_stats{};
+    take_sample(&start, NULL);
+    imported = wally_slideshow_manager_copy_wallpapers(manager, source, dest, &unchanged_stats, NULL, NULL);
+    add_result(json, "import-unchanged", count, &start, NULL, imported && unchanged_stats.copied == 0);
+    
+    gboolean changed = FALSE;
+    take_sample(&start, NULL);
+    gboolean written = wally_slideshow_manager_create_slideshow_xml(manager, dest, xml, 300, 2.0, &changed, NULL);
+    add_result(json, "xml-write", count, &start, NULL, written && changed);
+    
+    take_sample(&start, NULL);
+    written = wally_slideshow_manager_create_slideshow_xml(manager, dest, xml, 300, 2.0, &changed, NULL);
+    add_result(json, "xml-unchanged", count, &start, NULL, written && !changed);
+    
+    // The next size starts from an empty library
+    g_autofree char *wally_dir = g_build_filename(home, "Pictures", NULL);
+    remove_tree(source);
+    remove_tree(wally_dir);
+}
+
+int
+main(int argc, char *argv[])
+{
+    guint max_count = argc > 1 ? (guint)strtoul(argv[1], NULL, 10) : 100000;
+    const char *output_path = argc > 2 ? argv[2] : NULL;
+    
+    g_autofree char *tmp_dir = g_dir_make_tmp("wally-bench-XXXXXX", NULL);
+    if (tmp_dir == NULL) {
+        return 1;
+    }
+    
+    // Before anything asks GLib for the home or cache directory
+    g_autofree char *cache_dir = g_build_filename(tmp_dir, "cache", NULL);
+    g_setenv("HOME", tmp_dir, TRUE);
+    g_setenv("XDG_CACHE_HOME", cache_dir, TRUE);
+    
+    GString *json = g_string_new(NULL);
+    g_string_append_printf(json, "{\n  \"benchmark\": \"hot-paths\",\n  \"version\": \"%s\",\n"
+                                 "  \"cpus\": %u,\n  \"results\": [", VERSION, g_get_num_processors());
+    
+    for (guint count = 100; count <= max_count; count *= 10) {
+        run_size(json, tmp_dir, count);
+    }
+    
+    g_string_append(json, "\n  ]\n}\n");
+    fputs(json->str, stdout);
+    
+    gboolean success = TRUE;
+    if (output_path != NULL && !g_file_set_contents(output_path, json->str, json->len, NULL)) {
+        fprintf(stderr, "Failed to write %s\n", output_path);
+        success = FALSE;
+    }
+    
+    g_string_free(json, TRUE);
+    remove_tree(tmp_dir);
+    return success ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+/*
+ * Size of a slideshow and time to parse it back with the GMarkup reader,
+ * for the ways imported wallpapers can be named: mirroring the source
+ * folder, by content in the store, and with compact sequential names.
+ * Parsing is what gnome-shell does with the file at every login. Each parse
+ * is timed a few times and the fastest run kept, so the file is in the page
+ * cache for all of them.
+ *
+ * Usage: bench-slideshow-names [max images]
+ */
+#include "slideshow-writer.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#define PARSE_RUNS 5
+
+static const char *FOLDERS[] = {
+    "Wallpapers/Nature & Landscapes/2023 Dolomites trip",
+    "Wallpapers/Space/NASA Image of the Day archive",
+    "Wallpapers/Cities at night (edited, 4K)",
+};
+
+// Where each naming puts the index-th image, under a typical home folder
+static char *
+mirrored_path(guint index)
+{
+    return g_strdup_printf("/home/firstname.lastname/Pictures/Wally/DayWallpapers/%s/"
+                           "IMG_%05u - panorama stitched, colour graded, final version.jpg",
+                           FOLDERS[index % G_N_ELEMENTS(FOLDERS)], index);
+}
+
+static char *
+store_path(guint index)
+{
+    return g_strdup_printf("/home/firstname.lastname/Pictures/Wally/Store/%016" G_GINT64_MODIFIER "x.jpg",
+                           (guint64)index * G_GUINT64_CONSTANT(11400714819323198485));
+}
+
+static char *
+compact_path(guint index)
+{
+    return g_strdup_printf("/home/firstname.lastname/Pictures/Wally/DayWallpapers/%06u.jpg", index + 1);
+}
+
+static gboolean
+write_slideshow(const char *output_path, char *(*image_path)(guint), guint count)
+{
+    g_autoptr(WallySlideshowWriter) writer = wally_slideshow_writer_new(output_path, 1800, 2.0, NULL, NULL);
+    if (writer == NULL) {
+        return FALSE;
+    }
+    
+    for (guint i = 0; i < count; i++) {
+        g_autofree char *path = image_path(i);
+        if (!wally_slideshow_writer_add_file(writer, path, NULL)) {
+            return FALSE;
+        }
+    }
+    
+    return wally_slideshow_writer_finish(writer, NULL);
+}
+
+static void
+run(const char *name, char *(*image_path)(guint), const char *output_path, guint count)
+{
+    if (!write_slideshow(output_path, image_path, count)) {
+        printf("%-10s %9u  (failed to write)\n", name, count);
+        return;
+    }
+    
+    GStatBuf st;
+    guint64 size = g_stat(output_path, &st) == 0 ? st.st_size : 0;
+    
+    gint64 best_us = G_MAXINT64;
+    gboolean success = TRUE;
+    for (int run = 0; run < PARSE_RUNS && success; run++) {
+        std::vector<std::string> files;
+        double duration;
+        
+        gint64 start = g_get_monotonic_time();
+        success = wally_slideshow_read(output_path, files, &duration, NULL) && files.size() == count;
+        best_us = MIN(best_us, g_get_monotonic_time() - start);
+    }
+    
+    printf("%-10s %9u %12" G_GUINT64_FORMAT " %10.1f%s\n", name, count, size / 1024, best_us / 1000.0,
+           success ? "" : "  (failed)");
+    fflush(stdout);
+}
+
+int
+main(int argc, char *argv[])
+{
+    guint max_count = argc > 1 ? (guint)strtoul(argv[1], NULL, 10) : 100000;
+    
+    g_autofree char *tmp_dir = g_dir_make_tmp("wally-bench-XXXXXX", NULL);
+    if (tmp_dir == NULL) {
+        return 1;
+    }
+    g_autofree char *output_path = g_build_filename(tmp_dir, "slideshow.xml", NULL);
+    
+    printf("%-10s %9s %12s %10s\n", "names", "images", "output KiB", "parse ms");
+    for (guint count = 100; count <= max_count; count *= 10) {
+        run("mirrored", mirrored_path, output_path, count);
+        run("store", store_path, output_path, count);
+        run("compact", compact_path, output_path, count);
+    }
+    
+    g_unlink(output_path);
+    g_rmdir(tmp_dir);
+    return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * Peak memory and time to write a slideshow for growing libraries, streamed
+ * through WallySlideshowWriter versus built in one GString as before. Each
+ * run happens in its own child process so peaks don't carry over.
+ *
+ * Usage: bench-slideshow-writer [max images]
+ */
+#include "slideshow-writer.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+static char *
+image_path(guint index)
+{
+    return g_strdup_printf("/home/user/Pictures/Wally/Store/%016x & friends.jpg", index * 2654435761u);
+}
+
+// Resident and peak resident set size of this process, in KiB
+static void
+read_memory(long *rss_kb, long *hwm_kb)
+{
+    g_autofree char *status = NULL;
+    *rss_kb = *hwm_kb = 0;
+    
+    if (!g_file_get_contents("/proc/self/status", &status, NULL, NULL)) {
+        return;
+    }
+    
+    const char *rss = strstr(status, "VmRSS:");
+    const char *hwm = strstr(status, "VmHWM:");
+    if (rss != NULL) {
+        *rss_kb = strtol(rss + 6, NULL, 10);
+    }
+    if (hwm != NULL) {
+        *hwm_kb = strtol(hwm + 6, NULL, 10);
+    }
+}
+
+static gboolean
+write_streaming(const char *output_path, guint count)
+{
+    g_autoptr(WallySlideshowWriter) writer = wally_slideshow_writer_new(output_path, 1800, 2.0, NULL, NULL);
+    if (writer == NULL) {
+        return FALSE;
+    }
+    
+    for (guint i = 0; i < count; i++) {
+        g_autofree char *path = image_path(i);
+        if (!wally_slideshow_writer_add_file(writer, path, NULL)) {
+            return FALSE;
+        }
+    }
+    
+    return wally_slideshow_writer_finish(writer, NULL);
+}
+
+// What wally_slideshow_manager_create_slideshow_xml() used to do
+static gboolean
+write_gstring(const char *output_path, guint count)
+{
+    std::vector<std::string> image_files;
+    for (guint i = 0; i < count; i++) {
+        g_autofree char *path = image_path(i);
+        image_files.emplace_back(path);
+    }
+    
+    GString *xml_content = g_string_new("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<background>\n");
+    for (size_t i = 0; i < image_files.size(); i++) {
+        const std::string& current_file = image_files[i];
+        const std::string& next_file = image_files[(i + 1) % image_files.size()];
+        
+        g_string_append_printf(xml_content,
+            "  <static>\n    <duration>%d</duration>\n    <file>%s</file>\n  </static>\n",
+            1800, current_file.c_str());
+        g_string_append_printf(xml_content,
+            "  <transition>\n    <duration>%.1f</duration>\n    <from>%s</from>\n    <to>%s</to>\n  </transition>\n",
+            2.0, current_file.c_str(), next_file.c_str());
+    }
+    g_string_append(xml_content, "</background>\n");
+    
+    gboolean success = g_file_set_contents(output_path, xml_content->str, xml_content->len, NULL);
+    g_string_free(xml_content, TRUE);
+    return success;
+}
+
+static void
+run(const char *name, gboolean (*write)(const char *, guint), const char *output_path, guint count)
+{
+    fflush(stdout);
+    
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Start the peak from here, not from whatever the parent reached
+        g_file_set_contents("/proc/self/clear_refs", "5", 1, NULL);
+        
+        long start_rss_kb, start_hwm_kb;
+        read_memory(&start_rss_kb, &start_hwm_kb);
+        
+        gint64 start = g_get_monotonic_time();
+        gboolean success = write(output_path, count);
+        gint64 elapsed_us = g_get_monotonic_time() - start;
+        
+        long rss_kb, hwm_kb;
+        read_memory(&rss_kb, &hwm_kb);
+        
+        GStatBuf st;
+        guint64 size = g_stat(output_path, &st) == 0 ? st.st_size : 0;
+        
+        printf("%-10s %9u %12" G_GUINT64_FORMAT " %14ld %10.1f%s\n", name, count, size / 1024,
+               hwm_kb - start_rss_kb, elapsed_us / 1000.0, success ? "" : "  (failed)");
+        fflush(stdout);
+        _exit(success ? 0 : 1);
+    }
+    
+    int status;
+    waitpid(pid, &status, 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+    guint max_count = argc > 1 ? (guint)strtoul(argv[1], NULL, 10) : 1000000;
+    
+    g_autofree char *tmp_dir = g_dir_make_tmp("wally-bench-XXXXXX", NULL);
+    if (tmp_dir == NULL) {
+        return 1;
+    }
+    g_autofree char *output_path = g_build_filename(tmp_dir, "slideshow.xml", NULL);
+    
+    printf("%-10s %9s %12s %14s %10s\n", "writer", "images", "output KiB", "peak delta KiB", "ms");
+    for (guint count = 1000; count <= max_count; count *= 10) {
+        run("streaming", write_streaming, output_path, count);
+        run("gstring", write_gstring, output_path, count);
+    }
+    
+    g_unlink(output_path);
+    g_rmdir(tmp_dir);
+    return 0;
+}
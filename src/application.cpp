@@ -1,16 +1,652 @@
 #include "config.h"
 #include "application.h"
+#include "apply-job.h"
+#include "background-writer.h"
+#include "directory-scanner.h"
+#include "folder-watcher.h"
+#include "library-index.h"
 #include "preferences-window.h"
+#include "settings-manager.h"
+#include "slideshow-manager.h"
+#include "wallpaper-scheduler.h"
 
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
+
+// How long to wait before retrying a refresh while another job runs
+#define REFRESH_RETRY_SECONDS 5
+
+// Below the application's own object path, /com/qomarhsn/wally
+#define SCHEDULER_OBJECT_PATH "/com/qomarhsn/wally/Scheduler"
 
 struct _WallyApplication
 {
     AdwApplication parent_instance;
+
+    WallySettingsManager *settings_manager;
+    WallySlideshowManager *slideshow_manager;
+
+    // Background refresh of the slideshows when the folders change
+    WallyFolderWatcher *day_watcher;
+    WallyFolderWatcher *night_watcher;
+    gboolean watching;
+    WallyApplyJob *refresh_job;
+    GCancellable *refresh_cancellable;
+    guint pending_folders;
+    guint retry_id;
+
+    // Rotates the wallpaper itself when the scheduler is enabled
+    WallyWallpaperScheduler *scheduler;
+    // Watched while the scheduler is wanted but couldn't start
+    GFileMonitor *day_xml_monitor;
+    GFileMonitor *night_xml_monitor;
+    guint scheduler_retry_id;
+
+    gboolean holding;
 };
 
 G_DEFINE_FINAL_TYPE(WallyApplication, wally_application, ADW_TYPE_APPLICATION)
 
+static void start_refresh(WallyApplication *self);
+static void update_scheduler(WallyApplication *self);
+
+static gboolean
+on_refresh_retry(gpointer user_data)
+{
+    WallyApplication *self = WALLY_APPLICATION(user_data);
+
+    self->retry_id = 0;
+    start_refresh(self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+on_refresh_finished(GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    WallyApplyJob *job = WALLY_APPLY_JOB(source_object);
+    g_autoptr(WallyApplication) self = WALLY_APPLICATION(user_data);
+    g_autoptr(GError) error = NULL;
+
+    if (!wally_apply_job_run_finish(job, result, &error)) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning("Failed to refresh slideshows: %s", error->message);
+    } else {
+        const WallySyncStats *day = wally_apply_job_get_day_stats(job);
+        const WallySyncStats *night = wally_apply_job_get_night_stats(job);
+        g_message("Slideshows refreshed: %u files imported, %u removed",
+                  day->copied + night->copied, day->deleted + night->deleted);
+        update_scheduler(self);
+    }
+
+    g_clear_object(&self->refresh_job);
+    g_clear_object(&self->refresh_cancellable);
+
+    // Changes that arrived while this job ran get their own pass
+    if (self->pending_folders != 0 && self->watching)
+        start_refresh(self);
+}
+
+// Imports and re-applies only the collections whose folders changed
+static void
+start_refresh(WallyApplication *self)
+{
+    if (self->refresh_job != NULL || self->retry_id != 0 || self->pending_folders == 0)
+        return;
+
+    // Don't race an apply started from the preferences window over the same files
+    if (wally_apply_job_get_n_running() > 0) {
+        self->retry_id = g_timeout_add_seconds(REFRESH_RETRY_SECONDS, on_refresh_retry, self);
+        return;
+    }
+
+    GSettings *settings = wally_settings_manager_get_settings(self->settings_manager);
+    g_autofree char *day_folder = g_settings_get_string(settings, "day-folder-path");
+    g_autofree char *night_folder = g_settings_get_boolean(settings, "use-same-folder")
+                                    ? g_strdup(day_folder)
+                                    : g_settings_get_string(settings, "night-folder-path");
+
+    wally_slideshow_manager_load_settings(self->slideshow_manager, settings);
+
+    int scale_width;
+    int scale_height;
+    wally_settings_manager_get_scale_target(self->settings_manager, &scale_width, &scale_height);
+    wally_slideshow_manager_set_scale_target(self->slideshow_manager, scale_width, scale_height);
+
+    self->refresh_job = wally_apply_job_new(self->slideshow_manager, day_folder, night_folder,
+                                            g_settings_get_int(settings, "slideshow-interval"),
+                                            g_settings_get_double(settings, "transition-duration"));
+    wally_apply_job_set_folders(self->refresh_job, (WallyApplyFolders)self->pending_folders);
+    self->pending_folders = 0;
+
+    self->refresh_cancellable = g_cancellable_new();
+    wally_apply_job_run_async(self->refresh_job, self->refresh_cancellable,
+                              on_refresh_finished, g_object_ref(self));
+}
+
+static void
+on_folder_changed(WallyFolderWatcher *watcher, guint events, WallyApplication *self)
+{
+    GSettings *settings = wally_settings_manager_get_settings(self->settings_manager);
+
+    guint folders;
+    if (watcher == self->night_watcher)
+        folders = WALLY_APPLY_FOLDER_NIGHT;
+    else if (g_settings_get_boolean(settings, "use-same-folder"))
+        folders = WALLY_APPLY_FOLDER_BOTH;
+    else
+        folders = WALLY_APPLY_FOLDER_DAY;
+
+    g_debug("%u changes in %s", events, wally_folder_watcher_get_folder(watcher));
+
+    self->pending_folders |= folders;
+    start_refresh(self);
+}
+
+// Keep running without a window for as long as there is background work
+static void
+update_hold(WallyApplication *self)
+{
+    gboolean holding = self->watching || wally_wallpaper_scheduler_is_running(self->scheduler);
+
+    if (holding && !self->holding)
+        g_application_hold(G_APPLICATION(self));
+    else if (!holding && self->holding)
+        g_application_release(G_APPLICATION(self));
+
+    self->holding = holding;
+}
+
+// Watches the folders while the slideshows are on and watching is enabled
+static void
+update_watching(WallyApplication *self)
+{
+    GSettings *settings = wally_settings_manager_get_settings(self->settings_manager);
+    g_autofree char *day_folder = g_settings_get_string(settings, "day-folder-path");
+    g_autofree char *night_folder = g_settings_get_string(settings, "night-folder-path");
+    gboolean same_folder = g_settings_get_boolean(settings, "use-same-folder");
+    gboolean recursive = g_settings_get_boolean(settings, "scan-recursive");
+
+    gboolean watching = g_settings_get_boolean(settings, "watch-folders") &&
+                        g_settings_get_boolean(settings, "slideshow-enabled") &&
+                        day_folder[0] != '\0';
+
+    if (!watching) {
+        wally_folder_watcher_set_folder(self->day_watcher, NULL, FALSE);
+        wally_folder_watcher_set_folder(self->night_watcher, NULL, FALSE);
+        self->pending_folders = 0;
+        g_clear_handle_id(&self->retry_id, g_source_remove);
+    } else {
+        wally_folder_watcher_set_folder(self->day_watcher, day_folder, recursive);
+        wally_folder_watcher_set_folder(self->night_watcher, same_folder ? NULL : night_folder, recursive);
+    }
+
+    self->watching = watching;
+    update_hold(self);
+}
+
+// Starts the service at login while the scheduler is on; the rotation
+// position only lives in its memory
+static void
+update_autostart(gboolean enabled)
+{
+    g_autofree char *autostart_dir = g_build_filename(g_get_user_config_dir(), "autostart", NULL);
+    g_autofree char *path = g_build_filename(autostart_dir, APP_ID "-scheduler.desktop", NULL);
+    g_autoptr(GError) error = NULL;
+
+    if (!enabled) {
+        g_unlink(path);
+        return;
+    }
+
+    if (g_file_test(path, G_FILE_TEST_EXISTS))
+        return;
+
+    static const char contents[] =
+        "[Desktop Entry]\n"
+        "Type=Application\n"
+        "Name=" APP_NAME " Scheduler\n"
+        "Exec=wally --gapplication-service\n"
+        "NoDisplay=true\n"
+        "X-GNOME-Autostart-enabled=true\n";
+
+    g_mkdir_with_parents(autostart_dir, 0755);
+    if (!g_file_set_contents(path, contents, -1, &error))
+        g_warning("Failed to enable the scheduler at login: %s", error->message);
+}
+
+// Hands rotation back to GNOME's slideshows once the scheduler is turned off
+static void
+restore_slideshows(WallyApplication *self)
+{
+    for (WallyApplyFolders folder : {WALLY_APPLY_FOLDER_DAY, WALLY_APPLY_FOLDER_NIGHT}) {
+        g_autofree char *xml_path = wally_apply_job_build_xml_path(folder);
+        g_autoptr(GError) error = NULL;
+
+        if (g_file_test(xml_path, G_FILE_TEST_EXISTS) &&
+            !wally_slideshow_manager_stage_wallpaper(self->slideshow_manager, xml_path,
+                                                     folder == WALLY_APPLY_FOLDER_NIGHT, &error))
+            g_warning("Failed to restore slideshow %s: %s", xml_path, error->message);
+    }
+
+    wally_background_writer_commit(wally_background_writer_get_default());
+}
+
+static gboolean
+on_scheduler_retry(gpointer user_data)
+{
+    WallyApplication *self = WALLY_APPLICATION(user_data);
+
+    self->scheduler_retry_id = 0;
+    update_scheduler(self);
+
+    return G_SOURCE_REMOVE;
+}
+
+// One write raises several events; they are folded into a single retry,
+// made once the monitor that raised them is no longer emitting
+static void
+on_slideshow_written(GFileMonitor *monitor G_GNUC_UNUSED, GFile *file G_GNUC_UNUSED,
+                     GFile *other_file G_GNUC_UNUSED, GFileMonitorEvent event, WallyApplication *self)
+{
+    if (event == G_FILE_MONITOR_EVENT_DELETED || event == G_FILE_MONITOR_EVENT_MOVED_OUT ||
+        self->scheduler_retry_id != 0)
+        return;
+
+    self->scheduler_retry_id = g_idle_add(on_scheduler_retry, self);
+}
+
+static GFileMonitor *
+watch_slideshow(WallyApplication *self, WallyApplyFolders folder)
+{
+    g_autofree char *xml_path = wally_apply_job_build_xml_path(folder);
+    g_autoptr(GFile) file = g_file_new_for_path(xml_path);
+    GFileMonitor *monitor = g_file_monitor_file(file, G_FILE_MONITOR_WATCH_MOVES, NULL, NULL);
+
+    if (monitor != NULL)
+        g_signal_connect(monitor, "changed", G_CALLBACK(on_slideshow_written), self);
+
+    return monitor;
+}
+
+/*
+ * A scheduler that failed to start, typically because no slideshow was
+ * written yet, is tried again whenever one is written, by this process or
+ * by another. Apply jobs leave the slideshows to the scheduler, so until
+ * it runs GNOME is given them here instead.
+ */
+static void
+watch_slideshows(WallyApplication *self, gboolean watch)
+{
+    if (!watch) {
+        g_clear_handle_id(&self->scheduler_retry_id, g_source_remove);
+        g_clear_object(&self->day_xml_monitor);
+        g_clear_object(&self->night_xml_monitor);
+        return;
+    }
+
+    if (self->day_xml_monitor == NULL)
+        self->day_xml_monitor = watch_slideshow(self, WALLY_APPLY_FOLDER_DAY);
+    if (self->night_xml_monitor == NULL)
+        self->night_xml_monitor = watch_slideshow(self, WALLY_APPLY_FOLDER_NIGHT);
+}
+
+static void
+update_scheduler(WallyApplication *self)
+{
+    GSettings *settings = wally_settings_manager_get_settings(self->settings_manager);
+    g_autoptr(GError) error = NULL;
+
+    wally_wallpaper_scheduler_set_shuffle(self->scheduler,
+                                          g_settings_get_boolean(settings, "shuffle"),
+                                          g_settings_get_uint64(settings, "shuffle-seed"),
+                                          g_settings_get_boolean(settings, "shuffle-no-repeat"));
+    wally_wallpaper_scheduler_set_power_policy(self->scheduler,
+                                               g_settings_get_boolean(settings, "pause-when-locked"),
+                                               g_settings_get_double(settings, "battery-interval-factor"));
+
+    gboolean wanted = g_settings_get_boolean(settings, "use-scheduler") &&
+                      g_settings_get_boolean(settings, "slideshow-enabled");
+    gboolean running = wally_wallpaper_scheduler_is_running(self->scheduler);
+
+    if (wanted && !running) {
+        gboolean started = wally_wallpaper_scheduler_start(self->scheduler, &error);
+        if (!started) {
+            g_message("Wallpaper scheduler not started yet, GNOME rotates the slideshows meanwhile: %s",
+                      error->message);
+            restore_slideshows(self);
+        }
+        watch_slideshows(self, !started);
+    } else if (!wanted) {
+        watch_slideshows(self, FALSE);
+        if (running) {
+            wally_wallpaper_scheduler_stop(self->scheduler);
+            restore_slideshows(self);
+        }
+    }
+
+    update_autostart(g_settings_get_boolean(settings, "use-scheduler"));
+    update_hold(self);
+}
+
+static void
+on_settings_changed(GSettings *settings G_GNUC_UNUSED, const char *key, WallyApplication *self)
+{
+    static const char *const watched_keys[] = {
+        "day-folder-path", "night-folder-path", "use-same-folder",
+        "scan-recursive", "slideshow-enabled", "watch-folders", NULL
+    };
+
+    if (g_strv_contains(watched_keys, key))
+        update_watching(self);
+
+    if (g_str_equal(key, "use-scheduler") || g_str_equal(key, "slideshow-enabled") ||
+        g_str_has_prefix(key, "shuffle") || g_str_equal(key, "pause-when-locked") ||
+        g_str_equal(key, "battery-interval-factor"))
+        update_scheduler(self);
+}
+
+// Actions that run in the calling process and exit, without GTK or a window
+static const GOptionEntry option_entries[] = {
+    { "apply", 'a', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL,
+      N_("Import the wallpaper folders and apply the slideshows"), NULL },
+    { "rescan", 'r', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL,
+      N_("Like --apply, but read every folder again instead of using the scan cache"), NULL },
+    { "next", 'n', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL,
+      N_("Show the next wallpaper of the current slideshow"), NULL },
+    { "status", 's', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL,
+      N_("Show the configured folders and whether their slideshows are applied"), NULL },
+    { "gc", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL,
+      N_("Remove imported wallpapers no slideshow uses and keep the rest within the store quota"), NULL },
+    { "dry-run", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL,
+      N_("With --gc, only list what would be reclaimed"), NULL },
+    G_OPTION_ENTRY_NULL
+};
+
+static void
+get_folders(GSettings *settings, char **day_folder, char **night_folder)
+{
+    *day_folder = g_settings_get_string(settings, "day-folder-path");
+    if (g_settings_get_boolean(settings, "use-same-folder"))
+        *night_folder = g_strdup(*day_folder);
+    else
+        *night_folder = g_settings_get_string(settings, "night-folder-path");
+}
+
+static int
+run_apply(WallySettingsManager *settings_manager, gboolean rescan)
+{
+    GSettings *settings = wally_settings_manager_get_settings(settings_manager);
+    g_autofree char *day_folder = NULL;
+    g_autofree char *night_folder = NULL;
+    g_autoptr(GError) error = NULL;
+
+    get_folders(settings, &day_folder, &night_folder);
+    if (day_folder[0] == '\0' || night_folder[0] == '\0') {
+        g_printerr("%s\n", _("No wallpaper folders are set up yet; choose them in Wally first"));
+        return EXIT_FAILURE;
+    }
+
+    g_autoptr(WallySlideshowManager) manager = wally_slideshow_manager_new();
+    wally_slideshow_manager_load_settings(manager, settings);
+
+    int scale_width;
+    int scale_height;
+    wally_settings_manager_get_scale_target(settings_manager, &scale_width, &scale_height);
+    wally_slideshow_manager_set_scale_target(manager, scale_width, scale_height);
+
+    if (rescan)
+        wally_directory_scanner_clear_cache(wally_directory_scanner_get_default());
+
+    g_autoptr(WallyApplyJob) job = wally_apply_job_new(manager, day_folder, night_folder,
+                                                       g_settings_get_int(settings, "slideshow-interval"),
+                                                       g_settings_get_double(settings, "transition-duration"));
+    if (!wally_apply_job_run_sync(job, NULL, &error)) {
+        g_printerr("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    if (!g_settings_get_boolean(settings, "slideshow-enabled")) {
+        g_settings_set_boolean(settings, "slideshow-enabled", TRUE);
+        g_settings_sync();
+    }
+
+    const WallySyncStats *day = wally_apply_job_get_day_stats(job);
+    const WallySyncStats *night = wally_apply_job_get_night_stats(job);
+    g_print(_("Slideshows applied: %u files imported, %u unchanged, %u removed, %u failed\n"),
+            day->copied + night->copied, day->skipped + night->skipped,
+            day->deleted + night->deleted, day->failed + night->failed);
+
+    return day->failed + night->failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void
+print_collection_status(WallySlideshowManager *manager,
+                        const char *label,
+                        const char *folder,
+                        WallyApplyFolders collection)
+{
+    g_autofree char *dest_folder = wally_apply_job_build_dest_folder(collection);
+    g_autofree char *xml_path = wally_apply_job_build_xml_path(collection);
+    g_autoptr(WallyLibraryIndex) index = wally_library_index_open(dest_folder, NULL);
+    gboolean applied = wally_slideshow_manager_is_wallpaper_applied(manager, xml_path,
+                                                                     collection == WALLY_APPLY_FOLDER_NIGHT);
+
+    g_print("%s: %s\n", label, folder[0] != '\0' ? folder : _("(not set)"));
+    g_print(_("  %u wallpapers imported, slideshow %s\n"), index != NULL ? (guint)wally_library_index_get_n_records(index) : 0,
+            applied ? _("applied") : _("not applied"));
+}
+
+static int
+run_status(WallySettingsManager *settings_manager)
+{
+    GSettings *settings = wally_settings_manager_get_settings(settings_manager);
+    g_autofree char *day_folder = NULL;
+    g_autofree char *night_folder = NULL;
+
+    get_folders(settings, &day_folder, &night_folder);
+
+    g_autoptr(WallySlideshowManager) manager = wally_slideshow_manager_new();
+
+    print_collection_status(manager, _("Day folder"), day_folder, WALLY_APPLY_FOLDER_DAY);
+    print_collection_status(manager, _("Night folder"), night_folder, WALLY_APPLY_FOLDER_NIGHT);
+    g_print(_("Slideshow: %s, changing every %d minutes\n"),
+            g_settings_get_boolean(settings, "slideshow-enabled") ? _("on") : _("off"),
+            g_settings_get_int(settings, "slideshow-interval") / 60);
+    g_print(_("Folder watching: %s\n"),
+            g_settings_get_boolean(settings, "watch-folders") ? _("on") : _("off"));
+
+    return EXIT_SUCCESS;
+}
+
+static int
+run_gc(WallySettingsManager *settings_manager, gboolean dry_run)
+{
+    GSettings *settings = wally_settings_manager_get_settings(settings_manager);
+    g_autoptr(GError) error = NULL;
+
+    g_autoptr(WallySlideshowManager) manager = wally_slideshow_manager_new();
+    wally_slideshow_manager_load_settings(manager, settings);
+
+    g_autofree char *day_dest = wally_apply_job_build_dest_folder(WALLY_APPLY_FOLDER_DAY);
+    g_autofree char *night_dest = wally_apply_job_build_dest_folder(WALLY_APPLY_FOLDER_NIGHT);
+    g_autofree char *day_xml = wally_apply_job_build_xml_path(WALLY_APPLY_FOLDER_DAY);
+    g_autofree char *night_xml = wally_apply_job_build_xml_path(WALLY_APPLY_FOLDER_NIGHT);
+    const char *dest_folders[] = {day_dest, night_dest, NULL};
+    const char *xml_paths[] = {day_xml, night_xml, NULL};
+
+    WallyPruneStats stats;
+    gboolean success = wally_slideshow_manager_prune_store(manager, dest_folders, xml_paths, dry_run, &stats,
+                                                           [dry_run](WallyPruneAction action, const std::string& path,
+                                                                     guint64 bytes) {
+        if (!dry_run)
+            return;
+        g_autofree char *size = g_format_size(bytes);
+        g_print(action == WALLY_PRUNE_ACTION_REMOVE ? _("remove %s (%s)\n") : _("link to source %s (%s)\n"),
+                path.c_str(), size);
+    }, &error);
+
+    if (!success) {
+        g_printerr("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    g_autofree char *removed = g_format_size(stats.removed_bytes);
+    g_autofree char *evicted = g_format_size(stats.evicted_bytes);
+    g_autofree char *used = g_format_size(stats.used_bytes);
+    g_print(dry_run ? _("Would reclaim %s from %u unused files and %s by linking %u images to their source; %s would be left\n")
+                    : _("Reclaimed %s from %u unused files and %s by linking %u images to their source; %s left\n"),
+            removed, stats.removed, evicted, stats.evicted, used);
+
+    return EXIT_SUCCESS;
+}
+
+// Asks the running scheduler, started through D-Bus activation if need be
+static int
+run_next(WallySettingsManager *settings_manager)
+{
+    GSettings *settings = wally_settings_manager_get_settings(settings_manager);
+    g_autoptr(GError) error = NULL;
+
+    if (!g_settings_get_boolean(settings, "use-scheduler")) {
+        g_autoptr(WallySlideshowManager) manager = wally_slideshow_manager_new();
+        wally_slideshow_manager_next_wallpaper(manager);
+        return EXIT_SUCCESS;
+    }
+
+    g_autoptr(GDBusConnection) bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+    g_autoptr(GVariant) reply = NULL;
+    if (bus != NULL)
+        reply = g_dbus_connection_call_sync(bus, APP_ID, SCHEDULER_OBJECT_PATH,
+                                            WALLY_SCHEDULER_DBUS_INTERFACE, "Next",
+                                            NULL, NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+
+    if (reply == NULL) {
+        g_printerr("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Runs before the application registers or starts up, so the headless
+ * actions never initialize GTK or libadwaita and never load the window
+ * template. Returns -1 to carry on with normal startup when none was given.
+ */
+static int
+wally_application_handle_local_options(GApplication *app G_GNUC_UNUSED, GVariantDict *options)
+{
+    gboolean apply = g_variant_dict_contains(options, "apply");
+    gboolean rescan = g_variant_dict_contains(options, "rescan");
+    gboolean next = g_variant_dict_contains(options, "next");
+    gboolean status = g_variant_dict_contains(options, "status");
+    gboolean gc = g_variant_dict_contains(options, "gc");
+
+    if (!apply && !rescan && !next && !status && !gc)
+        return -1;
+
+    g_autoptr(WallySettingsManager) settings_manager = wally_settings_manager_new();
+
+    if ((apply || rescan) && run_apply(settings_manager, rescan) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    if (next && run_next(settings_manager) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    if (gc && run_gc(settings_manager, g_variant_dict_contains(options, "dry-run")) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    if (status)
+        return run_status(settings_manager);
+
+    return EXIT_SUCCESS;
+}
+
+static void
+wally_application_startup(GApplication *app)
+{
+    WallyApplication *self = WALLY_APPLICATION(app);
+
+    G_APPLICATION_CLASS(wally_application_parent_class)->startup(app);
+
+    self->settings_manager = wally_settings_manager_new();
+    self->slideshow_manager = wally_slideshow_manager_new();
+    self->day_watcher = wally_folder_watcher_new();
+    self->night_watcher = wally_folder_watcher_new();
+
+    g_signal_connect(self->day_watcher, "changed", G_CALLBACK(on_folder_changed), self);
+    g_signal_connect(self->night_watcher, "changed", G_CALLBACK(on_folder_changed), self);
+    g_signal_connect(wally_settings_manager_get_settings(self->settings_manager), "changed",
+                     G_CALLBACK(on_settings_changed), self);
+
+    update_watching(self);
+    update_scheduler(self);
+}
+
+static void
+wally_application_shutdown(GApplication *app)
+{
+    WallyApplication *self = WALLY_APPLICATION(app);
+
+    g_clear_handle_id(&self->retry_id, g_source_remove);
+    if (self->refresh_cancellable)
+        g_cancellable_cancel(self->refresh_cancellable);
+
+    if (self->settings_manager)
+        g_signal_handlers_disconnect_by_data(wally_settings_manager_get_settings(self->settings_manager), self);
+    g_clear_object(&self->day_watcher);
+    g_clear_object(&self->night_watcher);
+    wally_wallpaper_scheduler_stop(self->scheduler);
+
+    G_APPLICATION_CLASS(wally_application_parent_class)->shutdown(app);
+}
+
+static gboolean
+wally_application_dbus_register(GApplication *app,
+                                GDBusConnection *connection,
+                                const char *object_path,
+                                GError **error)
+{
+    WallyApplication *self = WALLY_APPLICATION(app);
+
+    if (!G_APPLICATION_CLASS(wally_application_parent_class)->dbus_register(app, connection, object_path, error))
+        return FALSE;
+
+    // Exported even while disabled, so Status can say so
+    g_autofree char *scheduler_path = g_strconcat(object_path, "/Scheduler", NULL);
+    return wally_wallpaper_scheduler_export(self->scheduler, connection, scheduler_path, error);
+}
+
+static void
+wally_application_dbus_unregister(GApplication *app,
+                                  GDBusConnection *connection,
+                                  const char *object_path)
+{
+    WallyApplication *self = WALLY_APPLICATION(app);
+
+    wally_wallpaper_scheduler_unexport(self->scheduler);
+
+    G_APPLICATION_CLASS(wally_application_parent_class)->dbus_unregister(app, connection, object_path);
+}
+
+static void
+wally_application_dispose(GObject *object)
+{
+    WallyApplication *self = WALLY_APPLICATION(object);
+
+    g_clear_object(&self->refresh_job);
+    g_clear_object(&self->refresh_cancellable);
+    g_clear_handle_id(&self->scheduler_retry_id, g_source_remove);
+    g_clear_object(&self->day_xml_monitor);
+    g_clear_object(&self->night_xml_monitor);
+    g_clear_object(&self->slideshow_manager);
+    g_clear_object(&self->settings_manager);
+    g_clear_object(&self->scheduler);
+
+    G_OBJECT_CLASS(wally_application_parent_class)->dispose(object);
+}
+
 static void
 wally_application_activate(GApplication *app)
 {
@@ -30,9 +666,17 @@ wally_application_activate(GApplication *app)
 static void
 wally_application_class_init(WallyApplicationClass *klass)
 {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
     GApplicationClass *app_class = G_APPLICATION_CLASS(klass);
 
+    object_class->dispose = wally_application_dispose;
+
+    app_class->handle_local_options = wally_application_handle_local_options;
+    app_class->startup = wally_application_startup;
+    app_class->shutdown = wally_application_shutdown;
     app_class->activate = wally_application_activate;
+    app_class->dbus_register = wally_application_dbus_register;
+    app_class->dbus_unregister = wally_application_dbus_unregister;
 }
 
 static void
@@ -42,6 +686,12 @@ wally_application_init(WallyApplication *self)
     g_object_set(self,
                  "application-id", APP_ID,
                  NULL);
+
+    g_application_add_main_option_entries(G_APPLICATION(self), option_entries);
+
+    g_autofree char *day_xml = wally_apply_job_build_xml_path(WALLY_APPLY_FOLDER_DAY);
+    g_autofree char *night_xml = wally_apply_job_build_xml_path(WALLY_APPLY_FOLDER_NIGHT);
+    self->scheduler = wally_wallpaper_scheduler_new(day_xml, night_xml);
 }
 
 WallyApplication *
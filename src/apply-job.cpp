@@ -0,0 +1,499 @@
+#include "apply-job.h"
+#include "background-writer.h"
+#include "trace.h"
+#include "config.h"
+
+#include <glib/gi18n.h>
+#include <new>
+
+struct _WallyApplyJob
+{
+    GObject parent_instance;
+    
+    WallySlideshowManager *manager;
+    char *day_folder;
+    char *night_folder;
+    int interval_seconds;
+    double transition_duration;
+    WallyApplyFolders folders;
+    
+    char *day_dest;
+    char *night_dest;
+    char *day_xml;
+    char *night_xml;
+    
+    std::atomic<int> stage;
+    std::atomic<guint> xml_written;
+    gboolean day_changed;
+    gboolean night_changed;
+    guint background_writes;
+    WallySyncStats day_stats;
+    WallySyncStats night_stats;
+    WallyScaleStats scale_stats;
+    WallyTraceRun *trace_run;
+};
+
+G_DEFINE_FINAL_TYPE(WallyApplyJob, wally_apply_job, G_TYPE_OBJECT)
+
+// Jobs started and not yet finished, counted on the main thread
+static guint n_running_jobs;
+
+static void
+wally_apply_job_dispose(GObject *object)
+{
+    WallyApplyJob *self = WALLY_APPLY_JOB(object);
+    
+    g_clear_object(&self->manager);
+    
+    G_OBJECT_CLASS(wally_apply_job_parent_class)->dispose(object);
+}
+
+static void
+wally_apply_job_finalize(GObject *object)
+{
+    WallyApplyJob *self = WALLY_APPLY_JOB(object);
+    
+    g_free(self->day_folder);
+    g_free(self->night_folder);
+    g_free(self->day_dest);
+    g_free(self->night_dest);
+    g_free(self->day_xml);
+    g_free(self->night_xml);
+    
+    // Only left when the job never finished
+    wally_trace_run_end(self->trace_run, FALSE);
+    
+    // Members with constructors were placement-constructed in init
+    self->day_stats.~WallySyncStats();
+    self->night_stats.~WallySyncStats();
+    self->scale_stats.~WallyScaleStats();
+    
+    G_OBJECT_CLASS(wally_apply_job_parent_class)->finalize(object);
+}
+
+static void
+wally_apply_job_class_init(WallyApplyJobClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    
+    object_class->dispose = wally_apply_job_dispose;
+    object_class->finalize = wally_apply_job_finalize;
+}
+
+static void
+wally_apply_job_init(WallyApplyJob *self)
+{
+    new (&self->stage) std::atomic<int>(WALLY_APPLY_STAGE_PENDING);
+    new (&self->xml_written) std::atomic<guint>(0);
+    new (&self->day_stats) WallySyncStats{};
+    new (&self->night_stats) WallySyncStats{};
+    new (&self->scale_stats) WallyScaleStats{};
+    
+    self->day_dest = wally_apply_job_build_dest_folder(WALLY_APPLY_FOLDER_DAY);
+    self->night_dest = wally_apply_job_build_dest_folder(WALLY_APPLY_FOLDER_NIGHT);
+    self->day_xml = wally_apply_job_build_xml_path(WALLY_APPLY_FOLDER_DAY);
+    self->night_xml = wally_apply_job_build_xml_path(WALLY_APPLY_FOLDER_NIGHT);
+}
+
+WallyApplyJob *
+wally_apply_job_new(WallySlideshowManager *manager,
+                    const char *day_folder,
+                    const char *night_folder,
+                    int interval_seconds,
+                    double transition_duration)
+{
+    g_return_val_if_fail(WALLY_IS_SLIDESHOW_MANAGER(manager), NULL);
+    g_return_val_if_fail(day_folder != NULL, NULL);
+    g_return_val_if_fail(night_folder != NULL, NULL);
+    
+    WallyApplyJob *self = static_cast<WallyApplyJob*>(g_object_new(WALLY_TYPE_APPLY_JOB, NULL));
+    self->manager = static_cast<WallySlideshowManager*>(g_object_ref(manager));
+    self->day_folder = g_strdup(day_folder);
+    self->night_folder = g_strdup(night_folder);
+    self->interval_seconds = interval_seconds;
+    self->transition_duration = transition_duration;
+    self->folders = WALLY_APPLY_FOLDER_BOTH;
+    
+    return self;
+}
+
+// One mixed folder the manager sorts into day and night itself
+static gboolean
+is_classifying(WallyApplyJob *self)
+{
+    return wally_slideshow_manager_get_auto_classify(self->manager) &&
+           g_strcmp0(self->day_folder, self->night_folder) == 0;
+}
+
+// Write one slideshow of a collection
+static gboolean
+write_slideshow(WallyApplyJob *self,
+                const char *dest_folder,
+                const char *xml_path,
+                WallyLuminanceClass luminance_class,
+                gboolean *changed,
+                GError **error)
+{
+    if (!wally_slideshow_manager_create_classified_xml(self->manager, dest_folder, xml_path, luminance_class,
+                                                       self->interval_seconds, self->transition_duration,
+                                                       changed, error)) {
+        return FALSE;
+    }
+    
+    self->xml_written++;
+    return TRUE;
+}
+
+// Everything up to the gsettings writes. A stage that fails or is
+// cancelled still has its span recorded, as failed.
+static gboolean
+run_thread_stages(WallyApplyJob *self,
+                  GCancellable *cancellable,
+                  GError **error)
+{
+    g_auto(WallyTraceSpan) span = {NULL, 0};
+    
+    // Both slideshows come out of the one import, so both follow any change
+    gboolean classifying = is_classifying(self);
+    if (classifying) {
+        self->folders = WALLY_APPLY_FOLDER_BOTH;
+    }
+    
+    if (self->folders & WALLY_APPLY_FOLDER_DAY) {
+        self->stage = WALLY_APPLY_STAGE_IMPORTING_DAY;
+        wally_trace_span_begin(&span, "import-day");
+        if (!wally_slideshow_manager_copy_wallpapers(self->manager, self->day_folder, self->day_dest,
+                                                     &self->day_stats, cancellable, error)) {
+            g_prefix_error(error, "Failed to copy day wallpapers: ");
+            return FALSE;
+        }
+        wally_trace_span_end(&span, self->day_stats.scanned, self->day_stats.bytes_copied);
+    }
+    
+    if ((self->folders & WALLY_APPLY_FOLDER_NIGHT) && !classifying) {
+        self->stage = WALLY_APPLY_STAGE_IMPORTING_NIGHT;
+        wally_trace_span_begin(&span, "import-night");
+        if (!wally_slideshow_manager_copy_wallpapers(self->manager, self->night_folder, self->night_dest,
+                                                     &self->night_stats, cancellable, error)) {
+            g_prefix_error(error, "Failed to copy night wallpapers: ");
+            return FALSE;
+        }
+        wally_trace_span_end(&span, self->night_stats.scanned, self->night_stats.bytes_copied);
+    }
+    
+    const char *dest_folders[] = {self->day_dest, self->night_dest, NULL};
+    
+    self->stage = WALLY_APPLY_STAGE_SCALING;
+    wally_trace_span_begin(&span, "scale");
+    if (!wally_slideshow_manager_prescale_wallpapers(self->manager, dest_folders, &self->scale_stats,
+                                                     cancellable, error)) {
+        g_prefix_error(error, "Failed to downscale wallpapers: ");
+        return FALSE;
+    }
+    wally_trace_span_end(&span, self->scale_stats.scaled, 0);
+    
+    self->stage = WALLY_APPLY_STAGE_WRITING_XML;
+    if ((self->folders & WALLY_APPLY_FOLDER_DAY) &&
+        !write_slideshow(self, self->day_dest, self->day_xml,
+                         classifying ? WALLY_LUMINANCE_CLASS_DAY : WALLY_LUMINANCE_CLASS_ANY,
+                         &self->day_changed, error)) {
+        g_prefix_error(error, "Failed to create day slideshow: ");
+        return FALSE;
+    }
+    
+    if ((self->folders & WALLY_APPLY_FOLDER_NIGHT) &&
+        !write_slideshow(self, classifying ? self->day_dest : self->night_dest, self->night_xml,
+                         classifying ? WALLY_LUMINANCE_CLASS_NIGHT : WALLY_LUMINANCE_CLASS_ANY,
+                         &self->night_changed, error)) {
+        g_prefix_error(error, "Failed to create night slideshow: ");
+        return FALSE;
+    }
+    
+    // Drop imported files neither the collections nor the new slideshows
+    // use any more, and keep the rest within the store quota
+    const char *xml_paths[] = {self->day_xml, self->night_xml, NULL};
+    WallyPruneStats prune_stats;
+    GError *prune_error = NULL;
+    wally_trace_span_begin(&span, "prune");
+    if (!wally_slideshow_manager_prune_store(self->manager, dest_folders, xml_paths, FALSE, &prune_stats, NULL,
+                                             &prune_error)) {
+        g_warning("Failed to prune wallpaper store: %s", prune_error->message);
+        g_clear_error(&prune_error);
+    } else if (prune_stats.removed > 0 || prune_stats.evicted > 0) {
+        g_debug("Removed %u unused wallpapers and linked %u back to their source",
+                prune_stats.removed, prune_stats.evicted);
+    }
+    wally_trace_span_end(&span, prune_stats.removed + prune_stats.evicted,
+                         prune_stats.removed_bytes + prune_stats.evicted_bytes);
+    
+    return TRUE;
+}
+
+// Runs on a worker thread
+static void
+apply_job_thread(GTask *task,
+                 gpointer source_object,
+                 gpointer task_data G_GNUC_UNUSED,
+                 GCancellable *cancellable)
+{
+    WallyApplyJob *self = WALLY_APPLY_JOB(source_object);
+    GError *error = NULL;
+    
+    // The run is ended on the main thread once the task returns, so every
+    // span has to be recorded by then
+    wally_trace_run_set_current(self->trace_run);
+    gboolean success = run_thread_stages(self, cancellable, &error);
+    wally_trace_run_set_current(NULL);
+    
+    if (!success) {
+        g_task_return_error(task, error);
+        return;
+    }
+    
+    g_task_return_boolean(task, TRUE);
+}
+
+// Setting the key again makes the shell reload the slideshow from the start,
+// so don't when it already points at an unchanged file
+static gboolean
+stage_slideshow(WallyApplyJob *self,
+                const char *xml_path,
+                gboolean is_dark_theme,
+                gboolean changed,
+                GError **error)
+{
+    if (!changed && wally_slideshow_manager_is_wallpaper_applied(self->manager, xml_path, is_dark_theme)) {
+        g_message("Slideshow %s is unchanged and already set, not applying it again", xml_path);
+        return TRUE;
+    }
+    
+    return wally_slideshow_manager_stage_wallpaper(self->manager, xml_path, is_dark_theme, error);
+}
+
+// Point GNOME at the new slideshows
+static gboolean
+apply_slideshows(WallyApplyJob *self,
+                 GError **error)
+{
+    // The scheduler notices the rewritten slideshows by itself
+    if (wally_slideshow_manager_get_scheduled(self->manager)) {
+        return TRUE;
+    }
+    
+    self->stage = WALLY_APPLY_STAGE_APPLYING;
+    
+    // Both collections, and anything else staged, go out in one write
+    WallyBackgroundWriter *writer = wally_background_writer_get_default();
+    
+    if ((self->folders & WALLY_APPLY_FOLDER_DAY) &&
+        !stage_slideshow(self, self->day_xml, FALSE, self->day_changed, error)) {
+        g_prefix_error(error, "Failed to apply day wallpaper: ");
+        wally_background_writer_discard(writer);
+        return FALSE;
+    }
+    
+    if ((self->folders & WALLY_APPLY_FOLDER_NIGHT) &&
+        !stage_slideshow(self, self->night_xml, TRUE, self->night_changed, error)) {
+        g_prefix_error(error, "Failed to apply night wallpaper: ");
+        wally_background_writer_discard(writer);
+        return FALSE;
+    }
+    
+    g_auto(WallyTraceSpan) span = {NULL, 0};
+    wally_trace_span_begin(&span, "gsettings-apply");
+    if (wally_background_writer_commit(writer)) {
+        self->background_writes++;
+    }
+    wally_trace_span_end(&span, self->background_writes, 0);
+    
+    return TRUE;
+}
+
+// Back on the main thread
+static void
+on_apply_job_thread_finished(GObject *source_object,
+                             GAsyncResult *result,
+                             gpointer user_data)
+{
+    WallyApplyJob *self = WALLY_APPLY_JOB(source_object);
+    g_autoptr(GTask) task = G_TASK(user_data);
+    GError *error = NULL;
+    
+    n_running_jobs--;
+    
+    wally_trace_run_set_current(self->trace_run);
+    gboolean success = g_task_propagate_boolean(G_TASK(result), &error) &&
+                       !g_cancellable_set_error_if_cancelled(g_task_get_cancellable(task), &error) &&
+                       apply_slideshows(self, &error);
+    wally_trace_run_set_current(NULL);
+    
+    wally_trace_run_end(self->trace_run, success);
+    self->trace_run = NULL;
+    
+    if (!success) {
+        g_task_return_error(task, error);
+        return;
+    }
+    
+    self->stage = WALLY_APPLY_STAGE_DONE;
+    g_task_return_boolean(task, TRUE);
+}
+
+/*
+ * Limits the job to some of the collections, e.g. when only one folder
+ * changed. Must be called before the job runs.
+ */
+void
+wally_apply_job_set_folders(WallyApplyJob *self,
+                            WallyApplyFolders folders)
+{
+    g_return_if_fail(WALLY_IS_APPLY_JOB(self));
+    g_return_if_fail(self->stage == WALLY_APPLY_STAGE_PENDING);
+    g_return_if_fail((folders & WALLY_APPLY_FOLDER_BOTH) != 0);
+    
+    self->folders = folders;
+}
+
+void
+wally_apply_job_run_async(WallyApplyJob *self,
+                          GCancellable *cancellable,
+                          GAsyncReadyCallback callback,
+                          gpointer user_data)
+{
+    g_return_if_fail(WALLY_IS_APPLY_JOB(self));
+    g_return_if_fail(self->stage == WALLY_APPLY_STAGE_PENDING);
+    
+    GTask *task = g_task_new(self, cancellable, callback, user_data);
+    g_task_set_source_tag(task, (gpointer)wally_apply_job_run_async);
+    
+    g_autoptr(GTask) thread_task = g_task_new(self, cancellable, on_apply_job_thread_finished, task);
+    g_task_set_name(thread_task, "wally-apply");
+    self->trace_run = wally_trace_run_begin("apply");
+    n_running_jobs++;
+    g_task_run_in_thread(thread_task, apply_job_thread);
+}
+
+gboolean
+wally_apply_job_run_finish(WallyApplyJob *self,
+                           GAsyncResult *result,
+                           GError **error)
+{
+    g_return_val_if_fail(WALLY_IS_APPLY_JOB(self), FALSE);
+    g_return_val_if_fail(g_task_is_valid(result, self), FALSE);
+    
+    return g_task_propagate_boolean(G_TASK(result), error);
+}
+
+static void
+on_apply_job_sync_finished(GObject *source_object G_GNUC_UNUSED,
+                           GAsyncResult *result,
+                           gpointer user_data)
+{
+    *static_cast<GAsyncResult**>(user_data) = G_ASYNC_RESULT(g_object_ref(result));
+}
+
+/*
+ * Runs the job to completion on the calling thread, for callers without a
+ * main loop such as the command-line actions. The gsettings writes are
+ * flushed before returning.
+ */
+gboolean
+wally_apply_job_run_sync(WallyApplyJob *self,
+                         GCancellable *cancellable,
+                         GError **error)
+{
+    g_return_val_if_fail(WALLY_IS_APPLY_JOB(self), FALSE);
+    
+    // A private context, so only this job's callbacks are dispatched meanwhile
+    g_autoptr(GMainContext) context = g_main_context_new();
+    g_main_context_push_thread_default(context);
+    
+    GAsyncResult *result = NULL;
+    wally_apply_job_run_async(self, cancellable, on_apply_job_sync_finished, &result);
+    while (result == NULL) {
+        g_main_context_iteration(context, TRUE);
+    }
+    
+    g_main_context_pop_thread_default(context);
+    
+    gboolean success = wally_apply_job_run_finish(self, result, error);
+    g_object_unref(result);
+    
+    wally_background_writer_flush(wally_background_writer_get_default());
+    
+    return success;
+}
+
+void
+wally_apply_job_get_progress(WallyApplyJob *self,
+                             WallyApplyProgress *progress)
+{
+    g_return_if_fail(WALLY_IS_APPLY_JOB(self));
+    g_return_if_fail(progress != NULL);
+    
+    progress->stage = static_cast<WallyApplyStage>(self->stage.load());
+    progress->bytes_copied = self->day_stats.bytes_copied + self->night_stats.bytes_copied;
+    progress->xml_written = self->xml_written;
+    
+    if (progress->stage == WALLY_APPLY_STAGE_SCALING) {
+        progress->files_scanned = self->scale_stats.queued;
+        progress->files_to_copy = self->scale_stats.queued;
+        progress->files_done = self->scale_stats.done;
+        return;
+    }
+    
+    const WallySyncStats& stats = progress->stage == WALLY_APPLY_STAGE_IMPORTING_DAY
+                                  ? self->day_stats : self->night_stats;
+    progress->files_scanned = stats.scanned;
+    progress->files_to_copy = stats.queued;
+    progress->files_done = stats.copied + stats.failed;
+}
+
+const WallySyncStats *
+wally_apply_job_get_day_stats(WallyApplyJob *self)
+{
+    g_return_val_if_fail(WALLY_IS_APPLY_JOB(self), NULL);
+    
+    return &self->day_stats;
+}
+
+const WallySyncStats *
+wally_apply_job_get_night_stats(WallyApplyJob *self)
+{
+    g_return_val_if_fail(WALLY_IS_APPLY_JOB(self), NULL);
+    
+    return &self->night_stats;
+}
+
+// Writes to the background settings the job made: 1 when it applied
+// anything, 0 when both slideshows were already in place
+guint
+wally_apply_job_get_background_writes(WallyApplyJob *self)
+{
+    g_return_val_if_fail(WALLY_IS_APPLY_JOB(self), 0);
+    
+    return self->background_writes;
+}
+
+// Where a collection's wallpapers are imported to
+char *
+wally_apply_job_build_dest_folder(WallyApplyFolders folder)
+{
+    return g_build_filename(g_get_home_dir(), "Pictures", "Wally",
+                            folder == WALLY_APPLY_FOLDER_NIGHT ? "NightWallpapers" : "DayWallpapers", NULL);
+}
+
+// Where a collection's slideshow is written
+char *
+wally_apply_job_build_xml_path(WallyApplyFolders folder)
+{
+    return g_build_filename(g_get_home_dir(), "Pictures", "Wally",
+                            folder == WALLY_APPLY_FOLDER_NIGHT ? "night-slideshow.xml" : "day-slideshow.xml", NULL);
+}
+
+// Lets background refreshes stay out of the way of a job the user started
+guint
+wally_apply_job_get_n_running(void)
+{
+    return n_running_jobs;
+}
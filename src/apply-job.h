@@ -0,0 +1,87 @@
+#pragma once
+
+#include "slideshow-manager.h"
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define WALLY_TYPE_APPLY_JOB (wally_apply_job_get_type())
+
+G_DECLARE_FINAL_TYPE(WallyApplyJob, wally_apply_job, WALLY, APPLY_JOB, GObject)
+
+typedef enum
+{
+    WALLY_APPLY_STAGE_PENDING,
+    WALLY_APPLY_STAGE_IMPORTING_DAY,
+    WALLY_APPLY_STAGE_IMPORTING_NIGHT,
+    WALLY_APPLY_STAGE_SCALING,
+    WALLY_APPLY_STAGE_WRITING_XML,
+    WALLY_APPLY_STAGE_APPLYING,
+    WALLY_APPLY_STAGE_DONE,
+} WallyApplyStage;
+
+/*
+ * Which collections a job imports, writes and applies. The store and the
+ * scaled cache are pruned against both either way.
+ */
+typedef enum
+{
+    WALLY_APPLY_FOLDER_DAY = 1 << 0,
+    WALLY_APPLY_FOLDER_NIGHT = 1 << 1,
+    WALLY_APPLY_FOLDER_BOTH = WALLY_APPLY_FOLDER_DAY | WALLY_APPLY_FOLDER_NIGHT,
+} WallyApplyFolders;
+
+/*
+ * Snapshot of a running job, safe to take from the main thread at any time.
+ * The file counters describe the import or scaling stage currently running.
+ */
+typedef struct
+{
+    WallyApplyStage stage;
+    guint files_scanned;
+    guint files_to_copy;
+    guint files_done;
+    guint64 bytes_copied;
+    guint xml_written;
+} WallyApplyProgress;
+
+WallyApplyJob *wally_apply_job_new(WallySlideshowManager *manager,
+                                   const char *day_folder,
+                                   const char *night_folder,
+                                   int interval_seconds,
+                                   double transition_duration);
+
+void wally_apply_job_set_folders(WallyApplyJob *self,
+                                 WallyApplyFolders folders);
+
+void wally_apply_job_run_async(WallyApplyJob *self,
+                               GCancellable *cancellable,
+                               GAsyncReadyCallback callback,
+                               gpointer user_data);
+
+gboolean wally_apply_job_run_finish(WallyApplyJob *self,
+                                    GAsyncResult *result,
+                                    GError **error);
+
+gboolean wally_apply_job_run_sync(WallyApplyJob *self,
+                                  GCancellable *cancellable,
+                                  GError **error);
+
+void wally_apply_job_get_progress(WallyApplyJob *self,
+                                  WallyApplyProgress *progress);
+
+const WallySyncStats *wally_apply_job_get_day_stats(WallyApplyJob *self);
+
+const WallySyncStats *wally_apply_job_get_night_stats(WallyApplyJob *self);
+
+guint wally_apply_job_get_background_writes(WallyApplyJob *self);
+
+char *wally_apply_job_build_dest_folder(WallyApplyFolders folder);
+
+char *wally_apply_job_build_xml_path(WallyApplyFolders folder);
+
+guint wally_apply_job_get_n_running(void);
+
+G_END_DECLS
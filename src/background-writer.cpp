@@ -0,0 +1,162 @@
+#include "background-writer.h"
+#include "config.h"
+
+#include <glib/gi18n.h>
+
+#define BACKGROUND_SCHEMA "org.gnome.desktop.background"
+
+struct _WallyBackgroundWriter
+{
+    GObject parent_instance;
+    
+    GSettings *settings;
+    guint write_count;
+};
+
+G_DEFINE_FINAL_TYPE(WallyBackgroundWriter, wally_background_writer, G_TYPE_OBJECT)
+
+static void
+wally_background_writer_dispose(GObject *object)
+{
+    WallyBackgroundWriter *self = WALLY_BACKGROUND_WRITER(object);
+    
+    if (self->settings != NULL) {
+        g_settings_revert(self->settings);
+    }
+    g_clear_object(&self->settings);
+    
+    G_OBJECT_CLASS(wally_background_writer_parent_class)->dispose(object);
+}
+
+static void
+wally_background_writer_class_init(WallyBackgroundWriterClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    
+    object_class->dispose = wally_background_writer_dispose;
+}
+
+static void
+wally_background_writer_init(WallyBackgroundWriter *self)
+{
+    self->settings = g_settings_new(BACKGROUND_SCHEMA);
+    
+    // Nothing reaches dconf until commit
+    g_settings_delay(self->settings);
+}
+
+WallyBackgroundWriter *
+wally_background_writer_get_default(void)
+{
+    static WallyBackgroundWriter *default_writer = NULL;
+    
+    if (default_writer == NULL) {
+        default_writer = static_cast<WallyBackgroundWriter*>(g_object_new(WALLY_TYPE_BACKGROUND_WRITER, NULL));
+    }
+    
+    return default_writer;
+}
+
+static const char *
+uri_key(gboolean dark)
+{
+    return dark ? "picture-uri-dark" : "picture-uri";
+}
+
+// Reads back staged values too, so a transaction sees its own changes
+char *
+wally_background_writer_get_uri(WallyBackgroundWriter *self,
+                                gboolean dark)
+{
+    g_return_val_if_fail(WALLY_IS_BACKGROUND_WRITER(self), NULL);
+    
+    return g_settings_get_string(self->settings, uri_key(dark));
+}
+
+static void
+stage_string(WallyBackgroundWriter *self,
+             const char *key,
+             const char *value)
+{
+    g_autofree char *current = g_settings_get_string(self->settings, key);
+    
+    if (g_strcmp0(current, value) != 0) {
+        g_settings_set_string(self->settings, key, value);
+    }
+}
+
+void
+wally_background_writer_set_uri(WallyBackgroundWriter *self,
+                                gboolean dark,
+                                const char *uri)
+{
+    g_return_if_fail(WALLY_IS_BACKGROUND_WRITER(self));
+    g_return_if_fail(uri != NULL);
+    
+    stage_string(self, uri_key(dark), uri);
+}
+
+char *
+wally_background_writer_get_picture_options(WallyBackgroundWriter *self)
+{
+    g_return_val_if_fail(WALLY_IS_BACKGROUND_WRITER(self), NULL);
+    
+    return g_settings_get_string(self->settings, "picture-options");
+}
+
+void
+wally_background_writer_set_picture_options(WallyBackgroundWriter *self,
+                                            const char *options)
+{
+    g_return_if_fail(WALLY_IS_BACKGROUND_WRITER(self));
+    g_return_if_fail(options != NULL);
+    
+    stage_string(self, "picture-options", options);
+}
+
+/*
+ * Sends everything staged since the last commit as one write. The write is
+ * asynchronous; call wally_background_writer_flush() before exiting.
+ * Returns TRUE if there was anything to write.
+ */
+gboolean
+wally_background_writer_commit(WallyBackgroundWriter *self)
+{
+    g_return_val_if_fail(WALLY_IS_BACKGROUND_WRITER(self), FALSE);
+    
+    if (!g_settings_get_has_unapplied(self->settings)) {
+        return FALSE;
+    }
+    
+    g_settings_apply(self->settings);
+    self->write_count++;
+    g_debug("Background settings written (%u writes so far)", self->write_count);
+    
+    return TRUE;
+}
+
+void
+wally_background_writer_discard(WallyBackgroundWriter *self)
+{
+    g_return_if_fail(WALLY_IS_BACKGROUND_WRITER(self));
+    
+    g_settings_revert(self->settings);
+}
+
+// Blocks until committed writes have reached dconf
+void
+wally_background_writer_flush(WallyBackgroundWriter *self)
+{
+    g_return_if_fail(WALLY_IS_BACKGROUND_WRITER(self));
+    
+    g_settings_sync();
+}
+
+// dconf writes made through this writer, for checking that an apply made one
+guint
+wally_background_writer_get_write_count(WallyBackgroundWriter *self)
+{
+    g_return_val_if_fail(WALLY_IS_BACKGROUND_WRITER(self), 0);
+    
+    return self->write_count;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define WALLY_TYPE_BACKGROUND_WRITER (wally_background_writer_get_type())
+
+G_DECLARE_FINAL_TYPE(WallyBackgroundWriter, wally_background_writer, WALLY, BACKGROUND_WRITER, GObject)
+
+/*
+ * The one place Wally writes org.gnome.desktop.background. Changes are
+ * staged on a cached GSettings in delay mode and go out together when
+ * committed, as a single asynchronous dconf write; staging a value the key
+ * already has is not a change. Main thread only.
+ */
+WallyBackgroundWriter *wally_background_writer_get_default(void);
+
+char *wally_background_writer_get_uri(WallyBackgroundWriter *self,
+                                      gboolean dark);
+
+void wally_background_writer_set_uri(WallyBackgroundWriter *self,
+                                     gboolean dark,
+                                     const char *uri);
+
+char *wally_background_writer_get_picture_options(WallyBackgroundWriter *self);
+
+void wally_background_writer_set_picture_options(WallyBackgroundWriter *self,
+                                                 const char *options);
+
+gboolean wally_background_writer_commit(WallyBackgroundWriter *self);
+
+void wally_background_writer_discard(WallyBackgroundWriter *self);
+
+void wally_background_writer_flush(WallyBackgroundWriter *self);
+
+guint wally_background_writer_get_write_count(WallyBackgroundWriter *self);
+
+G_END_DECLS
@@ -0,0 +1,218 @@
+#include "content-hash.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+static const guint64 PRIME64_1 = G_GUINT64_CONSTANT(0x9E3779B185EBCA87);
+static const guint64 PRIME64_2 = G_GUINT64_CONSTANT(0xC2B2AE3D27D4EB4F);
+static const guint64 PRIME64_3 = G_GUINT64_CONSTANT(0x165667B19E3779F9);
+static const guint64 PRIME64_4 = G_GUINT64_CONSTANT(0x85EBCA77C2B2AE63);
+static const guint64 PRIME64_5 = G_GUINT64_CONSTANT(0x27D4EB2F165667C5);
+
+// Files are hashed in chunks of this size
+static const gsize HASH_CHUNK_SIZE = 1024 * 1024;
+
+static inline guint64
+rotl64(guint64 value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline guint64
+read64(const guint8 *p)
+{
+    guint64 value;
+    memcpy(&value, p, sizeof(value));
+    return GUINT64_FROM_LE(value);
+}
+
+static inline guint32
+read32(const guint8 *p)
+{
+    guint32 value;
+    memcpy(&value, p, sizeof(value));
+    return GUINT32_FROM_LE(value);
+}
+
+static inline guint64
+hash_round(guint64 acc, guint64 input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline guint64
+hash_merge_round(guint64 acc, guint64 value)
+{
+    acc ^= hash_round(0, value);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+static void
+hash_consume_stripes(WallyHashState *state, const guint8 *p, gsize len)
+{
+    guint64 *acc = state->acc;
+    
+    for (gsize i = 0; i + 32 <= len; i += 32) {
+        acc[0] = hash_round(acc[0], read64(p + i));
+        acc[1] = hash_round(acc[1], read64(p + i + 8));
+        acc[2] = hash_round(acc[2], read64(p + i + 16));
+        acc[3] = hash_round(acc[3], read64(p + i + 24));
+    }
+}
+
+void
+wally_hash_init(WallyHashState *state, guint64 seed)
+{
+    g_return_if_fail(state != NULL);
+    
+    state->seed = seed;
+    state->acc[0] = seed + PRIME64_1 + PRIME64_2;
+    state->acc[1] = seed + PRIME64_2;
+    state->acc[2] = seed;
+    state->acc[3] = seed - PRIME64_1;
+    state->total_len = 0;
+    state->buffer_len = 0;
+}
+
+void
+wally_hash_update(WallyHashState *state, const void *data, gsize len)
+{
+    g_return_if_fail(state != NULL);
+    g_return_if_fail(data != NULL || len == 0);
+    
+    const guint8 *p = static_cast<const guint8*>(data);
+    state->total_len += len;
+    
+    // Top up a partially filled stripe first
+    if (state->buffer_len > 0) {
+        gsize take = MIN(len, sizeof(state->buffer) - state->buffer_len);
+        memcpy(state->buffer + state->buffer_len, p, take);
+        state->buffer_len += take;
+        p += take;
+        len -= take;
+        
+        if (state->buffer_len < sizeof(state->buffer)) {
+            return;
+        }
+        
+        hash_consume_stripes(state, state->buffer, sizeof(state->buffer));
+        state->buffer_len = 0;
+    }
+    
+    gsize whole = len - (len % 32);
+    hash_consume_stripes(state, p, whole);
+    
+    memcpy(state->buffer, p + whole, len - whole);
+    state->buffer_len = len - whole;
+}
+
+guint64
+wally_hash_finish(const WallyHashState *state)
+{
+    g_return_val_if_fail(state != NULL, 0);
+    
+    guint64 h;
+    
+    if (state->total_len >= 32) {
+        const guint64 *acc = state->acc;
+        h = rotl64(acc[0], 1) + rotl64(acc[1], 7) + rotl64(acc[2], 12) + rotl64(acc[3], 18);
+        h = hash_merge_round(h, acc[0]);
+        h = hash_merge_round(h, acc[1]);
+        h = hash_merge_round(h, acc[2]);
+        h = hash_merge_round(h, acc[3]);
+    } else {
+        h = state->seed + PRIME64_5;
+    }
+    
+    h += state->total_len;
+    
+    const guint8 *p = state->buffer;
+    const guint8 *end = state->buffer + state->buffer_len;
+    
+    for (; p + 8 <= end; p += 8) {
+        h ^= hash_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    
+    if (p + 4 <= end) {
+        h ^= static_cast<guint64>(read32(p)) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    
+    for (; p < end; p++) {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+    }
+    
+    // Final avalanche
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    
+    return h;
+}
+
+guint64
+wally_hash_data(const void *data, gsize len)
+{
+    WallyHashState state;
+    wally_hash_init(&state, 0);
+    wally_hash_update(&state, data, len);
+    return wally_hash_finish(&state);
+}
+
+gboolean
+wally_hash_file(const char *path,
+                guint64 *out_hash,
+                GError **error)
+{
+    g_return_val_if_fail(path != NULL, FALSE);
+    g_return_val_if_fail(out_hash != NULL, FALSE);
+    
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        int saved_errno = errno;
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved_errno),
+                    "Failed to open %s: %s", path, g_strerror(saved_errno));
+        return FALSE;
+    }
+    
+    // The file is read once front to back
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    
+    std::vector<guint8> chunk(HASH_CHUNK_SIZE);
+    WallyHashState state;
+    wally_hash_init(&state, 0);
+    
+    for (;;) {
+        ssize_t n = read(fd, chunk.data(), chunk.size());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            int saved_errno = errno;
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved_errno),
+                        "Failed to read %s: %s", path, g_strerror(saved_errno));
+            close(fd);
+            return FALSE;
+        }
+        if (n == 0) {
+            break;
+        }
+        wally_hash_update(&state, chunk.data(), static_cast<gsize>(n));
+    }
+    
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    
+    *out_hash = wally_hash_finish(&state);
+    return TRUE;
+}
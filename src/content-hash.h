@@ -0,0 +1,33 @@
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Streaming 64-bit content hash (XXH64). It is not cryptographic; it is only
+ * used to tell whether two wallpaper files hold the same bytes.
+ */
+typedef struct
+{
+    guint64 acc[4];
+    guint64 total_len;
+    guint8 buffer[32];
+    gsize buffer_len;
+    guint64 seed;
+} WallyHashState;
+
+void wally_hash_init(WallyHashState *state, guint64 seed);
+
+void wally_hash_update(WallyHashState *state, const void *data, gsize len);
+
+guint64 wally_hash_finish(const WallyHashState *state);
+
+guint64 wally_hash_data(const void *data, gsize len);
+
+gboolean wally_hash_file(const char *path,
+                         guint64 *out_hash,
+                         GError **error);
+
+G_END_DECLS
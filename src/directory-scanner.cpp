@@ -0,0 +1,411 @@
+#include "directory-scanner.h"
+#include "parallel.h"
+
+#include <glib/gstdio.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <set>
+#include <unordered_map>
+
+#define SCAN_CACHE_VERSION 1
+
+// (version, {directory: (mtime, image files, subdirectories)})
+#define SCAN_CACHE_VARIANT_TYPE "(ua{s(xasas)})"
+
+// Directories modified this recently are not cached: another change within
+// the same timestamp tick would go unnoticed
+#define SCAN_CACHE_RACY_NS (G_GINT64_CONSTANT(2) * 1000000000)
+
+static const char * const IMAGE_EXTENSIONS[] = {".jpg", ".jpeg", ".png", ".bmp", ".webp", ".tiff", ".svg"};
+
+typedef struct
+{
+    gint64 mtime_ns;
+    std::vector<std::string> files;
+    std::vector<std::string> subdirs;
+} CachedDirectory;
+
+struct _WallyDirectoryScanner
+{
+    GObject parent_instance;
+    
+    char *cache_path;
+    guint max_workers;
+    
+    GMutex lock;
+    std::unordered_map<std::string, CachedDirectory> *cache;
+    gboolean cache_loaded;
+    gboolean cache_dirty;
+    
+    std::atomic<guint> *stat_count;
+    std::atomic<guint> *dir_read_count;
+};
+
+G_DEFINE_FINAL_TYPE(WallyDirectoryScanner, wally_directory_scanner, G_TYPE_OBJECT)
+
+static void
+wally_directory_scanner_finalize(GObject *object)
+{
+    WallyDirectoryScanner *self = WALLY_DIRECTORY_SCANNER(object);
+    
+    g_free(self->cache_path);
+    g_mutex_clear(&self->lock);
+    delete self->cache;
+    delete self->stat_count;
+    delete self->dir_read_count;
+    
+    G_OBJECT_CLASS(wally_directory_scanner_parent_class)->finalize(object);
+}
+
+static void
+wally_directory_scanner_class_init(WallyDirectoryScannerClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    
+    object_class->finalize = wally_directory_scanner_finalize;
+}
+
+static void
+wally_directory_scanner_init(WallyDirectoryScanner *self)
+{
+    g_mutex_init(&self->lock);
+    self->cache = new std::unordered_map<std::string, CachedDirectory>();
+    self->stat_count = new std::atomic<guint>(0);
+    self->dir_read_count = new std::atomic<guint>(0);
+}
+
+WallyDirectoryScanner *
+wally_directory_scanner_new(const char *cache_path)
+{
+    WallyDirectoryScanner *self = static_cast<WallyDirectoryScanner*>(g_object_new(WALLY_TYPE_DIRECTORY_SCANNER, NULL));
+    self->cache_path = g_strdup(cache_path);
+    return self;
+}
+
+WallyDirectoryScanner *
+wally_directory_scanner_get_default(void)
+{
+    static gsize initialized = 0;
+    static WallyDirectoryScanner *default_scanner = NULL;
+    
+    if (g_once_init_enter(&initialized)) {
+        g_autofree char *cache_path = g_build_filename(g_get_user_cache_dir(), "wally", "scan-cache", NULL);
+        default_scanner = wally_directory_scanner_new(cache_path);
+        g_once_init_leave(&initialized, 1);
+    }
+    
+    return default_scanner;
+}
+
+void
+wally_directory_scanner_set_max_workers(WallyDirectoryScanner *self,
+                                        guint max_workers)
+{
+    g_return_if_fail(WALLY_IS_DIRECTORY_SCANNER(self));
+    
+    self->max_workers = max_workers;
+}
+
+gboolean
+wally_is_image_filename(const char *filename)
+{
+    g_return_val_if_fail(filename != NULL, FALSE);
+    
+    const char *extension = strrchr(filename, '.');
+    if (extension == NULL) {
+        return FALSE;
+    }
+    
+    for (const char *image_extension : IMAGE_EXTENSIONS) {
+        if (g_ascii_strcasecmp(extension, image_extension) == 0) {
+            return TRUE;
+        }
+    }
+    
+    return FALSE;
+}
+
+static void
+load_cache(WallyDirectoryScanner *self)
+{
+    self->cache_loaded = TRUE;
+    
+    if (self->cache_path == NULL) {
+        return;
+    }
+    
+    g_autofree char *contents = NULL;
+    gsize length = 0;
+    if (!g_file_get_contents(self->cache_path, &contents, &length, NULL)) {
+        return;
+    }
+    
+    g_autoptr(GBytes) bytes = g_bytes_new_take(g_steal_pointer(&contents), length);
+    g_autoptr(GVariant) root = g_variant_new_from_bytes(G_VARIANT_TYPE(SCAN_CACHE_VARIANT_TYPE), bytes, FALSE);
+    if (!g_variant_is_normal_form(root)) {
+        return;
+    }
+    
+    guint32 version = 0;
+    g_autoptr(GVariantIter) iter = NULL;
+    g_variant_get(root, "(ua{s(xasas)})", &version, &iter);
+    if (version != SCAN_CACHE_VERSION) {
+        return;
+    }
+    
+    const char *directory;
+    gint64 mtime_ns;
+    GVariantIter *files_iter;
+    GVariantIter *subdirs_iter;
+    while (g_variant_iter_next(iter, "{&s(xasas)}", &directory, &mtime_ns, &files_iter, &subdirs_iter)) {
+        CachedDirectory& cached = (*self->cache)[directory];
+        cached.mtime_ns = mtime_ns;
+        
+        const char *name;
+        while (g_variant_iter_next(files_iter, "&s", &name)) {
+            cached.files.emplace_back(name);
+        }
+        while (g_variant_iter_next(subdirs_iter, "&s", &name)) {
+            cached.subdirs.emplace_back(name);
+        }
+        
+        g_variant_iter_free(files_iter);
+        g_variant_iter_free(subdirs_iter);
+    }
+}
+
+/*
+ * Forgets every cached listing, on disk too once the cache is saved, so the
+ * next scan reads every directory again instead of trusting its mtime.
+ */
+void
+wally_directory_scanner_clear_cache(WallyDirectoryScanner *self)
+{
+    g_return_if_fail(WALLY_IS_DIRECTORY_SCANNER(self));
+    
+    g_mutex_lock(&self->lock);
+    self->cache->clear();
+    self->cache_loaded = TRUE;
+    self->cache_dirty = TRUE;
+    g_mutex_unlock(&self->lock);
+}
+
+gboolean
+wally_directory_scanner_save_cache(WallyDirectoryScanner *self,
+                                   GError **error)
+{
+    g_return_val_if_fail(WALLY_IS_DIRECTORY_SCANNER(self), FALSE);
+    
+    if (self->cache_path == NULL || !self->cache_dirty) {
+        return TRUE;
+    }
+    
+    GVariantBuilder entries;
+    g_variant_builder_init(&entries, G_VARIANT_TYPE("a{s(xasas)}"));
+    
+    g_mutex_lock(&self->lock);
+    for (const auto& [directory, cached] : *self->cache) {
+        GVariantBuilder files;
+        GVariantBuilder subdirs;
+        g_variant_builder_init(&files, G_VARIANT_TYPE("as"));
+        g_variant_builder_init(&subdirs, G_VARIANT_TYPE("as"));
+        
+        for (const std::string& name : cached.files) {
+            g_variant_builder_add(&files, "s", name.c_str());
+        }
+        for (const std::string& name : cached.subdirs) {
+            g_variant_builder_add(&subdirs, "s", name.c_str());
+        }
+        
+        g_variant_builder_add(&entries, "{s(xasas)}", directory.c_str(), cached.mtime_ns, &files, &subdirs);
+    }
+    self->cache_dirty = FALSE;
+    g_mutex_unlock(&self->lock);
+    
+    g_autoptr(GVariant) root = g_variant_ref_sink(g_variant_new(SCAN_CACHE_VARIANT_TYPE,
+                                                                SCAN_CACHE_VERSION, &entries));
+    
+    g_autofree char *cache_dir = g_path_get_dirname(self->cache_path);
+    g_mkdir_with_parents(cache_dir, 0755);
+    
+    return g_file_set_contents(self->cache_path,
+                               static_cast<const char*>(g_variant_get_data(root)),
+                               g_variant_get_size(root),
+                               error);
+}
+
+// List one directory, from the cache when its mtime hasn't moved. Costs one
+// stat() when cached; otherwise entries are classified by d_type and only
+// symlinks and filesystems that don't report a type need an extra stat.
+static void
+scan_directory(WallyDirectoryScanner *self,
+               const std::string& directory,
+               CachedDirectory& result)
+{
+    struct stat st;
+    (*self->stat_count)++;
+    if (stat(directory.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        g_warning("Error reading directory %s: %s", directory.c_str(), g_strerror(errno));
+        return;
+    }
+    
+    gint64 mtime_ns = st.st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000) + st.st_mtim.tv_nsec;
+    
+    g_mutex_lock(&self->lock);
+    auto cached = self->cache->find(directory);
+    if (cached != self->cache->end() && cached->second.mtime_ns == mtime_ns) {
+        result = cached->second;
+        g_mutex_unlock(&self->lock);
+        return;
+    }
+    g_mutex_unlock(&self->lock);
+    
+    DIR *dir = opendir(directory.c_str());
+    if (dir == NULL) {
+        g_warning("Error reading directory %s: %s", directory.c_str(), g_strerror(errno));
+        return;
+    }
+    (*self->dir_read_count)++;
+    
+    result.mtime_ns = mtime_ns;
+    
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+        
+        unsigned char type = entry->d_type;
+        gboolean is_link = type == DT_LNK;
+        
+        if (type == DT_UNKNOWN || is_link) {
+            struct stat entry_st;
+            (*self->stat_count)++;
+            if (fstatat(dirfd(dir), name, &entry_st, 0) != 0) {
+                continue;
+            }
+            type = S_ISDIR(entry_st.st_mode) ? DT_DIR : S_ISREG(entry_st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        
+        if (type == DT_DIR) {
+            // Hidden folders are skipped, symlinked ones too to avoid loops
+            if (name[0] != '.' && !is_link) {
+                result.subdirs.emplace_back(name);
+            }
+        } else if (type == DT_REG && wally_is_image_filename(name)) {
+            result.files.emplace_back(name);
+        }
+    }
+    
+    closedir(dir);
+    
+    if (g_get_real_time() * 1000 - mtime_ns < SCAN_CACHE_RACY_NS) {
+        return;
+    }
+    
+    g_mutex_lock(&self->lock);
+    (*self->cache)[directory] = result;
+    self->cache_dirty = TRUE;
+    g_mutex_unlock(&self->lock);
+}
+
+static std::string
+join_relative(const std::string& prefix, const std::string& name)
+{
+    return prefix.empty() ? name : prefix + G_DIR_SEPARATOR_S + name;
+}
+
+std::vector<std::string>
+wally_directory_scanner_scan(WallyDirectoryScanner *self,
+                             const char *folder_path,
+                             gboolean recursive)
+{
+    g_return_val_if_fail(WALLY_IS_DIRECTORY_SCANNER(self), {});
+    g_return_val_if_fail(folder_path != NULL, {});
+    
+    g_mutex_lock(&self->lock);
+    if (!self->cache_loaded) {
+        load_cache(self);
+    }
+    g_mutex_unlock(&self->lock);
+    
+    g_autofree char *root_path = g_canonicalize_filename(folder_path, NULL);
+    std::string root(root_path);
+    
+    std::vector<std::string> image_files;
+    std::set<std::string> visited;
+    
+    // Walk one level at a time, listing each level's folders in parallel
+    std::vector<std::string> level = {""};
+    while (!level.empty()) {
+        std::vector<CachedDirectory> listings(level.size());
+        
+        wally_parallel_for(level.size(), self->max_workers, [&](gsize index, guint worker G_GNUC_UNUSED) {
+            scan_directory(self, join_relative(root, level[index]), listings[index]);
+        });
+        
+        std::vector<std::string> next_level;
+        for (gsize i = 0; i < level.size(); i++) {
+            visited.insert(join_relative(root, level[i]));
+            
+            for (const std::string& name : listings[i].files) {
+                image_files.push_back(join_relative(level[i], name));
+            }
+            
+            if (recursive) {
+                for (const std::string& name : listings[i].subdirs) {
+                    next_level.push_back(join_relative(level[i], name));
+                }
+            }
+        }
+        
+        level = std::move(next_level);
+    }
+    
+    if (recursive) {
+        // Forget folders under this root that no longer exist
+        std::string prefix = root + G_DIR_SEPARATOR_S;
+        
+        g_mutex_lock(&self->lock);
+        for (auto it = self->cache->begin(); it != self->cache->end();) {
+            if (g_str_has_prefix(it->first.c_str(), prefix.c_str()) && visited.count(it->first) == 0) {
+                it = self->cache->erase(it);
+                self->cache_dirty = TRUE;
+            } else {
+                ++it;
+            }
+        }
+        g_mutex_unlock(&self->lock);
+    }
+    
+    GError *error = NULL;
+    if (!wally_directory_scanner_save_cache(self, &error)) {
+        g_warning("Failed to save scan cache: %s", error->message);
+        g_error_free(error);
+    }
+    
+    // Sort files for consistent ordering
+    std::sort(image_files.begin(), image_files.end());
+    return image_files;
+}
+
+guint
+wally_directory_scanner_get_stat_count(WallyDirectoryScanner *self)
+{
+    g_return_val_if_fail(WALLY_IS_DIRECTORY_SCANNER(self), 0);
+    
+    return *self->stat_count;
+}
+
+// Directories listed from disk rather than from the cache
+guint
+wally_directory_scanner_get_dir_read_count(WallyDirectoryScanner *self)
+{
+    g_return_val_if_fail(WALLY_IS_DIRECTORY_SCANNER(self), 0);
+    
+    return *self->dir_read_count;
+}
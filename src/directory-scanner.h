@@ -0,0 +1,36 @@
+#pragma once
+
+#include <glib-object.h>
+#include <gio/gio.h>
+#include <string>
+#include <vector>
+
+G_BEGIN_DECLS
+
+#define WALLY_TYPE_DIRECTORY_SCANNER (wally_directory_scanner_get_type())
+
+G_DECLARE_FINAL_TYPE(WallyDirectoryScanner, wally_directory_scanner, WALLY, DIRECTORY_SCANNER, GObject)
+
+WallyDirectoryScanner *wally_directory_scanner_new(const char *cache_path);
+
+WallyDirectoryScanner *wally_directory_scanner_get_default(void);
+
+void wally_directory_scanner_set_max_workers(WallyDirectoryScanner *self,
+                                             guint max_workers);
+
+std::vector<std::string> wally_directory_scanner_scan(WallyDirectoryScanner *self,
+                                                      const char *folder_path,
+                                                      gboolean recursive);
+
+void wally_directory_scanner_clear_cache(WallyDirectoryScanner *self);
+
+gboolean wally_directory_scanner_save_cache(WallyDirectoryScanner *self,
+                                            GError **error);
+
+guint wally_directory_scanner_get_stat_count(WallyDirectoryScanner *self);
+
+guint wally_directory_scanner_get_dir_read_count(WallyDirectoryScanner *self);
+
+gboolean wally_is_image_filename(const char *filename);
+
+G_END_DECLS
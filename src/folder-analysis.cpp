@@ -0,0 +1,306 @@
+#include "folder-analysis.h"
+#include "directory-scanner.h"
+#include "image-probe.h"
+#include "parallel.h"
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <atomic>
+#include <new>
+#include <string>
+#include <vector>
+
+/*
+ * Rough costs of an import, for the estimate. Copies are bound by the disk,
+ * links by the metadata updates; reading for the content hash runs at about
+ * the speed a cold disk reads.
+ */
+#define COPY_BYTES_PER_SECOND (G_GUINT64_CONSTANT(150) * 1000 * 1000)
+#define HASH_BYTES_PER_SECOND (G_GUINT64_CONSTANT(400) * 1000 * 1000)
+#define COPY_FILE_COST_US 2000
+#define LINK_FILE_COST_US 300
+
+typedef struct
+{
+    std::string path;
+    guint64 size;
+} Candidate;
+
+struct _WallyFolderAnalysis
+{
+    GObject parent_instance;
+    
+    char *folder_path;
+    char *dest_folder;
+    gboolean recursive;
+    
+    std::atomic<gboolean> counting;
+    std::atomic<guint> images;
+    std::atomic<guint> checked;
+    std::atomic<guint> unsupported;
+    std::atomic<guint> broken;
+    std::atomic<guint64> bytes;
+    std::atomic<gboolean> same_filesystem;
+    gboolean started;
+};
+
+G_DEFINE_FINAL_TYPE(WallyFolderAnalysis, wally_folder_analysis, G_TYPE_OBJECT)
+
+static void
+wally_folder_analysis_finalize(GObject *object)
+{
+    WallyFolderAnalysis *self = WALLY_FOLDER_ANALYSIS(object);
+    
+    g_free(self->folder_path);
+    g_free(self->dest_folder);
+    
+    G_OBJECT_CLASS(wally_folder_analysis_parent_class)->finalize(object);
+}
+
+static void
+wally_folder_analysis_class_init(WallyFolderAnalysisClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    
+    object_class->finalize = wally_folder_analysis_finalize;
+}
+
+static void
+wally_folder_analysis_init(WallyFolderAnalysis *self)
+{
+    new (&self->counting) std::atomic<gboolean>(TRUE);
+    new (&self->images) std::atomic<guint>(0);
+    new (&self->checked) std::atomic<guint>(0);
+    new (&self->unsupported) std::atomic<guint>(0);
+    new (&self->broken) std::atomic<guint>(0);
+    new (&self->bytes) std::atomic<guint64>(0);
+    new (&self->same_filesystem) std::atomic<gboolean>(TRUE);
+}
+
+/*
+ * @dest_folder is where the images would be imported to; it doesn't need
+ * to exist yet. It only tells whether links are possible.
+ */
+WallyFolderAnalysis *
+wally_folder_analysis_new(const char *folder_path,
+                          const char *dest_folder,
+                          gboolean recursive)
+{
+    g_return_val_if_fail(folder_path != NULL, NULL);
+    g_return_val_if_fail(dest_folder != NULL, NULL);
+    
+    WallyFolderAnalysis *self = WALLY_FOLDER_ANALYSIS(g_object_new(WALLY_TYPE_FOLDER_ANALYSIS, NULL));
+    self->folder_path = g_strdup(folder_path);
+    self->dest_folder = g_strdup(dest_folder);
+    self->recursive = recursive;
+    
+    return self;
+}
+
+// The device of @path, or of its closest ancestor that exists
+static gboolean
+get_device(const char *path, dev_t *device)
+{
+    g_autofree char *current = g_strdup(path);
+    struct stat st;
+    
+    while (stat(current, &st) != 0) {
+        g_autofree char *parent = g_path_get_dirname(current);
+        if (g_strcmp0(parent, current) == 0) {
+            return FALSE;
+        }
+        g_free(current);
+        current = g_steal_pointer(&parent);
+    }
+    
+    *device = st.st_dev;
+    return TRUE;
+}
+
+// Follows the same rules as the directory scanner, so the images counted
+// are the ones an import would pick up
+static gboolean
+count_files(WallyFolderAnalysis *self,
+            std::vector<Candidate>& candidates,
+            GCancellable *cancellable,
+            GError **error)
+{
+    std::vector<std::string> pending = {self->folder_path};
+    
+    while (!pending.empty()) {
+        if (g_cancellable_set_error_if_cancelled(cancellable, error)) {
+            return FALSE;
+        }
+        
+        std::string directory = std::move(pending.back());
+        pending.pop_back();
+        
+        DIR *dir = opendir(directory.c_str());
+        if (dir == NULL) {
+            int saved_errno = errno;
+            // Only the folder itself must be readable; a subfolder that isn't is skipped
+            if (directory == self->folder_path) {
+                g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved_errno),
+                            "Error reading folder %s: %s", directory.c_str(), g_strerror(saved_errno));
+                return FALSE;
+            }
+            continue;
+        }
+        
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            const char *name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            
+            struct stat st;
+            if (fstatat(dirfd(dir), name, &st, 0) != 0) {
+                continue;
+            }
+            
+            if (S_ISDIR(st.st_mode)) {
+                if (self->recursive && name[0] != '.' && entry->d_type != DT_LNK) {
+                    pending.push_back(directory + G_DIR_SEPARATOR_S + name);
+                }
+            } else if (S_ISREG(st.st_mode)) {
+                if (wally_is_image_filename(name)) {
+                    candidates.push_back({directory + G_DIR_SEPARATOR_S + name, (guint64)st.st_size});
+                    self->images++;
+                    self->bytes += st.st_size;
+                } else if (name[0] != '.') {
+                    // Hidden files are desktop metadata, not pictures someone left out
+                    self->unsupported++;
+                }
+            }
+        }
+        
+        closedir(dir);
+    }
+    
+    return TRUE;
+}
+
+static void
+analysis_thread(GTask *task,
+                gpointer source_object,
+                gpointer task_data G_GNUC_UNUSED,
+                GCancellable *cancellable)
+{
+    WallyFolderAnalysis *self = WALLY_FOLDER_ANALYSIS(source_object);
+    GError *error = NULL;
+    std::vector<Candidate> candidates;
+    
+    dev_t source_device;
+    dev_t dest_device;
+    self->same_filesystem = get_device(self->folder_path, &source_device) &&
+                            get_device(self->dest_folder, &dest_device) &&
+                            source_device == dest_device;
+    
+    gboolean success = count_files(self, candidates, cancellable, &error);
+    self->counting = FALSE;
+    if (!success) {
+        g_task_return_error(task, error);
+        return;
+    }
+    
+    // Only the headers are read, so this is quick even on a large folder
+    wally_parallel_for(candidates.size(), 0, [&](gsize index, guint worker G_GNUC_UNUSED) {
+        if (g_cancellable_is_cancelled(cancellable)) {
+            return;
+        }
+        
+        const Candidate& candidate = candidates[index];
+        g_autoptr(GError) probe_error = NULL;
+        WallyImageInfo info;
+        
+        if (!wally_image_probe_file(candidate.path.c_str(), &info, &probe_error)) {
+            self->images--;
+            self->bytes -= candidate.size;
+            if (g_error_matches(probe_error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED)) {
+                self->unsupported++;
+            } else {
+                self->broken++;
+            }
+        }
+        self->checked++;
+    });
+    
+    if (g_cancellable_set_error_if_cancelled(cancellable, &error)) {
+        g_task_return_error(task, error);
+        return;
+    }
+    
+    g_task_return_boolean(task, TRUE);
+}
+
+void
+wally_folder_analysis_run_async(WallyFolderAnalysis *self,
+                                GCancellable *cancellable,
+                                GAsyncReadyCallback callback,
+                                gpointer user_data)
+{
+    g_return_if_fail(WALLY_IS_FOLDER_ANALYSIS(self));
+    g_return_if_fail(!self->started);
+    
+    self->started = TRUE;
+    
+    g_autoptr(GTask) task = g_task_new(self, cancellable, callback, user_data);
+    g_task_set_source_tag(task, (gpointer)wally_folder_analysis_run_async);
+    g_task_set_name(task, "wally-folder-analysis");
+    g_task_run_in_thread(task, analysis_thread);
+}
+
+gboolean
+wally_folder_analysis_run_finish(WallyFolderAnalysis *self,
+                                 GAsyncResult *result,
+                                 GError **error)
+{
+    g_return_val_if_fail(WALLY_IS_FOLDER_ANALYSIS(self), FALSE);
+    g_return_val_if_fail(g_task_is_valid(result, self), FALSE);
+    
+    return g_task_propagate_boolean(G_TASK(result), error);
+}
+
+void
+wally_folder_analysis_get_summary(WallyFolderAnalysis *self,
+                                  WallyFolderSummary *summary)
+{
+    g_return_if_fail(WALLY_IS_FOLDER_ANALYSIS(self));
+    g_return_if_fail(summary != NULL);
+    
+    summary->counting = self->counting;
+    summary->images = self->images;
+    summary->checked = self->checked;
+    summary->unsupported = self->unsupported;
+    summary->broken = self->broken;
+    summary->bytes = self->bytes;
+    summary->same_filesystem = self->same_filesystem;
+}
+
+/*
+ * How long a first import of the folder would take, give or take. Later
+ * imports only bring over what changed and are much faster. Reflinks and
+ * hard links need the import on the same filesystem; elsewhere the engine
+ * falls back to copying.
+ */
+guint64
+wally_folder_summary_estimate_import_seconds(const WallyFolderSummary *summary,
+                                             WallyImportMode mode,
+                                             gboolean hash_content)
+{
+    g_return_val_if_fail(summary != NULL, 0);
+    
+    gboolean copies = mode == WALLY_IMPORT_MODE_COPY ||
+                      (mode != WALLY_IMPORT_MODE_SYMLINK && !summary->same_filesystem);
+    
+    guint64 microseconds = (guint64)summary->images * (copies ? COPY_FILE_COST_US : LINK_FILE_COST_US);
+    if (copies) {
+        microseconds += summary->bytes * G_USEC_PER_SEC / COPY_BYTES_PER_SECOND;
+    } else if (hash_content) {
+        microseconds += summary->bytes * G_USEC_PER_SEC / HASH_BYTES_PER_SECOND;
+    }
+    
+    return (microseconds + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "import-engine.h"
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define WALLY_TYPE_FOLDER_ANALYSIS (wally_folder_analysis_get_type())
+
+G_DECLARE_FINAL_TYPE(WallyFolderAnalysis, wally_folder_analysis, WALLY, FOLDER_ANALYSIS, GObject)
+
+/*
+ * Snapshot of an analysis, safe to take from the main thread while it runs.
+ * Files are first counted, then their headers are checked; images and bytes
+ * only cover files that pass, so they shrink a little while checking.
+ * Unsupported files are those Wally would not import: other file types and
+ * images in a format it can't show. Broken files look like a supported
+ * image but are truncated or unreadable.
+ */
+typedef struct
+{
+    gboolean counting;
+    guint images;
+    guint checked;
+    guint unsupported;
+    guint broken;
+    guint64 bytes;
+    gboolean same_filesystem;
+} WallyFolderSummary;
+
+WallyFolderAnalysis *wally_folder_analysis_new(const char *folder_path,
+                                               const char *dest_folder,
+                                               gboolean recursive);
+
+void wally_folder_analysis_run_async(WallyFolderAnalysis *self,
+                                     GCancellable *cancellable,
+                                     GAsyncReadyCallback callback,
+                                     gpointer user_data);
+
+gboolean wally_folder_analysis_run_finish(WallyFolderAnalysis *self,
+                                          GAsyncResult *result,
+                                          GError **error);
+
+void wally_folder_analysis_get_summary(WallyFolderAnalysis *self,
+                                       WallyFolderSummary *summary);
+
+guint64 wally_folder_summary_estimate_import_seconds(const WallyFolderSummary *summary,
+                                                     WallyImportMode mode,
+                                                     gboolean hash_content);
+
+G_END_DECLS
@@ -0,0 +1,404 @@
+#include "folder-watcher.h"
+#include "directory-scanner.h"
+#include "config.h"
+
+#include <glib/gi18n.h>
+#include <vector>
+
+#define DEFAULT_QUIET_MS 2000
+#define DEFAULT_MAX_DELAY_MS 10000
+
+struct _WallyFolderWatcher
+{
+    GObject parent_instance;
+    
+    char *folder_path;
+    gboolean recursive;
+    guint quiet_ms;
+    guint max_delay_ms;
+    
+    // Directory path -> GFileMonitor; inotify watches aren't recursive,
+    // so every watched subfolder has its own
+    GHashTable *monitors;
+    gboolean warned_limit;
+    
+    guint pending_events;
+    gint64 first_event_time;
+    gint64 last_event_time;
+    guint timeout_id;
+};
+
+enum
+{
+    SIGNAL_CHANGED,
+    N_SIGNALS
+};
+
+static guint signals[N_SIGNALS];
+
+G_DEFINE_FINAL_TYPE(WallyFolderWatcher, wally_folder_watcher, G_TYPE_OBJECT)
+
+static void
+cancel_monitor(gpointer data)
+{
+    GFileMonitor *monitor = G_FILE_MONITOR(data);
+    
+    // A cancelled monitor emits nothing more, so no handler outlives us
+    g_file_monitor_cancel(monitor);
+    g_object_unref(monitor);
+}
+
+static void
+reset_pending(WallyFolderWatcher *self)
+{
+    g_clear_handle_id(&self->timeout_id, g_source_remove);
+    self->pending_events = 0;
+    self->first_event_time = 0;
+    self->last_event_time = 0;
+}
+
+static void
+wally_folder_watcher_dispose(GObject *object)
+{
+    WallyFolderWatcher *self = WALLY_FOLDER_WATCHER(object);
+    
+    reset_pending(self);
+    g_hash_table_remove_all(self->monitors);
+    
+    G_OBJECT_CLASS(wally_folder_watcher_parent_class)->dispose(object);
+}
+
+static void
+wally_folder_watcher_finalize(GObject *object)
+{
+    WallyFolderWatcher *self = WALLY_FOLDER_WATCHER(object);
+    
+    g_hash_table_unref(self->monitors);
+    g_free(self->folder_path);
+    
+    G_OBJECT_CLASS(wally_folder_watcher_parent_class)->finalize(object);
+}
+
+static void
+wally_folder_watcher_class_init(WallyFolderWatcherClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    
+    object_class->dispose = wally_folder_watcher_dispose;
+    object_class->finalize = wally_folder_watcher_finalize;
+    
+    /*
+     * Emitted on the main thread once a burst of changes has settled.
+     * @events is the number of relevant file events that were coalesced.
+     */
+    signals[SIGNAL_CHANGED] = g_signal_new("changed",
+                                           G_TYPE_FROM_CLASS(klass),
+                                           G_SIGNAL_RUN_LAST,
+                                           0, NULL, NULL, NULL,
+                                           G_TYPE_NONE, 1, G_TYPE_UINT);
+}
+
+static void
+wally_folder_watcher_init(WallyFolderWatcher *self)
+{
+    self->quiet_ms = DEFAULT_QUIET_MS;
+    self->max_delay_ms = DEFAULT_MAX_DELAY_MS;
+    self->monitors = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, cancel_monitor);
+}
+
+WallyFolderWatcher *
+wally_folder_watcher_new(void)
+{
+    return static_cast<WallyFolderWatcher*>(g_object_new(WALLY_TYPE_FOLDER_WATCHER, NULL));
+}
+
+static gboolean
+on_debounce_timeout(gpointer user_data)
+{
+    WallyFolderWatcher *self = WALLY_FOLDER_WATCHER(user_data);
+    
+    self->timeout_id = 0;
+    
+    // Events that arrived since the timer was armed push it back, up to the cap
+    gint64 now = g_get_monotonic_time();
+    gint64 quiet_left = self->last_event_time + (gint64)self->quiet_ms * 1000 - now;
+    gint64 max_left = self->first_event_time + (gint64)self->max_delay_ms * 1000 - now;
+    if (quiet_left > 0 && max_left > 0) {
+        guint wait_ms = (guint)(MAX(MIN(quiet_left, max_left) / 1000, 1));
+        self->timeout_id = g_timeout_add(wait_ms, on_debounce_timeout, self);
+        return G_SOURCE_REMOVE;
+    }
+    
+    guint events = self->pending_events;
+    reset_pending(self);
+    
+    g_debug("%s: %u file events settled", self->folder_path, events);
+    g_signal_emit(self, signals[SIGNAL_CHANGED], 0, events);
+    
+    return G_SOURCE_REMOVE;
+}
+
+static void
+note_event(WallyFolderWatcher *self)
+{
+    gint64 now = g_get_monotonic_time();
+    
+    self->pending_events++;
+    if (self->first_event_time == 0) {
+        self->first_event_time = now;
+    }
+    self->last_event_time = now;
+    
+    // One timer per burst; it re-arms itself instead of being replaced on every event
+    if (self->timeout_id == 0) {
+        self->timeout_id = g_timeout_add(self->quiet_ms, on_debounce_timeout, self);
+    }
+}
+
+static void on_monitor_changed(GFileMonitor *monitor,
+                               GFile *file,
+                               GFile *other_file,
+                               GFileMonitorEvent event_type,
+                               WallyFolderWatcher *self);
+
+static gboolean
+watch_directory(WallyFolderWatcher *self, GFile *directory)
+{
+    g_autofree char *path = g_file_get_path(directory);
+    
+    if (path == NULL || g_hash_table_contains(self->monitors, path)) {
+        return FALSE;
+    }
+    
+    GError *error = NULL;
+    GFileMonitor *monitor = g_file_monitor_directory(directory, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+    if (monitor == NULL) {
+        // Usually fs.inotify.max_user_watches; say so once, not per folder
+        if (!self->warned_limit) {
+            g_warning("Cannot watch %s for new wallpapers: %s", path, error->message);
+            self->warned_limit = TRUE;
+        }
+        g_error_free(error);
+        return FALSE;
+    }
+    
+    g_signal_connect(monitor, "changed", G_CALLBACK(on_monitor_changed), self);
+    g_hash_table_insert(self->monitors, g_steal_pointer(&path), monitor);
+    
+    return TRUE;
+}
+
+// Watches @root and, when recursive, every visible real subfolder below it
+static void
+watch_tree(WallyFolderWatcher *self, GFile *root)
+{
+    std::vector<GFile*> pending;
+    pending.push_back(G_FILE(g_object_ref(root)));
+    
+    while (!pending.empty()) {
+        g_autoptr(GFile) directory = pending.back();
+        pending.pop_back();
+        
+        if (!watch_directory(self, directory) || !self->recursive) {
+            continue;
+        }
+        
+        g_autoptr(GFileEnumerator) enumerator =
+            g_file_enumerate_children(directory,
+                                      G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                      G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+                                      G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN,
+                                      G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                      NULL, NULL);
+        if (enumerator == NULL) {
+            continue;
+        }
+        
+        GFileInfo *info;
+        GFile *child;
+        while (g_file_enumerator_iterate(enumerator, &info, &child, NULL, NULL) && info != NULL) {
+            // Same rules as the directory scanner: no hidden folders, no symlinks
+            if (g_file_info_get_file_type(info) == G_FILE_TYPE_DIRECTORY &&
+                !g_file_info_get_is_hidden(info)) {
+                pending.push_back(G_FILE(g_object_ref(child)));
+            }
+        }
+    }
+}
+
+// Stops watching @path and everything below it; TRUE if it was watched
+static gboolean
+unwatch_tree(WallyFolderWatcher *self, const char *path)
+{
+    g_autofree char *prefix = g_strconcat(path, G_DIR_SEPARATOR_S, NULL);
+    
+    GHashTableIter iter;
+    gpointer key;
+    guint removed = 0;
+    
+    g_hash_table_iter_init(&iter, self->monitors);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        const char *watched = static_cast<const char*>(key);
+        if (g_str_equal(watched, path) || g_str_has_prefix(watched, prefix)) {
+            g_hash_table_iter_remove(&iter);
+            removed++;
+        }
+    }
+    
+    return removed > 0;
+}
+
+static gboolean
+is_hidden_name(GFile *file)
+{
+    g_autofree char *name = g_file_get_basename(file);
+    
+    return name == NULL || name[0] == '.';
+}
+
+static gboolean
+is_image_file(GFile *file)
+{
+    g_autofree char *name = g_file_get_basename(file);
+    
+    return name != NULL && name[0] != '.' && wally_is_image_filename(name);
+}
+
+static gboolean
+handle_appeared(WallyFolderWatcher *self, GFile *file)
+{
+    if (file == NULL || is_hidden_name(file)) {
+        return FALSE;
+    }
+    
+    if (is_image_file(file)) {
+        return TRUE;
+    }
+    
+    // A new subfolder (an unpacked archive, say) may already hold images
+    if (self->recursive &&
+        g_file_query_file_type(file, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL) == G_FILE_TYPE_DIRECTORY) {
+        watch_tree(self, file);
+        return TRUE;
+    }
+    
+    return FALSE;
+}
+
+static gboolean
+handle_disappeared(WallyFolderWatcher *self, GFile *file)
+{
+    if (file == NULL) {
+        return FALSE;
+    }
+    
+    g_autofree char *path = g_file_get_path(file);
+    if (path != NULL && unwatch_tree(self, path)) {
+        return TRUE;
+    }
+    
+    return is_image_file(file);
+}
+
+static void
+on_monitor_changed(GFileMonitor *monitor G_GNUC_UNUSED,
+                   GFile *file,
+                   GFile *other_file,
+                   GFileMonitorEvent event_type,
+                   WallyFolderWatcher *self)
+{
+    gboolean relevant = FALSE;
+    
+    switch (event_type) {
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+        relevant = handle_appeared(self, file);
+        break;
+    case G_FILE_MONITOR_EVENT_DELETED:
+    case G_FILE_MONITOR_EVENT_MOVED_OUT:
+        relevant = handle_disappeared(self, file);
+        break;
+    case G_FILE_MONITOR_EVENT_RENAMED:
+        relevant = handle_disappeared(self, file);
+        relevant = handle_appeared(self, other_file) || relevant;
+        break;
+    case G_FILE_MONITOR_EVENT_CHANGED:
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+        // Writes in progress keep the batch open until the file is complete
+        relevant = is_image_file(file);
+        break;
+    default:
+        // Attribute changes and unmounts don't change which images exist
+        break;
+    }
+    
+    if (relevant) {
+        note_event(self);
+    }
+}
+
+void
+wally_folder_watcher_set_delays(WallyFolderWatcher *self,
+                                guint quiet_ms,
+                                guint max_delay_ms)
+{
+    g_return_if_fail(WALLY_IS_FOLDER_WATCHER(self));
+    g_return_if_fail(quiet_ms > 0);
+    
+    self->quiet_ms = quiet_ms;
+    self->max_delay_ms = MAX(max_delay_ms, quiet_ms);
+}
+
+/*
+ * Starts watching @folder_path, replacing any folder watched before. An
+ * empty or NULL path stops watching. Pending events for the old folder are
+ * dropped.
+ */
+void
+wally_folder_watcher_set_folder(WallyFolderWatcher *self,
+                                const char *folder_path,
+                                gboolean recursive)
+{
+    g_return_if_fail(WALLY_IS_FOLDER_WATCHER(self));
+    
+    if (folder_path != NULL && folder_path[0] == '\0') {
+        folder_path = NULL;
+    }
+    
+    if (g_strcmp0(folder_path, self->folder_path) == 0 && recursive == self->recursive) {
+        return;
+    }
+    
+    reset_pending(self);
+    g_hash_table_remove_all(self->monitors);
+    self->warned_limit = FALSE;
+    
+    g_free(self->folder_path);
+    self->folder_path = g_strdup(folder_path);
+    self->recursive = recursive;
+    
+    if (self->folder_path == NULL) {
+        return;
+    }
+    
+    g_autoptr(GFile) root = g_file_new_for_path(self->folder_path);
+    watch_tree(self, root);
+    
+    g_debug("Watching %s with %u monitors", self->folder_path, g_hash_table_size(self->monitors));
+}
+
+const char *
+wally_folder_watcher_get_folder(WallyFolderWatcher *self)
+{
+    g_return_val_if_fail(WALLY_IS_FOLDER_WATCHER(self), NULL);
+    
+    return self->folder_path;
+}
+
+guint
+wally_folder_watcher_get_monitor_count(WallyFolderWatcher *self)
+{
+    g_return_val_if_fail(WALLY_IS_FOLDER_WATCHER(self), 0);
+    
+    return g_hash_table_size(self->monitors);
+}
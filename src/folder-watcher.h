@@ -0,0 +1,36 @@
+#pragma once
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define WALLY_TYPE_FOLDER_WATCHER (wally_folder_watcher_get_type())
+
+G_DECLARE_FINAL_TYPE(WallyFolderWatcher, wally_folder_watcher, WALLY, FOLDER_WATCHER, GObject)
+
+/*
+ * Watches one wallpaper folder, and its subfolders when recursive, and emits
+ * ::changed once a burst of file events has settled: after @quiet_ms without
+ * new events, or at the latest @max_delay_ms after the first one. Only
+ * events that can change the slideshow count: image files appearing,
+ * disappearing or being rewritten, and subfolders coming and going.
+ *
+ * The watcher relies on the kernel's file notifications and runs no timers
+ * while nothing happens.
+ */
+WallyFolderWatcher *wally_folder_watcher_new(void);
+
+void wally_folder_watcher_set_delays(WallyFolderWatcher *self,
+                                     guint quiet_ms,
+                                     guint max_delay_ms);
+
+void wally_folder_watcher_set_folder(WallyFolderWatcher *self,
+                                     const char *folder_path,
+                                     gboolean recursive);
+
+const char *wally_folder_watcher_get_folder(WallyFolderWatcher *self);
+
+guint wally_folder_watcher_get_monitor_count(WallyFolderWatcher *self);
+
+G_END_DECLS
@@ -0,0 +1,512 @@
+#include "image-probe.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Enough for every supported header except the occasional JPEG or TIFF
+static const gsize PROBE_HEAD_SIZE = 4096;
+
+// Stop walking JPEG segments after this many; real files need a handful
+static const guint MAX_JPEG_SEGMENTS = 256;
+
+// How far from the end of a PNG its IEND chunk is looked for; some tools
+// leave padding or a stray trailer after it
+static const gsize PNG_TRAILER_SEARCH_SIZE = 4096;
+
+/*
+ * The start of the file, with further reads served from the file itself when
+ * there is one to read from.
+ */
+typedef struct
+{
+    const guint8 *head;
+    gsize head_length;
+    int fd;
+    guint64 file_size;
+} ProbeReader;
+
+static gboolean
+read_at(const ProbeReader *reader, guint64 offset, void *buffer, gsize length)
+{
+    if (offset + length <= reader->head_length) {
+        memcpy(buffer, reader->head + offset, length);
+        return TRUE;
+    }
+    
+    if (reader->fd < 0 || offset + length > reader->file_size) {
+        return FALSE;
+    }
+    
+    ssize_t n;
+    do {
+        n = pread(reader->fd, buffer, length, offset);
+    } while (n < 0 && errno == EINTR);
+    
+    return n == (ssize_t)length;
+}
+
+static inline guint16
+be16(const guint8 *p)
+{
+    return (guint16)(p[0] << 8 | p[1]);
+}
+
+static inline guint32
+be32(const guint8 *p)
+{
+    return (guint32)p[0] << 24 | (guint32)p[1] << 16 | (guint32)p[2] << 8 | p[3];
+}
+
+static inline guint16
+le16(const guint8 *p)
+{
+    return (guint16)(p[0] | p[1] << 8);
+}
+
+static inline guint32
+le24(const guint8 *p)
+{
+    return (guint32)p[0] | (guint32)p[1] << 8 | (guint32)p[2] << 16;
+}
+
+static inline guint32
+le32(const guint8 *p)
+{
+    return le24(p) | (guint32)p[3] << 24;
+}
+
+// The Orientation tag of the first directory of the TIFF structure at
+// @base, which is how EXIF data is laid out; 1 when there is none
+static guint
+read_tiff_orientation(const ProbeReader *reader, guint64 base)
+{
+    guint8 header[8];
+    if (!read_at(reader, base, header, sizeof(header)) ||
+        (memcmp(header, "II*\0", 4) != 0 && memcmp(header, "MM\0*", 4) != 0)) {
+        return 1;
+    }
+    
+    gboolean big_endian = header[0] == 'M';
+    auto u16 = [big_endian](const guint8 *p) { return big_endian ? be16(p) : le16(p); };
+    auto u32 = [big_endian](const guint8 *p) { return big_endian ? be32(p) : le32(p); };
+    
+    guint64 ifd_offset = base + u32(header + 4);
+    guint8 count_bytes[2];
+    if (!read_at(reader, ifd_offset, count_bytes, sizeof(count_bytes))) {
+        return 1;
+    }
+    
+    // Tags are sorted, so the walk stops soon after the ones it wants
+    guint16 entry_count = u16(count_bytes);
+    for (guint16 i = 0; i < entry_count; i++) {
+        guint8 entry[12];
+        if (!read_at(reader, ifd_offset + 2 + (guint64)i * 12, entry, sizeof(entry))) {
+            return 1;
+        }
+        
+        guint16 tag = u16(entry);
+        if (tag == 274) {
+            guint orientation = u16(entry + 2) == 3 ? u16(entry + 8) : 1;
+            return orientation >= 1 && orientation <= 8 ? orientation : 1;
+        } else if (tag > 274) {
+            break;
+        }
+    }
+    
+    return 1;
+}
+
+static gboolean
+probe_jpeg(const ProbeReader *reader, WallyImageInfo *info)
+{
+    guint64 offset = 2;
+    
+    for (guint i = 0; i < MAX_JPEG_SEGMENTS; i++) {
+        guint8 marker[4];
+        if (!read_at(reader, offset, marker, 2) || marker[0] != 0xFF) {
+            return FALSE;
+        }
+        
+        // Markers may be padded with any number of 0xFF bytes
+        if (marker[1] == 0xFF) {
+            offset++;
+            continue;
+        }
+        
+        guint8 type = marker[1];
+        if (type == 0x01 || (type >= 0xD0 && type <= 0xD7)) {
+            offset += 2;
+            continue;
+        }
+        
+        // Image data starts before any frame header: not a usable JPEG
+        if (type == 0xD9 || type == 0xDA) {
+            return FALSE;
+        }
+        
+        if (!read_at(reader, offset + 2, marker + 2, 2)) {
+            return FALSE;
+        }
+        guint16 segment_length = be16(marker + 2);
+        if (segment_length < 2) {
+            return FALSE;
+        }
+        
+        // EXIF comes in an APP1 segment, before the frame header
+        guint8 exif_id[6];
+        if (type == 0xE1 && info->orientation == 1 && segment_length >= 2 + sizeof(exif_id) + 8 &&
+            read_at(reader, offset + 4, exif_id, sizeof(exif_id)) && memcmp(exif_id, "Exif\0\0", 6) == 0) {
+            info->orientation = read_tiff_orientation(reader, offset + 4 + sizeof(exif_id));
+        }
+        
+        // SOF0-SOF15, except DHT, JPG and DAC which share the range
+        if (type >= 0xC0 && type <= 0xCF && type != 0xC4 && type != 0xC8 && type != 0xCC) {
+            guint8 frame[5];
+            if (segment_length < 7 || !read_at(reader, offset + 4, frame, sizeof(frame))) {
+                return FALSE;
+            }
+            
+            info->height = be16(frame + 1);
+            info->width = be16(frame + 3);
+            
+            // The scan data has to follow the frame header
+            return offset + 2 + segment_length < reader->file_size;
+        }
+        
+        offset += 2 + segment_length;
+    }
+    
+    return FALSE;
+}
+
+static gboolean
+probe_png(const ProbeReader *reader, WallyImageInfo *info)
+{
+    static const guint8 IEND[] = {0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xAE, 0x42, 0x60, 0x82};
+    
+    guint8 header[24];
+    if (!read_at(reader, 0, header, sizeof(header)) || memcmp(header + 12, "IHDR", 4) != 0) {
+        return FALSE;
+    }
+    
+    info->width = be32(header + 16);
+    info->height = be32(header + 20);
+    
+    // A complete PNG always ends with an empty IEND chunk, give or take
+    // some bytes after it
+    if (reader->fd >= 0) {
+        if (reader->file_size < sizeof(header) + sizeof(IEND)) {
+            return FALSE;
+        }
+        
+        guint8 trailer[PNG_TRAILER_SEARCH_SIZE];
+        gsize length = (gsize)MIN(reader->file_size - sizeof(header), (guint64)sizeof(trailer));
+        if (!read_at(reader, reader->file_size - length, trailer, length)) {
+            return FALSE;
+        }
+        
+        // From the end, since that is where it nearly always is
+        for (gsize offset = length - sizeof(IEND) + 1; offset > 0; offset--) {
+            if (memcmp(trailer + offset - 1, IEND, sizeof(IEND)) == 0) {
+                return TRUE;
+            }
+        }
+        return FALSE;
+    }
+    
+    return TRUE;
+}
+
+static gboolean
+probe_webp(const ProbeReader *reader, WallyImageInfo *info)
+{
+    guint8 header[30];
+    if (!read_at(reader, 0, header, sizeof(header))) {
+        return FALSE;
+    }
+    
+    if ((guint64)le32(header + 4) + 8 > reader->file_size) {
+        return FALSE;
+    }
+    
+    if (memcmp(header + 12, "VP8 ", 4) == 0) {
+        // Lossy: key frame start code, then 14-bit dimensions
+        if (header[23] != 0x9D || header[24] != 0x01 || header[25] != 0x2A) {
+            return FALSE;
+        }
+        info->width = le16(header + 26) & 0x3FFF;
+        info->height = le16(header + 28) & 0x3FFF;
+    } else if (memcmp(header + 12, "VP8L", 4) == 0) {
+        if (header[20] != 0x2F) {
+            return FALSE;
+        }
+        guint32 bits = le32(header + 21);
+        info->width = (bits & 0x3FFF) + 1;
+        info->height = ((bits >> 14) & 0x3FFF) + 1;
+    } else if (memcmp(header + 12, "VP8X", 4) == 0) {
+        info->width = le24(header + 24) + 1;
+        info->height = le24(header + 27) + 1;
+    } else {
+        return FALSE;
+    }
+    
+    return TRUE;
+}
+
+static gboolean
+probe_bmp(const ProbeReader *reader, WallyImageInfo *info)
+{
+    guint8 header[30];
+    if (!read_at(reader, 0, header, sizeof(header))) {
+        return FALSE;
+    }
+    
+    if (le32(header + 2) > reader->file_size) {
+        return FALSE;
+    }
+    
+    guint32 dib_size = le32(header + 14);
+    if (dib_size == 12) {
+        info->width = le16(header + 18);
+        info->height = le16(header + 20);
+    } else if (dib_size >= 40) {
+        // Negative heights mean the rows are stored top-down
+        gint32 width = (gint32)le32(header + 18);
+        gint32 height = (gint32)le32(header + 22);
+        info->width = (guint32)ABS(width);
+        info->height = (guint32)ABS(height);
+        
+        // Only 32-bit images with an alpha mask (V3 headers and up) have one;
+        // otherwise the fourth byte is padding
+        guint8 alpha_mask[4];
+        info->has_alpha = le16(header + 28) == 32 && dib_size >= 56 &&
+                          read_at(reader, 14 + 52, alpha_mask, sizeof(alpha_mask)) && le32(alpha_mask) != 0;
+    } else {
+        return FALSE;
+    }
+    
+    return TRUE;
+}
+
+static gboolean
+probe_tiff(const ProbeReader *reader, WallyImageInfo *info)
+{
+    guint8 header[8];
+    if (!read_at(reader, 0, header, sizeof(header))) {
+        return FALSE;
+    }
+    
+    gboolean big_endian = header[0] == 'M';
+    auto u16 = [big_endian](const guint8 *p) { return big_endian ? be16(p) : le16(p); };
+    auto u32 = [big_endian](const guint8 *p) { return big_endian ? be32(p) : le32(p); };
+    
+    guint64 ifd_offset = u32(header + 4);
+    guint8 count_bytes[2];
+    if (!read_at(reader, ifd_offset, count_bytes, sizeof(count_bytes))) {
+        return FALSE;
+    }
+    
+    // Tags are sorted, and ExtraSamples comes after the size
+    guint16 entry_count = u16(count_bytes);
+    for (guint16 i = 0; i < entry_count; i++) {
+        guint8 entry[12];
+        if (!read_at(reader, ifd_offset + 2 + (guint64)i * 12, entry, sizeof(entry))) {
+            return FALSE;
+        }
+        
+        guint16 tag = u16(entry);
+        guint16 type = u16(entry + 2);
+        guint32 value = type == 3 ? u16(entry + 8) : type == 4 ? u32(entry + 8) : 0;
+        
+        if (tag == 256) {
+            info->width = value;
+        } else if (tag == 257) {
+            info->height = value;
+        } else if (tag == 274) {
+            info->orientation = value >= 1 && value <= 8 ? value : 1;
+        } else if (tag == 338) {
+            // ExtraSamples: 1 is premultiplied alpha, 2 straight alpha
+            info->has_alpha = value == 1 || value == 2;
+        } else if (tag > 338) {
+            break;
+        }
+    }
+    
+    return info->width > 0 && info->height > 0;
+}
+
+static gboolean
+probe_svg(const ProbeReader *reader)
+{
+    // Text that opens with a tag, after an optional BOM and whitespace
+    gsize i = 0;
+    if (reader->head_length >= 3 && memcmp(reader->head, "\xEF\xBB\xBF", 3) == 0) {
+        i = 3;
+    }
+    while (i < reader->head_length && g_ascii_isspace(reader->head[i])) {
+        i++;
+    }
+    
+    return i < reader->head_length && reader->head[i] == '<' &&
+           g_strstr_len((const char *)reader->head, reader->head_length, "<svg") != NULL;
+}
+
+static WallyImageFormat
+sniff_format(const guint8 *head, gsize length)
+{
+    if (length >= 3 && head[0] == 0xFF && head[1] == 0xD8 && head[2] == 0xFF) {
+        return WALLY_IMAGE_FORMAT_JPEG;
+    }
+    if (length >= 8 && memcmp(head, "\x89PNG\r\n\x1a\n", 8) == 0) {
+        return WALLY_IMAGE_FORMAT_PNG;
+    }
+    if (length >= 12 && memcmp(head, "RIFF", 4) == 0 && memcmp(head + 8, "WEBP", 4) == 0) {
+        return WALLY_IMAGE_FORMAT_WEBP;
+    }
+    if (length >= 2 && head[0] == 'B' && head[1] == 'M') {
+        return WALLY_IMAGE_FORMAT_BMP;
+    }
+    if (length >= 4 && (memcmp(head, "II*\0", 4) == 0 || memcmp(head, "MM\0*", 4) == 0)) {
+        return WALLY_IMAGE_FORMAT_TIFF;
+    }
+    
+    return WALLY_IMAGE_FORMAT_UNKNOWN;
+}
+
+static gboolean
+probe(const ProbeReader *reader, WallyImageInfo *info, GError **error)
+{
+    *info = WallyImageInfo{WALLY_IMAGE_FORMAT_UNKNOWN, 0, 0, FALSE, 1};
+    
+    WallyImageFormat format = sniff_format(reader->head, reader->head_length);
+    gboolean valid = FALSE;
+    
+    switch (format) {
+    case WALLY_IMAGE_FORMAT_JPEG:
+        valid = probe_jpeg(reader, info);
+        break;
+    case WALLY_IMAGE_FORMAT_PNG:
+        valid = probe_png(reader, info);
+        break;
+    case WALLY_IMAGE_FORMAT_WEBP:
+        valid = probe_webp(reader, info);
+        break;
+    case WALLY_IMAGE_FORMAT_BMP:
+        valid = probe_bmp(reader, info);
+        break;
+    case WALLY_IMAGE_FORMAT_TIFF:
+        valid = probe_tiff(reader, info);
+        break;
+    case WALLY_IMAGE_FORMAT_UNKNOWN:
+    case WALLY_IMAGE_FORMAT_SVG:
+    default:
+        if (probe_svg(reader)) {
+            format = WALLY_IMAGE_FORMAT_SVG;
+            valid = TRUE;
+        }
+        break;
+    }
+    
+    if (format == WALLY_IMAGE_FORMAT_UNKNOWN) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Not a supported image");
+        return FALSE;
+    }
+    
+    if (!valid || (format != WALLY_IMAGE_FORMAT_SVG && (info->width == 0 || info->height == 0))) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Truncated or corrupt %s image",
+                    wally_image_format_to_string(format));
+        return FALSE;
+    }
+    
+    info->format = format;
+    return TRUE;
+}
+
+gboolean
+wally_image_probe_data(const guint8 *data,
+                       gsize length,
+                       WallyImageInfo *info,
+                       GError **error)
+{
+    g_return_val_if_fail(data != NULL || length == 0, FALSE);
+    g_return_val_if_fail(info != NULL, FALSE);
+    
+    ProbeReader reader = {data, length, -1, length};
+    return probe(&reader, info, error);
+}
+
+gboolean
+wally_image_probe_file(const char *path,
+                       WallyImageInfo *info,
+                       GError **error)
+{
+    g_return_val_if_fail(path != NULL, FALSE);
+    g_return_val_if_fail(info != NULL, FALSE);
+    
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        int saved_errno = errno;
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved_errno),
+                    "Failed to open %s: %s", path, g_strerror(saved_errno));
+        return FALSE;
+    }
+    
+    struct stat st;
+    guint8 head[PROBE_HEAD_SIZE];
+    ssize_t n;
+    do {
+        n = read(fd, head, sizeof(head));
+    } while (n < 0 && errno == EINTR);
+    
+    if (n < 0 || fstat(fd, &st) != 0) {
+        int saved_errno = errno;
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved_errno),
+                    "Failed to read %s: %s", path, g_strerror(saved_errno));
+        close(fd);
+        return FALSE;
+    }
+    
+    ProbeReader reader = {head, static_cast<gsize>(n), fd, static_cast<guint64>(st.st_size)};
+    gboolean success = probe(&reader, info, error);
+    close(fd);
+    
+    return success;
+}
+
+/*
+ * The size of the image once its EXIF orientation has been applied:
+ * orientations 5 to 8 turn it by a quarter, swapping width and height.
+ */
+void
+wally_image_info_get_display_size(const WallyImageInfo *info, guint32 *width, guint32 *height)
+{
+    gboolean swapped = info->orientation >= 5 && info->orientation <= 8;
+    
+    *width = swapped ? info->height : info->width;
+    *height = swapped ? info->width : info->height;
+}
+
+const char *
+wally_image_format_to_string(WallyImageFormat format)
+{
+    switch (format) {
+    case WALLY_IMAGE_FORMAT_JPEG:
+        return "JPEG";
+    case WALLY_IMAGE_FORMAT_PNG:
+        return "PNG";
+    case WALLY_IMAGE_FORMAT_WEBP:
+        return "WebP";
+    case WALLY_IMAGE_FORMAT_BMP:
+        return "BMP";
+    case WALLY_IMAGE_FORMAT_TIFF:
+        return "TIFF";
+    case WALLY_IMAGE_FORMAT_SVG:
+        return "SVG";
+    case WALLY_IMAGE_FORMAT_UNKNOWN:
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+    WALLY_IMAGE_FORMAT_UNKNOWN,
+    WALLY_IMAGE_FORMAT_JPEG,
+    WALLY_IMAGE_FORMAT_PNG,
+    WALLY_IMAGE_FORMAT_WEBP,
+    WALLY_IMAGE_FORMAT_BMP,
+    WALLY_IMAGE_FORMAT_TIFF,
+    WALLY_IMAGE_FORMAT_SVG,
+} WallyImageFormat;
+
+/*
+ * What the header of an image file says. Width and height are 0 for SVG,
+ * which has no fixed size, and are the size as stored, before any rotation.
+ * has_alpha is only looked for in BMP and TIFF, the formats that may get
+ * converted on import. orientation is the EXIF orientation (1 to 8) of a
+ * JPEG or TIFF, the formats GdkPixbuf turns upright, and 1 for the rest.
+ */
+typedef struct
+{
+    WallyImageFormat format;
+    guint32 width;
+    guint32 height;
+    gboolean has_alpha;
+    guint orientation;
+} WallyImageInfo;
+
+/*
+ * Identify an image by its magic bytes and read its size from the header,
+ * without decoding any pixels. Only the first few KB are read, plus the odd
+ * small read where a format keeps its size further in (JPEG after large
+ * metadata, TIFF with a trailing directory). Files whose header promises more
+ * data than the file holds are reported as truncated, with
+ * G_IO_ERROR_INVALID_DATA; files in no format Wally knows fail with
+ * G_IO_ERROR_NOT_SUPPORTED.
+ */
+gboolean wally_image_probe_file(const char *path,
+                                WallyImageInfo *info,
+                                GError **error);
+
+gboolean wally_image_probe_data(const guint8 *data,
+                                gsize length,
+                                WallyImageInfo *info,
+                                GError **error);
+
+void wally_image_info_get_display_size(const WallyImageInfo *info,
+                                       guint32 *width,
+                                       guint32 *height);
+
+const char *wally_image_format_to_string(WallyImageFormat format);
+
+G_END_DECLS
@@ -0,0 +1,438 @@
+#include "import-engine.h"
+#include "content-hash.h"
+#include "parallel.h"
+#include "transcoder.h"
+
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Large buffers keep the number of read/write syscalls per file low
+#define IMPORT_BUFFER_SIZE (4 * 1024 * 1024)
+
+#define DEFAULT_TRANSCODE_QUALITY 90
+
+struct _WallyImportEngine
+{
+    GObject parent_instance;
+    
+    guint max_workers;
+    WallyImportMode mode;
+    int transcode_quality;
+};
+
+G_DEFINE_FINAL_TYPE(WallyImportEngine, wally_import_engine, G_TYPE_OBJECT)
+
+static void
+wally_import_engine_class_init(WallyImportEngineClass *klass G_GNUC_UNUSED)
+{
+}
+
+static void
+wally_import_engine_init(WallyImportEngine *self)
+{
+    self->max_workers = 0;
+    self->mode = WALLY_IMPORT_MODE_COPY;
+    self->transcode_quality = DEFAULT_TRANSCODE_QUALITY;
+}
+
+WallyImportEngine *
+wally_import_engine_new(void)
+{
+    return static_cast<WallyImportEngine*>(g_object_new(WALLY_TYPE_IMPORT_ENGINE, NULL));
+}
+
+void
+wally_import_engine_set_max_workers(WallyImportEngine *self,
+                                    guint max_workers)
+{
+    g_return_if_fail(WALLY_IS_IMPORT_ENGINE(self));
+    
+    self->max_workers = max_workers;
+}
+
+void
+wally_import_engine_set_mode(WallyImportEngine *self,
+                             WallyImportMode mode)
+{
+    g_return_if_fail(WALLY_IS_IMPORT_ENGINE(self));
+    g_return_if_fail(mode <= WALLY_IMPORT_MODE_COPY);
+    
+    self->mode = mode;
+}
+
+// JPEG quality, 1 to 100, of jobs that transcode
+void
+wally_import_engine_set_transcode_quality(WallyImportEngine *self,
+                                          int quality)
+{
+    g_return_if_fail(WALLY_IS_IMPORT_ENGINE(self));
+    g_return_if_fail(quality >= 1 && quality <= 100);
+    
+    self->transcode_quality = quality;
+}
+
+const char *
+wally_import_mode_to_string(WallyImportMode mode)
+{
+    switch (mode) {
+    case WALLY_IMPORT_MODE_REFLINK:
+        return "reflink";
+    case WALLY_IMPORT_MODE_HARDLINK:
+        return "hardlink";
+    case WALLY_IMPORT_MODE_SYMLINK:
+        return "symlink";
+    case WALLY_IMPORT_MODE_COPY:
+    default:
+        return "copy";
+    }
+}
+
+static std::string
+errno_message(const char *action, const std::string& path, int saved_errno)
+{
+    g_autofree char *message = g_strdup_printf("%s %s: %s", action, path.c_str(), g_strerror(saved_errno));
+    return message;
+}
+
+static gboolean
+write_all(int fd, const char *data, gsize len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return FALSE;
+        }
+        data += n;
+        len -= n;
+    }
+    return TRUE;
+}
+
+// Stream @source into @dest_fd, hashing the bytes on the way if asked to
+static gboolean
+copy_contents(int source_fd, int dest_fd, WallyImportJob& job, std::vector<char>& buffer,
+              GCancellable *cancellable)
+{
+    WallyHashState hash_state;
+    wally_hash_init(&hash_state, 0);
+    
+    for (;;) {
+        // Checked per buffer so a cancel doesn't wait for a large file
+        if (g_cancellable_is_cancelled(cancellable)) {
+            job.error = "Import cancelled";
+            return FALSE;
+        }
+        
+        ssize_t n = read(source_fd, buffer.data(), buffer.size());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            job.error = errno_message("Failed to read", job.source, errno);
+            return FALSE;
+        }
+        if (n == 0) {
+            break;
+        }
+        
+        if (job.compute_hash) {
+            wally_hash_update(&hash_state, buffer.data(), n);
+        }
+        
+        if (!write_all(dest_fd, buffer.data(), n)) {
+            job.error = errno_message("Failed to write", job.dest, errno);
+            return FALSE;
+        }
+        job.bytes += n;
+    }
+    
+    if (job.compute_hash) {
+        job.hash = wally_hash_finish(&hash_state);
+    }
+    
+    return TRUE;
+}
+
+// Errors that mean "this mode can't do it here", as opposed to real I/O
+// failures that the next mode would hit as well
+static gboolean
+is_unsupported_errno(int error_code)
+{
+    switch (error_code) {
+    case EXDEV:
+    case EOPNOTSUPP:
+#if ENOTSUP != EOPNOTSUPP
+    case ENOTSUP:
+#endif
+    case ENOTTY:
+    case ENOSYS:
+    case EINVAL:
+    case EPERM:
+    case EMLINK:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+// Share the source's extents, falling back to an in-kernel copy. Returns
+// FALSE with errno set when neither is possible between these files.
+static gboolean
+clone_contents(int source_fd, int dest_fd, guint64 size, WallyImportJob& job)
+{
+    if (ioctl(dest_fd, FICLONE, source_fd) == 0) {
+        job.bytes = size;
+        return TRUE;
+    }
+    
+    if (!is_unsupported_errno(errno)) {
+        return FALSE;
+    }
+    
+    // copy_file_range() lets the filesystem reflink or copy server-side
+    // where it can; across filesystems it fails and we move on
+    loff_t offset = 0;
+    while (static_cast<guint64>(offset) < size) {
+        ssize_t n = copy_file_range(source_fd, &offset, dest_fd, NULL, size - offset, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return FALSE;
+        }
+        if (n == 0) {
+            break;
+        }
+    }
+    
+    job.bytes = offset;
+    return TRUE;
+}
+
+// Import by cloning or copying the data into @partial
+static gboolean
+import_contents(WallyImportJob& job, WallyImportMode mode,
+                const std::string& partial, std::vector<char>& buffer,
+                GCancellable *cancellable, gboolean *unsupported)
+{
+    int source_fd = open(job.source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (source_fd < 0) {
+        job.error = errno_message("Failed to open", job.source, errno);
+        return FALSE;
+    }
+    
+    struct stat st;
+    if (fstat(source_fd, &st) != 0) {
+        job.error = errno_message("Failed to read", job.source, errno);
+        close(source_fd);
+        return FALSE;
+    }
+    
+    int dest_fd = open(partial.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (dest_fd < 0) {
+        job.error = errno_message("Failed to create", partial, errno);
+        close(source_fd);
+        return FALSE;
+    }
+    
+    gboolean success;
+    
+    if (mode == WALLY_IMPORT_MODE_REFLINK) {
+        success = clone_contents(source_fd, dest_fd, st.st_size, job);
+        if (!success) {
+            if (is_unsupported_errno(errno)) {
+                *unsupported = TRUE;
+            } else {
+                job.error = errno_message("Failed to clone", job.source, errno);
+            }
+        }
+    } else {
+        posix_fadvise(source_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        
+        if (st.st_size > 0) {
+            // Best effort; reserving the space up front avoids fragmentation.
+            // Unlike posix_fallocate() this never falls back to writing zeros.
+            fallocate(dest_fd, 0, 0, st.st_size);
+        }
+        
+        success = copy_contents(source_fd, dest_fd, job, buffer, cancellable);
+        
+        // The source is not needed again, drop it from the page cache
+        posix_fadvise(source_fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    
+    close(source_fd);
+    
+    if (close(dest_fd) != 0 && success) {
+        job.error = errno_message("Failed to write", job.dest, errno);
+        success = FALSE;
+    }
+    
+    return success;
+}
+
+// Import by linking @partial to the source
+static gboolean
+import_link(WallyImportJob& job, WallyImportMode mode,
+            const std::string& partial, gboolean *unsupported)
+{
+    int result;
+    
+    if (mode == WALLY_IMPORT_MODE_HARDLINK) {
+        result = link(job.source.c_str(), partial.c_str());
+    } else {
+        g_autofree char *absolute_source = g_canonicalize_filename(job.source.c_str(), NULL);
+        result = symlink(absolute_source, partial.c_str());
+    }
+    
+    if (result != 0) {
+        if (is_unsupported_errno(errno)) {
+            *unsupported = TRUE;
+        } else {
+            job.error = errno_message("Failed to link", job.source, errno);
+        }
+        return FALSE;
+    }
+    
+    struct stat st;
+    job.bytes = stat(job.source.c_str(), &st) == 0 ? st.st_size : 0;
+    return TRUE;
+}
+
+// Import by converting the source. Decoding holds the whole image, which is
+// why only images within the transcoder's budget are sent this way.
+static void
+import_transcoded(WallyImportJob& job, int quality)
+{
+    job.mode = WALLY_IMPORT_MODE_COPY;
+    
+    struct stat st;
+    if (stat(job.source.c_str(), &st) != 0) {
+        job.error = errno_message("Failed to read", job.source, errno);
+        return;
+    }
+    
+    GError *transcode_error = NULL;
+    if (!wally_transcoder_transcode(job.source.c_str(), job.dest.c_str(), quality, &transcode_error)) {
+        job.error = "Failed to convert " + job.source + ": " + transcode_error->message;
+        g_error_free(transcode_error);
+        return;
+    }
+    job.bytes = st.st_size;
+    
+    if (job.compute_hash) {
+        GError *hash_error = NULL;
+        if (!wally_hash_file(job.source.c_str(), &job.hash, &hash_error)) {
+            g_warning("%s", hash_error->message);
+            g_error_free(hash_error);
+            job.hash = 0;
+        }
+    }
+}
+
+static void
+import_file(WallyImportJob& job, WallyImportMode first_mode, std::vector<char>& buffer,
+            GCancellable *cancellable)
+{
+    job.bytes = 0;
+    job.hash = 0;
+    job.error.clear();
+    
+    // Create the file next to the destination and rename it over, so a
+    // failed or interrupted import never leaves a truncated wallpaper behind
+    std::string partial = job.dest + ".wally-part";
+    
+    for (int mode = first_mode; mode <= WALLY_IMPORT_MODE_COPY; mode++) {
+        job.mode = static_cast<WallyImportMode>(mode);
+        g_unlink(partial.c_str());
+        
+        gboolean unsupported = FALSE;
+        gboolean success;
+        
+        if (job.mode == WALLY_IMPORT_MODE_HARDLINK || job.mode == WALLY_IMPORT_MODE_SYMLINK) {
+            success = import_link(job, job.mode, partial, &unsupported);
+        } else {
+            success = import_contents(job, job.mode, partial, buffer, cancellable, &unsupported);
+        }
+        
+        if (unsupported) {
+            continue;
+        }
+        
+        if (success && rename(partial.c_str(), job.dest.c_str()) != 0) {
+            job.error = errno_message("Failed to move into place", job.dest, errno);
+            success = FALSE;
+        }
+        
+        // rename() is a no-op when both names are links to the same inode
+        g_unlink(partial.c_str());
+        
+        if (success && job.compute_hash && job.mode != WALLY_IMPORT_MODE_COPY) {
+            // Only the copy path reads the data; hash it separately otherwise
+            GError *hash_error = NULL;
+            if (!wally_hash_file(job.source.c_str(), &job.hash, &hash_error)) {
+                g_warning("%s", hash_error->message);
+                g_error_free(hash_error);
+                job.hash = 0;
+            }
+        }
+        
+        return;
+    }
+    
+    job.error = "No import mode could handle " + job.source;
+}
+
+guint
+wally_import_engine_run(WallyImportEngine *self,
+                        std::vector<WallyImportJob>& jobs,
+                        GCancellable *cancellable,
+                        const WallyImportCallback& on_finished)
+{
+    g_return_val_if_fail(WALLY_IS_IMPORT_ENGINE(self), 0);
+    
+    if (jobs.empty()) {
+        return 0;
+    }
+    
+    guint workers = wally_parallel_worker_count(jobs.size(), self->max_workers);
+    std::vector<std::vector<char>> buffers(workers);
+    std::atomic<guint> imported{0};
+    
+    wally_parallel_for(jobs.size(), workers, [&](gsize index, guint worker) {
+        WallyImportJob& job = jobs[index];
+        
+        if (g_cancellable_is_cancelled(cancellable)) {
+            job.error = "Import cancelled";
+            return;
+        }
+        
+        std::vector<char>& buffer = buffers[worker];
+        if (buffer.empty()) {
+            buffer.resize(IMPORT_BUFFER_SIZE);
+        }
+        
+        if (job.transcode) {
+            import_transcoded(job, self->transcode_quality);
+        } else {
+            import_file(job, self->mode, buffer, cancellable);
+        }
+        if (job.error.empty()) {
+            imported++;
+        }
+        
+        if (on_finished) {
+            on_finished(job);
+        }
+    });
+    
+    return imported;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <glib-object.h>
+#include <gio/gio.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+G_BEGIN_DECLS
+
+#define WALLY_TYPE_IMPORT_ENGINE (wally_import_engine_get_type())
+
+G_DECLARE_FINAL_TYPE(WallyImportEngine, wally_import_engine, WALLY, IMPORT_ENGINE, GObject)
+
+/*
+ * How a wallpaper gets into the Wally folder, cheapest first. Values match
+ * the import-mode enum in the GSettings schema. When a mode is not supported
+ * for a file (e.g. the source is on another filesystem) the engine falls
+ * back to the next one; copying always works.
+ */
+typedef enum
+{
+    WALLY_IMPORT_MODE_REFLINK,
+    WALLY_IMPORT_MODE_HARDLINK,
+    WALLY_IMPORT_MODE_SYMLINK,
+    WALLY_IMPORT_MODE_COPY,
+} WallyImportMode;
+
+/*
+ * One file to import. On return from wally_import_engine_run() @error is
+ * empty if the file was imported, @mode says how it was imported and @hash
+ * holds its content hash when @compute_hash was set. With @transcode the
+ * source is converted to the format @dest's extension names instead (see
+ * transcoder.h); the mode is then copy, and @bytes and @hash still
+ * describe the source.
+ */
+typedef struct
+{
+    std::string source;
+    std::string dest;
+    gboolean compute_hash;
+    gboolean transcode;
+    
+    guint64 bytes;
+    guint64 hash;
+    WallyImportMode mode;
+    std::string error;
+} WallyImportJob;
+
+// Called on a worker thread as each job finishes, successfully or not
+typedef std::function<void(const WallyImportJob& job)> WallyImportCallback;
+
+WallyImportEngine *wally_import_engine_new(void);
+
+void wally_import_engine_set_max_workers(WallyImportEngine *self,
+                                         guint max_workers);
+
+void wally_import_engine_set_mode(WallyImportEngine *self,
+                                  WallyImportMode mode);
+
+void wally_import_engine_set_transcode_quality(WallyImportEngine *self,
+                                               int quality);
+
+const char *wally_import_mode_to_string(WallyImportMode mode);
+
+guint wally_import_engine_run(WallyImportEngine *self,
+                              std::vector<WallyImportJob>& jobs,
+                              GCancellable *cancellable,
+                              const WallyImportCallback& on_finished);
+
+G_END_DECLS
@@ -0,0 +1,266 @@
+#include "library-index.h"
+
+#include <string.h>
+#include <vector>
+
+#define INDEX_FILENAME ".wally-library.idx"
+#define INDEX_MAGIC "WALLYIDX"
+#define INDEX_VERSION 2
+#define INDEX_BYTE_ORDER 0x01020304
+
+static_assert(sizeof(WallyIndexHeader) == 64, "index header layout changed");
+static_assert(sizeof(WallyIndexRecord) == 48, "index record layout changed");
+
+struct _WallyLibraryIndex
+{
+    GMappedFile *file;
+    const WallyIndexHeader *header;
+    const WallyIndexRecord *records;
+    const char *strings;
+};
+
+static char *
+build_index_path(const char *dest_folder)
+{
+    return g_build_filename(dest_folder, INDEX_FILENAME, NULL);
+}
+
+/*
+ * Maps the index of the collection in @dest_folder. Only the header and
+ * the overall layout are checked here; the records are trusted as far as
+ * the string offsets they hold, which are checked on use.
+ */
+WallyLibraryIndex *
+wally_library_index_open(const char *dest_folder,
+                         GError **error)
+{
+    g_return_val_if_fail(dest_folder != NULL, NULL);
+    
+    g_autofree char *path = build_index_path(dest_folder);
+    GMappedFile *file = g_mapped_file_new(path, FALSE, error);
+    if (file == NULL) {
+        return NULL;
+    }
+    
+    const char *data = g_mapped_file_get_contents(file);
+    gsize length = g_mapped_file_get_length(file);
+    const WallyIndexHeader *header = reinterpret_cast<const WallyIndexHeader*>(data);
+    
+    // Each step only relies on what the earlier ones established
+    gboolean valid = length >= sizeof(WallyIndexHeader) &&
+                     memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) == 0 &&
+                     header->version == INDEX_VERSION &&
+                     header->byte_order == INDEX_BYTE_ORDER &&
+                     header->record_size == sizeof(WallyIndexRecord) &&
+                     header->n_records <= (length - sizeof(WallyIndexHeader)) / sizeof(WallyIndexRecord) &&
+                     header->strings_offset == sizeof(WallyIndexHeader) + header->n_records * sizeof(WallyIndexRecord) &&
+                     header->strings_size > 0 &&
+                     header->strings_size == length - header->strings_offset &&
+                     data[length - 1] == '\0' &&
+                     header->source_root < header->strings_size &&
+                     header->options < header->strings_size;
+    
+    if (!valid) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Corrupt or outdated library index %s", path);
+        g_mapped_file_unref(file);
+        return NULL;
+    }
+    
+    WallyLibraryIndex *index = g_new0(WallyLibraryIndex, 1);
+    index->file = file;
+    index->header = header;
+    index->records = reinterpret_cast<const WallyIndexRecord*>(data + sizeof(WallyIndexHeader));
+    index->strings = data + header->strings_offset;
+    
+    return index;
+}
+
+void
+wally_library_index_free(WallyLibraryIndex *index)
+{
+    if (index == NULL) {
+        return;
+    }
+    
+    g_mapped_file_unref(index->file);
+    g_free(index);
+}
+
+const char *
+wally_library_index_get_source_root(WallyLibraryIndex *index)
+{
+    g_return_val_if_fail(index != NULL, NULL);
+    
+    return index->strings + index->header->source_root;
+}
+
+const char *
+wally_library_index_get_options(WallyLibraryIndex *index)
+{
+    g_return_val_if_fail(index != NULL, NULL);
+    
+    return index->strings + index->header->options;
+}
+
+guint32
+wally_library_index_get_last_number(WallyLibraryIndex *index)
+{
+    g_return_val_if_fail(index != NULL, 0);
+    
+    return index->header->last_number;
+}
+
+gsize
+wally_library_index_get_n_records(WallyLibraryIndex *index)
+{
+    g_return_val_if_fail(index != NULL, 0);
+    
+    return index->header->n_records;
+}
+
+// Records come sorted by relative path
+const WallyIndexRecord *
+wally_library_index_get_record(WallyLibraryIndex *index,
+                               gsize position)
+{
+    g_return_val_if_fail(index != NULL, NULL);
+    g_return_val_if_fail(position < index->header->n_records, NULL);
+    
+    return &index->records[position];
+}
+
+// Offsets past the table, which only a damaged file has, read as ""
+const char *
+wally_library_index_get_string(WallyLibraryIndex *index,
+                               guint32 offset)
+{
+    g_return_val_if_fail(index != NULL, "");
+    
+    if (G_UNLIKELY(offset >= index->header->strings_size)) {
+        return "";
+    }
+    
+    return index->strings + offset;
+}
+
+const WallyIndexRecord *
+wally_library_index_lookup(WallyLibraryIndex *index,
+                           const char *relative_path)
+{
+    g_return_val_if_fail(index != NULL, NULL);
+    g_return_val_if_fail(relative_path != NULL, NULL);
+    
+    // strcmp() orders like std::string, which sorted the records
+    gsize low = 0;
+    gsize high = index->header->n_records;
+    while (low < high) {
+        gsize middle = low + (high - low) / 2;
+        const WallyIndexRecord *record = &index->records[middle];
+        int order = strcmp(wally_library_index_get_string(index, record->relative_path), relative_path);
+        
+        if (order == 0) {
+            return record;
+        } else if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    
+    return NULL;
+}
+
+void
+wally_library_index_get_entry(WallyLibraryIndex *index,
+                              const WallyIndexRecord *record,
+                              WallyManifestEntry *entry)
+{
+    g_return_if_fail(index != NULL);
+    g_return_if_fail(record != NULL);
+    g_return_if_fail(entry != NULL);
+    
+    entry->target = wally_library_index_get_string(index, record->target);
+    entry->size = record->size;
+    entry->mtime_ns = record->mtime_ns;
+    entry->hash = record->hash;
+    entry->width = record->width;
+    entry->height = record->height;
+    entry->luminance = record->luminance;
+    entry->luminance_p90 = record->luminance_p90;
+}
+
+static guint32
+add_string(std::vector<char>& strings,
+           const std::string& value)
+{
+    guint32 offset = strings.size();
+    strings.insert(strings.end(), value.c_str(), value.c_str() + value.size() + 1);
+    return offset;
+}
+
+/*
+ * Replaces the index of the collection in @dest_folder. The file is written
+ * whole and renamed into place, so a reader never maps a half-written one.
+ */
+gboolean
+wally_library_index_write(const char *dest_folder,
+                          const char *source_root,
+                          const char *options,
+                          guint32 last_number,
+                          const std::map<std::string, WallyManifestEntry>& entries,
+                          GError **error)
+{
+    g_return_val_if_fail(dest_folder != NULL, FALSE);
+    g_return_val_if_fail(source_root != NULL, FALSE);
+    g_return_val_if_fail(options != NULL, FALSE);
+    
+    WallyIndexHeader header = {};
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.record_size = sizeof(WallyIndexRecord);
+    header.byte_order = INDEX_BYTE_ORDER;
+    header.n_records = entries.size();
+    header.last_number = last_number;
+    
+    std::vector<char> strings;
+    header.source_root = add_string(strings, source_root);
+    header.options = add_string(strings, options);
+    
+    std::vector<WallyIndexRecord> records;
+    records.reserve(entries.size());
+    for (const auto& [relative_path, entry] : entries) {
+        WallyIndexRecord record = {};
+        record.relative_path = add_string(strings, relative_path);
+        record.target = add_string(strings, entry.target);
+        record.size = entry.size;
+        record.mtime_ns = entry.mtime_ns;
+        record.hash = entry.hash;
+        record.width = entry.width;
+        record.height = entry.height;
+        record.luminance = entry.luminance;
+        record.luminance_p90 = entry.luminance_p90;
+        records.push_back(record);
+    }
+    
+    if (strings.size() > G_MAXUINT32) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NO_SPACE, "Too many wallpapers for one library index");
+        return FALSE;
+    }
+    
+    header.strings_offset = sizeof(header) + records.size() * sizeof(WallyIndexRecord);
+    header.strings_size = strings.size();
+    
+    std::vector<char> contents(header.strings_offset + strings.size());
+    memcpy(contents.data(), &header, sizeof(header));
+    if (!records.empty()) {
+        memcpy(contents.data() + sizeof(header), records.data(), records.size() * sizeof(WallyIndexRecord));
+    }
+    memcpy(contents.data() + header.strings_offset, strings.data(), strings.size());
+    
+    g_autofree char *path = build_index_path(dest_folder);
+    if (!g_file_set_contents(path, contents.data(), contents.size(), error)) {
+        return FALSE;
+    }
+    
+    return TRUE;
+}
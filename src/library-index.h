@@ -0,0 +1,89 @@
+#pragma once
+
+#include "sync-manifest.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <map>
+#include <string>
+
+G_BEGIN_DECLS
+
+/*
+ * The records of one imported collection, kept next to it in a file that is
+ * memory-mapped rather than read: opening an index of any size costs a
+ * header check, and only the pages actually looked at are ever read in.
+ *
+ * Layout, in host byte order: a WallyIndexHeader, then n_records fixed-size
+ * WallyIndexRecords sorted by relative path, then a table of NUL-terminated
+ * strings that the records point into by offset. last_number is the highest
+ * number handed out for a compact name (see
+ * wally_slideshow_manager_set_compact_names()), kept even once its file is
+ * gone; indexes written before it existed hold 0 there.
+ */
+typedef struct
+{
+    char magic[8];
+    guint32 version;
+    guint32 record_size;
+    guint64 n_records;
+    guint64 strings_offset;
+    guint64 strings_size;
+    guint32 source_root;
+    guint32 options;
+    guint32 byte_order;
+    guint32 last_number;
+    guint32 reserved[2];
+} WallyIndexHeader;
+
+typedef struct
+{
+    guint32 relative_path;
+    guint32 target;
+    guint64 size;
+    gint64 mtime_ns;
+    guint64 hash;
+    guint32 width;
+    guint32 height;
+    float luminance;
+    float luminance_p90;
+} WallyIndexRecord;
+
+typedef struct _WallyLibraryIndex WallyLibraryIndex;
+
+WallyLibraryIndex *wally_library_index_open(const char *dest_folder,
+                                            GError **error);
+
+void wally_library_index_free(WallyLibraryIndex *index);
+
+const char *wally_library_index_get_source_root(WallyLibraryIndex *index);
+
+const char *wally_library_index_get_options(WallyLibraryIndex *index);
+
+guint32 wally_library_index_get_last_number(WallyLibraryIndex *index);
+
+gsize wally_library_index_get_n_records(WallyLibraryIndex *index);
+
+const WallyIndexRecord *wally_library_index_get_record(WallyLibraryIndex *index,
+                                                       gsize position);
+
+const char *wally_library_index_get_string(WallyLibraryIndex *index,
+                                           guint32 offset);
+
+const WallyIndexRecord *wally_library_index_lookup(WallyLibraryIndex *index,
+                                                   const char *relative_path);
+
+void wally_library_index_get_entry(WallyLibraryIndex *index,
+                                   const WallyIndexRecord *record,
+                                   WallyManifestEntry *entry);
+
+gboolean wally_library_index_write(const char *dest_folder,
+                                   const char *source_root,
+                                   const char *options,
+                                   guint32 last_number,
+                                   const std::map<std::string, WallyManifestEntry>& entries,
+                                   GError **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(WallyLibraryIndex, wally_library_index_free)
+
+G_END_DECLS
@@ -0,0 +1,254 @@
+#include "luminance.h"
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+// Images are decoded to fit this box; brightness needs no more
+#define MEASURE_SIZE 64
+
+#define CACHE_VERSION 1
+// (version, {content hash: (mean, p90)})
+#define CACHE_VARIANT_TYPE "(ua{t(dd)})"
+
+// Rec. 709 luma weights in 128ths, small enough for signed 8-bit lanes
+#define WEIGHT_R 27
+#define WEIGHT_G 92
+#define WEIGHT_B 9
+
+// Converts one row of RGBA pixels to 8-bit luma
+typedef void (*LumaRowFunc)(const guint8 *rgba, guint8 *luma, int width);
+
+static void
+luma_row_scalar(const guint8 *rgba, guint8 *luma, int width)
+{
+    for (int x = 0; x < width; x++) {
+        const guint8 *pixel = rgba + x * 4;
+        luma[x] = (WEIGHT_R * pixel[0] + WEIGHT_G * pixel[1] + WEIGHT_B * pixel[2]) >> 7;
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+
+// Four pixels at a time
+__attribute__((target("sse2")))
+static void
+luma_row_sse2(const guint8 *rgba, guint8 *luma, int width)
+{
+    const __m128i weights = _mm_setr_epi16(WEIGHT_R, WEIGHT_G, WEIGHT_B, 0, WEIGHT_R, WEIGHT_G, WEIGHT_B, 0);
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    
+    for (; x + 4 <= width; x += 4) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + x * 4));
+        
+        // Widened to 16 bits, two pixels per register; each 32-bit lane gets R+G or B+A
+        __m128 low = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), weights));
+        __m128 high = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), weights));
+        __m128i red_green = _mm_castps_si128(_mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0)));
+        __m128i blue_alpha = _mm_castps_si128(_mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1)));
+        
+        __m128i values = _mm_srli_epi32(_mm_add_epi32(red_green, blue_alpha), 7);
+        values = _mm_packs_epi32(values, values);
+        values = _mm_packus_epi16(values, values);
+        
+        guint32 packed = _mm_cvtsi128_si32(values);
+        memcpy(luma + x, &packed, sizeof(packed));
+    }
+    
+    luma_row_scalar(rgba + x * 4, luma + x, width - x);
+}
+
+// Eight pixels at a time
+__attribute__((target("avx2")))
+static void
+luma_row_avx2(const guint8 *rgba, guint8 *luma, int width)
+{
+    const __m256i weights = _mm256_set1_epi32(WEIGHT_R | (WEIGHT_G << 8) | (WEIGHT_B << 16));
+    const __m256i ones = _mm256_set1_epi16(1);
+    int x = 0;
+    
+    for (; x + 8 <= width; x += 8) {
+        __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rgba + x * 4));
+        
+        // R*wr+G*wg and B*wb in 16 bits (at most 255 * 119, no saturation),
+        // then both halves of each pixel summed into 32 bits
+        __m256i values = _mm256_madd_epi16(_mm256_maddubs_epi16(pixels, weights), ones);
+        values = _mm256_srli_epi32(values, 7);
+        
+        // The packs work within each 128-bit half, leaving pixels 0-3 at the
+        // bottom of the low half and 4-7 at the bottom of the high one
+        values = _mm256_packs_epi32(values, values);
+        values = _mm256_packus_epi16(values, values);
+        
+        guint32 low = _mm256_cvtsi256_si32(values);
+        guint32 high = _mm_cvtsi128_si32(_mm256_extracti128_si256(values, 1));
+        memcpy(luma + x, &low, sizeof(low));
+        memcpy(luma + x + 4, &high, sizeof(high));
+    }
+    
+    luma_row_scalar(rgba + x * 4, luma + x, width - x);
+}
+
+#endif
+
+static LumaRowFunc
+pick_luma_row_func(void)
+{
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return luma_row_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return luma_row_sse2;
+    }
+#endif
+    return luma_row_scalar;
+}
+
+/*
+ * Measures 8-bit RGBA pixels. The vector kernels give exactly the same luma
+ * as the scalar one, so results don't depend on the machine.
+ */
+void
+wally_luminance_compute(const guint8 *pixels,
+                        int width,
+                        int height,
+                        int rowstride,
+                        WallyLuminance *luminance)
+{
+    g_return_if_fail(pixels != NULL);
+    g_return_if_fail(luminance != NULL);
+    
+    static const LumaRowFunc luma_row = pick_luma_row_func();
+    
+    luminance->mean = 0;
+    luminance->p90 = 0;
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+    
+    guint64 histogram[256] = {0};
+    std::vector<guint8> luma(width);
+    for (int y = 0; y < height; y++) {
+        luma_row(pixels + (gsize)y * rowstride, luma.data(), width);
+        for (guint8 value : luma) {
+            histogram[value]++;
+        }
+    }
+    
+    guint64 count = (guint64)width * height;
+    guint64 sum = 0;
+    for (int value = 0; value < 256; value++) {
+        sum += histogram[value] * value;
+    }
+    luminance->mean = (float)((double)sum / count / 255.0);
+    
+    guint64 below = 0;
+    for (int value = 0; value < 256; value++) {
+        below += histogram[value];
+        if (below * 10 >= count * 9) {
+            luminance->p90 = value / 255.0f;
+            break;
+        }
+    }
+}
+
+// Decodes at a small size, which for JPEG skips most of the work
+gboolean
+wally_luminance_measure_file(const char *path,
+                             WallyLuminance *luminance,
+                             GError **error)
+{
+    g_return_val_if_fail(path != NULL, FALSE);
+    g_return_val_if_fail(luminance != NULL, FALSE);
+    
+    g_autoptr(GdkPixbuf) pixbuf = gdk_pixbuf_new_from_file_at_scale(path, MEASURE_SIZE, MEASURE_SIZE, TRUE, error);
+    if (pixbuf == NULL) {
+        return FALSE;
+    }
+    
+    // The kernels take whole 4-byte pixels
+    if (!gdk_pixbuf_get_has_alpha(pixbuf)) {
+        GdkPixbuf *rgba = gdk_pixbuf_add_alpha(pixbuf, FALSE, 0, 0, 0);
+        g_object_unref(pixbuf);
+        pixbuf = rgba;
+    }
+    
+    wally_luminance_compute(gdk_pixbuf_read_pixels(pixbuf),
+                            gdk_pixbuf_get_width(pixbuf),
+                            gdk_pixbuf_get_height(pixbuf),
+                            gdk_pixbuf_get_rowstride(pixbuf),
+                            luminance);
+    return TRUE;
+}
+
+char *
+wally_luminance_cache_get_default_path(void)
+{
+    return g_build_filename(g_get_user_cache_dir(), "wally", "luminance-cache", NULL);
+}
+
+void
+wally_luminance_cache_load(WallyLuminanceCache& cache,
+                           const char *path)
+{
+    g_return_if_fail(path != NULL);
+    
+    g_autofree char *contents = NULL;
+    gsize length = 0;
+    if (!g_file_get_contents(path, &contents, &length, NULL)) {
+        return;
+    }
+    
+    g_autoptr(GBytes) bytes = g_bytes_new_take(g_steal_pointer(&contents), length);
+    g_autoptr(GVariant) root = g_variant_new_from_bytes(G_VARIANT_TYPE(CACHE_VARIANT_TYPE), bytes, FALSE);
+    if (!g_variant_is_normal_form(root)) {
+        return;
+    }
+    
+    guint32 version = 0;
+    g_autoptr(GVariantIter) iter = NULL;
+    g_variant_get(root, "(ua{t(dd)})", &version, &iter);
+    if (version != CACHE_VERSION) {
+        return;
+    }
+    
+    guint64 hash;
+    double mean;
+    double p90;
+    while (g_variant_iter_next(iter, "{t(dd)}", &hash, &mean, &p90)) {
+        cache[hash] = WallyLuminance{(float)mean, (float)p90};
+    }
+}
+
+gboolean
+wally_luminance_cache_save(const WallyLuminanceCache& cache,
+                           const char *path,
+                           GError **error)
+{
+    g_return_val_if_fail(path != NULL, FALSE);
+    
+    GVariantBuilder entries;
+    g_variant_builder_init(&entries, G_VARIANT_TYPE("a{t(dd)}"));
+    for (const auto& [hash, luminance] : cache) {
+        g_variant_builder_add(&entries, "{t(dd)}", hash, (double)luminance.mean, (double)luminance.p90);
+    }
+    
+    g_autoptr(GVariant) root = g_variant_ref_sink(g_variant_new(CACHE_VARIANT_TYPE, CACHE_VERSION, &entries));
+    
+    g_autofree char *cache_dir = g_path_get_dirname(path);
+    g_mkdir_with_parents(cache_dir, 0755);
+    
+    return g_file_set_contents(path,
+                               static_cast<const char*>(g_variant_get_data(root)),
+                               g_variant_get_size(root),
+                               error);
+}
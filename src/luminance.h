@@ -0,0 +1,46 @@
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <unordered_map>
+
+G_BEGIN_DECLS
+
+/*
+ * How bright an image is, from 0 (black) to 1 (white): the mean luma and the
+ * luma that 90% of the pixels stay under, which tells a dark image with a
+ * bright sky from one that is dark all over. Luma uses the Rec. 709 weights
+ * on the encoded values.
+ */
+typedef struct
+{
+    float mean;
+    float p90;
+} WallyLuminance;
+
+void wally_luminance_compute(const guint8 *pixels,
+                             int width,
+                             int height,
+                             int rowstride,
+                             WallyLuminance *luminance);
+
+gboolean wally_luminance_measure_file(const char *path,
+                                      WallyLuminance *luminance,
+                                      GError **error);
+
+/*
+ * Measurements by content hash, kept in Wally's cache folder so an image is
+ * only ever decoded for this once, whichever folder or name it turns up under.
+ */
+typedef std::unordered_map<guint64, WallyLuminance> WallyLuminanceCache;
+
+char *wally_luminance_cache_get_default_path(void);
+
+void wally_luminance_cache_load(WallyLuminanceCache& cache,
+                                const char *path);
+
+gboolean wally_luminance_cache_save(const WallyLuminanceCache& cache,
+                                    const char *path,
+                                    GError **error);
+
+G_END_DECLS
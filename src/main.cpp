@@ -1,5 +1,6 @@
 #include "config.h"
 #include "application.h"
+#include "trace.h"
 
 #include <glib/gi18n.h>
 #include <adwaita.h>
@@ -14,8 +15,11 @@ int main(int argc, char *argv[])
     bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
     textdomain(GETTEXT_PACKAGE);
 
-    // Initialize Adwaita
-    adw_init();
+    // WALLY_TRACE or a Sysprof recording turns on timing spans
+    wally_trace_init();
+
+    // Adwaita is initialized in startup, which the command-line actions never
+    // reach, so they run without touching the display
 
     // Create application
     app = wally_application_new(APP_ID, G_APPLICATION_DEFAULT_FLAGS);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <glib.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/*
+ * Number of workers wally_parallel_for() will use for @count items when asked
+ * for at most @max_workers (0 picks one per processor).
+ */
+static inline guint
+wally_parallel_worker_count(gsize count, guint max_workers)
+{
+    guint workers = max_workers > 0 ? max_workers : g_get_num_processors();
+    return static_cast<guint>(MAX(MIN(static_cast<gsize>(workers), count), 1));
+}
+
+/*
+ * Run func(index, worker) for every index in [0, count) on a bounded set of
+ * threads. Items are handed out one at a time so slow items don't hold up a
+ * whole batch. The calling thread works as worker 0 and the call returns once
+ * every item is done.
+ */
+template <typename Func>
+static inline void
+wally_parallel_for(gsize count, guint max_workers, Func&& func)
+{
+    guint workers = wally_parallel_worker_count(count, max_workers);
+    std::atomic<gsize> next_index{0};
+    
+    auto run_worker = [&](guint worker) {
+        for (gsize i = next_index.fetch_add(1); i < count; i = next_index.fetch_add(1)) {
+            func(i, worker);
+        }
+    };
+    
+    std::vector<std::thread> threads;
+    threads.reserve(workers - 1);
+    for (guint worker = 1; worker < workers; worker++) {
+        threads.emplace_back(run_worker, worker);
+    }
+    
+    run_worker(0);
+    
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
@@ -0,0 +1,246 @@
+#include "power-monitor.h"
+#include "config.h"
+
+#define UPOWER_NAME "org.freedesktop.UPower"
+#define UPOWER_PATH "/org/freedesktop/UPower"
+#define UPOWER_INTERFACE "org.freedesktop.UPower"
+
+// "auto" is whichever session the caller belongs to
+#define LOGIND_NAME "org.freedesktop.login1"
+#define LOGIND_SESSION_PATH "/org/freedesktop/login1/session/auto"
+#define LOGIND_SESSION_INTERFACE "org.freedesktop.login1.Session"
+
+#define SCREENSAVER_NAME "org.gnome.ScreenSaver"
+#define SCREENSAVER_PATH "/org/gnome/ScreenSaver"
+#define SCREENSAVER_INTERFACE "org.gnome.ScreenSaver"
+
+struct _WallyPowerMonitor
+{
+    GObject parent_instance;
+    
+    GCancellable *cancellable;
+    GDBusProxy *upower;
+    GDBusProxy *session;
+    GDBusProxy *screensaver;
+    
+    gboolean on_battery;
+    gboolean locked;
+    gboolean blanked;
+};
+
+enum
+{
+    SIGNAL_CHANGED,
+    N_SIGNALS
+};
+
+static guint signals[N_SIGNALS];
+
+G_DEFINE_FINAL_TYPE(WallyPowerMonitor, wally_power_monitor, G_TYPE_OBJECT)
+
+static void
+wally_power_monitor_dispose(GObject *object)
+{
+    WallyPowerMonitor *self = WALLY_POWER_MONITOR(object);
+    
+    // Proxies still being made are dropped on arrival
+    if (self->cancellable != NULL) {
+        g_cancellable_cancel(self->cancellable);
+    }
+    g_clear_object(&self->cancellable);
+    g_clear_object(&self->upower);
+    g_clear_object(&self->session);
+    g_clear_object(&self->screensaver);
+    
+    G_OBJECT_CLASS(wally_power_monitor_parent_class)->dispose(object);
+}
+
+static void
+wally_power_monitor_class_init(WallyPowerMonitorClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    object_class->dispose = wally_power_monitor_dispose;
+    
+    signals[SIGNAL_CHANGED] = g_signal_new("changed",
+                                           G_TYPE_FROM_CLASS(klass),
+                                           G_SIGNAL_RUN_LAST,
+                                           0, NULL, NULL, NULL,
+                                           G_TYPE_NONE, 0);
+}
+
+static void
+wally_power_monitor_init(WallyPowerMonitor *self)
+{
+    self->cancellable = g_cancellable_new();
+}
+
+static gboolean
+get_cached_boolean(GDBusProxy *proxy,
+                   const char *property)
+{
+    if (proxy == NULL) {
+        return FALSE;
+    }
+    
+    g_autoptr(GVariant) value = g_dbus_proxy_get_cached_property(proxy, property);
+    return value != NULL && g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN) && g_variant_get_boolean(value);
+}
+
+static void
+set_state(WallyPowerMonitor *self,
+          gboolean on_battery,
+          gboolean locked,
+          gboolean blanked)
+{
+    if (self->on_battery == on_battery && self->locked == locked && self->blanked == blanked) {
+        return;
+    }
+    
+    g_debug("Power state: %s, screen %s", on_battery ? "on battery" : "on mains power",
+            locked ? "locked" : blanked ? "blanked" : "on");
+    
+    self->on_battery = on_battery;
+    self->locked = locked;
+    self->blanked = blanked;
+    g_signal_emit(self, signals[SIGNAL_CHANGED], 0);
+}
+
+// UPower and logind publish what we need as properties
+static void
+on_properties_changed(GDBusProxy *proxy G_GNUC_UNUSED,
+                      GVariant *changed G_GNUC_UNUSED,
+                      GStrv invalidated G_GNUC_UNUSED,
+                      WallyPowerMonitor *self)
+{
+    set_state(self,
+              get_cached_boolean(self->upower, "OnBattery"),
+              get_cached_boolean(self->session, "LockedHint"),
+              self->blanked);
+}
+
+// The screensaver only has a signal and a method
+static void
+on_screensaver_signal(GDBusProxy *proxy G_GNUC_UNUSED,
+                      const char *sender_name G_GNUC_UNUSED,
+                      const char *signal_name,
+                      GVariant *parameters,
+                      WallyPowerMonitor *self)
+{
+    if (g_str_equal(signal_name, "ActiveChanged") && g_variant_is_of_type(parameters, G_VARIANT_TYPE("(b)"))) {
+        gboolean active;
+        g_variant_get(parameters, "(b)", &active);
+        set_state(self, self->on_battery, self->locked, active);
+    }
+}
+
+static void
+on_screensaver_active(GObject *source,
+                      GAsyncResult *result,
+                      gpointer user_data)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) reply = g_dbus_proxy_call_finish(G_DBUS_PROXY(source), result, &error);
+    
+    if (reply == NULL) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_debug("No screensaver state: %s", error->message);
+        }
+        return;
+    }
+    
+    WallyPowerMonitor *self = WALLY_POWER_MONITOR(user_data);
+    gboolean active;
+    g_variant_get(reply, "(b)", &active);
+    set_state(self, self->on_battery, self->locked, active);
+}
+
+static void
+on_proxy_ready(GObject *source G_GNUC_UNUSED,
+               GAsyncResult *result,
+               gpointer user_data)
+{
+    g_autoptr(GError) error = NULL;
+    GDBusProxy *proxy = g_dbus_proxy_new_finish(result, &error);
+    
+    if (proxy == NULL) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_debug("Not following power state: %s", error->message);
+        }
+        return;
+    }
+    
+    WallyPowerMonitor *self = WALLY_POWER_MONITOR(user_data);
+    const char *interface_name = g_dbus_proxy_get_interface_name(proxy);
+    
+    if (g_str_equal(interface_name, SCREENSAVER_INTERFACE)) {
+        self->screensaver = proxy;
+        g_signal_connect(proxy, "g-signal", G_CALLBACK(on_screensaver_signal), self);
+        g_dbus_proxy_call(proxy, "GetActive", NULL, G_DBUS_CALL_FLAGS_NONE, -1,
+                          self->cancellable, on_screensaver_active, self);
+        return;
+    }
+    
+    if (g_str_equal(interface_name, UPOWER_INTERFACE)) {
+        self->upower = proxy;
+    } else {
+        self->session = proxy;
+    }
+    g_signal_connect(proxy, "g-properties-changed", G_CALLBACK(on_properties_changed), self);
+    on_properties_changed(proxy, NULL, NULL, self);
+}
+
+static void
+create_proxy(WallyPowerMonitor *self,
+             GDBusConnection *connection,
+             GBusType bus_type,
+             GDBusProxyFlags flags,
+             const char *name,
+             const char *object_path,
+             const char *interface_name)
+{
+    // Changed values are sent along, so the cache never needs a round trip
+    flags = static_cast<GDBusProxyFlags>(flags | G_DBUS_PROXY_FLAGS_GET_INVALIDATED_PROPERTIES);
+    
+    if (connection != NULL) {
+        g_dbus_proxy_new(connection, flags, NULL, name, object_path, interface_name,
+                         self->cancellable, on_proxy_ready, self);
+    } else {
+        g_dbus_proxy_new_for_bus(bus_type, flags, NULL, name, object_path, interface_name,
+                                 self->cancellable, on_proxy_ready, self);
+    }
+}
+
+WallyPowerMonitor *
+wally_power_monitor_new(GDBusConnection *system_bus,
+                        GDBusConnection *session_bus)
+{
+    g_return_val_if_fail(system_bus == NULL || G_IS_DBUS_CONNECTION(system_bus), NULL);
+    g_return_val_if_fail(session_bus == NULL || G_IS_DBUS_CONNECTION(session_bus), NULL);
+    
+    WallyPowerMonitor *self = static_cast<WallyPowerMonitor*>(g_object_new(WALLY_TYPE_POWER_MONITOR, NULL));
+    
+    create_proxy(self, system_bus, G_BUS_TYPE_SYSTEM, G_DBUS_PROXY_FLAGS_NONE,
+                 UPOWER_NAME, UPOWER_PATH, UPOWER_INTERFACE);
+    create_proxy(self, system_bus, G_BUS_TYPE_SYSTEM, G_DBUS_PROXY_FLAGS_NONE,
+                 LOGIND_NAME, LOGIND_SESSION_PATH, LOGIND_SESSION_INTERFACE);
+    create_proxy(self, session_bus, G_BUS_TYPE_SESSION, G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
+                 SCREENSAVER_NAME, SCREENSAVER_PATH, SCREENSAVER_INTERFACE);
+    
+    return self;
+}
+
+gboolean
+wally_power_monitor_get_on_battery(WallyPowerMonitor *self)
+{
+    g_return_val_if_fail(WALLY_IS_POWER_MONITOR(self), FALSE);
+    
+    return self->on_battery;
+}
+
+gboolean
+wally_power_monitor_get_screen_off(WallyPowerMonitor *self)
+{
+    g_return_val_if_fail(WALLY_IS_POWER_MONITOR(self), FALSE);
+    
+    return self->locked || self->blanked;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define WALLY_TYPE_POWER_MONITOR (wally_power_monitor_get_type())
+
+G_DECLARE_FINAL_TYPE(WallyPowerMonitor, wally_power_monitor, WALLY, POWER_MONITOR, GObject)
+
+/*
+ * Follows whether the machine runs on battery (UPower's OnBattery) and
+ * whether nobody can see the screen: the session is locked (logind's
+ * LockedHint) or the screen is blanked (the GNOME screensaver is active).
+ * Emits ::changed when either changes. Services that aren't there count as
+ * on mains power with the screen on.
+ *
+ * The buses default to the system and session bus; a test can pass its own
+ * connections to stand-in services instead.
+ */
+WallyPowerMonitor *wally_power_monitor_new(GDBusConnection *system_bus,
+                                           GDBusConnection *session_bus);
+
+gboolean wally_power_monitor_get_on_battery(WallyPowerMonitor *self);
+
+gboolean wally_power_monitor_get_screen_off(WallyPowerMonitor *self);
+
+G_END_DECLS
@@ -1,6 +1,10 @@
 #include "preferences-window.h"
+#include "apply-job.h"
+#include "folder-analysis.h"
+#include "preview-window.h"
 #include "slideshow-manager.h"
 #include "settings-manager.h"
+#include "trace.h"
 #include "config.h"
 
 #include <glib/gi18n.h>
@@ -12,11 +16,25 @@ struct _WallyPreferencesWindow
     
     GtkButton *day_folder_button;
     GtkButton *night_folder_button;
+    AdwActionRow *day_folder_row;
     GtkSpinButton *interval_spin;
     GtkButton *apply_button;
+    AdwActionRow *apply_progress_row;
+    GtkProgressBar *apply_progress_bar;
+    GtkButton *apply_cancel_button;
     GtkSwitch *same_folder_switch;
     AdwActionRow *night_folder_row;
+    AdwSwitchRow *auto_classify_switch;
+    AdwActionRow *preview_row;
     AdwSwitchRow *auto_night_mode_switch;
+    AdwSwitchRow *shuffle_switch;
+    AdwSwitchRow *scan_recursive_switch;
+    AdwSwitchRow *deduplicate_switch;
+    AdwSwitchRow *watch_folders_switch;
+    AdwSwitchRow *scheduler_switch;
+    AdwSwitchRow *prescale_switch;
+    AdwSwitchRow *transcode_switch;
+    AdwComboRow *import_mode_row;
     GtkScale *transition_scale;
     
     WallySettingsManager *settings_manager;
@@ -24,10 +42,161 @@ struct _WallyPreferencesWindow
     
     char *day_folder_path;
     char *night_folder_path;
+    
+    WallyApplyJob *apply_job;
+    GCancellable *apply_cancellable;
+    guint apply_progress_id;
+    
+    WallyFolderAnalysis *day_analysis;
+    WallyFolderAnalysis *night_analysis;
+    GCancellable *day_analysis_cancellable;
+    GCancellable *night_analysis_cancellable;
+    guint analysis_progress_id;
 };
 
 G_DEFINE_TYPE(WallyPreferencesWindow, wally_preferences_window, ADW_TYPE_PREFERENCES_WINDOW)
 
+static char *
+format_import_time(guint64 seconds)
+{
+    if (seconds < 60) {
+        return g_strdup(_("under a minute to import"));
+    }
+    
+    if (seconds < 60 * 60) {
+        guint minutes = (guint)((seconds + 30) / 60);
+        return g_strdup_printf(ngettext("about %u minute to import", "about %u minutes to import", minutes), minutes);
+    }
+    
+    guint hours = (guint)((seconds + 30 * 60) / (60 * 60));
+    return g_strdup_printf(ngettext("about %u hour to import", "about %u hours to import", hours), hours);
+}
+
+static void
+update_folder_row(WallyPreferencesWindow *self, AdwActionRow *row, WallyFolderAnalysis *analysis, gboolean running)
+{
+    WallyFolderSummary summary;
+    wally_folder_analysis_get_summary(analysis, &summary);
+    
+    GSettings *settings = wally_settings_manager_get_settings(self->settings_manager);
+    WallyImportMode mode = static_cast<WallyImportMode>(g_settings_get_enum(settings, "import-mode"));
+    gboolean hash_content = g_settings_get_boolean(settings, "deduplicate");
+    
+    g_autofree char *bytes = g_format_size(summary.bytes);
+    g_autofree char *import_time = format_import_time(wally_folder_summary_estimate_import_seconds(&summary, mode,
+                                                                                                   hash_content));
+    GString *subtitle = g_string_new(NULL);
+    
+    g_string_append_printf(subtitle, ngettext("%u image, %s", "%u images, %s", summary.images), summary.images, bytes);
+    if (summary.unsupported > 0) {
+        g_string_append(subtitle, ", ");
+        g_string_append_printf(subtitle, ngettext("%u unsupported", "%u unsupported", summary.unsupported),
+                               summary.unsupported);
+    }
+    if (summary.broken > 0) {
+        g_string_append(subtitle, ", ");
+        g_string_append_printf(subtitle, ngettext("%u broken", "%u broken", summary.broken), summary.broken);
+    }
+    g_string_append(subtitle, ", ");
+    g_string_append(subtitle, import_time);
+    
+    if (summary.counting) {
+        g_string_prepend(subtitle, _("Counting: "));
+    } else if (running) {
+        g_string_prepend(subtitle, _("Checking: "));
+    }
+    
+    g_autofree char *text = g_string_free(subtitle, FALSE);
+    adw_action_row_set_subtitle(row, text);
+}
+
+// Polled like the apply progress, so a folder of many small files doesn't
+// flood the main loop with updates
+static gboolean
+update_analysis_progress(gpointer user_data)
+{
+    WallyPreferencesWindow *self = (WallyPreferencesWindow *)user_data;
+    
+    if (self->day_analysis_cancellable) {
+        update_folder_row(self, self->day_folder_row, self->day_analysis, TRUE);
+    }
+    if (self->night_analysis_cancellable) {
+        update_folder_row(self, self->night_folder_row, self->night_analysis, TRUE);
+    }
+    
+    if (!self->day_analysis_cancellable && !self->night_analysis_cancellable) {
+        self->analysis_progress_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+    
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+on_folder_analysis_finished(GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    WallyPreferencesWindow *self = (WallyPreferencesWindow *)user_data;
+    WallyFolderAnalysis *analysis = WALLY_FOLDER_ANALYSIS(source_object);
+    g_autoptr(GError) error = NULL;
+    
+    gboolean success = wally_folder_analysis_run_finish(analysis, result, &error);
+    
+    // Superseded by another folder, or the window was closed
+    gboolean is_day = analysis == self->day_analysis;
+    if (!is_day && analysis != self->night_analysis) {
+        g_object_unref(self);
+        return;
+    }
+    
+    AdwActionRow *row = is_day ? self->day_folder_row : self->night_folder_row;
+    g_clear_object(is_day ? &self->day_analysis_cancellable : &self->night_analysis_cancellable);
+    
+    if (success) {
+        update_folder_row(self, row, analysis, FALSE);
+    } else {
+        g_warning("%s", error->message);
+        adw_action_row_set_subtitle(row, error->message);
+    }
+    
+    g_object_unref(self);
+}
+
+/*
+ * Counts what is in the folder just picked, showing the numbers in its row
+ * as they come in. An analysis still running for the same row is cancelled.
+ */
+static void
+start_folder_analysis(WallyPreferencesWindow *self, gboolean night)
+{
+    WallyFolderAnalysis **analysis = night ? &self->night_analysis : &self->day_analysis;
+    GCancellable **cancellable = night ? &self->night_analysis_cancellable : &self->day_analysis_cancellable;
+    const char *folder_path = night ? self->night_folder_path : self->day_folder_path;
+    
+    if (*cancellable) {
+        g_cancellable_cancel(*cancellable);
+    }
+    g_clear_object(cancellable);
+    g_clear_object(analysis);
+    
+    if (!folder_path) {
+        return;
+    }
+    
+    GSettings *settings = wally_settings_manager_get_settings(self->settings_manager);
+    g_autofree char *dest_folder = wally_apply_job_build_dest_folder(night ? WALLY_APPLY_FOLDER_NIGHT
+                                                                           : WALLY_APPLY_FOLDER_DAY);
+    
+    *analysis = wally_folder_analysis_new(folder_path, dest_folder, g_settings_get_boolean(settings, "scan-recursive"));
+    *cancellable = g_cancellable_new();
+    
+    adw_action_row_set_subtitle(night ? self->night_folder_row : self->day_folder_row, _("Counting images"));
+    if (!self->analysis_progress_id) {
+        self->analysis_progress_id = g_timeout_add(200, update_analysis_progress, self);
+    }
+    
+    wally_folder_analysis_run_async(*analysis, *cancellable, on_folder_analysis_finished, g_object_ref(self));
+}
+
 
 static void
 on_day_folder_button_clicked(GtkButton *button G_GNUC_UNUSED, WallyPreferencesWindow *self)
@@ -52,6 +221,7 @@ on_day_folder_button_clicked(GtkButton *button G_GNUC_UNUSED, WallyPreferencesWi
             // Update button label
             g_autofree char *basename = g_file_get_basename(file);
             gtk_button_set_label(self->day_folder_button, basename);
+            start_folder_analysis(self, FALSE);
             
             gboolean use_same_folder = gtk_switch_get_active(self->same_folder_switch);
             if (use_same_folder) {
@@ -94,6 +264,7 @@ on_night_folder_button_clicked(GtkButton *button G_GNUC_UNUSED, WallyPreferences
             
             g_autofree char *basename = g_file_get_basename(file);
             gtk_button_set_label(self->night_folder_button, basename);
+            start_folder_analysis(self, TRUE);
             
             GSettings *settings = wally_settings_manager_get_settings(self->settings_manager);
             g_settings_set_string(settings, "night-folder-path", self->night_folder_path);
@@ -105,78 +276,194 @@ on_night_folder_button_clicked(GtkButton *button G_GNUC_UNUSED, WallyPreferences
 }
 
 static void
-on_apply_button_clicked(GtkButton *button G_GNUC_UNUSED, WallyPreferencesWindow *self)
+set_apply_running(WallyPreferencesWindow *self, gboolean running)
 {
-    GError *error = NULL;
+    gtk_widget_set_sensitive(GTK_WIDGET(self->apply_button), !running);
+    gtk_widget_set_visible(GTK_WIDGET(self->apply_progress_row), running);
+    gtk_widget_set_sensitive(GTK_WIDGET(self->apply_cancel_button), running);
     
-    if (!self->day_folder_path || !self->night_folder_path) {
-        g_warning("Please select both day and night folders");
-        return;
+    if (running) {
+        gtk_progress_bar_set_fraction(self->apply_progress_bar, 0.0);
+    }
+}
+
+static void
+show_toast(WallyPreferencesWindow *self, const char *message)
+{
+    adw_preferences_window_add_toast(ADW_PREFERENCES_WINDOW(self), adw_toast_new(message));
+}
+
+// Polled from a timer rather than pushed from the worker threads, so the
+// main loop only ever does a little work per frame however fast files go
+static gboolean
+update_apply_progress(gpointer user_data)
+{
+    WallyPreferencesWindow *self = (WallyPreferencesWindow *)user_data;
+    WallyApplyProgress progress;
+    
+    wally_apply_job_get_progress(self->apply_job, &progress);
+    
+    g_autofree char *bytes = g_format_size(progress.bytes_copied);
+    g_autofree char *subtitle = NULL;
+    double fraction = 0.0;
+    
+    switch (progress.stage) {
+    case WALLY_APPLY_STAGE_IMPORTING_DAY:
+    case WALLY_APPLY_STAGE_IMPORTING_NIGHT:
+        subtitle = g_strdup_printf(progress.stage == WALLY_APPLY_STAGE_IMPORTING_DAY
+                                   ? _("Day wallpapers: %u scanned, %u of %u copied (%s)")
+                                   : _("Night wallpapers: %u scanned, %u of %u copied (%s)"),
+                                   progress.files_scanned, progress.files_done,
+                                   progress.files_to_copy, bytes);
+        if (progress.files_to_copy > 0) {
+            fraction = (double)progress.files_done / progress.files_to_copy;
+        }
+        break;
+    case WALLY_APPLY_STAGE_SCALING:
+        subtitle = g_strdup_printf(_("Downscaling: %u of %u images checked"),
+                                   progress.files_done, progress.files_to_copy);
+        if (progress.files_to_copy > 0) {
+            fraction = (double)progress.files_done / progress.files_to_copy;
+        }
+        break;
+    case WALLY_APPLY_STAGE_WRITING_XML:
+        subtitle = g_strdup_printf(_("Writing slideshows: %u of 2 written"), progress.xml_written);
+        fraction = progress.xml_written / 2.0;
+        break;
+    case WALLY_APPLY_STAGE_APPLYING:
+    case WALLY_APPLY_STAGE_DONE:
+        subtitle = g_strdup(_("Applying wallpapers"));
+        fraction = 1.0;
+        break;
+    case WALLY_APPLY_STAGE_PENDING:
+    default:
+        subtitle = g_strdup(_("Starting"));
+        break;
     }
     
-    // Create Wally directories
-    g_autofree char *wally_dir = g_build_filename(g_get_home_dir(), "Pictures", "Wally", NULL);
-    g_autofree char *day_dest = g_build_filename(wally_dir, "DayWallpapers", NULL);
-    g_autofree char *night_dest = g_build_filename(wally_dir, "NightWallpapers", NULL);
+    adw_action_row_set_subtitle(self->apply_progress_row, subtitle);
+    gtk_progress_bar_set_fraction(self->apply_progress_bar, fraction);
     
-    // Copy wallpapers
-    if (!wally_slideshow_manager_copy_wallpapers(self->slideshow_manager, 
-                                                 self->day_folder_path, day_dest, &error)) {
-        g_warning("Failed to copy day wallpapers: %s", error->message);
-        g_error_free(error);
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+handle_apply_result(WallyPreferencesWindow *self, WallyApplyJob *job, GAsyncResult *result)
+{
+    GError *error = NULL;
+    
+    gboolean success = wally_apply_job_run_finish(job, result, &error);
+    
+    // The window was closed while the job ran; nothing left to update
+    if (self->apply_job != job) {
+        g_clear_error(&error);
         return;
     }
     
-    if (!wally_slideshow_manager_copy_wallpapers(self->slideshow_manager, 
-                                                 self->night_folder_path, night_dest, &error)) {
-        g_warning("Failed to copy night wallpapers: %s", error->message);
+    g_clear_handle_id(&self->apply_progress_id, g_source_remove);
+    g_clear_object(&self->apply_cancellable);
+    set_apply_running(self, FALSE);
+    
+    if (!success) {
+        if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            show_toast(self, _("Apply cancelled"));
+        } else {
+            g_warning("%s", error->message);
+            show_toast(self, error->message);
+        }
         g_error_free(error);
+        g_clear_object(&self->apply_job);
         return;
     }
     
-    // Get settings
+    const WallySyncStats *day_stats = wally_apply_job_get_day_stats(job);
+    const WallySyncStats *night_stats = wally_apply_job_get_night_stats(job);
+    g_debug("Day wallpapers: %u copied, %u skipped, %u deleted, %u failed, %u duplicates, %u rejected",
+            day_stats->copied.load(), day_stats->skipped.load(),
+            day_stats->deleted.load(), day_stats->failed.load(),
+            day_stats->duplicates.load(), day_stats->rejected.load());
+    g_debug("Night wallpapers: %u copied, %u skipped, %u deleted, %u failed, %u duplicates, %u rejected",
+            night_stats->copied.load(), night_stats->skipped.load(),
+            night_stats->deleted.load(), night_stats->failed.load(),
+            night_stats->duplicates.load(), night_stats->rejected.load());
+    g_debug("Background settings writes: %u", wally_apply_job_get_background_writes(job));
+    guint duplicates = day_stats->duplicates + night_stats->duplicates;
+    
+    g_clear_object(&self->apply_job);
+    
+    // Mark slideshow as enabled
     GSettings *settings = wally_settings_manager_get_settings(self->settings_manager);
-    int interval_minutes = (int)gtk_spin_button_get_value(self->interval_spin);
-    int interval = interval_minutes * 60; // Convert minutes to seconds
-    double transition = g_settings_get_double(settings, "transition-duration");
+    g_settings_set_boolean(settings, "slideshow-enabled", TRUE);
+    
+    g_print("Wallpaper settings applied successfully!\n");
+    if (duplicates > 0) {
+        g_autofree char *message = g_strdup_printf(ngettext("Wallpaper settings applied; %u duplicate image found",
+                                                            "Wallpaper settings applied; %u duplicate images found",
+                                                            duplicates),
+                                                   duplicates);
+        show_toast(self, message);
+    } else {
+        show_toast(self, _("Wallpaper settings applied"));
+    }
+}
+
+static void
+on_apply_job_finished(GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    WallyPreferencesWindow *self = (WallyPreferencesWindow *)user_data;
     
-    // Create slideshow XML files
-    g_autofree char *day_xml = g_build_filename(wally_dir, "day-slideshow.xml", NULL);
-    g_autofree char *night_xml = g_build_filename(wally_dir, "night-slideshow.xml", NULL);
+    handle_apply_result(self, WALLY_APPLY_JOB(source_object), result);
     
-    if (!wally_slideshow_manager_create_slideshow_xml(self->slideshow_manager,
-                                                      day_dest, day_xml, interval, transition, &error)) {
-        g_warning("Failed to create day slideshow: %s", error->message);
-        g_error_free(error);
+    // Drop the reference taken when the job was started
+    g_object_unref(self);
+}
+
+static void
+on_apply_button_clicked(GtkButton *button G_GNUC_UNUSED, WallyPreferencesWindow *self)
+{
+    if (!self->day_folder_path || !self->night_folder_path) {
+        g_warning("Please select both day and night folders");
         return;
     }
     
-    if (!wally_slideshow_manager_create_slideshow_xml(self->slideshow_manager,
-                                                      night_dest, night_xml, interval, transition, &error)) {
-        g_warning("Failed to create night slideshow: %s", error->message);
-        g_error_free(error);
+    if (self->apply_job) {
         return;
     }
     
-    // Apply wallpapers
-    // gboolean is_dark = wally_settings_manager_is_dark_theme(self->settings_manager);
+    // Get settings
+    GSettings *settings = wally_settings_manager_get_settings(self->settings_manager);
+    wally_slideshow_manager_load_settings(self->slideshow_manager, settings);
     
-    if (!wally_slideshow_manager_apply_wallpaper(self->slideshow_manager, day_xml, FALSE, &error)) {
-        g_warning("Failed to apply day wallpaper: %s", error->message);
-        g_error_free(error);
-        return;
-    }
+    int scale_width;
+    int scale_height;
+    wally_settings_manager_get_scale_target(self->settings_manager, &scale_width, &scale_height);
+    wally_slideshow_manager_set_scale_target(self->slideshow_manager, scale_width, scale_height);
     
-    if (!wally_slideshow_manager_apply_wallpaper(self->slideshow_manager, night_xml, TRUE, &error)) {
-        g_warning("Failed to apply night wallpaper: %s", error->message);
-        g_error_free(error);
-        return;
-    }
+    int interval_minutes = (int)gtk_spin_button_get_value(self->interval_spin);
+    int interval = interval_minutes * 60; // Convert minutes to seconds
+    double transition = g_settings_get_double(settings, "transition-duration");
     
-    // Mark slideshow as enabled
-    g_settings_set_boolean(settings, "slideshow-enabled", TRUE);
+    // Import, write the slideshows and apply them off the main thread
+    self->apply_job = wally_apply_job_new(self->slideshow_manager,
+                                          self->day_folder_path, self->night_folder_path,
+                                          interval, transition);
+    self->apply_cancellable = g_cancellable_new();
     
-    g_print("Wallpaper settings applied successfully!\n");
+    set_apply_running(self, TRUE);
+    update_apply_progress(self);
+    self->apply_progress_id = g_timeout_add(100, update_apply_progress, self);
+    
+    wally_apply_job_run_async(self->apply_job, self->apply_cancellable,
+                              on_apply_job_finished, g_object_ref(self));
+}
+
+static void
+on_apply_cancel_button_clicked(GtkButton *button G_GNUC_UNUSED, WallyPreferencesWindow *self)
+{
+    if (self->apply_cancellable) {
+        g_cancellable_cancel(self->apply_cancellable);
+        gtk_widget_set_sensitive(GTK_WIDGET(self->apply_cancel_button), FALSE);
+    }
 }
 
 static void
@@ -186,6 +473,7 @@ on_same_folder_switch_toggled(GtkSwitch *switch_widget G_GNUC_UNUSED, GParamSpec
     
     // Show/hide night folder row based on switch state
     gtk_widget_set_visible(GTK_WIDGET(self->night_folder_row), !use_same_folder);
+    gtk_widget_set_visible(GTK_WIDGET(self->auto_classify_switch), use_same_folder);
     
     // If using same folder, copy day folder path to night folder path
     if (use_same_folder && self->day_folder_path) {
@@ -201,6 +489,25 @@ on_same_folder_switch_toggled(GtkSwitch *switch_widget G_GNUC_UNUSED, GParamSpec
         GSettings *settings = wally_settings_manager_get_settings(self->settings_manager);
         g_settings_set_string(settings, "night-folder-path", self->night_folder_path);
     }
+    
+    // The night row shows again, so count what its own folder holds
+    if (!use_same_folder) {
+        start_folder_analysis(self, TRUE);
+    }
+}
+
+static void
+on_preview_row_activated(AdwActionRow *row G_GNUC_UNUSED, WallyPreferencesWindow *self)
+{
+    GSettings *settings = wally_settings_manager_get_settings(self->settings_manager);
+    gboolean use_same_folder = gtk_switch_get_active(self->same_folder_switch);
+    
+    WallyPreviewWindow *preview = wally_preview_window_new(self->day_folder_path,
+                                                           use_same_folder ? self->day_folder_path
+                                                                           : self->night_folder_path,
+                                                           g_settings_get_boolean(settings, "scan-recursive"));
+    gtk_window_set_transient_for(GTK_WINDOW(preview), GTK_WINDOW(self));
+    gtk_window_present(GTK_WINDOW(preview));
 }
 
 
@@ -212,16 +519,26 @@ on_theme_changed(GSettings *settings G_GNUC_UNUSED, const char *key, WallyPrefer
         gboolean auto_mode = g_settings_get_boolean(app_settings, "auto-night-mode");
         gboolean slideshow_enabled = g_settings_get_boolean(app_settings, "slideshow-enabled");
         
-        if (auto_mode && slideshow_enabled) {
+        // The scheduler follows the theme itself; handing GNOME the slideshow
+        // here would replace the picture it set
+        wally_slideshow_manager_load_settings(self->slideshow_manager, app_settings);
+        if (auto_mode && slideshow_enabled && !wally_slideshow_manager_get_scheduled(self->slideshow_manager)) {
             gboolean is_dark = wally_settings_manager_is_dark_theme(self->settings_manager);
             
-            g_autofree char *wally_dir = g_build_filename(g_get_home_dir(), "Pictures", "Wally", NULL);
-            g_autofree char *xml_file = g_build_filename(wally_dir, 
-                                                         is_dark ? "night-slideshow.xml" : "day-slideshow.xml", NULL);
+            g_autofree char *xml_file = wally_apply_job_build_xml_path(is_dark ? WALLY_APPLY_FOLDER_NIGHT
+                                                                               : WALLY_APPLY_FOLDER_DAY);
             
             GError *error = NULL;
             if (g_file_test(xml_file, G_FILE_TEST_EXISTS)) {
+                WallyTraceRun *run = wally_trace_run_begin("theme-change");
+                wally_trace_run_set_current(run);
+                
+                g_auto(WallyTraceSpan) span = {NULL, 0};
+                wally_trace_span_begin(&span, "gsettings-apply");
                 wally_slideshow_manager_apply_wallpaper(self->slideshow_manager, xml_file, is_dark, &error);
+                wally_trace_span_end(&span, 1, 0);
+                
+                wally_trace_run_end(run, error == NULL);
                 if (error) {
                     g_warning("Failed to switch wallpaper theme: %s", error->message);
                     g_error_free(error);
@@ -252,6 +569,11 @@ load_settings(WallyPreferencesWindow *self)
         gtk_button_set_label(self->night_folder_button, basename);
     }
     
+    start_folder_analysis(self, FALSE);
+    if (!g_settings_get_boolean(settings, "use-same-folder")) {
+        start_folder_analysis(self, TRUE);
+    }
+    
     // Load other settings
     gboolean auto_night = g_settings_get_boolean(settings, "auto-night-mode");
     adw_switch_row_set_active(self->auto_night_mode_switch, auto_night);
@@ -262,6 +584,9 @@ load_settings(WallyPreferencesWindow *self)
     
     double transition = g_settings_get_double(settings, "transition-duration");
     gtk_range_set_value(GTK_RANGE(self->transition_scale), transition);
+    
+    // Combo row positions follow the order of the import-mode enum
+    adw_combo_row_set_selected(self->import_mode_row, g_settings_get_enum(settings, "import-mode"));
 }
 
 static void
@@ -269,6 +594,21 @@ wally_preferences_window_dispose(GObject *object)
 {
     WallyPreferencesWindow *self = (WallyPreferencesWindow *)object;
     
+    if (self->apply_cancellable) {
+        g_cancellable_cancel(self->apply_cancellable);
+    }
+    g_clear_handle_id(&self->apply_progress_id, g_source_remove);
+    g_clear_object(&self->apply_cancellable);
+    g_clear_object(&self->apply_job);
+    
+    g_cancellable_cancel(self->day_analysis_cancellable);
+    g_cancellable_cancel(self->night_analysis_cancellable);
+    g_clear_handle_id(&self->analysis_progress_id, g_source_remove);
+    g_clear_object(&self->day_analysis_cancellable);
+    g_clear_object(&self->night_analysis_cancellable);
+    g_clear_object(&self->day_analysis);
+    g_clear_object(&self->night_analysis);
+    
     g_clear_object(&self->settings_manager);
     g_clear_object(&self->slideshow_manager);
     g_clear_pointer(&self->day_folder_path, g_free);
@@ -289,10 +629,24 @@ wally_preferences_window_class_init(WallyPreferencesWindowClass *klass)
     
     gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, day_folder_button);
     gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, night_folder_button);
+    gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, day_folder_row);
     gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, apply_button);
+    gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, apply_progress_row);
+    gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, apply_progress_bar);
+    gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, apply_cancel_button);
     gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, same_folder_switch);
     gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, night_folder_row);
+    gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, auto_classify_switch);
+    gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, preview_row);
     gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, auto_night_mode_switch);
+    gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, scan_recursive_switch);
+    gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, deduplicate_switch);
+    gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, shuffle_switch);
+    gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, watch_folders_switch);
+    gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, scheduler_switch);
+    gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, prescale_switch);
+    gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, transcode_switch);
+    gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, import_mode_row);
     gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, interval_spin);
     gtk_widget_class_bind_template_child(widget_class, WallyPreferencesWindow, transition_scale);
 }
@@ -310,7 +664,9 @@ wally_preferences_window_init(WallyPreferencesWindow *self)
     g_signal_connect(self->day_folder_button, "clicked", G_CALLBACK(on_day_folder_button_clicked), self);
     g_signal_connect(self->night_folder_button, "clicked", G_CALLBACK(on_night_folder_button_clicked), self);
     g_signal_connect(self->apply_button, "clicked", G_CALLBACK(on_apply_button_clicked), self);
+    g_signal_connect(self->apply_cancel_button, "clicked", G_CALLBACK(on_apply_cancel_button_clicked), self);
     g_signal_connect(self->same_folder_switch, "notify::active", G_CALLBACK(on_same_folder_switch_toggled), self);
+    g_signal_connect(self->preview_row, "activated", G_CALLBACK(on_preview_row_activated), self);
     
     // Bind settings to UI elements
     GSettings *settings = wally_settings_manager_get_settings(self->settings_manager);
@@ -327,6 +683,38 @@ wally_preferences_window_init(WallyPreferencesWindow *self)
                     self->same_folder_switch, "active",
                     G_SETTINGS_BIND_DEFAULT);
     
+    g_settings_bind(settings, "auto-classify",
+                    self->auto_classify_switch, "active",
+                    G_SETTINGS_BIND_DEFAULT);
+    
+    g_settings_bind(settings, "scan-recursive",
+                    self->scan_recursive_switch, "active",
+                    G_SETTINGS_BIND_DEFAULT);
+    
+    g_settings_bind(settings, "shuffle",
+                    self->shuffle_switch, "active",
+                    G_SETTINGS_BIND_DEFAULT);
+    
+    g_settings_bind(settings, "deduplicate",
+                    self->deduplicate_switch, "active",
+                    G_SETTINGS_BIND_DEFAULT);
+    
+    g_settings_bind(settings, "watch-folders",
+                    self->watch_folders_switch, "active",
+                    G_SETTINGS_BIND_DEFAULT);
+    
+    g_settings_bind(settings, "use-scheduler",
+                    self->scheduler_switch, "active",
+                    G_SETTINGS_BIND_DEFAULT);
+    
+    g_settings_bind(settings, "prescale",
+                    self->prescale_switch, "active",
+                    G_SETTINGS_BIND_DEFAULT);
+    
+    g_settings_bind(settings, "transcode",
+                    self->transcode_switch, "active",
+                    G_SETTINGS_BIND_DEFAULT);
+    
     // Connect interval spin button to save settings when changed
     g_signal_connect(self->interval_spin, "value-changed",
                      G_CALLBACK(+[](GtkSpinButton *spin, gpointer user_data) {
@@ -336,6 +724,13 @@ wally_preferences_window_init(WallyPreferencesWindow *self)
                          g_settings_set_int(settings, "slideshow-interval", minutes * 60);
                      }), self);
     
+    g_signal_connect(self->import_mode_row, "notify::selected",
+                     G_CALLBACK(+[](AdwComboRow *row, GParamSpec *pspec G_GNUC_UNUSED, gpointer user_data) {
+                         WallyPreferencesWindow *self = (WallyPreferencesWindow *)user_data;
+                         GSettings *settings = wally_settings_manager_get_settings(self->settings_manager);
+                         g_settings_set_enum(settings, "import-mode", adw_combo_row_get_selected(row));
+                     }), self);
+    
     // Monitor theme changes
     wally_settings_manager_monitor_theme_changes(self->settings_manager,
                                                  G_CALLBACK(on_theme_changed), self);
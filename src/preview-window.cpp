@@ -0,0 +1,268 @@
+#include "preview-window.h"
+#include "directory-scanner.h"
+#include "thumbnail-loader.h"
+#include "config.h"
+
+#include <glib/gi18n.h>
+
+#define TILE_WIDTH 160
+#define TILE_HEIGHT 100
+
+struct _WallyPreviewWindow
+{
+    AdwWindow parent_instance;
+    
+    AdwViewStack *view_stack;
+    
+    GCancellable *cancellable;
+};
+
+G_DEFINE_FINAL_TYPE(WallyPreviewWindow, wally_preview_window, ADW_TYPE_WINDOW)
+
+// What a folder scan fills in once it is done
+typedef struct
+{
+    char *folder;
+    gboolean recursive;
+    GtkStack *stack;
+    GtkGridView *grid;
+    AdwStatusPage *status;
+} FolderScan;
+
+static void
+folder_scan_free(gpointer data)
+{
+    FolderScan *scan = static_cast<FolderScan*>(data);
+    
+    g_free(scan->folder);
+    g_object_unref(scan->stack);
+    g_object_unref(scan->grid);
+    g_object_unref(scan->status);
+    g_free(scan);
+}
+
+static void
+wally_preview_window_dispose(GObject *object)
+{
+    WallyPreviewWindow *self = WALLY_PREVIEW_WINDOW(object);
+    
+    // Scans still running report back to nobody
+    if (self->cancellable != NULL) {
+        g_cancellable_cancel(self->cancellable);
+    }
+    g_clear_object(&self->cancellable);
+    
+    G_OBJECT_CLASS(wally_preview_window_parent_class)->dispose(object);
+}
+
+static void
+wally_preview_window_class_init(WallyPreviewWindowClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    GtkWidgetClass *widget_class = GTK_WIDGET_CLASS(klass);
+    
+    object_class->dispose = wally_preview_window_dispose;
+    
+    gtk_widget_class_set_template_from_resource(widget_class, "/com/qomarhsn/wally/ui/preview-window.ui");
+    gtk_widget_class_bind_template_child(widget_class, WallyPreviewWindow, view_stack);
+}
+
+static void
+wally_preview_window_init(WallyPreviewWindow *self)
+{
+    gtk_widget_init_template(GTK_WIDGET(self));
+    
+    self->cancellable = g_cancellable_new();
+}
+
+static void
+on_thumbnail_loaded(GObject *source,
+                    GAsyncResult *result,
+                    gpointer user_data)
+{
+    g_autoptr(GtkPicture) picture = GTK_PICTURE(user_data);
+    GError *error = NULL;
+    
+    g_autoptr(GdkTexture) texture = wally_thumbnail_loader_load_finish(WALLY_THUMBNAIL_LOADER(source), result, &error);
+    if (texture == NULL) {
+        // Cancelled means the tile shows another image by now
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_debug("No thumbnail: %s", error->message);
+            gtk_picture_set_paintable(picture, NULL);
+        }
+        g_error_free(error);
+        return;
+    }
+    
+    gtk_picture_set_paintable(picture, GDK_PAINTABLE(texture));
+}
+
+static void
+setup_tile(GtkSignalListItemFactory *factory G_GNUC_UNUSED,
+           GtkListItem *item,
+           gpointer user_data G_GNUC_UNUSED)
+{
+    GtkWidget *picture = gtk_picture_new();
+    gtk_picture_set_content_fit(GTK_PICTURE(picture), GTK_CONTENT_FIT_COVER);
+    gtk_widget_set_size_request(picture, TILE_WIDTH, TILE_HEIGHT);
+    gtk_widget_set_overflow(picture, GTK_OVERFLOW_HIDDEN);
+    gtk_widget_add_css_class(picture, "card");
+    
+    gtk_list_item_set_child(item, picture);
+}
+
+static void
+bind_tile(GtkSignalListItemFactory *factory G_GNUC_UNUSED,
+          GtkListItem *item,
+          gpointer user_data G_GNUC_UNUSED)
+{
+    GtkPicture *picture = GTK_PICTURE(gtk_list_item_get_child(item));
+    const char *path = gtk_string_object_get_string(GTK_STRING_OBJECT(gtk_list_item_get_item(item)));
+    
+    g_autofree char *basename = g_path_get_basename(path);
+    gtk_widget_set_tooltip_text(GTK_WIDGET(picture), basename);
+    
+    WallyThumbnailLoader *loader = wally_thumbnail_loader_get_default();
+    g_autoptr(GdkTexture) texture = wally_thumbnail_loader_lookup(loader, path);
+    gtk_picture_set_paintable(picture, texture != NULL ? GDK_PAINTABLE(texture) : NULL);
+    if (texture != NULL) {
+        return;
+    }
+    
+    // Cancelled when the tile is recycled for another image
+    GCancellable *cancellable = g_cancellable_new();
+    g_object_set_data_full(G_OBJECT(item), "thumbnail-cancellable", cancellable, g_object_unref);
+    wally_thumbnail_loader_load_async(loader, path, cancellable, on_thumbnail_loaded, g_object_ref(picture));
+}
+
+static void
+unbind_tile(GtkSignalListItemFactory *factory G_GNUC_UNUSED,
+            GtkListItem *item,
+            gpointer user_data G_GNUC_UNUSED)
+{
+    GCancellable *cancellable = G_CANCELLABLE(g_object_get_data(G_OBJECT(item), "thumbnail-cancellable"));
+    if (cancellable != NULL) {
+        g_cancellable_cancel(cancellable);
+        g_object_set_data(G_OBJECT(item), "thumbnail-cancellable", NULL);
+    }
+}
+
+// Runs on a worker thread
+static void
+scan_folder_thread(GTask *task,
+                   gpointer source_object G_GNUC_UNUSED,
+                   gpointer task_data,
+                   GCancellable *cancellable G_GNUC_UNUSED)
+{
+    FolderScan *scan = static_cast<FolderScan*>(task_data);
+    std::vector<std::string> files = wally_directory_scanner_scan(wally_directory_scanner_get_default(),
+                                                                  scan->folder, scan->recursive);
+    
+    char **paths = g_new(char*, files.size() + 1);
+    for (gsize i = 0; i < files.size(); i++) {
+        paths[i] = g_build_filename(scan->folder, files[i].c_str(), NULL);
+    }
+    paths[files.size()] = NULL;
+    
+    g_task_return_pointer(task, paths, (GDestroyNotify)g_strfreev);
+}
+
+static void
+on_folder_scanned(GObject *source G_GNUC_UNUSED,
+                  GAsyncResult *result,
+                  gpointer user_data G_GNUC_UNUSED)
+{
+    GTask *task = G_TASK(result);
+    FolderScan *scan = static_cast<FolderScan*>(g_task_get_task_data(task));
+    GError *error = NULL;
+    
+    g_auto(GStrv) paths = static_cast<char**>(g_task_propagate_pointer(task, &error));
+    if (paths == NULL) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            adw_status_page_set_description(scan->status, error->message);
+            gtk_stack_set_visible_child_name(scan->stack, "empty");
+        }
+        g_error_free(error);
+        return;
+    }
+    
+    if (paths[0] == NULL) {
+        gtk_stack_set_visible_child_name(scan->stack, "empty");
+        return;
+    }
+    
+    // The list holds the paths; items and tiles are only made for what is shown.
+    // The selection takes the list, and the grid takes its own reference.
+    g_autoptr(GtkNoSelection) selection = gtk_no_selection_new(G_LIST_MODEL(gtk_string_list_new(paths)));
+    gtk_grid_view_set_model(scan->grid, GTK_SELECTION_MODEL(selection));
+    gtk_stack_set_visible_child_name(scan->stack, "grid");
+}
+
+static void
+add_folder_page(WallyPreviewWindow *self,
+                const char *name,
+                const char *title,
+                const char *icon_name,
+                const char *folder,
+                gboolean recursive)
+{
+    GtkWidget *stack = gtk_stack_new();
+    
+    GtkWidget *spinner = gtk_spinner_new();
+    gtk_spinner_set_spinning(GTK_SPINNER(spinner), TRUE);
+    gtk_widget_set_halign(spinner, GTK_ALIGN_CENTER);
+    gtk_widget_set_valign(spinner, GTK_ALIGN_CENTER);
+    gtk_stack_add_named(GTK_STACK(stack), spinner, "loading");
+    
+    GtkWidget *status = adw_status_page_new();
+    adw_status_page_set_icon_name(ADW_STATUS_PAGE(status), "image-missing-symbolic");
+    adw_status_page_set_title(ADW_STATUS_PAGE(status), _("No Wallpapers"));
+    gtk_stack_add_named(GTK_STACK(stack), status, "empty");
+    
+    GtkListItemFactory *factory = gtk_signal_list_item_factory_new();
+    g_signal_connect(factory, "setup", G_CALLBACK(setup_tile), NULL);
+    g_signal_connect(factory, "bind", G_CALLBACK(bind_tile), NULL);
+    g_signal_connect(factory, "unbind", G_CALLBACK(unbind_tile), NULL);
+    
+    GtkWidget *grid = gtk_grid_view_new(NULL, factory);
+    gtk_grid_view_set_max_columns(GTK_GRID_VIEW(grid), 8);
+    
+    GtkWidget *scrolled = gtk_scrolled_window_new();
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scrolled), grid);
+    gtk_stack_add_named(GTK_STACK(stack), scrolled, "grid");
+    
+    adw_view_stack_add_titled_with_icon(self->view_stack, stack, name, title, icon_name);
+    
+    if (folder == NULL || folder[0] == '\0') {
+        adw_status_page_set_description(ADW_STATUS_PAGE(status), _("No folder chosen"));
+        gtk_stack_set_visible_child_name(GTK_STACK(stack), "empty");
+        return;
+    }
+    
+    gtk_stack_set_visible_child_name(GTK_STACK(stack), "loading");
+    
+    FolderScan *scan = g_new0(FolderScan, 1);
+    scan->folder = g_strdup(folder);
+    scan->recursive = recursive;
+    scan->stack = GTK_STACK(g_object_ref(stack));
+    scan->grid = GTK_GRID_VIEW(g_object_ref(grid));
+    scan->status = ADW_STATUS_PAGE(g_object_ref(status));
+    
+    g_autoptr(GTask) task = g_task_new(self, self->cancellable, on_folder_scanned, NULL);
+    g_task_set_task_data(task, scan, folder_scan_free);
+    g_task_run_in_thread(task, scan_folder_thread);
+}
+
+WallyPreviewWindow *
+wally_preview_window_new(const char *day_folder,
+                         const char *night_folder,
+                         gboolean recursive)
+{
+    WallyPreviewWindow *self = static_cast<WallyPreviewWindow*>(g_object_new(WALLY_TYPE_PREVIEW_WINDOW, NULL));
+    
+    add_folder_page(self, "day", _("Day"), "weather-clear-symbolic", day_folder, recursive);
+    add_folder_page(self, "night", _("Night"), "weather-clear-night-symbolic", night_folder, recursive);
+    
+    return self;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <adwaita.h>
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+#define WALLY_TYPE_PREVIEW_WINDOW (wally_preview_window_get_type())
+
+G_DECLARE_FINAL_TYPE(WallyPreviewWindow, wally_preview_window, WALLY, PREVIEW_WINDOW, AdwWindow)
+
+/*
+ * Shows the images of the day and night folders as a grid of thumbnails.
+ * Only the rows on screen have widgets and only their thumbnails are
+ * decoded, so folders of any size scroll the same.
+ */
+WallyPreviewWindow *wally_preview_window_new(const char *day_folder,
+                                             const char *night_folder,
+                                             gboolean recursive);
+
+G_END_DECLS
@@ -0,0 +1,128 @@
+#include "scaled-cache.h"
+#include "content-hash.h"
+#include "image-probe.h"
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <glib/gstdio.h>
+#include <math.h>
+#include <string.h>
+
+char *
+wally_scaled_cache_get_default_dir(void)
+{
+    return g_build_filename(g_get_user_cache_dir(), "wally", "scaled", NULL);
+}
+
+// Formats that may carry transparency are kept lossless
+static gboolean
+wants_png(const std::string& path)
+{
+    const char *extension = strrchr(path.c_str(), '.');
+    if (extension == NULL) {
+        return TRUE;
+    }
+    
+    return g_ascii_strcasecmp(extension, ".jpg") != 0 &&
+           g_ascii_strcasecmp(extension, ".jpeg") != 0 &&
+           g_ascii_strcasecmp(extension, ".bmp") != 0;
+}
+
+std::string
+wally_scaled_cache_get_path(const char *cache_dir,
+                            const WallyManifestEntry& entry,
+                            int width,
+                            int height)
+{
+    g_return_val_if_fail(cache_dir != NULL, "");
+    
+    // The content hash names the image best; without one, the imported file
+    // and the source's size and mtime do
+    guint64 key = entry.hash;
+    if (key == 0) {
+        g_autofree char *identity = g_strdup_printf("%s\n%" G_GUINT64_FORMAT "\n%" G_GINT64_FORMAT,
+                                                    entry.target.c_str(), entry.size, entry.mtime_ns);
+        key = wally_hash_data(identity, strlen(identity));
+    }
+    
+    g_autofree char *filename = g_strdup_printf("%016" G_GINT64_MODIFIER "x-%dx%d.%s", key, width, height,
+                                                wants_png(entry.target) ? "png" : "jpg");
+    
+    g_autofree char *path = g_build_filename(cache_dir, filename, NULL);
+    return path;
+}
+
+gboolean
+wally_scaled_cache_build(const char *source_path,
+                         const char *cache_path,
+                         int width,
+                         int height,
+                         WallyScaleResult *result,
+                         GError **error)
+{
+    g_return_val_if_fail(source_path != NULL, FALSE);
+    g_return_val_if_fail(cache_path != NULL, FALSE);
+    g_return_val_if_fail(width > 0 && height > 0, FALSE);
+    g_return_val_if_fail(result != NULL, FALSE);
+    
+    if (g_file_test(cache_path, G_FILE_TEST_EXISTS)) {
+        *result = WALLY_SCALE_RESULT_CACHED;
+        return TRUE;
+    }
+    
+    WallyImageInfo info;
+    if (!wally_image_probe_file(source_path, &info, error)) {
+        return FALSE;
+    }
+    
+    // Vector images are drawn at whatever size the screen is
+    if (info.format == WALLY_IMAGE_FORMAT_SVG) {
+        *result = WALLY_SCALE_RESULT_NOT_NEEDED;
+        return TRUE;
+    }
+    
+    // The shell zooms wallpapers to cover the screen, so the image has to stay
+    // at least that large the way up it is shown
+    guint32 shown_width = 0;
+    guint32 shown_height = 0;
+    wally_image_info_get_display_size(&info, &shown_width, &shown_height);
+    
+    double scale = MAX((double)width / shown_width, (double)height / shown_height);
+    if (scale >= 1.0) {
+        *result = WALLY_SCALE_RESULT_NOT_NEEDED;
+        return TRUE;
+    }
+    
+    // Decoding happens the way the image is stored, before it is turned
+    int scaled_width = (int)ceil(info.width * scale);
+    int scaled_height = (int)ceil(info.height * scale);
+    
+    // Loaders that can (JPEG) decode straight at the reduced size
+    g_autoptr(GdkPixbuf) pixbuf = gdk_pixbuf_new_from_file_at_scale(source_path, scaled_width, scaled_height,
+                                                                    TRUE, error);
+    if (pixbuf == NULL) {
+        return FALSE;
+    }
+    
+    g_autoptr(GdkPixbuf) oriented = gdk_pixbuf_apply_embedded_orientation(pixbuf);
+    
+    g_autofree char *cache_dir = g_path_get_dirname(cache_path);
+    g_mkdir_with_parents(cache_dir, 0755);
+    
+    g_autofree char *partial_path = g_strconcat(cache_path, ".part", NULL);
+    gboolean saved = g_str_has_suffix(cache_path, ".png")
+                     ? gdk_pixbuf_save(oriented, partial_path, "png", error, NULL)
+                     : gdk_pixbuf_save(oriented, partial_path, "jpeg", error, "quality", "92", NULL);
+    
+    if (!saved || g_rename(partial_path, cache_path) != 0) {
+        if (saved) {
+            int saved_errno = errno;
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved_errno),
+                        "Failed to write %s: %s", cache_path, g_strerror(saved_errno));
+        }
+        g_unlink(partial_path);
+        return FALSE;
+    }
+    
+    *result = WALLY_SCALE_RESULT_SCALED;
+    return TRUE;
+}
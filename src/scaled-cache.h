@@ -0,0 +1,38 @@
+#pragma once
+
+#include "sync-manifest.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <string>
+
+G_BEGIN_DECLS
+
+/*
+ * Copies of imported wallpapers downscaled to the screen, so the shell
+ * doesn't decode and keep full-size camera images around. A copy is named
+ * after the manifest entry it was made from and the target size; when either
+ * changes the old copy simply stops being used.
+ */
+typedef enum
+{
+    WALLY_SCALE_RESULT_SCALED,
+    WALLY_SCALE_RESULT_CACHED,
+    WALLY_SCALE_RESULT_NOT_NEEDED,
+} WallyScaleResult;
+
+char *wally_scaled_cache_get_default_dir(void);
+
+std::string wally_scaled_cache_get_path(const char *cache_dir,
+                                        const WallyManifestEntry& entry,
+                                        int width,
+                                        int height);
+
+gboolean wally_scaled_cache_build(const char *source_path,
+                                  const char *cache_path,
+                                  int width,
+                                  int height,
+                                  WallyScaleResult *result,
+                                  GError **error);
+
+G_END_DECLS
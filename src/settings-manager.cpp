@@ -2,6 +2,7 @@
 #include "config.h"
 
 #include <glib/gi18n.h>
+#include <gtk/gtk.h>
 
 struct _WallySettingsManager
 {
@@ -67,6 +68,75 @@ wally_settings_manager_is_dark_theme(WallySettingsManager *self)
     return g_strcmp0(color_scheme, "prefer-dark") == 0;
 }
 
+/*
+ * The size wallpapers get downscaled to: the prescale-width/height keys, or
+ * the largest connected screen in device pixels when those are unset. Both
+ * are 0 when prescaling is off.
+ *
+ * The screen size is remembered, so command-line runs without a display
+ * scale to the same size as the window did.
+ */
+void
+wally_settings_manager_get_scale_target(WallySettingsManager *self,
+                                        int *width,
+                                        int *height)
+{
+    g_return_if_fail(WALLY_IS_SETTINGS_MANAGER(self));
+    g_return_if_fail(width != NULL && height != NULL);
+    
+    *width = 0;
+    *height = 0;
+    
+    if (!g_settings_get_boolean(self->app_settings, "prescale")) {
+        return;
+    }
+    
+    *width = g_settings_get_int(self->app_settings, "prescale-width");
+    *height = g_settings_get_int(self->app_settings, "prescale-height");
+    if (*width > 0 && *height > 0) {
+        return;
+    }
+    
+    int saved_width = 0;
+    int saved_height = 0;
+    g_settings_get(self->app_settings, "screen-size", "(ii)", &saved_width, &saved_height);
+    
+    *width = saved_width;
+    *height = saved_height;
+    
+    // gdk_display_get_default() is NULL until GTK is initialized
+    GdkDisplay *display = gdk_display_get_default();
+    if (display == NULL) {
+        return;
+    }
+    
+    *width = 0;
+    *height = 0;
+    
+    GListModel *monitors = gdk_display_get_monitors(display);
+    for (guint i = 0; i < g_list_model_get_n_items(monitors); i++) {
+        g_autoptr(GdkMonitor) monitor = GDK_MONITOR(g_list_model_get_item(monitors, i));
+        GdkRectangle geometry;
+        gdk_monitor_get_geometry(monitor, &geometry);
+        
+        int scale = gdk_monitor_get_scale_factor(monitor);
+        int monitor_width = geometry.width * scale;
+        int monitor_height = geometry.height * scale;
+        
+        if ((gint64)monitor_width * monitor_height > (gint64)*width * *height) {
+            *width = monitor_width;
+            *height = monitor_height;
+        }
+    }
+    
+    if (*width == 0) {
+        *width = saved_width;
+        *height = saved_height;
+    } else if (*width != saved_width || *height != saved_height) {
+        g_settings_set(self->app_settings, "screen-size", "(ii)", *width, *height);
+    }
+}
+
 void
 wally_settings_manager_monitor_theme_changes(WallySettingsManager *self,
                                              GCallback callback,
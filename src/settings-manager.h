@@ -15,6 +15,10 @@ GSettings *wally_settings_manager_get_settings(WallySettingsManager *self);
 
 gboolean wally_settings_manager_is_dark_theme(WallySettingsManager *self);
 
+void wally_settings_manager_get_scale_target(WallySettingsManager *self,
+                                             int *width,
+                                             int *height);
+
 void wally_settings_manager_monitor_theme_changes(WallySettingsManager *self,
                                                   GCallback callback,
                                                   gpointer user_data);
@@ -0,0 +1,151 @@
+#include "shuffle.h"
+
+static const guint64 GOLDEN_GAMMA = G_GUINT64_CONSTANT(0x9E3779B97F4A7C15);
+
+// splitmix64's finalizer
+static inline guint64
+mix64(guint64 value)
+{
+    value ^= value >> 30;
+    value *= G_GUINT64_CONSTANT(0xBF58476D1CE4E5B9);
+    value ^= value >> 27;
+    value *= G_GUINT64_CONSTANT(0x94D049BB133111EB);
+    value ^= value >> 31;
+    return value;
+}
+
+static void
+set_round(WallyShuffle *shuffle,
+          guint64 round)
+{
+    shuffle->round = round;
+    for (int i = 0; i < WALLY_SHUFFLE_ROUNDS; i++) {
+        shuffle->keys[i] = mix64(shuffle->seed + round * GOLDEN_GAMMA + (guint64)i);
+    }
+}
+
+void
+wally_shuffle_init(WallyShuffle *shuffle,
+                   guint64 count,
+                   guint64 seed,
+                   gboolean no_repeat)
+{
+    g_return_if_fail(shuffle != NULL);
+    
+    shuffle->count = count;
+    shuffle->seed = seed;
+    shuffle->no_repeat = no_repeat;
+    
+    // The smallest even number of bits that covers count, so the network
+    // works on less than 4 * count values and cycle-walking stays short
+    guint bits = 2;
+    while (bits < 64 && (G_GUINT64_CONSTANT(1) << bits) < count) {
+        bits += 2;
+    }
+    shuffle->half_bits = bits / 2;
+    shuffle->half_mask = (G_GUINT64_CONSTANT(1) << shuffle->half_bits) - 1;
+    
+    set_round(shuffle, 0);
+}
+
+static guint64
+feistel_forward(const WallyShuffle *shuffle,
+                guint64 value)
+{
+    guint64 left = value >> shuffle->half_bits;
+    guint64 right = value & shuffle->half_mask;
+    
+    for (int i = 0; i < WALLY_SHUFFLE_ROUNDS; i++) {
+        guint64 next = left ^ (mix64(right ^ shuffle->keys[i]) & shuffle->half_mask);
+        left = right;
+        right = next;
+    }
+    
+    return (left << shuffle->half_bits) | right;
+}
+
+static guint64
+feistel_backward(const WallyShuffle *shuffle,
+                 guint64 value)
+{
+    guint64 left = value >> shuffle->half_bits;
+    guint64 right = value & shuffle->half_mask;
+    
+    for (int i = WALLY_SHUFFLE_ROUNDS - 1; i >= 0; i--) {
+        guint64 previous = right ^ (mix64(left ^ shuffle->keys[i]) & shuffle->half_mask);
+        right = left;
+        left = previous;
+    }
+    
+    return (left << shuffle->half_bits) | right;
+}
+
+// The index shown at @position in @round
+guint64
+wally_shuffle_get(WallyShuffle *shuffle,
+                  guint64 round,
+                  guint64 position)
+{
+    g_return_val_if_fail(shuffle != NULL, 0);
+    g_return_val_if_fail(position < shuffle->count, 0);
+    
+    if (!shuffle->no_repeat) {
+        return mix64(shuffle->seed ^ mix64(round * GOLDEN_GAMMA + position)) % shuffle->count;
+    }
+    
+    if (round != shuffle->round) {
+        set_round(shuffle, round);
+    }
+    
+    // Values past the end are stepped over; the network is a bijection on
+    // its domain, so this walk always comes back below count
+    guint64 value = position;
+    do {
+        value = feistel_forward(shuffle, value);
+    } while (value >= shuffle->count);
+    
+    return value;
+}
+
+/*
+ * The position @index is shown at in @round, the inverse of
+ * wally_shuffle_get(). Independent picks have no such position; returns
+ * FALSE for those.
+ */
+gboolean
+wally_shuffle_find(WallyShuffle *shuffle,
+                   guint64 round,
+                   guint64 index,
+                   guint64 *position)
+{
+    g_return_val_if_fail(shuffle != NULL, FALSE);
+    g_return_val_if_fail(position != NULL, FALSE);
+    
+    if (!shuffle->no_repeat || index >= shuffle->count) {
+        return FALSE;
+    }
+    
+    if (round != shuffle->round) {
+        set_round(shuffle, round);
+    }
+    
+    guint64 value = index;
+    do {
+        value = feistel_backward(shuffle, value);
+    } while (value >= shuffle->count);
+    
+    *position = value;
+    return TRUE;
+}
+
+// Never 0, which the settings use for "no seed yet"
+guint64
+wally_shuffle_new_seed(void)
+{
+    guint64 seed;
+    do {
+        seed = ((guint64)g_random_int() << 32) | g_random_int();
+    } while (seed == 0);
+    
+    return seed;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define WALLY_SHUFFLE_ROUNDS 4
+
+/*
+ * A seeded shuffle of the positions 0..count-1, worked out one position at a
+ * time in O(1) instead of by shuffling an array. Each round, i.e. each pass
+ * through the list, has its own order.
+ *
+ * With no_repeat every round is a permutation (a Feistel network over the
+ * indices, cycle-walked down to count), so nothing comes back before all of
+ * the list has been shown. Without it each position is an independent pick.
+ */
+typedef struct
+{
+    guint64 count;
+    guint64 seed;
+    gboolean no_repeat;
+    
+    // Keys of the round last asked for
+    guint64 round;
+    guint half_bits;
+    guint64 half_mask;
+    guint64 keys[WALLY_SHUFFLE_ROUNDS];
+} WallyShuffle;
+
+void wally_shuffle_init(WallyShuffle *shuffle,
+                        guint64 count,
+                        guint64 seed,
+                        gboolean no_repeat);
+
+guint64 wally_shuffle_get(WallyShuffle *shuffle,
+                          guint64 round,
+                          guint64 position);
+
+gboolean wally_shuffle_find(WallyShuffle *shuffle,
+                            guint64 round,
+                            guint64 index,
+                            guint64 *position);
+
+guint64 wally_shuffle_new_seed(void);
+
+G_END_DECLS
@@ -1,23 +1,92 @@
 #include "slideshow-manager.h"
+#include "background-writer.h"
+#include "content-hash.h"
+#include "directory-scanner.h"
+#include "image-probe.h"
+#include "import-engine.h"
+#include "library-index.h"
+#include "luminance.h"
+#include "parallel.h"
+#include "scaled-cache.h"
+#include "transcoder.h"
+#include "shuffle.h"
+#include "slideshow-writer.h"
+#include "sync-manifest.h"
+#include "trace.h"
 #include "config.h"
 
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <set>
 #include <algorithm>
 #include <filesystem>
+#include <functional>
 
 struct _WallySlideshowManager
 {
     GObject parent_instance;
+    
+    WallyImportEngine *import_engine;
+    WallyImportMode import_mode;
+    gboolean verify_content_hash;
+    gboolean transcode;
+    int transcode_quality;
+    
+    WallyDirectoryScanner *scanner;
+    gboolean recursive;
+    
+    char *store_folder;
+    gboolean deduplicate;
+    gboolean compact_names;
+    guint64 store_quota;
+    guint max_workers;
+    
+    char *scaled_cache_dir;
+    int scale_width;
+    int scale_height;
+    
+    guint min_width;
+    guint min_height;
+    double min_aspect_ratio;
+    double max_aspect_ratio;
+    
+    gboolean scheduled;
+    
+    gboolean shuffle;
+    guint64 shuffle_seed;
+    
+    gboolean auto_classify;
+    double night_mean_threshold;
+    double night_bright_threshold;
 };
 
 G_DEFINE_FINAL_TYPE(WallySlideshowManager, wally_slideshow_manager, G_TYPE_OBJECT)
 
 static void
-wally_slideshow_manager_finalize(GObject *object G_GNUC_UNUSED)
+wally_slideshow_manager_dispose(GObject *object)
 {
+    WallySlideshowManager *self = WALLY_SLIDESHOW_MANAGER(object);
+    
+    g_clear_object(&self->import_engine);
+    g_clear_object(&self->scanner);
+    
+    G_OBJECT_CLASS(wally_slideshow_manager_parent_class)->dispose(object);
+}
+
+static void
+wally_slideshow_manager_finalize(GObject *object)
+{
+    WallySlideshowManager *self = WALLY_SLIDESHOW_MANAGER(object);
+    
+    g_free(self->store_folder);
+    g_free(self->scaled_cache_dir);
+    
     G_OBJECT_CLASS(wally_slideshow_manager_parent_class)->finalize(object);
 }
 
@@ -25,12 +94,19 @@ static void
 wally_slideshow_manager_class_init(WallySlideshowManagerClass *klass G_GNUC_UNUSED)
 {
     GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    object_class->dispose = wally_slideshow_manager_dispose;
     object_class->finalize = wally_slideshow_manager_finalize;
 }
 
 static void
-wally_slideshow_manager_init(WallySlideshowManager *self G_GNUC_UNUSED)
+wally_slideshow_manager_init(WallySlideshowManager *self)
 {
+    self->import_engine = wally_import_engine_new();
+    self->import_mode = WALLY_IMPORT_MODE_COPY;
+    self->transcode_quality = 90;
+    self->scanner = static_cast<WallyDirectoryScanner*>(g_object_ref(wally_directory_scanner_get_default()));
+    self->store_folder = g_build_filename(g_get_home_dir(), "Pictures", "Wally", "Store", NULL);
+    self->scaled_cache_dir = wally_scaled_cache_get_default_dir();
 }
 
 WallySlideshowManager *
@@ -39,34 +115,384 @@ wally_slideshow_manager_new(void)
     return static_cast<WallySlideshowManager*>(g_object_new(WALLY_TYPE_SLIDESHOW_MANAGER, NULL));
 }
 
+void
+wally_slideshow_manager_set_import_workers(WallySlideshowManager *self,
+                                           guint max_workers)
+{
+    g_return_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self));
+    
+    self->max_workers = max_workers;
+    wally_import_engine_set_max_workers(self->import_engine, max_workers);
+}
+
+void
+wally_slideshow_manager_set_import_mode(WallySlideshowManager *self,
+                                        WallyImportMode mode)
+{
+    g_return_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self));
+    
+    self->import_mode = mode;
+    wally_import_engine_set_mode(self->import_engine, mode);
+}
+
+void
+wally_slideshow_manager_set_verify_content_hash(WallySlideshowManager *self,
+                                                gboolean verify)
+{
+    g_return_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self));
+    
+    self->verify_content_hash = verify;
+}
+
+/*
+ * Whether BMP and TIFF images are converted to JPEG (PNG when they have
+ * alpha) on import, and the JPEG @quality from 1 to 100. The imported copy
+ * is named after the original with the new extension added, and the
+ * original's path stays the key of its manifest entry, so later syncs still
+ * match it to its source.
+ */
+void
+wally_slideshow_manager_set_transcode(WallySlideshowManager *self,
+                                      gboolean transcode,
+                                      int quality)
+{
+    g_return_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self));
+    g_return_if_fail(quality >= 1 && quality <= 100);
+    
+    self->transcode = transcode;
+    self->transcode_quality = quality;
+    wally_import_engine_set_transcode_quality(self->import_engine, quality);
+}
+
+void
+wally_slideshow_manager_set_recursive(WallySlideshowManager *self,
+                                      gboolean recursive)
+{
+    g_return_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self));
+    
+    self->recursive = recursive;
+}
+
+void
+wally_slideshow_manager_set_deduplicate(WallySlideshowManager *self,
+                                        gboolean deduplicate)
+{
+    g_return_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self));
+    
+    self->deduplicate = deduplicate;
+}
+
+/*
+ * Names the files imported into a collection folder 000001.jpg, 000002.png
+ * and so on instead of mirroring the source folder, which keeps every path
+ * in the slideshow short however deep and long the original names are. The
+ * manifest still maps each file back to its original. Files kept in the
+ * store are named by content whatever this says.
+ */
+void
+wally_slideshow_manager_set_compact_names(WallySlideshowManager *self,
+                                          gboolean compact_names)
+{
+    g_return_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self));
+    
+    self->compact_names = compact_names;
+}
+
+/*
+ * When the wallpaper scheduler rotates the images, the slideshows are still
+ * written but no longer handed to GNOME; the scheduler reads them instead.
+ */
+void
+wally_slideshow_manager_set_scheduled(WallySlideshowManager *self,
+                                      gboolean scheduled)
+{
+    g_return_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self));
+    
+    self->scheduled = scheduled;
+}
+
+gboolean
+wally_slideshow_manager_get_scheduled(WallySlideshowManager *self)
+{
+    g_return_val_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self), FALSE);
+    
+    return self->scheduled;
+}
+
+/*
+ * Orders slideshows by a shuffle of @seed instead of by name; the same seed
+ * gives the same order every time. Each image is listed once either way;
+ * shuffle-no-repeat only changes what the scheduler does after the first
+ * round.
+ */
+void
+wally_slideshow_manager_set_shuffle(WallySlideshowManager *self,
+                                    gboolean shuffle,
+                                    guint64 seed)
+{
+    g_return_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self));
+    
+    self->shuffle = shuffle;
+    self->shuffle_seed = seed;
+}
+
+/*
+ * Sorts one mixed folder into day and night by how bright each image is: an
+ * image is night when both its mean and 90th percentile luminance are under
+ * the thresholds. Only imports made while this is on measure the images.
+ */
+void
+wally_slideshow_manager_set_auto_classify(WallySlideshowManager *self,
+                                          gboolean auto_classify,
+                                          double mean_threshold,
+                                          double bright_threshold)
+{
+    g_return_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self));
+    
+    self->auto_classify = auto_classify;
+    self->night_mean_threshold = mean_threshold;
+    self->night_bright_threshold = bright_threshold;
+}
+
+gboolean
+wally_slideshow_manager_get_auto_classify(WallySlideshowManager *self)
+{
+    g_return_val_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self), FALSE);
+    
+    return self->auto_classify;
+}
+
+void
+wally_slideshow_manager_set_filters(WallySlideshowManager *self,
+                                    guint min_width,
+                                    guint min_height,
+                                    double min_aspect_ratio,
+                                    double max_aspect_ratio)
+{
+    g_return_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self));
+    
+    self->min_width = min_width;
+    self->min_height = min_height;
+    self->min_aspect_ratio = min_aspect_ratio;
+    self->max_aspect_ratio = max_aspect_ratio;
+}
+
+void
+wally_slideshow_manager_set_scale_target(WallySlideshowManager *self,
+                                         int width,
+                                         int height)
+{
+    g_return_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self));
+    
+    // Either dimension unset turns prescaling off
+    if (width <= 0 || height <= 0) {
+        width = height = 0;
+    }
+    
+    self->scale_width = width;
+    self->scale_height = height;
+}
+
+/*
+ * Picks up every import option from the app settings, so the preferences
+ * window and background refreshes sync the same way. The scale target
+ * depends on the screens and is set separately.
+ */
+void
+wally_slideshow_manager_load_settings(WallySlideshowManager *self,
+                                      GSettings *settings)
+{
+    g_return_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self));
+    g_return_if_fail(G_IS_SETTINGS(settings));
+    
+    wally_slideshow_manager_set_verify_content_hash(self, g_settings_get_boolean(settings, "verify-content-hash"));
+    wally_slideshow_manager_set_import_workers(self, g_settings_get_int(settings, "import-workers"));
+    wally_slideshow_manager_set_import_mode(self, (WallyImportMode)g_settings_get_enum(settings, "import-mode"));
+    wally_slideshow_manager_set_transcode(self,
+                                          g_settings_get_boolean(settings, "transcode"),
+                                          g_settings_get_int(settings, "transcode-quality"));
+    wally_slideshow_manager_set_recursive(self, g_settings_get_boolean(settings, "scan-recursive"));
+    wally_slideshow_manager_set_deduplicate(self, g_settings_get_boolean(settings, "deduplicate"));
+    wally_slideshow_manager_set_compact_names(self, g_settings_get_boolean(settings, "compact-names"));
+    wally_slideshow_manager_set_store_quota(self, (guint64)g_settings_get_int(settings, "store-quota") * 1024 * 1024);
+    wally_slideshow_manager_set_filters(self,
+                                        g_settings_get_int(settings, "min-width"),
+                                        g_settings_get_int(settings, "min-height"),
+                                        g_settings_get_double(settings, "min-aspect-ratio"),
+                                        g_settings_get_double(settings, "max-aspect-ratio"));
+    wally_slideshow_manager_set_scheduled(self, g_settings_get_boolean(settings, "use-scheduler"));
+    
+    // The seed is kept so the order survives restarts
+    gboolean shuffle = g_settings_get_boolean(settings, "shuffle");
+    guint64 seed = g_settings_get_uint64(settings, "shuffle-seed");
+    if (shuffle && seed == 0) {
+        seed = wally_shuffle_new_seed();
+        g_settings_set_uint64(settings, "shuffle-seed", seed);
+    }
+    wally_slideshow_manager_set_shuffle(self, shuffle, seed);
+    
+    wally_slideshow_manager_set_auto_classify(self,
+                                              g_settings_get_boolean(settings, "auto-classify"),
+                                              g_settings_get_double(settings, "auto-classify-mean-threshold"),
+                                              g_settings_get_double(settings, "auto-classify-bright-threshold"));
+}
+
+// Image files under a folder as absolute paths, in a stable order
 static std::vector<std::string>
-get_image_files(const std::string& folder_path)
+get_image_files(WallySlideshowManager *self, const std::string& folder_path)
 {
-    std::vector<std::string> image_files;
-    const std::vector<std::string> extensions = {".jpg", ".jpeg", ".png", ".bmp", ".webp", ".tiff", ".svg"};
+    std::vector<std::string> image_files = wally_directory_scanner_scan(self->scanner, folder_path.c_str(),
+                                                                        self->recursive);
+    
+    for (std::string& image_file : image_files) {
+        image_file = (std::filesystem::path(folder_path) / image_file).string();
+    }
     
+    return image_files;
+}
+
+// Lists what a sync may have put in the destination, symlinks (dangling ones
+// included) as well, so that links made by the symlink import mode can be
+// cleaned up. Partial files an interrupted import left behind are listed
+// too; nothing refers to them, so they go the same way as other stale
+// files. Subfolders are returned deepest first.
+static void
+get_imported_files(const std::string& dest_folder,
+                   std::vector<std::string>& imported_files,
+                   std::vector<std::string>& subfolders)
+{
     try {
-        for (const auto& entry : std::filesystem::directory_iterator(folder_path)) {
-            if (entry.is_regular_file()) {
-                std::string filename = entry.path().filename().string();
-                std::string extension = entry.path().extension().string();
-                
-                // Convert extension to lowercase
-                std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
-                
-                // Check if it's an image file
-                if (std::find(extensions.begin(), extensions.end(), extension) != extensions.end()) {
-                    image_files.push_back(entry.path().string());
+        auto iterator = std::filesystem::recursive_directory_iterator(dest_folder);
+        for (auto it = std::filesystem::begin(iterator); it != std::filesystem::end(iterator); ++it) {
+            std::string filename = it->path().filename().string();
+            
+            if (it->is_directory() && !it->is_symlink()) {
+                if (filename[0] == '.') {
+                    it.disable_recursion_pending();
+                } else {
+                    subfolders.push_back(it->path().string());
                 }
+                continue;
+            }
+            
+            if (!it->is_symlink() && !it->is_regular_file()) {
+                continue;
+            }
+            
+            if (wally_is_image_filename(filename.c_str()) || g_str_has_suffix(filename.c_str(), ".wally-part")) {
+                imported_files.push_back(it->path().string());
             }
         }
     } catch (const std::filesystem::filesystem_error& e) {
-        g_warning("Error reading directory %s: %s", folder_path.c_str(), e.what());
+        g_warning("Error reading directory %s: %s", dest_folder.c_str(), e.what());
     }
     
-    // Sort files for consistent ordering
-    std::sort(image_files.begin(), image_files.end());
-    return image_files;
+    std::sort(subfolders.begin(), subfolders.end(), std::greater<std::string>());
+}
+
+// Which slideshow an image belongs in by its brightness; images that were
+// never measured count as day
+static WallyLuminanceClass
+classify_record(WallySlideshowManager *self, const WallyIndexRecord *record)
+{
+    if (record->luminance < 0 || record->luminance_p90 < 0) {
+        return WALLY_LUMINANCE_CLASS_DAY;
+    }
+    
+    if (record->luminance < self->night_mean_threshold && record->luminance_p90 < self->night_bright_threshold) {
+        return WALLY_LUMINANCE_CLASS_NIGHT;
+    }
+    
+    return WALLY_LUMINANCE_CLASS_DAY;
+}
+
+// Walk the images of this folder by name: what the last sync imported, read
+// straight from its index so that files kept in the store are found too, or
+// else whatever is in the folder. Only images of @luminance_class are
+// walked, which needs the index. Stops early when @func returns FALSE.
+static gboolean
+for_each_listed_file(WallySlideshowManager *self,
+                     WallyLibraryIndex *index,
+                     const char *folder_path,
+                     WallyLuminanceClass luminance_class,
+                     const std::function<gboolean(const std::string&)>& func)
+{
+    gsize n_records = index != NULL ? wally_library_index_get_n_records(index) : 0;
+    std::set<std::string_view> listed;
+    WallyManifestEntry entry;
+    
+    for (gsize i = 0; i < n_records; i++) {
+        const WallyIndexRecord *record = wally_library_index_get_record(index, i);
+        const char *target = wally_library_index_get_string(index, record->target);
+        
+        if (luminance_class != WALLY_LUMINANCE_CLASS_ANY && classify_record(self, record) != luminance_class) {
+            continue;
+        }
+        
+        // Identical files share one stored copy; show it once
+        if (!listed.insert(target).second) {
+            continue;
+        }
+        
+        // Point at the downscaled copy when there is one
+        if (self->scale_width > 0) {
+            wally_library_index_get_entry(index, record, &entry);
+            std::string scaled_path = wally_scaled_cache_get_path(self->scaled_cache_dir, entry,
+                                                                  self->scale_width, self->scale_height);
+            if (g_file_test(scaled_path.c_str(), G_FILE_TEST_EXISTS)) {
+                if (!func(scaled_path)) {
+                    return FALSE;
+                }
+                continue;
+            }
+        }
+        
+        if (!func(target)) {
+            return FALSE;
+        }
+    }
+    
+    if (n_records == 0 && luminance_class == WALLY_LUMINANCE_CLASS_ANY) {
+        for (const std::string& image_file : get_image_files(self, folder_path)) {
+            if (!func(image_file)) {
+                return FALSE;
+            }
+        }
+    }
+    
+    return TRUE;
+}
+
+// Walk the images a slideshow of this folder shows, in the order it shows them
+static gboolean
+for_each_slideshow_file(WallySlideshowManager *self,
+                        WallyLibraryIndex *index,
+                        const char *folder_path,
+                        WallyLuminanceClass luminance_class,
+                        const std::function<gboolean(const std::string&)>& func)
+{
+    if (!self->shuffle) {
+        return for_each_listed_file(self, index, folder_path, luminance_class, func);
+    }
+    
+    std::vector<std::string> files;
+    for_each_listed_file(self, index, folder_path, luminance_class, [&](const std::string& path) {
+        files.push_back(path);
+        return TRUE;
+    });
+    
+    // The first round of the shuffle; the scheduler goes on to the next ones.
+    // Always a permutation: independent picks would leave some images out of
+    // the slideshow file and list others twice.
+    WallyShuffle shuffle;
+    wally_shuffle_init(&shuffle, files.size(), self->shuffle_seed, TRUE);
+    for (gsize position = 0; position < files.size(); position++) {
+        if (!func(files[wally_shuffle_get(&shuffle, 0, position)])) {
+            return FALSE;
+        }
+    }
+    
+    return TRUE;
 }
 
 gboolean
@@ -75,67 +501,143 @@ wally_slideshow_manager_create_slideshow_xml(WallySlideshowManager *self,
                                               const char *output_path,
                                               int interval_seconds,
                                               double transition_duration,
+                                              gboolean *changed,
+                                              GError **error)
+{
+    return wally_slideshow_manager_create_classified_xml(self, folder_path, output_path, WALLY_LUMINANCE_CLASS_ANY,
+                                                         interval_seconds, transition_duration, changed, error);
+}
+
+/*
+ * Like wally_slideshow_manager_create_slideshow_xml(), showing only the
+ * images of the folder that classify as @luminance_class. When none do, the
+ * slideshow shows all of them rather than nothing.
+ */
+gboolean
+wally_slideshow_manager_create_classified_xml(WallySlideshowManager *self,
+                                              const char *folder_path,
+                                              const char *output_path,
+                                              WallyLuminanceClass luminance_class,
+                                              int interval_seconds,
+                                              double transition_duration,
+                                              gboolean *changed,
                                               GError **error)
 {
     g_return_val_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self), FALSE);
     g_return_val_if_fail(folder_path != NULL, FALSE);
     g_return_val_if_fail(output_path != NULL, FALSE);
     
-    // Get image files from the folder
-    std::vector<std::string> image_files = get_image_files(folder_path);
+    if (changed != NULL) {
+        *changed = FALSE;
+    }
     
-    if (image_files.empty()) {
+    g_auto(WallyTraceSpan) span = {NULL, 0};
+    wally_trace_span_begin(&span, "xml-write");
+    
+    g_autoptr(WallyLibraryIndex) index = wally_library_index_open(folder_path, NULL);
+    
+    // Leave the file alone when it would come out the same: replacing it
+    // makes the shell reload the slideshow and start it over
+    WallySlideshowFingerprint fingerprint;
+    guint count = 0;
+    wally_slideshow_fingerprint_init(&fingerprint, interval_seconds, transition_duration);
+    auto add_to_fingerprint = [&](const std::string& path) {
+        wally_slideshow_fingerprint_add_file(&fingerprint, path.c_str());
+        count++;
+        return TRUE;
+    };
+    for_each_slideshow_file(self, index, folder_path, luminance_class, add_to_fingerprint);
+    
+    if (count == 0 && luminance_class != WALLY_LUMINANCE_CLASS_ANY) {
+        g_message("No %s images in %s, showing all of them",
+                  luminance_class == WALLY_LUMINANCE_CLASS_NIGHT ? "night" : "day", folder_path);
+        luminance_class = WALLY_LUMINANCE_CLASS_ANY;
+        for_each_slideshow_file(self, index, folder_path, luminance_class, add_to_fingerprint);
+    }
+    
+    if (count == 0) {
         g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
                     "No image files found in folder: %s", folder_path);
         return FALSE;
     }
     
-    GString *xml_content = g_string_new("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-    g_string_append(xml_content, "<!DOCTYPE background SYSTEM \"gnome-wp-list.dtd\">\n");
-    g_string_append(xml_content, "<background>\n");
-    g_string_append(xml_content, "  <starttime>\n");
-    g_string_append(xml_content, "    <year>2024</year>\n");
-    g_string_append(xml_content, "    <month>01</month>\n");
-    g_string_append(xml_content, "    <day>01</day>\n");
-    g_string_append(xml_content, "    <hour>00</hour>\n");
-    g_string_append(xml_content, "    <minute>00</minute>\n");
-    g_string_append(xml_content, "    <second>00</second>\n");
-    g_string_append(xml_content, "  </starttime>\n");
-    for (size_t i = 0; i < image_files.size(); i++) {
-        const std::string& current_file = image_files[i];
-        const std::string& next_file = image_files[(i + 1) % image_files.size()];
-        
-        g_string_append_printf(xml_content,
-            "  <static>\n"
-            "    <duration>%d</duration>\n"
-            "    <file>%s</file>\n"
-            "  </static>\n",
-            interval_seconds, current_file.c_str());
-        
-        g_string_append_printf(xml_content,
-            "  <transition>\n"
-            "    <duration>%.1f</duration>\n"
-            "    <from>%s</from>\n"
-            "    <to>%s</to>\n"
-            "  </transition>\n",
-            transition_duration, current_file.c_str(), next_file.c_str());
+    guint64 existing_fingerprint;
+    if (wally_slideshow_read_fingerprint(output_path, &existing_fingerprint) &&
+        existing_fingerprint == wally_slideshow_fingerprint_finish(&fingerprint)) {
+        g_message("Slideshow %s is unchanged, not rewriting it", output_path);
+        wally_trace_span_end(&span, count, 0);
+        return TRUE;
+    }
+    
+    g_autoptr(WallySlideshowWriter) writer = wally_slideshow_writer_new(output_path, interval_seconds,
+                                                                        transition_duration, NULL, error);
+    if (writer == NULL) {
+        return FALSE;
+    }
+    
+    gboolean written = for_each_slideshow_file(self, index, folder_path, luminance_class, [&](const std::string& path) {
+        GError *add_error = NULL;
+        if (!wally_slideshow_writer_add_file(writer, path.c_str(), &add_error)) {
+            if (!g_error_matches(add_error, G_IO_ERROR, G_IO_ERROR_INVALID_FILENAME)) {
+                g_propagate_error(error, add_error);
+                return FALSE;
+            }
+            g_warning("%s", add_error->message);
+            g_error_free(add_error);
+        }
+        return TRUE;
+    });
+    
+    if (!written) {
+        return FALSE;
+    }
+    
+    if (wally_slideshow_writer_get_count(writer) == 0) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                    "No usable image files found in folder: %s", folder_path);
+        return FALSE;
+    }
+    
+    if (!wally_slideshow_writer_finish(writer, error)) {
+        return FALSE;
     }
     
-    g_string_append(xml_content, "</background>\n");
+    GStatBuf st;
+    wally_trace_span_end(&span, wally_slideshow_writer_get_count(writer),
+                         wally_trace_enabled && g_stat(output_path, &st) == 0 ? st.st_size : 0);
     
-    GError *write_error = NULL;
-    gboolean success = g_file_set_contents(output_path, xml_content->str, xml_content->len, &write_error);
+    if (changed != NULL) {
+        *changed = TRUE;
+    }
+    return TRUE;
+}
+
+gboolean
+wally_slideshow_manager_is_wallpaper_applied(WallySlideshowManager *self,
+                                             const char *xml_path,
+                                             gboolean is_dark_theme)
+{
+    g_return_val_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self), FALSE);
+    g_return_val_if_fail(xml_path != NULL, FALSE);
     
-    if (!success) {
-        g_propagate_error(error, write_error);
+    g_autofree char *file_uri = g_filename_to_uri(xml_path, NULL, NULL);
+    if (!file_uri) {
+        return FALSE;
     }
     
-    g_string_free(xml_content, TRUE);
-    return success;
+    g_autofree char *current_uri = wally_background_writer_get_uri(wally_background_writer_get_default(),
+                                                                   is_dark_theme);
+    
+    return g_strcmp0(current_uri, file_uri) == 0;
 }
 
+/*
+ * Stages pointing the light or dark background at a slideshow, to be
+ * written together with other staged changes by
+ * wally_background_writer_commit().
+ */
 gboolean
-wally_slideshow_manager_apply_wallpaper(WallySlideshowManager *self,
+wally_slideshow_manager_stage_wallpaper(WallySlideshowManager *self,
                                         const char *xml_path,
                                         gboolean is_dark_theme,
                                         GError **error)
@@ -143,89 +645,1001 @@ wally_slideshow_manager_apply_wallpaper(WallySlideshowManager *self,
     g_return_val_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self), FALSE);
     g_return_val_if_fail(xml_path != NULL, FALSE);
     
-    // Construct file URI
     g_autofree char *file_uri = g_filename_to_uri(xml_path, NULL, error);
     if (!file_uri) {
         return FALSE;
     }
     
-    // Apply wallpaper using gsettings
-    const char *schema = "org.gnome.desktop.background";
-    const char *key = is_dark_theme ? "picture-uri-dark" : "picture-uri";
-    
-    g_autoptr(GSettings) bg_settings = g_settings_new(schema);
-    gboolean success = g_settings_set_string(bg_settings, key, file_uri);
+    WallyBackgroundWriter *writer = wally_background_writer_get_default();
+    wally_background_writer_set_uri(writer, is_dark_theme, file_uri);
     
-    if (success) {
-        g_settings_sync();
-    } else {
-        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                    "Failed to apply wallpaper via gsettings");
+    // With no picture at all the slideshow would never show
+    g_autofree char *options = wally_background_writer_get_picture_options(writer);
+    if (g_strcmp0(options, "none") == 0) {
+        wally_background_writer_set_picture_options(writer, "zoom");
     }
     
-    return success;
+    return TRUE;
 }
 
 gboolean
-wally_slideshow_manager_copy_wallpapers(WallySlideshowManager *self,
-                                        const char *source_folder,
-                                        const char *dest_folder,
+wally_slideshow_manager_apply_wallpaper(WallySlideshowManager *self,
+                                        const char *xml_path,
+                                        gboolean is_dark_theme,
                                         GError **error)
 {
     g_return_val_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self), FALSE);
-    g_return_val_if_fail(source_folder != NULL, FALSE);
-    g_return_val_if_fail(dest_folder != NULL, FALSE);
+    g_return_val_if_fail(xml_path != NULL, FALSE);
     
-    // Create destination directory if it doesn't exist
-    if (g_mkdir_with_parents(dest_folder, 0755) != 0) {
-        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                    "Failed to create destination directory: %s", dest_folder);
+    if (!wally_slideshow_manager_stage_wallpaper(self, xml_path, is_dark_theme, error)) {
         return FALSE;
     }
     
-    // Get image files from source folder
-    std::vector<std::string> image_files = get_image_files(source_folder);
+    wally_background_writer_commit(wally_background_writer_get_default());
+    return TRUE;
+}
+
+static gboolean
+stat_file(const std::string& path, guint64 *size, gint64 *mtime_ns)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return FALSE;
+    }
     
-    if (image_files.empty()) {
-        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
-                    "No image files found in source folder: %s", source_folder);
+    *size = st.st_size;
+    *mtime_ns = st.st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000) + st.st_mtim.tv_nsec;
+    return TRUE;
+}
+
+// Whether an imported file was converted from its source rather than taken
+// over as is, which is when the extensions differ
+static gboolean
+is_transcoded_target(const std::string& source_file, const std::string& target)
+{
+    return g_ascii_strcasecmp(std::filesystem::path(source_file).extension().c_str(),
+                              std::filesystem::path(target).extension().c_str()) != 0;
+}
+
+// Decide whether the file recorded in the manifest still matches the source.
+// Size and mtime settle it in the common case; when they disagree only on
+// mtime and content hashing is enabled, the bytes get the final word.
+static gboolean
+is_entry_up_to_date(WallySlideshowManager *self,
+                    const std::string& source_file,
+                    const WallyManifestEntry& previous,
+                    WallyManifestEntry& current)
+{
+    // An empty target is filled in from the record: store targets and those
+    // of converted files are only known once the content is
+    if ((!current.target.empty() && previous.target != current.target) || previous.size != current.size) {
         return FALSE;
     }
     
-    // Copy each image file
-    for (const std::string& source_file : image_files) {
-        std::filesystem::path source_path(source_file);
-        std::filesystem::path dest_path = std::filesystem::path(dest_folder) / source_path.filename();
-        
-        try {
-            std::filesystem::copy_file(source_path, dest_path, 
-                                       std::filesystem::copy_options::overwrite_existing);
-        } catch (const std::filesystem::filesystem_error& e) {
-            g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                        "Failed to copy file %s: %s", source_file.c_str(), e.what());
-            return FALSE;
-        }
+    // A converted copy has a size of its own
+    guint64 dest_size;
+    gint64 dest_mtime_ns;
+    if (!stat_file(previous.target, &dest_size, &dest_mtime_ns) ||
+        (dest_size != current.size && !is_transcoded_target(source_file, previous.target))) {
+        return FALSE;
+    }
+    
+    if (previous.mtime_ns == current.mtime_ns) {
+        current.target = previous.target;
+        current.hash = previous.hash;
+        return TRUE;
+    }
+    
+    if (!self->verify_content_hash || previous.hash == 0) {
+        return FALSE;
+    }
+    
+    if (!wally_hash_file(source_file.c_str(), &current.hash, NULL) || current.hash != previous.hash) {
+        current.hash = 0;
+        return FALSE;
     }
     
+    current.target = previous.target;
     return TRUE;
 }
 
-void
-wally_slideshow_manager_next_wallpaper(WallySlideshowManager *self)
+// Where the store keeps a file with this content: named by its hash, keeping
+// the extension of @import_name so that loaders which go by it still work
+static std::string
+get_store_path(WallySlideshowManager *self, const std::string& import_name, guint64 hash)
 {
-    g_return_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self));
+    const char *extension = strrchr(import_name.c_str(), '.');
+    g_autofree char *lower_extension = g_ascii_strdown(extension != NULL ? extension : "", -1);
+    g_autofree char *filename = g_strdup_printf("%016" G_GINT64_MODIFIER "x%s", hash, lower_extension);
     
-    // Force GNOME to refresh the wallpaper by temporarily setting a different value
-    // and then setting it back. This triggers the slideshow to advance.
-    g_autoptr(GSettings) bg_settings = g_settings_new("org.gnome.desktop.background");
+    return (std::filesystem::path(self->store_folder) / filename).string();
+}
+
+// The short name of the @number-th file imported into @dest_folder, with the
+// extension of @import_name like store names
+static std::string
+get_compact_path(const char *dest_folder, guint number, const std::string& import_name)
+{
+    g_autofree char *lower_extension = g_ascii_strdown(std::filesystem::path(import_name).extension().c_str(), -1);
+    g_autofree char *filename = g_strdup_printf("%06u%s", number, lower_extension);
+    
+    return (std::filesystem::path(dest_folder) / filename).string();
+}
+
+// The number of a compact name, 0 for any other name: the stem must be all
+// digits, so a mirrored 2023-01-01.jpg isn't taken for number 2023
+static guint
+get_compact_number(const std::string& target)
+{
+    std::string stem = std::filesystem::path(target).stem().string();
+    if (stem.empty() || stem.size() > 10) {
+        return 0;
+    }
+    
+    for (char c : stem) {
+        if (!g_ascii_isdigit(c)) {
+            return 0;
+        }
+    }
+    
+    guint64 number = g_ascii_strtoull(stem.c_str(), NULL, 10);
+    return number <= G_MAXUINT ? (guint)number : 0;
+}
+
+// Hash files in parallel. A hash of 0 means the file couldn't be read.
+static std::vector<guint64>
+hash_files(WallySlideshowManager *self,
+           const char *source_folder,
+           const std::vector<std::string>& relative_paths,
+           GCancellable *cancellable)
+{
+    std::vector<guint64> hashes(relative_paths.size(), 0);
+    
+    wally_parallel_for(relative_paths.size(), self->max_workers, [&](gsize index, guint worker G_GNUC_UNUSED) {
+        if (g_cancellable_is_cancelled(cancellable)) {
+            return;
+        }
+        
+        std::string source_file = (std::filesystem::path(source_folder) / relative_paths[index]).string();
+        GError *hash_error = NULL;
+        if (!wally_hash_file(source_file.c_str(), &hashes[index], &hash_error)) {
+            g_warning("Failed to hash %s: %s", source_file.c_str(), hash_error->message);
+            g_error_free(hash_error);
+            hashes[index] = 0;
+        }
+    });
+    
+    return hashes;
+}
+
+// Read the headers of files in parallel, filling in their dimensions.
+// Files that aren't images, or are cut short, come back in an unknown format.
+static std::vector<WallyImageInfo>
+probe_files(WallySlideshowManager *self,
+            const char *source_folder,
+            const std::vector<std::string>& relative_paths,
+            std::map<std::string, WallyManifestEntry>& entries)
+{
+    std::vector<WallyImageInfo> infos(relative_paths.size(), WallyImageInfo{WALLY_IMAGE_FORMAT_UNKNOWN, 0, 0, FALSE, 1});
+    
+    // Look the entries up front; the map isn't touched by the workers
+    std::vector<WallyManifestEntry*> probed;
+    for (const std::string& relative_path : relative_paths) {
+        probed.push_back(&entries[relative_path]);
+    }
+    
+    wally_parallel_for(relative_paths.size(), self->max_workers, [&](gsize index, guint worker G_GNUC_UNUSED) {
+        std::string source_file = (std::filesystem::path(source_folder) / relative_paths[index]).string();
+        WallyImageInfo& info = infos[index];
+        GError *probe_error = NULL;
+        
+        if (!wally_image_probe_file(source_file.c_str(), &info, &probe_error)) {
+            g_warning("Skipping %s: %s", source_file.c_str(), probe_error->message);
+            g_error_free(probe_error);
+            return;
+        }
+        
+        probed[index]->width = info.width;
+        probed[index]->height = info.height;
+    });
+    
+    return infos;
+}
+
+// Whether an image meets the configured size and shape limits
+static gboolean
+passes_filters(WallySlideshowManager *self, const WallyManifestEntry& entry)
+{
+    // Vector images have no size to check
+    if (entry.width == 0 || entry.height == 0) {
+        return TRUE;
+    }
+    
+    if (entry.width < self->min_width || entry.height < self->min_height) {
+        return FALSE;
+    }
+    
+    double aspect_ratio = (double)entry.width / entry.height;
+    if ((self->min_aspect_ratio > 0 && aspect_ratio < self->min_aspect_ratio) ||
+        (self->max_aspect_ratio > 0 && aspect_ratio > self->max_aspect_ratio)) {
+        return FALSE;
+    }
+    
+    return TRUE;
+}
+
+// Tell the user about byte-identical files within one source folder
+static void
+report_duplicates(const std::map<std::string, WallyManifestEntry>& synced,
+                  WallySyncStats *stats)
+{
+    std::map<guint64, const std::string*> first_with_hash;
+    
+    for (const auto& [relative_path, entry] : synced) {
+        if (entry.hash == 0) {
+            continue;
+        }
+        
+        auto [first, inserted] = first_with_hash.emplace(entry.hash, &relative_path);
+        if (!inserted) {
+            g_message("%s is identical to %s", relative_path.c_str(), first->second->c_str());
+            stats->duplicates++;
+        }
+    }
+}
+
+// Measure the brightness of imported images that don't have it yet, in
+// parallel. Contents measured before under any name come from the cache.
+static void
+measure_luminance(WallySlideshowManager *self,
+                  std::map<std::string, WallyManifestEntry>& synced,
+                  GCancellable *cancellable)
+{
+    std::vector<WallyManifestEntry*> unmeasured;
+    for (auto& [relative_path, entry] : synced) {
+        if (entry.luminance < 0 || entry.luminance_p90 < 0) {
+            unmeasured.push_back(&entry);
+        }
+    }
+    
+    if (unmeasured.empty()) {
+        return;
+    }
+    
+    g_autofree char *cache_path = wally_luminance_cache_get_default_path();
+    WallyLuminanceCache cache;
+    wally_luminance_cache_load(cache, cache_path);
+    
+    std::vector<WallyManifestEntry*> to_decode;
+    for (WallyManifestEntry *entry : unmeasured) {
+        auto it = entry->hash != 0 ? cache.find(entry->hash) : cache.end();
+        if (it != cache.end()) {
+            entry->luminance = it->second.mean;
+            entry->luminance_p90 = it->second.p90;
+        } else {
+            to_decode.push_back(entry);
+        }
+    }
+    
+    if (to_decode.empty()) {
+        return;
+    }
+    
+    g_auto(WallyTraceSpan) span = {NULL, 0};
+    wally_trace_span_begin(&span, "measure-luminance");
+    
+    std::vector<WallyLuminance> measured(to_decode.size(), WallyLuminance{-1, -1});
+    wally_parallel_for(to_decode.size(), self->max_workers, [&](gsize index, guint worker G_GNUC_UNUSED) {
+        if (g_cancellable_is_cancelled(cancellable)) {
+            return;
+        }
+        
+        const char *path = to_decode[index]->target.c_str();
+        GError *measure_error = NULL;
+        if (!wally_luminance_measure_file(path, &measured[index], &measure_error)) {
+            g_warning("Failed to measure brightness of %s: %s", path, measure_error->message);
+            g_error_free(measure_error);
+            measured[index] = WallyLuminance{-1, -1};
+        }
+    });
+    
+    // Failures stay unmeasured and are tried again on the next sync
+    gboolean cache_changed = FALSE;
+    for (gsize i = 0; i < to_decode.size(); i++) {
+        if (measured[i].mean < 0) {
+            continue;
+        }
+        
+        to_decode[i]->luminance = measured[i].mean;
+        to_decode[i]->luminance_p90 = measured[i].p90;
+        if (to_decode[i]->hash != 0) {
+            cache[to_decode[i]->hash] = measured[i];
+            cache_changed = TRUE;
+        }
+    }
+    
+    wally_trace_span_end(&span, to_decode.size(), 0);
+    
+    GError *save_error = NULL;
+    if (cache_changed && !wally_luminance_cache_save(cache, cache_path, &save_error)) {
+        g_warning("Failed to save luminance cache: %s", save_error->message);
+        g_error_free(save_error);
+    }
+}
+
+gboolean
+wally_slideshow_manager_copy_wallpapers(WallySlideshowManager *self,
+                                        const char *source_folder,
+                                        const char *dest_folder,
+                                        WallySyncStats *stats,
+                                        GCancellable *cancellable,
+                                        GError **error)
+{
+    g_return_val_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self), FALSE);
+    g_return_val_if_fail(source_folder != NULL, FALSE);
+    g_return_val_if_fail(dest_folder != NULL, FALSE);
+    
+    WallySyncStats local_stats{};
+    if (stats == NULL) {
+        stats = &local_stats;
+    }
+    
+    // Create destination directory if it doesn't exist
+    if (g_mkdir_with_parents(dest_folder, 0755) != 0) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                    "Failed to create destination directory: %s", dest_folder);
+        return FALSE;
+    }
+    
+    gboolean use_store = self->deduplicate;
+    gboolean compact = self->compact_names && !use_store;
+    if (use_store && g_mkdir_with_parents(self->store_folder, 0755) != 0) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                    "Failed to create wallpaper store: %s", self->store_folder);
+        return FALSE;
+    }
+    
+    // Get image files from source folder, relative to it
+    g_auto(WallyTraceSpan) span = {NULL, 0};
+    wally_trace_span_begin(&span, "scan");
+    std::vector<std::string> image_files = wally_directory_scanner_scan(self->scanner, source_folder,
+                                                                        self->recursive);
+    wally_trace_span_end(&span, image_files.size(), 0);
+    
+    if (image_files.empty()) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                    "No image files found in source folder: %s", source_folder);
+        return FALSE;
+    }
+    
+    g_autofree char *transcode_options = self->transcode ? g_strdup_printf("+transcode%d", self->transcode_quality)
+                                                         : g_strdup("");
+    g_autofree char *options = g_strconcat(wally_import_mode_to_string(self->import_mode),
+                                           use_store ? "+store" : "", compact ? "+compact" : "",
+                                           transcode_options, NULL);
+    g_autoptr(WallySyncManifest) manifest = wally_sync_manifest_load(dest_folder, source_folder, options);
+    
+    // Compact names are never reused for another file, not even one that
+    // was removed from the source: the shell may still hold the old image.
+    // The index remembers the highest number given out; without a usable
+    // index, whatever is in the folder counts.
+    guint next_number = manifest->last_number + 1;
+    std::map<std::string, guint> previous_numbers;
+    if (compact && manifest->previous == NULL) {
+        std::vector<std::string> existing_files;
+        std::vector<std::string> existing_subfolders;
+        get_imported_files(dest_folder, existing_files, existing_subfolders);
+        for (const std::string& existing_file : existing_files) {
+            next_number = MAX(next_number, get_compact_number(existing_file) + 1);
+        }
+        manifest->last_number = next_number - 1;
+    }
+    
+    std::map<std::string, WallyManifestEntry> synced;
+    std::set<std::string> targets;
+    
+    // Work out which files are new or changed
+    std::vector<WallyImportJob> jobs;
+    std::vector<std::string> job_relative_paths;
+    std::vector<std::string> unprobed;
+    std::vector<std::string> unhashed;
+    std::vector<std::string> unhashed_names;
+    std::set<std::string> created_folders;
+    std::set<std::string> stored_targets;
+    
+    // Everything up to the copy: stat, probe, filter and hash
+    wally_trace_span_begin(&span, "filter");
+    for (const std::string& relative_path : image_files) {
+        std::string source_file = (std::filesystem::path(source_folder) / relative_path).string();
+        std::filesystem::path dest_path = std::filesystem::path(dest_folder) / relative_path;
+        
+        if (g_cancellable_set_error_if_cancelled(cancellable, error)) {
+            return FALSE;
+        }
+        
+        stats->scanned++;
+        
+        // With the store the target depends on the content, so it is left
+        // empty until the file has been hashed; the same goes for files that
+        // may be converted until they have been probed, and for compact
+        // names until the file is known to be imported at all
+        gboolean may_transcode = self->transcode && wally_transcoder_is_heavy_filename(relative_path.c_str());
+        WallyManifestEntry entry{use_store || compact || may_transcode ? "" : dest_path.string(), 0, 0, 0, 0, 0};
+        if (!stat_file(source_file, &entry.size, &entry.mtime_ns)) {
+            g_warning("Failed to read file %s", source_file.c_str());
+            stats->failed++;
+            continue;
+        }
+        
+        WallyManifestEntry previous;
+        gboolean found = wally_sync_manifest_lookup(manifest, relative_path, &previous);
+        if (found && is_entry_up_to_date(self, source_file, previous, entry)) {
+            // The filters may have changed since; the recorded size still holds
+            entry.width = previous.width;
+            entry.height = previous.height;
+            entry.luminance = previous.luminance;
+            entry.luminance_p90 = previous.luminance_p90;
+            if (!passes_filters(self, entry)) {
+                stats->rejected++;
+                continue;
+            }
+            
+            if (!use_store) {
+                targets.insert(entry.target);
+            }
+            stats->skipped++;
+            synced[relative_path] = std::move(entry);
+            continue;
+        }
+        
+        // A changed file keeps its number
+        if (found && compact) {
+            previous_numbers[relative_path] = get_compact_number(previous.target);
+        }
+        
+        synced[relative_path] = std::move(entry);
+        unprobed.push_back(relative_path);
+    }
+    
+    // Weed out broken and unwanted images before spending any I/O on them
+    std::vector<WallyImageInfo> infos = probe_files(self, source_folder, unprobed, synced);
+    if (g_cancellable_set_error_if_cancelled(cancellable, error)) {
+        return FALSE;
+    }
+    
+    for (gsize i = 0; i < unprobed.size(); i++) {
+        const std::string& relative_path = unprobed[i];
+        WallyManifestEntry& entry = synced[relative_path];
+        const WallyImageInfo& info = infos[i];
+        
+        if (info.format == WALLY_IMAGE_FORMAT_UNKNOWN || !passes_filters(self, entry)) {
+            stats->rejected++;
+            synced.erase(relative_path);
+            continue;
+        }
+        
+        // A converted copy is named after the original plus its new extension
+        std::string import_name = relative_path;
+        gboolean transcode = FALSE;
+        if (self->transcode && wally_transcoder_is_heavy_filename(relative_path.c_str())) {
+            transcode = wally_transcoder_should_transcode(&info);
+            if (transcode) {
+                import_name += wally_transcoder_get_extension(&info);
+            } else if (info.format == WALLY_IMAGE_FORMAT_BMP || info.format == WALLY_IMAGE_FORMAT_TIFF) {
+                g_message("Importing %s as it is: %ux%u is too large to convert",
+                          relative_path.c_str(), info.width, info.height);
+            }
+        }
+        
+        if (use_store) {
+            unhashed.push_back(relative_path);
+            unhashed_names.push_back(std::move(import_name));
+            continue;
+        }
+        
+        if (compact) {
+            auto previous_number = previous_numbers.find(relative_path);
+            guint number = previous_number != previous_numbers.end() && previous_number->second > 0
+                           ? previous_number->second : next_number++;
+            entry.target = get_compact_path(dest_folder, number, import_name);
+            manifest->last_number = MAX(manifest->last_number, number);
+        } else if (entry.target.empty()) {
+            entry.target = (std::filesystem::path(dest_folder) / import_name).string();
+        }
+        
+        // Keep whatever is there now until the import has succeeded
+        targets.insert(entry.target);
+        
+        // Mirror the source's subfolders
+        std::string dest_parent = std::filesystem::path(entry.target).parent_path().string();
+        if (created_folders.insert(dest_parent).second && g_mkdir_with_parents(dest_parent.c_str(), 0755) != 0) {
+            g_warning("Failed to create directory %s", dest_parent.c_str());
+        }
+        
+        WallyImportJob job = {};
+        job.source = (std::filesystem::path(source_folder) / relative_path).string();
+        job.dest = entry.target;
+        // Brightness is cached by content
+        job.compute_hash = self->verify_content_hash || self->auto_classify;
+        job.transcode = transcode;
+        jobs.push_back(std::move(job));
+        job_relative_paths.push_back(relative_path);
+    }
+    
+    // Store each distinct content once, whichever folder or file it came from
+    std::vector<guint64> hashes = hash_files(self, source_folder, unhashed, cancellable);
+    if (g_cancellable_set_error_if_cancelled(cancellable, error)) {
+        return FALSE;
+    }
+    
+    for (gsize i = 0; i < unhashed.size(); i++) {
+        const std::string& relative_path = unhashed[i];
+        
+        if (hashes[i] == 0) {
+            stats->failed++;
+            synced.erase(relative_path);
+            continue;
+        }
+        
+        WallyManifestEntry& entry = synced[relative_path];
+        gboolean transcode = unhashed_names[i] != relative_path;
+        entry.hash = hashes[i];
+        entry.target = get_store_path(self, unhashed_names[i], entry.hash);
+        
+        // Already stored, or about to be for an identical file
+        guint64 stored_size;
+        gint64 stored_mtime_ns;
+        if (!stored_targets.insert(entry.target).second ||
+            (stat_file(entry.target, &stored_size, &stored_mtime_ns) && (transcode || stored_size == entry.size))) {
+            stats->skipped++;
+            continue;
+        }
+        
+        WallyImportJob job = {};
+        job.source = (std::filesystem::path(source_folder) / relative_path).string();
+        job.dest = entry.target;
+        job.transcode = transcode;
+        jobs.push_back(std::move(job));
+        job_relative_paths.push_back(relative_path);
+    }
+    
+    wally_trace_span_end(&span, image_files.size(), 0);
+    
+    // Copy them in parallel; failures are collected per file
+    stats->queued = jobs.size();
+    guint64 bytes_before = stats->bytes_copied;
+    wally_trace_span_begin(&span, "copy");
+    wally_import_engine_run(self->import_engine, jobs, cancellable,
+                            [stats](const WallyImportJob& job) {
+                                if (job.error.empty()) {
+                                    stats->copied++;
+                                    stats->bytes_copied += job.bytes;
+                                    if (job.transcode) {
+                                        stats->transcoded++;
+                                    }
+                                } else {
+                                    stats->failed++;
+                                }
+                            });
+    wally_trace_span_end(&span, jobs.size(), stats->bytes_copied - bytes_before);
+    
+    gboolean cancelled = g_cancellable_is_cancelled(cancellable);
+    std::set<std::string> failed_targets;
+    
+    for (gsize i = 0; i < jobs.size(); i++) {
+        const WallyImportJob& job = jobs[i];
+        
+        if (!job.error.empty()) {
+            if (!cancelled) {
+                g_warning("%s", job.error.c_str());
+            }
+            failed_targets.insert(job.dest);
+            continue;
+        }
+        
+        if (!use_store) {
+            synced[job_relative_paths[i]].hash = job.hash;
+        }
+    }
+    
+    // Leave failed files out of the manifest so the next sync retries them
+    for (auto it = synced.begin(); it != synced.end();) {
+        if (failed_targets.count(it->second.target) > 0) {
+            it = synced.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    
+    if (cancelled) {
+        // Remember what did get imported so the next run picks up from here
+        manifest->entries = std::move(synced);
+        wally_sync_manifest_merge_previous(manifest);
+        wally_sync_manifest_save(manifest, NULL);
+        
+        g_cancellable_set_error_if_cancelled(cancellable, error);
+        return FALSE;
+    }
+    
+    report_duplicates(synced, stats);
+    
+    // Remove images that no longer come from the source folder
+    std::vector<std::string> imported_files;
+    std::vector<std::string> subfolders;
+    get_imported_files(dest_folder, imported_files, subfolders);
+    
+    for (const std::string& dest_file : imported_files) {
+        if (targets.count(dest_file) > 0) {
+            continue;
+        }
+        
+        if (g_unlink(dest_file.c_str()) == 0) {
+            if (!g_str_has_suffix(dest_file.c_str(), ".wally-part")) {
+                stats->deleted++;
+            }
+        } else {
+            g_warning("Failed to remove stale wallpaper %s", dest_file.c_str());
+        }
+    }
+    
+    // Then the subfolders that emptied out; rmdir() leaves the others alone
+    for (const std::string& subfolder : subfolders) {
+        g_rmdir(subfolder.c_str());
+    }
+    
+    if (self->auto_classify) {
+        measure_luminance(self, synced, cancellable);
+    }
+    
+    manifest->entries = std::move(synced);
+    
+    GError *save_error = NULL;
+    if (!wally_sync_manifest_save(manifest, &save_error)) {
+        // Not fatal: the next sync just re-checks everything
+        g_warning("Failed to save sync manifest: %s", save_error->message);
+        g_error_free(save_error);
+    }
+    
+    if (manifest->entries.empty()) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                    "Failed to import any of the %u wallpapers from %s",
+                    stats->failed.load(), source_folder);
+        return FALSE;
+    }
+    
+    return TRUE;
+}
+
+/*
+ * Caps the space imported copies may take up, 0 for no limit. Over it,
+ * pruning swaps the copies shown longest ago for links to their source.
+ */
+void
+wally_slideshow_manager_set_store_quota(WallySlideshowManager *self,
+                                        guint64 max_bytes)
+{
+    g_return_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self));
+    
+    self->store_quota = max_bytes;
+}
+
+// Space a file takes up only because it was imported; links to the source
+// share its data
+static guint64
+get_owned_size(const struct stat& st)
+{
+    return S_ISREG(st.st_mode) && st.st_nlink == 1 ? st.st_size : 0;
+}
+
+// Swap an imported copy for a link to where it came from, without the path
+// ever going missing in between
+static gboolean
+replace_with_link(const std::string& path, const std::string& source_file)
+{
+    std::string partial = path + ".wally-part";
+    g_autofree char *absolute_source = g_canonicalize_filename(source_file.c_str(), NULL);
+    
+    g_unlink(partial.c_str());
+    if (symlink(absolute_source, partial.c_str()) != 0 || rename(partial.c_str(), path.c_str()) != 0) {
+        g_warning("Failed to link %s to its source: %s", path.c_str(), g_strerror(errno));
+        g_unlink(partial.c_str());
+        return FALSE;
+    }
+    
+    return TRUE;
+}
+
+/*
+ * Removes imported files that neither a collection's index nor one of the
+ * slideshows at @xml_paths uses, from the store and from @dest_folders.
+ * Then, while the copies left and the downscaled ones take up more than the
+ * store quota, the ones shown longest ago are replaced by a link to their
+ * source. "Shown" goes by the access time of the file the slideshow points
+ * at, the downscaled copy when there is one. The shell reading a wallpaper
+ * updates it, but under relatime only about once a day, so images shown on
+ * the same day come in no particular order. Copies whose source is gone or
+ * differs, converted ones included, are kept.
+ *
+ * With @dry_run nothing is changed; @stats and @on_file tell what would be.
+ */
+gboolean
+wally_slideshow_manager_prune_store(WallySlideshowManager *self,
+                                    const char * const *dest_folders,
+                                    const char * const *xml_paths,
+                                    gboolean dry_run,
+                                    WallyPruneStats *stats,
+                                    const WallyPruneCallback& on_file,
+                                    GError **error)
+{
+    g_return_val_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self), FALSE);
+    g_return_val_if_fail(dest_folders != NULL, FALSE);
+    g_return_val_if_fail(xml_paths != NULL, FALSE);
+    
+    WallyPruneStats local_stats{};
+    if (stats == NULL) {
+        stats = &local_stats;
+    }
+    *stats = WallyPruneStats{};
+    
+    // Anything a collection or a slideshow still points at stays; the
+    // collections also tell where each file came from and which downscaled
+    // copy the slideshows show in its place
+    std::set<std::string> referenced;
+    std::map<std::string, std::string> source_files;
+    std::map<std::string, std::string> scaled_files;
+    for (const char * const *dest_folder = dest_folders; *dest_folder != NULL; dest_folder++) {
+        g_autoptr(WallyLibraryIndex) index = wally_library_index_open(*dest_folder, NULL);
+        gsize n_records = index != NULL ? wally_library_index_get_n_records(index) : 0;
+        const char *source_root = index != NULL ? wally_library_index_get_source_root(index) : NULL;
+        
+        for (gsize i = 0; i < n_records; i++) {
+            const WallyIndexRecord *record = wally_library_index_get_record(index, i);
+            const char *target = wally_library_index_get_string(index, record->target);
+            referenced.insert(target);
+            
+            if (source_root != NULL) {
+                const char *relative_path = wally_library_index_get_string(index, record->relative_path);
+                source_files.emplace(target, (std::filesystem::path(source_root) / relative_path).string());
+            }
+            
+            if (self->scale_width > 0) {
+                WallyManifestEntry entry;
+                wally_library_index_get_entry(index, record, &entry);
+                scaled_files.emplace(target, wally_scaled_cache_get_path(self->scaled_cache_dir, entry,
+                                                                         self->scale_width, self->scale_height));
+            }
+        }
+    }
+    
+    for (const char * const *xml_path = xml_paths; *xml_path != NULL; xml_path++) {
+        std::vector<std::string> files;
+        double duration;
+        if (wally_slideshow_read(*xml_path, files, &duration, NULL)) {
+            referenced.insert(files.begin(), files.end());
+        }
+    }
+    
+    // Everything imported: the collection folders and the store
+    std::vector<std::string> imported_files;
+    std::vector<std::string> subfolders;
+    for (const char * const *dest_folder = dest_folders; *dest_folder != NULL; dest_folder++) {
+        if (g_file_test(*dest_folder, G_FILE_TEST_IS_DIR)) {
+            get_imported_files(*dest_folder, imported_files, subfolders);
+        }
+    }
+    
+    if (g_file_test(self->store_folder, G_FILE_TEST_IS_DIR)) {
+        g_autoptr(GDir) dir = g_dir_open(self->store_folder, 0, error);
+        if (dir == NULL) {
+            return FALSE;
+        }
+        
+        const char *name;
+        while ((name = g_dir_read_name(dir)) != NULL) {
+            imported_files.push_back((std::filesystem::path(self->store_folder) / name).string());
+        }
+    }
+    
+    struct OwnedFile
+    {
+        std::string path;
+        guint64 size;
+        gint64 atime_ns;
+    };
+    std::vector<OwnedFile> owned;
+    
+    for (const std::string& path : imported_files) {
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0) {
+            continue;
+        }
+        
+        guint64 size = get_owned_size(st);
+        if (referenced.count(path) > 0) {
+            if (size > 0) {
+                // The slideshows read the downscaled copy instead when there is one
+                struct stat shown_st;
+                auto scaled_file = scaled_files.find(path);
+                if (scaled_file == scaled_files.end() || stat(scaled_file->second.c_str(), &shown_st) != 0) {
+                    shown_st = st;
+                }
+                
+                gint64 atime_ns = shown_st.st_atim.tv_sec * G_GINT64_CONSTANT(1000000000) +
+                                  shown_st.st_atim.tv_nsec;
+                owned.push_back({path, size, atime_ns});
+                stats->used_bytes += size;
+            }
+            continue;
+        }
+        
+        if (!dry_run && g_unlink(path.c_str()) != 0) {
+            g_warning("Failed to remove unused wallpaper %s", path.c_str());
+            continue;
+        }
+        
+        stats->removed++;
+        stats->removed_bytes += size;
+        if (on_file) {
+            on_file(WALLY_PRUNE_ACTION_REMOVE, path, size);
+        }
+    }
+    
+    // rmdir() leaves the subfolders that still hold something alone
+    if (!dry_run) {
+        for (const std::string& subfolder : subfolders) {
+            g_rmdir(subfolder.c_str());
+        }
+    }
+    
+    // Downscaled copies count against the quota too, though only the
+    // originals can be swapped for links
+    g_autoptr(GDir) scaled_dir = g_dir_open(self->scaled_cache_dir, 0, NULL);
+    const char *scaled_name;
+    while (scaled_dir != NULL && (scaled_name = g_dir_read_name(scaled_dir)) != NULL) {
+        g_autofree char *path = g_build_filename(self->scaled_cache_dir, scaled_name, NULL);
+        struct stat st;
+        if (lstat(path, &st) == 0) {
+            stats->used_bytes += get_owned_size(st);
+        }
+    }
+    
+    if (self->store_quota == 0 || stats->used_bytes <= self->store_quota) {
+        return TRUE;
+    }
+    
+    std::sort(owned.begin(), owned.end(), [](const OwnedFile& a, const OwnedFile& b) {
+        return a.atime_ns < b.atime_ns;
+    });
+    
+    for (const OwnedFile& file : owned) {
+        if (stats->used_bytes <= self->store_quota) {
+            break;
+        }
+        
+        // Only where the source still holds the same image
+        auto source_file = source_files.find(file.path);
+        struct stat source_st;
+        if (source_file == source_files.end() || stat(source_file->second.c_str(), &source_st) != 0 ||
+            !S_ISREG(source_st.st_mode) || (guint64)source_st.st_size != file.size) {
+            continue;
+        }
+        
+        if (!dry_run && !replace_with_link(file.path, source_file->second)) {
+            continue;
+        }
+        
+        stats->evicted++;
+        stats->evicted_bytes += file.size;
+        stats->used_bytes -= file.size;
+        if (on_file) {
+            on_file(WALLY_PRUNE_ACTION_EVICT, file.path, file.size);
+        }
+    }
+    
+    if (stats->used_bytes > self->store_quota) {
+        g_autofree char *used = g_format_size(stats->used_bytes);
+        g_message("Imported wallpapers still take up %s, over the store quota: the rest have no source to link to",
+                  used);
+    }
+    
+    return TRUE;
+}
+
+gboolean
+wally_slideshow_manager_prescale_wallpapers(WallySlideshowManager *self,
+                                            const char * const *dest_folders,
+                                            WallyScaleStats *stats,
+                                            GCancellable *cancellable,
+                                            GError **error)
+{
+    g_return_val_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self), FALSE);
+    g_return_val_if_fail(dest_folders != NULL, FALSE);
+    
+    WallyScaleStats local_stats{};
+    if (stats == NULL) {
+        stats = &local_stats;
+    }
+    
+    // Every image the collections use, once, with the copy it would get
+    std::map<std::string, std::string> scaled_paths;
+    if (self->scale_width > 0) {
+        for (const char * const *dest_folder = dest_folders; *dest_folder != NULL; dest_folder++) {
+            g_autoptr(WallyLibraryIndex) index = wally_library_index_open(*dest_folder, NULL);
+            gsize n_records = index != NULL ? wally_library_index_get_n_records(index) : 0;
+            for (gsize i = 0; i < n_records; i++) {
+                WallyManifestEntry entry;
+                wally_library_index_get_entry(index, wally_library_index_get_record(index, i), &entry);
+                scaled_paths.emplace(entry.target,
+                                     wally_scaled_cache_get_path(self->scaled_cache_dir, entry,
+                                                                 self->scale_width, self->scale_height));
+            }
+        }
+    }
+    
+    std::vector<std::pair<std::string, std::string>> work(scaled_paths.begin(), scaled_paths.end());
+    stats->queued = work.size();
+    
+    // Decoding dominates, so each core takes whole images
+    wally_parallel_for(work.size(), self->max_workers, [&](gsize index, guint worker G_GNUC_UNUSED) {
+        if (g_cancellable_is_cancelled(cancellable)) {
+            return;
+        }
+        
+        const auto& [source_path, cache_path] = work[index];
+        WallyScaleResult result;
+        GError *scale_error = NULL;
+        if (!wally_scaled_cache_build(source_path.c_str(), cache_path.c_str(),
+                                      self->scale_width, self->scale_height, &result, &scale_error)) {
+            g_warning("Failed to downscale %s: %s", source_path.c_str(), scale_error->message);
+            g_error_free(scale_error);
+            stats->failed++;
+        } else if (result == WALLY_SCALE_RESULT_SCALED) {
+            stats->scaled++;
+        }
+        stats->done++;
+    });
+    
+    if (g_cancellable_set_error_if_cancelled(cancellable, error)) {
+        return FALSE;
+    }
+    
+    // Drop copies nothing points at any more, including all of them when
+    // prescaling was turned off
+    std::set<std::string> wanted;
+    for (const auto& [source_path, cache_path] : work) {
+        wanted.insert(cache_path);
+    }
+    
+    g_autoptr(GDir) dir = g_dir_open(self->scaled_cache_dir, 0, NULL);
+    const char *name;
+    while (dir != NULL && (name = g_dir_read_name(dir)) != NULL) {
+        g_autofree char *path = g_build_filename(self->scaled_cache_dir, name, NULL);
+        if (wanted.count(path) == 0) {
+            g_unlink(path);
+        }
+    }
+    
+    return TRUE;
+}
+
+void
+wally_slideshow_manager_next_wallpaper(WallySlideshowManager *self)
+{
+    g_return_if_fail(WALLY_IS_SLIDESHOW_MANAGER(self));
     
-    g_autofree char *current_uri = g_settings_get_string(bg_settings, "picture-uri");
+    // Force GNOME to reload the slideshows by briefly clearing both keys and
+    // then restoring them; the shell restarts them at the next image
+    WallyBackgroundWriter *writer = wally_background_writer_get_default();
+    g_autofree char *light_uri = wally_background_writer_get_uri(writer, FALSE);
+    g_autofree char *dark_uri = wally_background_writer_get_uri(writer, TRUE);
     
-    // Temporarily set to a different value to force refresh
-    g_settings_set_string(bg_settings, "picture-uri", "");
-    g_settings_sync();
+    wally_background_writer_set_uri(writer, FALSE, "");
+    wally_background_writer_set_uri(writer, TRUE, "");
+    wally_background_writer_commit(writer);
+    wally_background_writer_flush(writer);
     
-    // Set back to original value to continue slideshow
-    g_settings_set_string(bg_settings, "picture-uri", current_uri);
-    g_settings_sync();
+    wally_background_writer_set_uri(writer, FALSE, light_uri);
+    wally_background_writer_set_uri(writer, TRUE, dark_uri);
+    wally_background_writer_commit(writer);
+    wally_background_writer_flush(writer);
 }
@@ -1,7 +1,11 @@
 #pragma once
 
+#include "import-engine.h"
+
 #include <glib-object.h>
 #include <gio/gio.h>
+#include <atomic>
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -11,15 +15,158 @@ G_BEGIN_DECLS
 
 G_DECLARE_FINAL_TYPE(WallySlideshowManager, wally_slideshow_manager, WALLY, SLIDESHOW_MANAGER, GObject)
 
+/*
+ * Outcome of wally_slideshow_manager_copy_wallpapers(). The counters are
+ * updated while the sync runs, so another thread may read them to show
+ * progress. Zero-initialize with WallySyncStats stats{};
+ *
+ * duplicates counts files whose bytes match an earlier file in the same
+ * source folder; they are only detected when content hashes are computed.
+ * rejected counts files left out because they aren't valid images or don't
+ * meet the size filters. transcoded counts the copied files that were
+ * converted on the way.
+ */
+typedef struct
+{
+    std::atomic<guint> scanned;
+    std::atomic<guint> queued;
+    std::atomic<guint> copied;
+    std::atomic<guint> skipped;
+    std::atomic<guint> deleted;
+    std::atomic<guint> failed;
+    std::atomic<guint> duplicates;
+    std::atomic<guint> rejected;
+    std::atomic<guint> transcoded;
+    std::atomic<guint64> bytes_copied;
+} WallySyncStats;
+
+/*
+ * Progress of wally_slideshow_manager_prescale_wallpapers(), readable from
+ * another thread like WallySyncStats. Zero-initialize with WallyScaleStats stats{};
+ */
+typedef struct
+{
+    std::atomic<guint> queued;
+    std::atomic<guint> done;
+    std::atomic<guint> scaled;
+    std::atomic<guint> failed;
+} WallyScaleStats;
+
+/*
+ * What wally_slideshow_manager_prune_store() did or, on a dry run, would
+ * do. Removed files are imported files nothing uses any more; evicted ones
+ * are copies that were swapped for a link to their source to stay under
+ * the store quota. used_bytes is the space imported and downscaled copies
+ * take up after.
+ */
+typedef struct
+{
+    guint removed;
+    guint64 removed_bytes;
+    guint evicted;
+    guint64 evicted_bytes;
+    guint64 used_bytes;
+} WallyPruneStats;
+
+typedef enum
+{
+    WALLY_PRUNE_ACTION_REMOVE,
+    WALLY_PRUNE_ACTION_EVICT,
+} WallyPruneAction;
+
+// Called for each file pruned, or that would be on a dry run
+typedef std::function<void(WallyPruneAction action, const std::string& path, guint64 bytes)> WallyPruneCallback;
+
+/*
+ * Which images of a folder a slideshow shows when the manager sorts them
+ * into day and night itself; see wally_slideshow_manager_set_auto_classify().
+ */
+typedef enum
+{
+    WALLY_LUMINANCE_CLASS_ANY,
+    WALLY_LUMINANCE_CLASS_DAY,
+    WALLY_LUMINANCE_CLASS_NIGHT,
+} WallyLuminanceClass;
+
 WallySlideshowManager *wally_slideshow_manager_new(void);
 
+void wally_slideshow_manager_set_import_workers(WallySlideshowManager *self,
+                                                guint max_workers);
+
+void wally_slideshow_manager_set_import_mode(WallySlideshowManager *self,
+                                             WallyImportMode mode);
+
+void wally_slideshow_manager_set_verify_content_hash(WallySlideshowManager *self,
+                                                     gboolean verify);
+
+void wally_slideshow_manager_set_transcode(WallySlideshowManager *self,
+                                           gboolean transcode,
+                                           int quality);
+
+void wally_slideshow_manager_set_recursive(WallySlideshowManager *self,
+                                           gboolean recursive);
+
+void wally_slideshow_manager_set_deduplicate(WallySlideshowManager *self,
+                                             gboolean deduplicate);
+
+void wally_slideshow_manager_set_compact_names(WallySlideshowManager *self,
+                                               gboolean compact_names);
+
+void wally_slideshow_manager_set_scheduled(WallySlideshowManager *self,
+                                           gboolean scheduled);
+
+gboolean wally_slideshow_manager_get_scheduled(WallySlideshowManager *self);
+
+void wally_slideshow_manager_set_shuffle(WallySlideshowManager *self,
+                                         gboolean shuffle,
+                                         guint64 seed);
+
+void wally_slideshow_manager_set_auto_classify(WallySlideshowManager *self,
+                                               gboolean auto_classify,
+                                               double mean_threshold,
+                                               double bright_threshold);
+
+gboolean wally_slideshow_manager_get_auto_classify(WallySlideshowManager *self);
+
+void wally_slideshow_manager_set_filters(WallySlideshowManager *self,
+                                         guint min_width,
+                                         guint min_height,
+                                         double min_aspect_ratio,
+                                         double max_aspect_ratio);
+
+void wally_slideshow_manager_set_scale_target(WallySlideshowManager *self,
+                                              int width,
+                                              int height);
+
+void wally_slideshow_manager_load_settings(WallySlideshowManager *self,
+                                           GSettings *settings);
+
 gboolean wally_slideshow_manager_create_slideshow_xml(WallySlideshowManager *self,
                                                       const char *folder_path,
                                                       const char *output_path,
                                                       int interval_seconds,
                                                       double transition_duration,
+                                                      gboolean *changed,
                                                       GError **error);
 
+gboolean wally_slideshow_manager_create_classified_xml(WallySlideshowManager *self,
+                                                       const char *folder_path,
+                                                       const char *output_path,
+                                                       WallyLuminanceClass luminance_class,
+                                                       int interval_seconds,
+                                                       double transition_duration,
+                                                       gboolean *changed,
+                                                       GError **error);
+
+gboolean wally_slideshow_manager_is_wallpaper_applied(WallySlideshowManager *self,
+                                                      const char *xml_path,
+                                                      gboolean is_dark_theme);
+
+gboolean wally_slideshow_manager_stage_wallpaper(WallySlideshowManager *self,
+                                                  const char *xml_path,
+                                                  gboolean is_dark_theme,
+                                                  GError **error);
+
 gboolean wally_slideshow_manager_apply_wallpaper(WallySlideshowManager *self,
                                                   const char *xml_path,
                                                   gboolean is_dark_theme,
@@ -28,8 +175,27 @@ gboolean wally_slideshow_manager_apply_wallpaper(WallySlideshowManager *self,
 gboolean wally_slideshow_manager_copy_wallpapers(WallySlideshowManager *self,
                                                   const char *source_folder,
                                                   const char *dest_folder,
+                                                  WallySyncStats *stats,
+                                                  GCancellable *cancellable,
                                                   GError **error);
 
+void wally_slideshow_manager_set_store_quota(WallySlideshowManager *self,
+                                             guint64 max_bytes);
+
+gboolean wally_slideshow_manager_prune_store(WallySlideshowManager *self,
+                                             const char * const *dest_folders,
+                                             const char * const *xml_paths,
+                                             gboolean dry_run,
+                                             WallyPruneStats *stats,
+                                             const WallyPruneCallback& on_file,
+                                             GError **error);
+
+gboolean wally_slideshow_manager_prescale_wallpapers(WallySlideshowManager *self,
+                                                     const char * const *dest_folders,
+                                                     WallyScaleStats *stats,
+                                                     GCancellable *cancellable,
+                                                     GError **error);
+
 void wally_slideshow_manager_next_wallpaper(WallySlideshowManager *self);
 
 G_END_DECLS
@@ -0,0 +1,478 @@
+#include "slideshow-writer.h"
+
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+// Output is handed to the kernel in blocks of this size
+static const gsize WRITE_BUFFER_SIZE = 64 * 1024;
+
+// Slideshows are read back in chunks of this size
+#define PARSE_CHUNK_SIZE (64 * 1024)
+
+static const char SLIDESHOW_HEADER[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<!DOCTYPE background SYSTEM \"gnome-wp-list.dtd\">\n"
+    "<background>\n"
+    "  <starttime>\n"
+    "    <year>2024</year>\n"
+    "    <month>01</month>\n"
+    "    <day>01</day>\n"
+    "    <hour>00</hour>\n"
+    "    <minute>00</minute>\n"
+    "    <second>00</second>\n"
+    "  </starttime>\n";
+
+// Bump when the output format changes, so old files count as different
+#define FINGERPRINT_VERSION 1
+
+#define FINGERPRINT_PREFIX "<!-- wally-fingerprint "
+#define FINGERPRINT_SUFFIX " -->\n"
+
+struct _WallySlideshowWriter
+{
+    char *output_path;
+    char *partial_path;
+    GOutputStream *stream;
+    GCancellable *cancellable;
+    
+    char interval[16];
+    char transition[G_ASCII_DTOSTR_BUF_SIZE];
+    
+    // A transition needs the image after it, so each one is written when
+    // the next image arrives; the last wraps round to the first
+    std::string first_file;
+    std::string previous_file;
+    guint count;
+    gboolean finished;
+    
+    WallySlideshowFingerprint fingerprint;
+};
+
+static void
+format_timings(int interval_seconds, double transition_duration,
+               char *interval, gsize interval_size, char *transition, gsize transition_size)
+{
+    // Always a dot for the decimal separator, whatever the locale
+    g_snprintf(interval, interval_size, "%d", interval_seconds);
+    g_ascii_formatd(transition, transition_size, "%.1f", transition_duration);
+}
+
+void
+wally_slideshow_fingerprint_init(WallySlideshowFingerprint *fingerprint,
+                                 int interval_seconds,
+                                 double transition_duration)
+{
+    g_return_if_fail(fingerprint != NULL);
+    
+    char interval[16];
+    char transition[G_ASCII_DTOSTR_BUF_SIZE];
+    format_timings(interval_seconds, transition_duration,
+                   interval, sizeof(interval), transition, sizeof(transition));
+    
+    // Timings as written, so values that print the same match
+    wally_hash_init(&fingerprint->state, FINGERPRINT_VERSION);
+    wally_hash_update(&fingerprint->state, interval, strlen(interval) + 1);
+    wally_hash_update(&fingerprint->state, transition, strlen(transition) + 1);
+}
+
+void
+wally_slideshow_fingerprint_add_file(WallySlideshowFingerprint *fingerprint,
+                                     const char *path)
+{
+    g_return_if_fail(fingerprint != NULL);
+    g_return_if_fail(path != NULL);
+    
+    wally_hash_update(&fingerprint->state, path, strlen(path) + 1);
+}
+
+guint64
+wally_slideshow_fingerprint_finish(const WallySlideshowFingerprint *fingerprint)
+{
+    g_return_val_if_fail(fingerprint != NULL, 0);
+    
+    return wally_hash_finish(&fingerprint->state);
+}
+
+gboolean
+wally_slideshow_read_fingerprint(const char *path,
+                                 guint64 *fingerprint)
+{
+    g_return_val_if_fail(path != NULL, FALSE);
+    g_return_val_if_fail(fingerprint != NULL, FALSE);
+    
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return FALSE;
+    }
+    
+    // The comment is the last line; only the tail is read
+    char tail[64];
+    off_t size = lseek(fd, 0, SEEK_END);
+    off_t offset = MAX(size - (off_t)(sizeof(tail) - 1), (off_t)0);
+    ssize_t n = size > 0 ? pread(fd, tail, MIN((off_t)(sizeof(tail) - 1), size), offset) : -1;
+    close(fd);
+    
+    if (n <= 0) {
+        return FALSE;
+    }
+    tail[n] = '\0';
+    
+    const char *comment = g_strrstr(tail, FINGERPRINT_PREFIX);
+    if (comment == NULL) {
+        return FALSE;
+    }
+    
+    char *end = NULL;
+    *fingerprint = g_ascii_strtoull(comment + strlen(FINGERPRINT_PREFIX), &end, 16);
+    return end != NULL && g_str_has_prefix(end, FINGERPRINT_SUFFIX);
+}
+
+// Only the <file> of each <static> matters; the first <static>'s
+// <duration> gives the interval
+typedef struct
+{
+    std::vector<std::string> files;
+    double duration;
+    gboolean in_static;
+    gboolean collecting;
+    GString *text;
+} SlideshowParser;
+
+static void
+parser_start_element(GMarkupParseContext *context G_GNUC_UNUSED,
+                     const char *element_name,
+                     const char **attribute_names G_GNUC_UNUSED,
+                     const char **attribute_values G_GNUC_UNUSED,
+                     gpointer user_data,
+                     GError **error G_GNUC_UNUSED)
+{
+    SlideshowParser *parser = static_cast<SlideshowParser*>(user_data);
+    
+    if (g_str_equal(element_name, "static")) {
+        parser->in_static = TRUE;
+    } else if (parser->in_static &&
+               (g_str_equal(element_name, "file") || g_str_equal(element_name, "duration"))) {
+        parser->collecting = TRUE;
+        g_string_truncate(parser->text, 0);
+    }
+}
+
+static void
+parser_end_element(GMarkupParseContext *context G_GNUC_UNUSED,
+                   const char *element_name,
+                   gpointer user_data,
+                   GError **error G_GNUC_UNUSED)
+{
+    SlideshowParser *parser = static_cast<SlideshowParser*>(user_data);
+    
+    if (g_str_equal(element_name, "static")) {
+        parser->in_static = FALSE;
+    } else if (parser->collecting && g_str_equal(element_name, "file")) {
+        parser->files.emplace_back(g_strstrip(parser->text->str));
+    } else if (parser->collecting && g_str_equal(element_name, "duration") && parser->duration <= 0) {
+        parser->duration = g_ascii_strtod(parser->text->str, NULL);
+    }
+    
+    parser->collecting = FALSE;
+}
+
+static void
+parser_text(GMarkupParseContext *context G_GNUC_UNUSED,
+            const char *text,
+            gsize text_len,
+            gpointer user_data,
+            GError **error G_GNUC_UNUSED)
+{
+    SlideshowParser *parser = static_cast<SlideshowParser*>(user_data);
+    
+    if (parser->collecting) {
+        g_string_append_len(parser->text, text, text_len);
+    }
+}
+
+gboolean
+wally_slideshow_read(const char *path,
+                     std::vector<std::string>& files,
+                     double *duration,
+                     GError **error)
+{
+    g_return_val_if_fail(path != NULL, FALSE);
+    g_return_val_if_fail(duration != NULL, FALSE);
+    
+    static const GMarkupParser markup_parser = {
+        parser_start_element,
+        parser_end_element,
+        parser_text,
+        NULL,
+        NULL,
+    };
+    
+    FILE *file = g_fopen(path, "rb");
+    if (file == NULL) {
+        int saved_errno = errno;
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved_errno),
+                    "Cannot open slideshow %s: %s", path, g_strerror(saved_errno));
+        return FALSE;
+    }
+    
+    SlideshowParser parser{};
+    parser.text = g_string_new(NULL);
+    GMarkupParseContext *context = g_markup_parse_context_new(&markup_parser, G_MARKUP_DEFAULT_FLAGS,
+                                                              &parser, NULL);
+    
+    std::vector<char> buffer(PARSE_CHUNK_SIZE);
+    gboolean success = TRUE;
+    size_t length;
+    while (success && (length = fread(buffer.data(), 1, buffer.size(), file)) > 0) {
+        success = g_markup_parse_context_parse(context, buffer.data(), length, error);
+    }
+    if (success) {
+        success = g_markup_parse_context_end_parse(context, error);
+    }
+    
+    g_markup_parse_context_free(context);
+    g_string_free(parser.text, TRUE);
+    fclose(file);
+    
+    if (!success) {
+        g_prefix_error(error, "Cannot read slideshow %s: ", path);
+        return FALSE;
+    }
+    
+    files = std::move(parser.files);
+    *duration = parser.duration;
+    return TRUE;
+}
+
+static gboolean
+write_text(WallySlideshowWriter *writer, const char *text, gsize length, GError **error)
+{
+    return g_output_stream_write_all(writer->stream, text, length, NULL, writer->cancellable, error);
+}
+
+static gboolean
+write_string(WallySlideshowWriter *writer, const char *text, GError **error)
+{
+    return write_text(writer, text, strlen(text), error);
+}
+
+// Write character data with the five XML special characters escaped
+static gboolean
+write_escaped(WallySlideshowWriter *writer, const std::string& text, GError **error)
+{
+    const char *run = text.c_str();
+    
+    for (const char *p = run; *p != '\0'; p++) {
+        const char *entity;
+        switch (*p) {
+        case '&':
+            entity = "&amp;";
+            break;
+        case '<':
+            entity = "&lt;";
+            break;
+        case '>':
+            entity = "&gt;";
+            break;
+        case '"':
+            entity = "&quot;";
+            break;
+        case '\'':
+            entity = "&apos;";
+            break;
+        default:
+            continue;
+        }
+        
+        if (!write_text(writer, run, p - run, error) || !write_string(writer, entity, error)) {
+            return FALSE;
+        }
+        run = p + 1;
+    }
+    
+    return write_string(writer, run, error);
+}
+
+static gboolean
+write_element(WallySlideshowWriter *writer, const char *indent, const char *name,
+              const std::string& value, gboolean escape, GError **error)
+{
+    return write_string(writer, indent, error) &&
+           write_string(writer, "<", error) && write_string(writer, name, error) && write_string(writer, ">", error) &&
+           (escape ? write_escaped(writer, value, error) : write_string(writer, value.c_str(), error)) &&
+           write_string(writer, "</", error) && write_string(writer, name, error) && write_string(writer, ">\n", error);
+}
+
+static gboolean
+write_transition(WallySlideshowWriter *writer, const std::string& from, const std::string& to, GError **error)
+{
+    return write_string(writer, "  <transition>\n", error) &&
+           write_element(writer, "    ", "duration", writer->transition, FALSE, error) &&
+           write_element(writer, "    ", "from", from, TRUE, error) &&
+           write_element(writer, "    ", "to", to, TRUE, error) &&
+           write_string(writer, "  </transition>\n", error);
+}
+
+// Get the written file onto the disk, so a crash after the rename can't
+// leave GNOME an empty slideshow in place of the old one
+static gboolean
+sync_file(const char *path, GError **error)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fdatasync(fd) != 0) {
+        int saved_errno = errno;
+        if (fd >= 0) {
+            close(fd);
+        }
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved_errno),
+                    "Failed to write %s to disk: %s", path, g_strerror(saved_errno));
+        return FALSE;
+    }
+    
+    close(fd);
+    return TRUE;
+}
+
+WallySlideshowWriter *
+wally_slideshow_writer_new(const char *output_path,
+                           int interval_seconds,
+                           double transition_duration,
+                           GCancellable *cancellable,
+                           GError **error)
+{
+    g_return_val_if_fail(output_path != NULL, NULL);
+    
+    g_autofree char *partial_path = g_strconcat(output_path, ".wally-part", NULL);
+    g_autoptr(GFile) file = g_file_new_for_path(partial_path);
+    g_autoptr(GFileOutputStream) file_stream = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_NONE,
+                                                              cancellable, error);
+    if (file_stream == NULL) {
+        return NULL;
+    }
+    
+    WallySlideshowWriter *writer = new WallySlideshowWriter();
+    writer->output_path = g_strdup(output_path);
+    writer->partial_path = g_steal_pointer(&partial_path);
+    writer->stream = g_buffered_output_stream_new_sized(G_OUTPUT_STREAM(file_stream), WRITE_BUFFER_SIZE);
+    writer->cancellable = cancellable != NULL ? static_cast<GCancellable*>(g_object_ref(cancellable)) : NULL;
+    
+    format_timings(interval_seconds, transition_duration,
+                   writer->interval, sizeof(writer->interval), writer->transition, sizeof(writer->transition));
+    wally_slideshow_fingerprint_init(&writer->fingerprint, interval_seconds, transition_duration);
+    
+    if (!write_text(writer, SLIDESHOW_HEADER, sizeof(SLIDESHOW_HEADER) - 1, error)) {
+        wally_slideshow_writer_free(writer);
+        return NULL;
+    }
+    
+    return writer;
+}
+
+gboolean
+wally_slideshow_writer_add_file(WallySlideshowWriter *writer,
+                                const char *path,
+                                GError **error)
+{
+    g_return_val_if_fail(writer != NULL, FALSE);
+    g_return_val_if_fail(!writer->finished, FALSE);
+    g_return_val_if_fail(path != NULL, FALSE);
+    
+    // Fingerprint what the caller asked for, skipped paths included, so that
+    // it matches one computed over the same list up front
+    wally_slideshow_fingerprint_add_file(&writer->fingerprint, path);
+    
+    // XML can't carry bytes that aren't UTF-8, nor most control characters
+    gboolean representable = g_utf8_validate(path, -1, NULL);
+    for (const char *p = path; representable && *p != '\0'; p++) {
+        representable = (guchar)*p >= 0x20 || *p == '\t';
+    }
+    if (!representable) {
+        g_autofree char *display_name = g_filename_display_name(path);
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_FILENAME,
+                    "Path can't be stored in a slideshow: %s", display_name);
+        return FALSE;
+    }
+    
+    if (writer->count > 0 && !write_transition(writer, writer->previous_file, path, error)) {
+        return FALSE;
+    }
+    
+    if (!write_string(writer, "  <static>\n", error) ||
+        !write_element(writer, "    ", "duration", writer->interval, FALSE, error) ||
+        !write_element(writer, "    ", "file", path, TRUE, error) ||
+        !write_string(writer, "  </static>\n", error)) {
+        return FALSE;
+    }
+    
+    if (writer->count == 0) {
+        writer->first_file = path;
+    }
+    writer->previous_file = path;
+    writer->count++;
+    
+    return TRUE;
+}
+
+guint
+wally_slideshow_writer_get_count(WallySlideshowWriter *writer)
+{
+    g_return_val_if_fail(writer != NULL, 0);
+    
+    return writer->count;
+}
+
+gboolean
+wally_slideshow_writer_finish(WallySlideshowWriter *writer,
+                              GError **error)
+{
+    g_return_val_if_fail(writer != NULL, FALSE);
+    g_return_val_if_fail(!writer->finished, FALSE);
+    
+    if (writer->count > 0 && !write_transition(writer, writer->previous_file, writer->first_file, error)) {
+        return FALSE;
+    }
+    
+    g_autofree char *fingerprint = g_strdup_printf(FINGERPRINT_PREFIX "%016" G_GINT64_MODIFIER "x" FINGERPRINT_SUFFIX,
+                                                   wally_slideshow_fingerprint_finish(&writer->fingerprint));
+    
+    if (!write_string(writer, "</background>\n", error) ||
+        !write_string(writer, fingerprint, error) ||
+        !g_output_stream_close(writer->stream, writer->cancellable, error) ||
+        !sync_file(writer->partial_path, error)) {
+        return FALSE;
+    }
+    
+    if (g_rename(writer->partial_path, writer->output_path) != 0) {
+        int saved_errno = errno;
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved_errno),
+                    "Failed to replace %s: %s", writer->output_path, g_strerror(saved_errno));
+        return FALSE;
+    }
+    
+    writer->finished = TRUE;
+    return TRUE;
+}
+
+void
+wally_slideshow_writer_free(WallySlideshowWriter *writer)
+{
+    if (writer == NULL) {
+        return;
+    }
+    
+    if (!writer->finished) {
+        g_output_stream_close(writer->stream, NULL, NULL);
+        g_unlink(writer->partial_path);
+    }
+    
+    g_clear_object(&writer->stream);
+    g_clear_object(&writer->cancellable);
+    g_free(writer->output_path);
+    g_free(writer->partial_path);
+    delete writer;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "content-hash.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <string>
+#include <vector>
+
+G_BEGIN_DECLS
+
+/*
+ * Writes a GNOME slideshow (gnome-wp-list) file one image at a time, straight
+ * to disk through a small buffer, so memory use doesn't depend on how many
+ * images there are. Paths are XML-escaped. The file is written next to the
+ * destination and only replaces it once wally_slideshow_writer_finish() has
+ * succeeded; freeing an unfinished writer leaves the old file in place.
+ */
+typedef struct _WallySlideshowWriter WallySlideshowWriter;
+
+/*
+ * Identifies a slideshow's content: the timings and the ordered image list.
+ * The writer records it in a trailing comment, so that a caller can compute
+ * it up front and leave an identical slideshow alone.
+ */
+typedef struct
+{
+    WallyHashState state;
+} WallySlideshowFingerprint;
+
+void wally_slideshow_fingerprint_init(WallySlideshowFingerprint *fingerprint,
+                                      int interval_seconds,
+                                      double transition_duration);
+
+void wally_slideshow_fingerprint_add_file(WallySlideshowFingerprint *fingerprint,
+                                          const char *path);
+
+guint64 wally_slideshow_fingerprint_finish(const WallySlideshowFingerprint *fingerprint);
+
+gboolean wally_slideshow_read_fingerprint(const char *path,
+                                          guint64 *fingerprint);
+
+/*
+ * Reads the images of a slideshow back, in order, along with how long the
+ * first one is shown. The file is parsed a chunk at a time, so even very
+ * large slideshows never sit in memory as text.
+ */
+gboolean wally_slideshow_read(const char *path,
+                              std::vector<std::string>& files,
+                              double *duration,
+                              GError **error);
+
+WallySlideshowWriter *wally_slideshow_writer_new(const char *output_path,
+                                                 int interval_seconds,
+                                                 double transition_duration,
+                                                 GCancellable *cancellable,
+                                                 GError **error);
+
+gboolean wally_slideshow_writer_add_file(WallySlideshowWriter *writer,
+                                         const char *path,
+                                         GError **error);
+
+guint wally_slideshow_writer_get_count(WallySlideshowWriter *writer);
+
+gboolean wally_slideshow_writer_finish(WallySlideshowWriter *writer,
+                                       GError **error);
+
+void wally_slideshow_writer_free(WallySlideshowWriter *writer);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(WallySlideshowWriter, wally_slideshow_writer_free)
+
+G_END_DECLS
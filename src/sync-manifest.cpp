@@ -0,0 +1,146 @@
+#include "sync-manifest.h"
+#include "library-index.h"
+
+WallySyncManifest *
+wally_sync_manifest_load(const char *dest_folder,
+                         const char *source_root,
+                         const char *options)
+{
+    g_return_val_if_fail(dest_folder != NULL, NULL);
+    g_return_val_if_fail(source_root != NULL, NULL);
+    g_return_val_if_fail(options != NULL, NULL);
+    
+    WallySyncManifest *manifest = new WallySyncManifest();
+    manifest->dest_folder = g_strdup(dest_folder);
+    manifest->source_root = source_root;
+    manifest->options = options;
+    
+    GError *error = NULL;
+    manifest->previous = wally_library_index_open(dest_folder, &error);
+    if (manifest->previous == NULL) {
+        // No index yet; everything will be treated as new
+        if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            g_warning("Ignoring library index: %s", error->message);
+        }
+        g_error_free(error);
+        return manifest;
+    }
+    
+    // Records made from another folder or with other options don't apply
+    if (g_strcmp0(wally_library_index_get_source_root(manifest->previous), source_root) != 0 ||
+        g_strcmp0(wally_library_index_get_options(manifest->previous), options) != 0) {
+        g_clear_pointer(&manifest->previous, wally_library_index_free);
+        return manifest;
+    }
+    
+    manifest->last_number = wally_library_index_get_last_number(manifest->previous);
+    
+    return manifest;
+}
+
+// Looks up what the last import recorded for a file
+gboolean
+wally_sync_manifest_lookup(WallySyncManifest *manifest,
+                           const std::string& relative_path,
+                           WallyManifestEntry *entry)
+{
+    g_return_val_if_fail(manifest != NULL, FALSE);
+    g_return_val_if_fail(entry != NULL, FALSE);
+    
+    if (manifest->previous == NULL) {
+        return FALSE;
+    }
+    
+    const WallyIndexRecord *record = wally_library_index_lookup(manifest->previous, relative_path.c_str());
+    if (record == NULL) {
+        return FALSE;
+    }
+    
+    wally_library_index_get_entry(manifest->previous, record, entry);
+    return TRUE;
+}
+
+// Carries over the records entries has nothing newer for, e.g. to keep the
+// work of an import that was cancelled
+void
+wally_sync_manifest_merge_previous(WallySyncManifest *manifest)
+{
+    g_return_if_fail(manifest != NULL);
+    
+    if (manifest->previous == NULL) {
+        return;
+    }
+    
+    gsize n_records = wally_library_index_get_n_records(manifest->previous);
+    for (gsize i = 0; i < n_records; i++) {
+        const WallyIndexRecord *record = wally_library_index_get_record(manifest->previous, i);
+        std::string relative_path = wally_library_index_get_string(manifest->previous, record->relative_path);
+        if (manifest->entries.count(relative_path) == 0) {
+            wally_library_index_get_entry(manifest->previous, record, &manifest->entries[relative_path]);
+        }
+    }
+}
+
+static gboolean
+entries_equal(const WallyManifestEntry& a,
+              const WallyManifestEntry& b)
+{
+    return a.target == b.target && a.size == b.size && a.mtime_ns == b.mtime_ns && a.hash == b.hash &&
+           a.width == b.width && a.height == b.height && a.luminance == b.luminance &&
+           a.luminance_p90 == b.luminance_p90;
+}
+
+// Whether entries holds exactly the records saved last
+static gboolean
+is_unchanged(WallySyncManifest *manifest)
+{
+    if (manifest->previous == NULL ||
+        wally_library_index_get_last_number(manifest->previous) != manifest->last_number ||
+        wally_library_index_get_n_records(manifest->previous) != manifest->entries.size()) {
+        return FALSE;
+    }
+    
+    // Both are sorted by relative path, so they can be walked side by side
+    gsize i = 0;
+    for (const auto& [relative_path, entry] : manifest->entries) {
+        const WallyIndexRecord *record = wally_library_index_get_record(manifest->previous, i++);
+        if (relative_path != wally_library_index_get_string(manifest->previous, record->relative_path)) {
+            return FALSE;
+        }
+        
+        WallyManifestEntry previous;
+        wally_library_index_get_entry(manifest->previous, record, &previous);
+        if (!entries_equal(entry, previous)) {
+            return FALSE;
+        }
+    }
+    
+    return TRUE;
+}
+
+// Writes entries as the collection's index, unless nothing changed
+gboolean
+wally_sync_manifest_save(WallySyncManifest *manifest,
+                         GError **error)
+{
+    g_return_val_if_fail(manifest != NULL, FALSE);
+    
+    if (is_unchanged(manifest)) {
+        return TRUE;
+    }
+    
+    return wally_library_index_write(manifest->dest_folder, manifest->source_root.c_str(),
+                                     manifest->options.c_str(), manifest->last_number, manifest->entries, error);
+}
+
+void
+wally_sync_manifest_free(WallySyncManifest *manifest)
+{
+    if (manifest == NULL) {
+        return;
+    }
+    
+    g_clear_pointer(&manifest->previous, wally_library_index_free);
+    g_free(manifest->dest_folder);
+    delete manifest;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <map>
+#include <string>
+
+G_BEGIN_DECLS
+
+/*
+ * Record of one imported wallpaper, keyed in the manifest by the file's path
+ * relative to the source folder. Size and mtime describe the source file at
+ * the time it was imported; hash is 0 when it was never computed. Width and
+ * height come from the image header and are 0 for images without a fixed
+ * size. Luminance is the mean brightness from 0 to 1 and luminance_p90 the
+ * brightness 90% of the pixels stay under; both are negative when the image
+ * was never measured.
+ *
+ * A manifest is the working copy of a collection's library index during an
+ * import. The records saved last are looked up in the mapped index; the
+ * import fills entries from scratch and saving writes them as the new
+ * index. The index also remembers the source folder and a string that
+ * describes the import options in effect; when either changes, the old
+ * records no longer apply and every file is imported again. last_number is
+ * carried from one index to the next, see WallyIndexHeader.
+ */
+typedef struct
+{
+    std::string target;
+    guint64 size;
+    gint64 mtime_ns;
+    guint64 hash;
+    guint32 width;
+    guint32 height;
+    float luminance = -1;
+    float luminance_p90 = -1;
+} WallyManifestEntry;
+
+typedef struct _WallyLibraryIndex WallyLibraryIndex;
+
+typedef struct _WallySyncManifest WallySyncManifest;
+
+struct _WallySyncManifest
+{
+    char *dest_folder;
+    std::string source_root;
+    std::string options;
+    guint32 last_number;
+    WallyLibraryIndex *previous;
+    std::map<std::string, WallyManifestEntry> entries;
+};
+
+WallySyncManifest *wally_sync_manifest_load(const char *dest_folder,
+                                            const char *source_root,
+                                            const char *options);
+
+gboolean wally_sync_manifest_lookup(WallySyncManifest *manifest,
+                                    const std::string& relative_path,
+                                    WallyManifestEntry *entry);
+
+void wally_sync_manifest_merge_previous(WallySyncManifest *manifest);
+
+gboolean wally_sync_manifest_save(WallySyncManifest *manifest,
+                                  GError **error);
+
+void wally_sync_manifest_free(WallySyncManifest *manifest);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(WallySyncManifest, wally_sync_manifest_free)
+
+G_END_DECLS
@@ -0,0 +1,378 @@
+#include "thumbnail-loader.h"
+#include "config.h"
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+// The "normal" size of the freedesktop thumbnail spec
+#define THUMBNAIL_SIZE 128
+#define DEFAULT_MAX_BYTES (48 * 1024 * 1024)
+#define MAX_WORKERS 4
+
+typedef struct
+{
+    GdkTexture *texture;
+    gsize bytes;
+    std::list<std::string>::iterator recent_position;
+} CachedThumbnail;
+
+typedef struct
+{
+    GTask *task;
+    char *path;
+    guint64 sequence;
+} LoadRequest;
+
+struct _WallyThumbnailLoader
+{
+    GObject parent_instance;
+    
+    GThreadPool *pool;
+    guint64 next_sequence;
+    
+    // Paths of the cached thumbnails, most recently used first
+    std::list<std::string> *recent;
+    std::unordered_map<std::string, CachedThumbnail> *cache;
+    gsize cached_bytes;
+    gsize max_bytes;
+};
+
+G_DEFINE_FINAL_TYPE(WallyThumbnailLoader, wally_thumbnail_loader, G_TYPE_OBJECT)
+
+static void
+load_request_free(LoadRequest *request)
+{
+    g_object_unref(request->task);
+    g_free(request->path);
+    g_free(request);
+}
+
+static void
+clear_cache(WallyThumbnailLoader *self)
+{
+    for (auto& [path, cached] : *self->cache) {
+        g_object_unref(cached.texture);
+    }
+    self->cache->clear();
+    self->recent->clear();
+    self->cached_bytes = 0;
+}
+
+static void
+wally_thumbnail_loader_finalize(GObject *object)
+{
+    WallyThumbnailLoader *self = WALLY_THUMBNAIL_LOADER(object);
+    
+    // Let the workers finish what they started; the rest is dropped
+    g_thread_pool_free(self->pool, TRUE, TRUE);
+    clear_cache(self);
+    delete self->cache;
+    delete self->recent;
+    
+    G_OBJECT_CLASS(wally_thumbnail_loader_parent_class)->finalize(object);
+}
+
+static void
+wally_thumbnail_loader_class_init(WallyThumbnailLoaderClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    object_class->finalize = wally_thumbnail_loader_finalize;
+}
+
+static char *
+get_thumbnail_path(const char *uri)
+{
+    g_autofree char *checksum = g_compute_checksum_for_string(G_CHECKSUM_MD5, uri, -1);
+    g_autofree char *filename = g_strconcat(checksum, ".png", NULL);
+    
+    return g_build_filename(g_get_user_cache_dir(), "thumbnails", "normal", filename, NULL);
+}
+
+// A saved thumbnail holds for the file it names until that file's mtime changes
+static GdkPixbuf *
+load_saved_thumbnail(const char *thumbnail_path,
+                     const char *uri,
+                     gint64 mtime)
+{
+    GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file(thumbnail_path, NULL);
+    if (pixbuf == NULL) {
+        return NULL;
+    }
+    
+    const char *thumbnail_uri = gdk_pixbuf_get_option(pixbuf, "tEXt::Thumb::URI");
+    const char *thumbnail_mtime = gdk_pixbuf_get_option(pixbuf, "tEXt::Thumb::MTime");
+    if (g_strcmp0(thumbnail_uri, uri) != 0 || thumbnail_mtime == NULL ||
+        g_ascii_strtoll(thumbnail_mtime, NULL, 10) != mtime) {
+        g_object_unref(pixbuf);
+        return NULL;
+    }
+    
+    return pixbuf;
+}
+
+// Failing to save only costs decoding the image again next time
+static void
+save_thumbnail(GdkPixbuf *pixbuf,
+               const char *thumbnail_path,
+               const char *uri,
+               const GStatBuf *st,
+               int image_width,
+               int image_height)
+{
+    g_autofree char *thumbnail_dir = g_path_get_dirname(thumbnail_path);
+    if (g_mkdir_with_parents(thumbnail_dir, 0700) != 0) {
+        return;
+    }
+    
+    g_autofree char *mtime = g_strdup_printf("%" G_GINT64_FORMAT, (gint64)st->st_mtime);
+    g_autofree char *size = g_strdup_printf("%" G_GUINT64_FORMAT, (guint64)st->st_size);
+    g_autofree char *width = g_strdup_printf("%d", image_width);
+    g_autofree char *height = g_strdup_printf("%d", image_height);
+    
+    g_autofree char *buffer = NULL;
+    gsize length = 0;
+    GError *error = NULL;
+    if (!gdk_pixbuf_save_to_buffer(pixbuf, &buffer, &length, "png", &error,
+                                   "tEXt::Thumb::URI", uri,
+                                   "tEXt::Thumb::MTime", mtime,
+                                   "tEXt::Thumb::Size", size,
+                                   "tEXt::Thumb::Image::Width", width,
+                                   "tEXt::Thumb::Image::Height", height,
+                                   "tEXt::Software", APP_NAME,
+                                   NULL) ||
+        // Written whole and renamed into place, private as the spec asks
+        !g_file_set_contents_full(thumbnail_path, buffer, length, G_FILE_SET_CONTENTS_CONSISTENT, 0600, &error)) {
+        g_debug("Failed to save thumbnail for %s: %s", uri, error->message);
+        g_error_free(error);
+    }
+}
+
+static GdkTexture *
+texture_for_pixbuf(GdkPixbuf *pixbuf)
+{
+    g_autoptr(GBytes) bytes = gdk_pixbuf_read_pixel_bytes(pixbuf);
+    
+    return gdk_memory_texture_new(gdk_pixbuf_get_width(pixbuf),
+                                  gdk_pixbuf_get_height(pixbuf),
+                                  gdk_pixbuf_get_has_alpha(pixbuf) ? GDK_MEMORY_R8G8B8A8 : GDK_MEMORY_R8G8B8,
+                                  bytes,
+                                  gdk_pixbuf_get_rowstride(pixbuf));
+}
+
+// Runs on a worker thread
+static GdkTexture *
+load_thumbnail(const char *path,
+               GError **error)
+{
+    GStatBuf st;
+    if (g_stat(path, &st) != 0) {
+        int saved_errno = errno;
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved_errno),
+                    "Failed to read %s: %s", path, g_strerror(saved_errno));
+        return NULL;
+    }
+    
+    g_autofree char *uri = g_filename_to_uri(path, NULL, error);
+    if (uri == NULL) {
+        return NULL;
+    }
+    
+    g_autofree char *thumbnail_path = get_thumbnail_path(uri);
+    g_autoptr(GdkPixbuf) pixbuf = load_saved_thumbnail(thumbnail_path, uri, st.st_mtime);
+    if (pixbuf != NULL) {
+        return texture_for_pixbuf(pixbuf);
+    }
+    
+    int width = 0;
+    int height = 0;
+    if (gdk_pixbuf_get_file_info(path, &width, &height) == NULL) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Unsupported image %s", path);
+        return NULL;
+    }
+    
+    // Small images aren't scaled up; sizeless ones are drawn at full size
+    int box = width > 0 && height > 0 ? MIN(THUMBNAIL_SIZE, MAX(width, height)) : THUMBNAIL_SIZE;
+    g_autoptr(GdkPixbuf) decoded = gdk_pixbuf_new_from_file_at_scale(path, box, box, TRUE, error);
+    if (decoded == NULL) {
+        return NULL;
+    }
+    
+    pixbuf = gdk_pixbuf_apply_embedded_orientation(decoded);
+    save_thumbnail(pixbuf, thumbnail_path, uri, &st, width, height);
+    
+    return texture_for_pixbuf(pixbuf);
+}
+
+static void
+run_request(gpointer data,
+            gpointer user_data G_GNUC_UNUSED)
+{
+    LoadRequest *request = static_cast<LoadRequest*>(data);
+    
+    // Items scrolled out of view by now are dropped here, undecoded
+    if (!g_task_return_error_if_cancelled(request->task)) {
+        GError *error = NULL;
+        GdkTexture *texture = load_thumbnail(request->path, &error);
+        if (texture != NULL) {
+            g_task_return_pointer(request->task, texture, g_object_unref);
+        } else {
+            g_task_return_error(request->task, error);
+        }
+    }
+    
+    load_request_free(request);
+}
+
+// Newest first
+static gint
+compare_requests(gconstpointer a,
+                 gconstpointer b,
+                 gpointer user_data G_GNUC_UNUSED)
+{
+    guint64 sequence_a = static_cast<const LoadRequest*>(a)->sequence;
+    guint64 sequence_b = static_cast<const LoadRequest*>(b)->sequence;
+    
+    return sequence_a < sequence_b ? 1 : sequence_a > sequence_b ? -1 : 0;
+}
+
+static void
+wally_thumbnail_loader_init(WallyThumbnailLoader *self)
+{
+    self->recent = new std::list<std::string>();
+    self->cache = new std::unordered_map<std::string, CachedThumbnail>();
+    self->max_bytes = DEFAULT_MAX_BYTES;
+    
+    self->pool = g_thread_pool_new(run_request, self, MIN(g_get_num_processors(), MAX_WORKERS), FALSE, NULL);
+    g_thread_pool_set_sort_function(self->pool, compare_requests, NULL);
+}
+
+WallyThumbnailLoader *
+wally_thumbnail_loader_get_default(void)
+{
+    static WallyThumbnailLoader *default_loader;
+    
+    if (default_loader == NULL) {
+        default_loader = static_cast<WallyThumbnailLoader*>(g_object_new(WALLY_TYPE_THUMBNAIL_LOADER, NULL));
+    }
+    
+    return default_loader;
+}
+
+static void
+trim_cache(WallyThumbnailLoader *self)
+{
+    while (self->cached_bytes > self->max_bytes && !self->recent->empty()) {
+        auto it = self->cache->find(self->recent->back());
+        self->cached_bytes -= it->second.bytes;
+        g_object_unref(it->second.texture);
+        self->cache->erase(it);
+        self->recent->pop_back();
+    }
+}
+
+/*
+ * Bounds the memory of the thumbnails kept for reuse. Thumbnails still
+ * shown somewhere stay alive through their widgets either way.
+ */
+void
+wally_thumbnail_loader_set_max_bytes(WallyThumbnailLoader *self,
+                                     gsize max_bytes)
+{
+    g_return_if_fail(WALLY_IS_THUMBNAIL_LOADER(self));
+    
+    self->max_bytes = max_bytes;
+    trim_cache(self);
+}
+
+static void
+remember_thumbnail(WallyThumbnailLoader *self,
+                   const char *path,
+                   GdkTexture *texture)
+{
+    auto it = self->cache->find(path);
+    if (it != self->cache->end()) {
+        self->cached_bytes -= it->second.bytes;
+        g_object_unref(it->second.texture);
+        self->recent->erase(it->second.recent_position);
+        self->cache->erase(it);
+    }
+    
+    CachedThumbnail cached;
+    cached.texture = static_cast<GdkTexture*>(g_object_ref(texture));
+    cached.bytes = (gsize)gdk_texture_get_width(texture) * gdk_texture_get_height(texture) * 4;
+    self->recent->push_front(path);
+    cached.recent_position = self->recent->begin();
+    
+    self->cached_bytes += cached.bytes;
+    self->cache->emplace(path, cached);
+    trim_cache(self);
+}
+
+// Returns a new reference to the thumbnail of @path when one is in memory
+GdkTexture *
+wally_thumbnail_loader_lookup(WallyThumbnailLoader *self,
+                              const char *path)
+{
+    g_return_val_if_fail(WALLY_IS_THUMBNAIL_LOADER(self), NULL);
+    g_return_val_if_fail(path != NULL, NULL);
+    
+    auto it = self->cache->find(path);
+    if (it == self->cache->end()) {
+        return NULL;
+    }
+    
+    self->recent->splice(self->recent->begin(), *self->recent, it->second.recent_position);
+    return static_cast<GdkTexture*>(g_object_ref(it->second.texture));
+}
+
+void
+wally_thumbnail_loader_load_async(WallyThumbnailLoader *self,
+                                  const char *path,
+                                  GCancellable *cancellable,
+                                  GAsyncReadyCallback callback,
+                                  gpointer user_data)
+{
+    g_return_if_fail(WALLY_IS_THUMBNAIL_LOADER(self));
+    g_return_if_fail(path != NULL);
+    
+    GTask *task = g_task_new(self, cancellable, callback, user_data);
+    g_task_set_source_tag(task, (gpointer)wally_thumbnail_loader_load_async);
+    g_task_set_task_data(task, g_strdup(path), g_free);
+    
+    LoadRequest *request = g_new0(LoadRequest, 1);
+    request->task = task;
+    request->path = g_strdup(path);
+    request->sequence = self->next_sequence++;
+    
+    g_thread_pool_push(self->pool, request, NULL);
+}
+
+// Returns the thumbnail, which is kept in memory for later lookups too
+GdkTexture *
+wally_thumbnail_loader_load_finish(WallyThumbnailLoader *self,
+                                   GAsyncResult *result,
+                                   GError **error)
+{
+    g_return_val_if_fail(WALLY_IS_THUMBNAIL_LOADER(self), NULL);
+    g_return_val_if_fail(g_task_is_valid(result, self), NULL);
+    
+    GTask *task = G_TASK(result);
+    GdkTexture *texture = static_cast<GdkTexture*>(g_task_propagate_pointer(task, error));
+    if (texture != NULL) {
+        remember_thumbnail(self, static_cast<const char*>(g_task_get_task_data(task)), texture);
+    }
+    
+    return texture;
+}
+
+gsize
+wally_thumbnail_loader_get_cached_bytes(WallyThumbnailLoader *self)
+{
+    g_return_val_if_fail(WALLY_IS_THUMBNAIL_LOADER(self), 0);
+    
+    return self->cached_bytes;
+}
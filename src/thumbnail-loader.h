@@ -0,0 +1,43 @@
+#pragma once
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+#define WALLY_TYPE_THUMBNAIL_LOADER (wally_thumbnail_loader_get_type())
+
+G_DECLARE_FINAL_TYPE(WallyThumbnailLoader, wally_thumbnail_loader, WALLY, THUMBNAIL_LOADER, GObject)
+
+/*
+ * Thumbnails for the preview, decoded at a small size on a few worker
+ * threads. Decoded thumbnails are kept in memory up to a byte budget, least
+ * recently used first out, and on disk in the shared thumbnail cache
+ * (~/.cache/thumbnails/normal), so other apps and later runs reuse them.
+ *
+ * Requests made last are served first: when scrolling, what is on screen
+ * now matters more than what scrolled past. Cancel requests for items that
+ * are no longer shown and they are dropped without being decoded.
+ *
+ * To be used from the main thread only.
+ */
+WallyThumbnailLoader *wally_thumbnail_loader_get_default(void);
+
+void wally_thumbnail_loader_set_max_bytes(WallyThumbnailLoader *self,
+                                          gsize max_bytes);
+
+GdkTexture *wally_thumbnail_loader_lookup(WallyThumbnailLoader *self,
+                                          const char *path);
+
+void wally_thumbnail_loader_load_async(WallyThumbnailLoader *self,
+                                       const char *path,
+                                       GCancellable *cancellable,
+                                       GAsyncReadyCallback callback,
+                                       gpointer user_data);
+
+GdkTexture *wally_thumbnail_loader_load_finish(WallyThumbnailLoader *self,
+                                               GAsyncResult *result,
+                                               GError **error);
+
+gsize wally_thumbnail_loader_get_cached_bytes(WallyThumbnailLoader *self);
+
+G_END_DECLS
@@ -0,0 +1,197 @@
+#include "trace.h"
+#include "config.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <vector>
+
+#ifdef HAVE_SYSPROF
+#include <sysprof-capture.h>
+#endif
+
+typedef struct
+{
+    const char *name;
+    gint64 begin_us;
+    gint64 duration_us;
+    guint64 files;
+    guint64 bytes;
+    gboolean success;
+} WallyTraceRecord;
+
+struct _WallyTraceRun
+{
+    char *name;
+    char *started;
+    gint64 begin_us;
+    GMutex lock;
+    std::vector<WallyTraceRecord> records;
+};
+
+gboolean wally_trace_enabled = FALSE;
+
+// NULL when only Sysprof is listening
+static char *trace_path;
+static gboolean use_sysprof;
+static GPrivate current_run;
+
+// Call once, before any other thread starts
+void
+wally_trace_init(void)
+{
+    const char *value = g_getenv("WALLY_TRACE");
+    
+    if (value != NULL && *value != '\0' && g_strcmp0(value, "0") != 0) {
+        if (g_strcmp0(value, "1") == 0) {
+            trace_path = g_build_filename(g_get_user_cache_dir(), "wally", "trace.json", NULL);
+        } else {
+            trace_path = g_strdup(value);
+        }
+    }
+
+#ifdef HAVE_SYSPROF
+    use_sysprof = sysprof_collector_is_active();
+#endif
+
+    wally_trace_enabled = trace_path != NULL || use_sysprof;
+}
+
+/*
+ * Starts timing one run, e.g. one apply. Make it current on each thread
+ * while that thread works for it. Returns NULL when tracing is off; the
+ * other functions accept that.
+ */
+WallyTraceRun *
+wally_trace_run_begin(const char *name)
+{
+    g_return_val_if_fail(name != NULL, NULL);
+    
+    if (G_LIKELY(!wally_trace_enabled)) {
+        return NULL;
+    }
+    
+    WallyTraceRun *run = new WallyTraceRun();
+    run->name = g_strdup(name);
+    g_autoptr(GDateTime) now = g_date_time_new_now_utc();
+    run->started = g_date_time_format_iso8601(now);
+    run->begin_us = g_get_monotonic_time();
+    g_mutex_init(&run->lock);
+    
+    return run;
+}
+
+// Pass NULL when the thread is done with the run
+void
+wally_trace_run_set_current(WallyTraceRun *run)
+{
+    if (G_UNLIKELY(wally_trace_enabled)) {
+        g_private_set(&current_run, run);
+    }
+}
+
+static void
+append_double(GString *json,
+              const char *format,
+              double value)
+{
+    char buffer[G_ASCII_DTOSTR_BUF_SIZE];
+    g_string_append(json, g_ascii_formatd(buffer, sizeof(buffer), format, value));
+}
+
+static void
+write_run(WallyTraceRun *run,
+          gboolean success,
+          gint64 duration_us)
+{
+    g_autoptr(GString) json = g_string_new(NULL);
+    
+    g_string_append_printf(json, "{\"run\": \"%s\", \"started\": \"%s\", \"success\": %s, \"ms\": ",
+                           run->name, run->started, success ? "true" : "false");
+    append_double(json, "%.3f", duration_us / 1000.0);
+    g_string_append(json, ", \"spans\": [");
+    
+    for (gsize i = 0; i < run->records.size(); i++) {
+        const WallyTraceRecord& record = run->records[i];
+        
+        g_string_append_printf(json, "%s{\"name\": \"%s\", \"start_ms\": ", i > 0 ? ", " : "", record.name);
+        append_double(json, "%.3f", (record.begin_us - run->begin_us) / 1000.0);
+        g_string_append(json, ", \"ms\": ");
+        append_double(json, "%.3f", record.duration_us / 1000.0);
+        g_string_append_printf(json, ", \"files\": %" G_GUINT64_FORMAT ", \"bytes\": %" G_GUINT64_FORMAT
+                               ", \"success\": %s}", record.files, record.bytes, record.success ? "true" : "false");
+    }
+    g_string_append(json, "]}\n");
+    
+    g_autofree char *folder = g_path_get_dirname(trace_path);
+    g_mkdir_with_parents(folder, 0755);
+    
+    // One run per line, so runs from several processes can share the file
+    FILE *file = g_fopen(trace_path, "a");
+    if (file == NULL) {
+        g_warning("Failed to open trace file %s", trace_path);
+        return;
+    }
+    fwrite(json->str, 1, json->len, file);
+    fclose(file);
+}
+
+// Writes out the run's summary and frees it
+void
+wally_trace_run_end(WallyTraceRun *run,
+                    gboolean success)
+{
+    if (run == NULL) {
+        return;
+    }
+    
+    gint64 duration_us = g_get_monotonic_time() - run->begin_us;
+    
+    if (g_private_get(&current_run) == run) {
+        g_private_set(&current_run, NULL);
+    }
+
+#ifdef HAVE_SYSPROF
+    if (use_sysprof) {
+        sysprof_collector_mark(run->begin_us * 1000, duration_us * 1000, "Wally", run->name,
+                               "%s", success ? "succeeded" : "failed");
+    }
+#endif
+
+    if (trace_path != NULL) {
+        g_mutex_lock(&run->lock);
+        write_run(run, success, duration_us);
+        g_mutex_unlock(&run->lock);
+    }
+    
+    g_mutex_clear(&run->lock);
+    g_free(run->name);
+    g_free(run->started);
+    delete run;
+}
+
+// Only reached while tracing; @span's name must be a static string
+void
+wally_trace_span_record(WallyTraceSpan *span,
+                        guint64 files,
+                        guint64 bytes,
+                        gboolean success)
+{
+    gint64 duration_us = g_get_monotonic_time() - span->begin_us;
+
+#ifdef HAVE_SYSPROF
+    if (use_sysprof) {
+        sysprof_collector_mark(span->begin_us * 1000, duration_us * 1000, "Wally", span->name,
+                               "%" G_GUINT64_FORMAT " files, %" G_GUINT64_FORMAT " bytes%s", files, bytes,
+                               success ? "" : ", failed");
+    }
+#endif
+
+    WallyTraceRun *run = static_cast<WallyTraceRun*>(g_private_get(&current_run));
+    if (run != NULL) {
+        g_mutex_lock(&run->lock);
+        run->records.push_back({span->name, span->begin_us, duration_us, files, bytes, success});
+        g_mutex_unlock(&run->lock);
+    }
+    
+    span->begin_us = 0;
+}
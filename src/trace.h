@@ -0,0 +1,74 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Timing spans around the stages of an apply. Tracing is off unless
+ * WALLY_TRACE is set or Sysprof is recording Wally; when off, a span costs a
+ * test of one global flag.
+ *
+ * Under Sysprof every span becomes a mark in the "Wally" group. With
+ * WALLY_TRACE set to a file name (or to 1, for trace.json in Wally's cache
+ * folder), each run appends one line of JSON to that file: the run's total
+ * time and, for each span, its start, duration and the files and bytes it
+ * handled.
+ *
+ * Spans are recorded into the run current on the thread that ends them.
+ * Declared with g_auto(WallyTraceSpan), a span still open when it goes out
+ * of scope, on an error or cancellation path, is recorded as failed.
+ */
+typedef struct _WallyTraceRun WallyTraceRun;
+
+typedef struct
+{
+    const char *name;
+    gint64 begin_us;
+} WallyTraceSpan;
+
+extern gboolean wally_trace_enabled;
+
+void wally_trace_init(void);
+
+WallyTraceRun *wally_trace_run_begin(const char *name);
+
+void wally_trace_run_set_current(WallyTraceRun *run);
+
+void wally_trace_run_end(WallyTraceRun *run,
+                         gboolean success);
+
+void wally_trace_span_record(WallyTraceSpan *span,
+                             guint64 files,
+                             guint64 bytes,
+                             gboolean success);
+
+static inline void
+wally_trace_span_begin(WallyTraceSpan *span,
+                       const char *name)
+{
+    span->name = name;
+    span->begin_us = G_UNLIKELY(wally_trace_enabled) ? g_get_monotonic_time() : 0;
+}
+
+static inline void
+wally_trace_span_end(WallyTraceSpan *span,
+                     guint64 files,
+                     guint64 bytes)
+{
+    if (G_UNLIKELY(span->begin_us != 0)) {
+        wally_trace_span_record(span, files, bytes, TRUE);
+    }
+}
+
+static inline void
+wally_trace_span_clear(WallyTraceSpan *span)
+{
+    if (G_UNLIKELY(span->begin_us != 0)) {
+        wally_trace_span_record(span, 0, 0, FALSE);
+    }
+}
+
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC(WallyTraceSpan, wally_trace_span_clear)
+
+G_END_DECLS
@@ -0,0 +1,105 @@
+#include "transcoder.h"
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <string.h>
+
+// Profiles beyond this are device calibration data nobody wants in a
+// wallpaper; typical sRGB and Display P3 profiles are a few KB
+#define MAX_ICC_PROFILE_LENGTH (64 * 1024)
+
+// Bytes per pixel of a decoded image; loaders may add alpha to any of them
+#define DECODED_PIXEL_SIZE 4
+
+// Decided by name, so that the import target is known before the file is
+// read: a .bmp that turns out to be a JPEG is simply imported as it is
+gboolean
+wally_transcoder_is_heavy_filename(const char *filename)
+{
+    g_return_val_if_fail(filename != NULL, FALSE);
+    
+    const char *extension = strrchr(filename, '.');
+    return extension != NULL &&
+           (g_ascii_strcasecmp(extension, ".bmp") == 0 || g_ascii_strcasecmp(extension, ".tiff") == 0);
+}
+
+gboolean
+wally_transcoder_should_transcode(const WallyImageInfo *info)
+{
+    g_return_val_if_fail(info != NULL, FALSE);
+    
+    if (info->format != WALLY_IMAGE_FORMAT_BMP && info->format != WALLY_IMAGE_FORMAT_TIFF) {
+        return FALSE;
+    }
+    
+    return (guint64)info->width * info->height * DECODED_PIXEL_SIZE <= WALLY_TRANSCODE_MAX_DECODED_BYTES;
+}
+
+const char *
+wally_transcoder_get_extension(const WallyImageInfo *info)
+{
+    g_return_val_if_fail(info != NULL, ".jpg");
+    
+    return info->has_alpha ? ".png" : ".jpg";
+}
+
+/*
+ * Writes @source_path to @dest_path in the format its extension names, as
+ * returned by wally_transcoder_get_extension(). @quality applies to JPEG.
+ * The file is written next to @dest_path and renamed over it, so a failed
+ * conversion never leaves half an image behind.
+ */
+gboolean
+wally_transcoder_transcode(const char *source_path,
+                           const char *dest_path,
+                           int quality,
+                           GError **error)
+{
+    g_return_val_if_fail(source_path != NULL, FALSE);
+    g_return_val_if_fail(dest_path != NULL, FALSE);
+    
+    g_autoptr(GdkPixbuf) pixbuf = gdk_pixbuf_new_from_file(source_path, error);
+    if (pixbuf == NULL) {
+        return FALSE;
+    }
+    
+    // Applied here once; the copy that is written carries no orientation
+    g_autoptr(GdkPixbuf) oriented = gdk_pixbuf_apply_embedded_orientation(pixbuf);
+    g_clear_object(&pixbuf);
+    
+    const char *keys[3] = {NULL};
+    const char *values[3] = {NULL};
+    int n_options = 0;
+    
+    // gdk-pixbuf only ever writes the options it is given, so EXIF, XMP
+    // and the like are left behind
+    const char *icc_profile = gdk_pixbuf_get_option(oriented, "icc-profile");
+    if (icc_profile != NULL && strlen(icc_profile) <= MAX_ICC_PROFILE_LENGTH * 4 / 3) {
+        keys[n_options] = "icc-profile";
+        values[n_options++] = icc_profile;
+    }
+    
+    const char *type = "png";
+    g_autofree char *quality_value = g_strdup_printf("%d", CLAMP(quality, 1, 100));
+    if (!g_str_has_suffix(dest_path, ".png")) {
+        type = "jpeg";
+        keys[n_options] = "quality";
+        values[n_options++] = quality_value;
+    }
+    
+    g_autofree char *partial_path = g_strconcat(dest_path, ".wally-part", NULL);
+    gboolean saved = gdk_pixbuf_savev(oriented, partial_path, type, (char **)keys, (char **)values, error);
+    
+    if (!saved || g_rename(partial_path, dest_path) != 0) {
+        if (saved) {
+            int saved_errno = errno;
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved_errno),
+                        "Failed to write %s: %s", dest_path, g_strerror(saved_errno));
+        }
+        g_unlink(partial_path);
+        return FALSE;
+    }
+    
+    return TRUE;
+}
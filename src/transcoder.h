@@ -0,0 +1,34 @@
+#pragma once
+
+#include "image-probe.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Conversion of images in formats that are big on disk and slow to load
+ * (uncompressed BMP and TIFF) to JPEG, or PNG when they have an alpha
+ * channel, at import. The shell then reads and decodes a fraction of the
+ * bytes on every transition.
+ *
+ * The image is turned upright by its EXIF orientation along the way and
+ * nothing but a colour profile of modest size is carried over. A conversion
+ * holds the whole decoded image in memory, so images larger than
+ * WALLY_TRANSCODE_MAX_DECODED_BYTES are left as they are.
+ */
+#define WALLY_TRANSCODE_MAX_DECODED_BYTES (G_GUINT64_CONSTANT(256) * 1024 * 1024)
+
+gboolean wally_transcoder_is_heavy_filename(const char *filename);
+
+gboolean wally_transcoder_should_transcode(const WallyImageInfo *info);
+
+const char *wally_transcoder_get_extension(const WallyImageInfo *info);
+
+gboolean wally_transcoder_transcode(const char *source_path,
+                                    const char *dest_path,
+                                    int quality,
+                                    GError **error);
+
+G_END_DECLS
@@ -0,0 +1,691 @@
+#include "wallpaper-scheduler.h"
+#include "background-writer.h"
+#include "slideshow-writer.h"
+#include "shuffle.h"
+#include "config.h"
+
+#include <glib/gi18n.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define DEFAULT_INTERVAL_SECONDS 300
+#define DEFAULT_BATTERY_INTERVAL_FACTOR 3.0
+#define RELOAD_DELAY_MS 500
+
+enum
+{
+    COLLECTION_DAY,
+    COLLECTION_NIGHT,
+    N_COLLECTIONS
+};
+
+static const char introspection_xml[] =
+    "<node>"
+    "  <interface name='" WALLY_SCHEDULER_DBUS_INTERFACE "'>"
+    "    <method name='Next'/>"
+    "    <method name='Previous'/>"
+    "    <method name='Pause'/>"
+    "    <method name='Resume'/>"
+    "    <method name='Status'>"
+    "      <arg type='a{sv}' name='status' direction='out'/>"
+    "    </method>"
+    "  </interface>"
+    "</node>";
+
+typedef struct
+{
+    char *xml_path;
+    std::vector<std::string> *files;
+    gsize position;
+    GFileMonitor *monitor;
+    
+    // Passes through the list so far; each pass after the first is
+    // reshuffled when shuffling
+    guint64 round;
+    WallyShuffle shuffle;
+} Playlist;
+
+struct _WallyWallpaperScheduler
+{
+    GObject parent_instance;
+    
+    Playlist playlists[N_COLLECTIONS];
+    guint interval_seconds;
+    
+    gboolean shuffle;
+    guint64 shuffle_seed;
+    gboolean shuffle_no_repeat;
+    
+    gboolean running;
+    gboolean paused;
+    guint timer_id;
+    guint reload_id;
+    
+    // Wall-clock time of the last timed change; suspend counts as well
+    gint64 last_step_time;
+    
+    WallyPowerMonitor *power_monitor;
+    gulong power_changed_id;
+    gboolean pause_when_screen_off;
+    double battery_interval_factor;
+    gboolean screen_off;
+    gboolean apply_pending;
+    
+    GDBusConnection *connection;
+    guint registration_id;
+};
+
+G_DEFINE_FINAL_TYPE(WallyWallpaperScheduler, wally_wallpaper_scheduler, G_TYPE_OBJECT)
+
+static void
+wally_wallpaper_scheduler_dispose(GObject *object)
+{
+    WallyWallpaperScheduler *self = WALLY_WALLPAPER_SCHEDULER(object);
+    
+    wally_wallpaper_scheduler_unexport(self);
+    wally_wallpaper_scheduler_stop(self);
+    g_clear_object(&self->power_monitor);
+    
+    G_OBJECT_CLASS(wally_wallpaper_scheduler_parent_class)->dispose(object);
+}
+
+static void
+wally_wallpaper_scheduler_finalize(GObject *object)
+{
+    WallyWallpaperScheduler *self = WALLY_WALLPAPER_SCHEDULER(object);
+    
+    for (Playlist& playlist : self->playlists) {
+        g_free(playlist.xml_path);
+        delete playlist.files;
+    }
+    
+    G_OBJECT_CLASS(wally_wallpaper_scheduler_parent_class)->finalize(object);
+}
+
+static void
+wally_wallpaper_scheduler_class_init(WallyWallpaperSchedulerClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    
+    object_class->dispose = wally_wallpaper_scheduler_dispose;
+    object_class->finalize = wally_wallpaper_scheduler_finalize;
+}
+
+static void
+wally_wallpaper_scheduler_init(WallyWallpaperScheduler *self)
+{
+    for (Playlist& playlist : self->playlists) {
+        playlist.files = new std::vector<std::string>();
+    }
+    self->interval_seconds = DEFAULT_INTERVAL_SECONDS;
+    self->pause_when_screen_off = TRUE;
+    self->battery_interval_factor = DEFAULT_BATTERY_INTERVAL_FACTOR;
+}
+
+WallyWallpaperScheduler *
+wally_wallpaper_scheduler_new(const char *day_xml_path,
+                              const char *night_xml_path)
+{
+    g_return_val_if_fail(day_xml_path != NULL, NULL);
+    g_return_val_if_fail(night_xml_path != NULL, NULL);
+    
+    WallyWallpaperScheduler *self = static_cast<WallyWallpaperScheduler*>(g_object_new(WALLY_TYPE_WALLPAPER_SCHEDULER, NULL));
+    self->playlists[COLLECTION_DAY].xml_path = g_strdup(day_xml_path);
+    self->playlists[COLLECTION_NIGHT].xml_path = g_strdup(night_xml_path);
+    return self;
+}
+
+// The first pass follows the slideshow, which is shuffled already when
+// shuffling is on
+static gsize
+get_current_index(WallyWallpaperScheduler *self,
+                  Playlist& playlist)
+{
+    if (!self->shuffle || playlist.round == 0) {
+        return playlist.position;
+    }
+    
+    return wally_shuffle_get(&playlist.shuffle, playlist.round, playlist.position);
+}
+
+// Points the background at the current image of each list, in one write
+static void
+apply_current(WallyWallpaperScheduler *self)
+{
+    WallyBackgroundWriter *writer = wally_background_writer_get_default();
+    
+    for (int i = 0; i < N_COLLECTIONS; i++) {
+        Playlist& playlist = self->playlists[i];
+        if (playlist.files->empty()) {
+            continue;
+        }
+        
+        gsize index = get_current_index(self, playlist);
+        g_autofree char *uri = g_filename_to_uri((*playlist.files)[index].c_str(), NULL, NULL);
+        if (uri != NULL) {
+            wally_background_writer_set_uri(writer, i == COLLECTION_NIGHT, uri);
+        }
+    }
+    
+    wally_background_writer_commit(writer);
+    self->apply_pending = FALSE;
+}
+
+// Moves each list on by @steps at once, as many passes as that takes
+static void
+advance(WallyWallpaperScheduler *self, guint64 steps)
+{
+    for (Playlist& playlist : self->playlists) {
+        gsize count = playlist.files->size();
+        if (count == 0) {
+            continue;
+        }
+        
+        guint64 total = playlist.position + steps;
+        if (self->shuffle) {
+            playlist.round += total / count;
+        }
+        playlist.position = total % count;
+    }
+}
+
+static void
+step(WallyWallpaperScheduler *self, gboolean forward)
+{
+    if (forward) {
+        advance(self, 1);
+    }
+    
+    for (Playlist& playlist : self->playlists) {
+        gsize count = playlist.files->size();
+        if (forward || count == 0) {
+            continue;
+        }
+        
+        if (playlist.position == 0 && self->shuffle && playlist.round > 0) {
+            playlist.round--;
+        }
+        playlist.position = (playlist.position + count - 1) % count;
+    }
+    
+    self->last_step_time = g_get_real_time();
+    apply_current(self);
+}
+
+// The slideshow's interval, stretched while on battery
+static guint
+get_effective_interval(WallyWallpaperScheduler *self)
+{
+    if (self->power_monitor == NULL || !wally_power_monitor_get_on_battery(self->power_monitor)) {
+        return self->interval_seconds;
+    }
+    
+    return (guint)MIN(self->interval_seconds * self->battery_interval_factor, (double)G_MAXINT);
+}
+
+/*
+ * Moves on by as many steps as the timer would have taken since the last
+ * change, in a single write: the images passed over are never set, so the
+ * shell never loads them. Returns whether anything moved.
+ */
+static gboolean
+catch_up(WallyWallpaperScheduler *self, gboolean at_least_one)
+{
+    gint64 interval_us = (gint64)get_effective_interval(self) * G_USEC_PER_SEC;
+    gint64 now = g_get_real_time();
+    gint64 elapsed = MAX(now - self->last_step_time, 0);
+    guint64 steps = elapsed / interval_us;
+    
+    if (steps > 0) {
+        // Keep to the original beat
+        self->last_step_time += steps * interval_us;
+    } else if (at_least_one) {
+        // The timer came a little early
+        steps = 1;
+        self->last_step_time = now;
+    } else {
+        return FALSE;
+    }
+    
+    advance(self, steps);
+    apply_current(self);
+    return TRUE;
+}
+
+static void restart_timer(WallyWallpaperScheduler *self);
+
+static gboolean
+on_timer(gpointer user_data)
+{
+    WallyWallpaperScheduler *self = WALLY_WALLPAPER_SCHEDULER(user_data);
+    
+    self->timer_id = 0;
+    catch_up(self, TRUE);
+    restart_timer(self);
+    
+    return G_SOURCE_REMOVE;
+}
+
+// Counts down what is left of the current interval. Nothing runs while
+// paused or while nobody sees the screen.
+static void
+restart_timer(WallyWallpaperScheduler *self)
+{
+    g_clear_handle_id(&self->timer_id, g_source_remove);
+    
+    if (!self->running || self->paused || self->screen_off) {
+        return;
+    }
+    
+    guint interval = get_effective_interval(self);
+    gint64 elapsed = (g_get_real_time() - self->last_step_time) / G_USEC_PER_SEC;
+    guint remaining = elapsed >= 0 && elapsed < interval ? interval - elapsed : 1;
+    
+    // Whole seconds let GLib wake up for this together with other timers
+    self->timer_id = g_timeout_add_seconds(remaining, on_timer, self);
+}
+
+static void
+on_power_changed(WallyPowerMonitor *monitor,
+                 WallyWallpaperScheduler *self)
+{
+    self->screen_off = self->pause_when_screen_off && wally_power_monitor_get_screen_off(monitor);
+    
+    // Coming back, show where the rotation would be by now
+    if (self->running && !self->paused && !self->screen_off &&
+        !catch_up(self, FALSE) && self->apply_pending) {
+        apply_current(self);
+    }
+    
+    restart_timer(self);
+}
+
+/*
+ * Reads both slideshows again. Each list keeps showing the image it was on
+ * when that image is still in it, and otherwise stays near its old spot.
+ */
+gboolean
+wally_wallpaper_scheduler_reload(WallyWallpaperScheduler *self,
+                                 GError **error)
+{
+    g_return_val_if_fail(WALLY_IS_WALLPAPER_SCHEDULER(self), FALSE);
+    
+    double interval = 0;
+    
+    for (Playlist& playlist : self->playlists) {
+        std::vector<std::string> files;
+        double duration = 0;
+        if (!wally_slideshow_read(playlist.xml_path, files, &duration, error)) {
+            return FALSE;
+        }
+        
+        if (interval <= 0) {
+            interval = duration;
+        }
+        
+        std::string current_file;
+        if (playlist.position < playlist.files->size()) {
+            current_file = (*playlist.files)[get_current_index(self, playlist)];
+        }
+        
+        *playlist.files = std::move(files);
+        wally_shuffle_init(&playlist.shuffle, playlist.files->size(), self->shuffle_seed, self->shuffle_no_repeat);
+        
+        // Find the image again, as a position in the current pass
+        gsize position = std::min(playlist.position, playlist.files->empty() ? 0 : playlist.files->size() - 1);
+        auto current = std::find(playlist.files->begin(), playlist.files->end(), current_file);
+        if (current != playlist.files->end()) {
+            guint64 index = current - playlist.files->begin();
+            guint64 shuffled_position;
+            if (!self->shuffle || playlist.round == 0) {
+                position = index;
+            } else if (wally_shuffle_find(&playlist.shuffle, playlist.round, index, &shuffled_position)) {
+                position = shuffled_position;
+            }
+        }
+        playlist.position = position;
+    }
+    
+    guint interval_seconds = interval >= 1 ? (guint)interval : DEFAULT_INTERVAL_SECONDS;
+    if (interval_seconds != self->interval_seconds) {
+        self->interval_seconds = interval_seconds;
+        restart_timer(self);
+    }
+    
+    g_debug("Scheduler loaded %zu day and %zu night wallpapers, changing every %u seconds",
+            self->playlists[COLLECTION_DAY].files->size(), self->playlists[COLLECTION_NIGHT].files->size(),
+            self->interval_seconds);
+    
+    return TRUE;
+}
+
+static gboolean
+on_reload_timeout(gpointer user_data)
+{
+    WallyWallpaperScheduler *self = WALLY_WALLPAPER_SCHEDULER(user_data);
+    GError *error = NULL;
+    
+    self->reload_id = 0;
+    
+    if (!wally_wallpaper_scheduler_reload(self, &error)) {
+        g_warning("%s", error->message);
+        g_error_free(error);
+        return G_SOURCE_REMOVE;
+    }
+    
+    // Nobody would see it; the change is made when the screen comes back
+    if (self->screen_off) {
+        self->apply_pending = TRUE;
+        return G_SOURCE_REMOVE;
+    }
+    
+    apply_current(self);
+    
+    return G_SOURCE_REMOVE;
+}
+
+// The slideshow files are replaced by rename; wait for the dust to settle
+static void
+on_slideshow_changed(GFileMonitor *monitor G_GNUC_UNUSED,
+                     GFile *file G_GNUC_UNUSED,
+                     GFile *other_file G_GNUC_UNUSED,
+                     GFileMonitorEvent event_type,
+                     WallyWallpaperScheduler *self)
+{
+    switch (event_type) {
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_RENAMED:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+        g_clear_handle_id(&self->reload_id, g_source_remove);
+        self->reload_id = g_timeout_add(RELOAD_DELAY_MS, on_reload_timeout, self);
+        break;
+    default:
+        break;
+    }
+}
+
+gboolean
+wally_wallpaper_scheduler_start(WallyWallpaperScheduler *self,
+                                GError **error)
+{
+    g_return_val_if_fail(WALLY_IS_WALLPAPER_SCHEDULER(self), FALSE);
+    
+    if (self->running) {
+        return TRUE;
+    }
+    
+    if (!wally_wallpaper_scheduler_reload(self, error)) {
+        return FALSE;
+    }
+    
+    for (Playlist& playlist : self->playlists) {
+        g_autoptr(GFile) file = g_file_new_for_path(playlist.xml_path);
+        playlist.monitor = g_file_monitor_file(file, G_FILE_MONITOR_WATCH_MOVES, NULL, NULL);
+        if (playlist.monitor != NULL) {
+            g_signal_connect(playlist.monitor, "changed", G_CALLBACK(on_slideshow_changed), self);
+        }
+    }
+    
+    if (self->power_monitor == NULL) {
+        self->power_monitor = wally_power_monitor_new(NULL, NULL);
+    }
+    self->power_changed_id = g_signal_connect(self->power_monitor, "changed", G_CALLBACK(on_power_changed), self);
+    self->screen_off = self->pause_when_screen_off && wally_power_monitor_get_screen_off(self->power_monitor);
+    
+    self->running = TRUE;
+    self->last_step_time = g_get_real_time();
+    apply_current(self);
+    restart_timer(self);
+    
+    return TRUE;
+}
+
+void
+wally_wallpaper_scheduler_stop(WallyWallpaperScheduler *self)
+{
+    g_return_if_fail(WALLY_IS_WALLPAPER_SCHEDULER(self));
+    
+    self->running = FALSE;
+    g_clear_handle_id(&self->timer_id, g_source_remove);
+    g_clear_handle_id(&self->reload_id, g_source_remove);
+    g_clear_signal_handler(&self->power_changed_id, self->power_monitor);
+    self->screen_off = FALSE;
+    
+    for (Playlist& playlist : self->playlists) {
+        if (playlist.monitor != NULL) {
+            g_file_monitor_cancel(playlist.monitor);
+            g_clear_object(&playlist.monitor);
+        }
+    }
+}
+
+gboolean
+wally_wallpaper_scheduler_is_running(WallyWallpaperScheduler *self)
+{
+    g_return_val_if_fail(WALLY_IS_WALLPAPER_SCHEDULER(self), FALSE);
+    
+    return self->running;
+}
+
+/*
+ * After each full pass through a list, shuffles it anew with @seed instead
+ * of starting over in the slideshow's order. Without @no_repeat every step
+ * is a random pick.
+ */
+void
+wally_wallpaper_scheduler_set_shuffle(WallyWallpaperScheduler *self,
+                                      gboolean shuffle,
+                                      guint64 seed,
+                                      gboolean no_repeat)
+{
+    g_return_if_fail(WALLY_IS_WALLPAPER_SCHEDULER(self));
+    
+    if (self->shuffle == shuffle && self->shuffle_seed == seed && self->shuffle_no_repeat == no_repeat) {
+        return;
+    }
+    
+    self->shuffle = shuffle;
+    self->shuffle_seed = seed;
+    self->shuffle_no_repeat = no_repeat;
+    
+    // Picks up from the start of the current pass's new order
+    for (Playlist& playlist : self->playlists) {
+        wally_shuffle_init(&playlist.shuffle, playlist.files->size(), seed, no_repeat);
+        if (!shuffle) {
+            playlist.round = 0;
+        }
+    }
+}
+
+/*
+ * Uses @monitor to follow the power state instead of one on the system and
+ * session bus; for tests. Takes effect on the next start.
+ */
+void
+wally_wallpaper_scheduler_set_power_monitor(WallyWallpaperScheduler *self,
+                                            WallyPowerMonitor *monitor)
+{
+    g_return_if_fail(WALLY_IS_WALLPAPER_SCHEDULER(self));
+    g_return_if_fail(WALLY_IS_POWER_MONITOR(monitor));
+    g_return_if_fail(!self->running);
+    
+    g_set_object(&self->power_monitor, monitor);
+}
+
+/*
+ * With @pause_when_screen_off the rotation stops while the session is
+ * locked or the screen blanked, and catches up in one step afterwards.
+ * On battery each interval lasts @battery_interval_factor times as long.
+ */
+void
+wally_wallpaper_scheduler_set_power_policy(WallyWallpaperScheduler *self,
+                                           gboolean pause_when_screen_off,
+                                           double battery_interval_factor)
+{
+    g_return_if_fail(WALLY_IS_WALLPAPER_SCHEDULER(self));
+    
+    self->pause_when_screen_off = pause_when_screen_off;
+    self->battery_interval_factor = MAX(battery_interval_factor, 1.0);
+    
+    if (self->running) {
+        on_power_changed(self->power_monitor, self);
+    }
+}
+
+// Moving by hand gives the new image a full interval
+void
+wally_wallpaper_scheduler_next(WallyWallpaperScheduler *self)
+{
+    g_return_if_fail(WALLY_IS_WALLPAPER_SCHEDULER(self));
+    g_return_if_fail(self->running);
+    
+    step(self, TRUE);
+    restart_timer(self);
+}
+
+void
+wally_wallpaper_scheduler_previous(WallyWallpaperScheduler *self)
+{
+    g_return_if_fail(WALLY_IS_WALLPAPER_SCHEDULER(self));
+    g_return_if_fail(self->running);
+    
+    step(self, FALSE);
+    restart_timer(self);
+}
+
+void
+wally_wallpaper_scheduler_set_paused(WallyWallpaperScheduler *self,
+                                     gboolean paused)
+{
+    g_return_if_fail(WALLY_IS_WALLPAPER_SCHEDULER(self));
+    
+    if (self->paused == paused) {
+        return;
+    }
+    
+    self->paused = paused;
+    
+    // Resuming starts a fresh interval rather than catching up
+    if (!paused) {
+        self->last_step_time = g_get_real_time();
+    }
+    restart_timer(self);
+}
+
+GVariant *
+wally_wallpaper_scheduler_get_status(WallyWallpaperScheduler *self)
+{
+    g_return_val_if_fail(WALLY_IS_WALLPAPER_SCHEDULER(self), NULL);
+    
+    static const char *const names[N_COLLECTIONS] = {"day", "night"};
+    
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add(&builder, "{sv}", "running", g_variant_new_boolean(self->running));
+    g_variant_builder_add(&builder, "{sv}", "paused", g_variant_new_boolean(self->paused));
+    g_variant_builder_add(&builder, "{sv}", "interval", g_variant_new_uint32(self->interval_seconds));
+    g_variant_builder_add(&builder, "{sv}", "effective-interval", g_variant_new_uint32(get_effective_interval(self)));
+    g_variant_builder_add(&builder, "{sv}", "screen-off", g_variant_new_boolean(self->screen_off));
+    g_variant_builder_add(&builder, "{sv}", "on-battery",
+                          g_variant_new_boolean(self->power_monitor != NULL &&
+                                                wally_power_monitor_get_on_battery(self->power_monitor)));
+    
+    for (int i = 0; i < N_COLLECTIONS; i++) {
+        Playlist& playlist = self->playlists[i];
+        g_autofree char *position_key = g_strdup_printf("%s-position", names[i]);
+        g_autofree char *count_key = g_strdup_printf("%s-count", names[i]);
+        g_autofree char *file_key = g_strdup_printf("%s-file", names[i]);
+        
+        g_variant_builder_add(&builder, "{sv}", position_key, g_variant_new_uint32(playlist.position));
+        g_variant_builder_add(&builder, "{sv}", count_key, g_variant_new_uint32(playlist.files->size()));
+        g_variant_builder_add(&builder, "{sv}", file_key,
+                              g_variant_new_string(playlist.files->empty()
+                                                   ? "" : (*playlist.files)[get_current_index(self, playlist)].c_str()));
+    }
+    
+    return g_variant_builder_end(&builder);
+}
+
+static void
+handle_method_call(GDBusConnection *connection G_GNUC_UNUSED,
+                   const char *sender G_GNUC_UNUSED,
+                   const char *object_path G_GNUC_UNUSED,
+                   const char *interface_name G_GNUC_UNUSED,
+                   const char *method_name,
+                   GVariant *parameters G_GNUC_UNUSED,
+                   GDBusMethodInvocation *invocation,
+                   gpointer user_data)
+{
+    WallyWallpaperScheduler *self = WALLY_WALLPAPER_SCHEDULER(user_data);
+    
+    if (g_str_equal(method_name, "Status")) {
+        g_dbus_method_invocation_return_value(invocation,
+                                              g_variant_new("(@a{sv})", wally_wallpaper_scheduler_get_status(self)));
+        return;
+    }
+    
+    if (!self->running) {
+        g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
+                                              "The wallpaper scheduler is not enabled");
+        return;
+    }
+    
+    if (g_str_equal(method_name, "Next")) {
+        wally_wallpaper_scheduler_next(self);
+    } else if (g_str_equal(method_name, "Previous")) {
+        wally_wallpaper_scheduler_previous(self);
+    } else if (g_str_equal(method_name, "Pause")) {
+        wally_wallpaper_scheduler_set_paused(self, TRUE);
+    } else if (g_str_equal(method_name, "Resume")) {
+        wally_wallpaper_scheduler_set_paused(self, FALSE);
+    }
+    
+    g_dbus_method_invocation_return_value(invocation, NULL);
+}
+
+static const GDBusInterfaceVTable interface_vtable = {
+    handle_method_call,
+    NULL,
+    NULL,
+    { NULL },
+};
+
+gboolean
+wally_wallpaper_scheduler_export(WallyWallpaperScheduler *self,
+                                 GDBusConnection *connection,
+                                 const char *object_path,
+                                 GError **error)
+{
+    g_return_val_if_fail(WALLY_IS_WALLPAPER_SCHEDULER(self), FALSE);
+    g_return_val_if_fail(G_IS_DBUS_CONNECTION(connection), FALSE);
+    g_return_val_if_fail(self->registration_id == 0, FALSE);
+    
+    static GDBusNodeInfo *introspection_data = NULL;
+    if (introspection_data == NULL) {
+        introspection_data = g_dbus_node_info_new_for_xml(introspection_xml, NULL);
+    }
+    
+    self->registration_id = g_dbus_connection_register_object(connection, object_path,
+                                                              introspection_data->interfaces[0],
+                                                              &interface_vtable, self, NULL, error);
+    if (self->registration_id == 0) {
+        return FALSE;
+    }
+    
+    self->connection = G_DBUS_CONNECTION(g_object_ref(connection));
+    return TRUE;
+}
+
+void
+wally_wallpaper_scheduler_unexport(WallyWallpaperScheduler *self)
+{
+    g_return_if_fail(WALLY_IS_WALLPAPER_SCHEDULER(self));
+    
+    if (self->registration_id != 0) {
+        g_dbus_connection_unregister_object(self->connection, self->registration_id);
+        self->registration_id = 0;
+    }
+    g_clear_object(&self->connection);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include "power-monitor.h"
+
+G_BEGIN_DECLS
+
+#define WALLY_TYPE_WALLPAPER_SCHEDULER (wally_wallpaper_scheduler_get_type())
+
+G_DECLARE_FINAL_TYPE(WallyWallpaperScheduler, wally_wallpaper_scheduler, WALLY, WALLPAPER_SCHEDULER, GObject)
+
+#define WALLY_SCHEDULER_DBUS_INTERFACE "com.qomarhsn.wally.Scheduler"
+
+/*
+ * Rotates the wallpaper from inside Wally instead of through GNOME's
+ * slideshow support. The images come from the day and night slideshow
+ * files, which are re-read whenever they are rewritten; picture-uri and
+ * picture-uri-dark are pointed straight at the current day and night image.
+ *
+ * The position in each list only lives in memory, so moving forwards or
+ * backwards is a single settings write, and a running scheduler wakes up
+ * once per interval. It sleeps while the screen is locked or blanked and
+ * slows down on battery; see wally_wallpaper_scheduler_set_power_policy().
+ */
+WallyWallpaperScheduler *wally_wallpaper_scheduler_new(const char *day_xml_path,
+                                                       const char *night_xml_path);
+
+gboolean wally_wallpaper_scheduler_start(WallyWallpaperScheduler *self,
+                                         GError **error);
+
+void wally_wallpaper_scheduler_stop(WallyWallpaperScheduler *self);
+
+gboolean wally_wallpaper_scheduler_is_running(WallyWallpaperScheduler *self);
+
+gboolean wally_wallpaper_scheduler_reload(WallyWallpaperScheduler *self,
+                                          GError **error);
+
+void wally_wallpaper_scheduler_set_shuffle(WallyWallpaperScheduler *self,
+                                           gboolean shuffle,
+                                           guint64 seed,
+                                           gboolean no_repeat);
+
+void wally_wallpaper_scheduler_set_power_monitor(WallyWallpaperScheduler *self,
+                                                 WallyPowerMonitor *monitor);
+
+void wally_wallpaper_scheduler_set_power_policy(WallyWallpaperScheduler *self,
+                                                gboolean pause_when_screen_off,
+                                                double battery_interval_factor);
+
+void wally_wallpaper_scheduler_next(WallyWallpaperScheduler *self);
+
+void wally_wallpaper_scheduler_previous(WallyWallpaperScheduler *self);
+
+void wally_wallpaper_scheduler_set_paused(WallyWallpaperScheduler *self,
+                                          gboolean paused);
+
+GVariant *wally_wallpaper_scheduler_get_status(WallyWallpaperScheduler *self);
+
+gboolean wally_wallpaper_scheduler_export(WallyWallpaperScheduler *self,
+                                          GDBusConnection *connection,
+                                          const char *object_path,
+                                          GError **error);
+
+void wally_wallpaper_scheduler_unexport(WallyWallpaperScheduler *self);
+
+G_END_DECLS
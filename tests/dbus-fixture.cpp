@@ -0,0 +1,76 @@
+#include "dbus-fixture.h"
+
+static GDBusConnection *
+connect_to_bus(GTestDBus *bus)
+{
+    g_autoptr(GError) error = NULL;
+    GDBusConnection *connection = g_dbus_connection_new_for_address_sync(
+        g_test_dbus_get_bus_address(bus),
+        static_cast<GDBusConnectionFlags>(G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                          G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION),
+        NULL, NULL, &error);
+    g_assert_no_error(error);
+    
+    return connection;
+}
+
+void
+dbus_fixture_set_up(DBusFixture *fixture)
+{
+    fixture->bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+    g_test_dbus_up(fixture->bus);
+    
+    fixture->service = connect_to_bus(fixture->bus);
+    fixture->client = connect_to_bus(fixture->bus);
+}
+
+void
+dbus_fixture_tear_down(DBusFixture *fixture)
+{
+    g_dbus_connection_close_sync(fixture->client, NULL, NULL);
+    g_dbus_connection_close_sync(fixture->service, NULL, NULL);
+    g_clear_object(&fixture->client);
+    g_clear_object(&fixture->service);
+    
+    g_test_dbus_down(fixture->bus);
+    g_clear_object(&fixture->bus);
+}
+
+static gboolean
+on_timeout(gpointer user_data)
+{
+    *static_cast<gboolean*>(user_data) = TRUE;
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * Runs the main loop until @condition holds, failing the test if it still
+ * doesn't after DBUS_FIXTURE_TIMEOUT_SECONDS. Services and clients share
+ * the thread, so this is how a test waits for replies and signals.
+ */
+void
+dbus_fixture_wait_until(const std::function<bool()>& condition)
+{
+    gboolean timed_out = FALSE;
+    guint timeout_id = g_timeout_add_seconds(DBUS_FIXTURE_TIMEOUT_SECONDS, on_timeout, &timed_out);
+    
+    while (!condition() && !timed_out) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    
+    g_assert_false(timed_out);
+    g_source_remove(timeout_id);
+}
+
+// Lets every pending D-Bus round trip finish, for tests that expect nothing
+// to happen
+void
+dbus_fixture_settle(void)
+{
+    gboolean timed_out = FALSE;
+    g_timeout_add(200, on_timeout, &timed_out);
+    
+    while (!timed_out) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <gio/gio.h>
+#include <functional>
+
+/*
+ * A private message bus for the D-Bus tests, with one connection for the
+ * services under test or standing in for the system's, and one for their
+ * clients. The bus serves as both the system and the session bus.
+ */
+#define DBUS_FIXTURE_TIMEOUT_SECONDS 5
+
+typedef struct
+{
+    GTestDBus *bus;
+    GDBusConnection *service;
+    GDBusConnection *client;
+} DBusFixture;
+
+void dbus_fixture_set_up(DBusFixture *fixture);
+
+void dbus_fixture_tear_down(DBusFixture *fixture);
+
+void dbus_fixture_wait_until(const std::function<bool()>& condition);
+
+void dbus_fixture_settle(void);
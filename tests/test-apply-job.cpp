@@ -0,0 +1,81 @@
+/*
+ * How often an Apply writes GNOME's background settings: once for both
+ * slideshows, and not at all when nothing changed. The background is written
+ * to the memory settings backend, against a stand-in of GNOME's schema.
+ */
+#include "apply-job.h"
+#include "background-writer.h"
+
+#include <glib/gstdio.h>
+
+// A 1x1 grey PNG
+static const guint8 PIXEL_PNG[] = {
+    0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a, 0x00, 0x00, 0x00, 0x0d, 0x49, 0x48, 0x44, 0x52,
+    0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x08, 0x02, 0x00, 0x00, 0x00, 0x90, 0x77, 0x53,
+    0xde, 0x00, 0x00, 0x00, 0x0c, 0x49, 0x44, 0x41, 0x54, 0x78, 0x9c, 0x63, 0x68, 0x68, 0x68, 0x00,
+    0x00, 0x03, 0x04, 0x01, 0x81, 0x4b, 0xd3, 0xd2, 0x10, 0x00, 0x00, 0x00, 0x00, 0x49, 0x45, 0x4e,
+    0x44, 0xae, 0x42, 0x60, 0x82,
+};
+
+// A folder of @n_images copies of the PNG, in the isolated home directory
+static char *
+make_folder(const char *name, guint n_images)
+{
+    char *folder = g_build_filename(g_get_home_dir(), name, NULL);
+    g_assert_cmpint(g_mkdir_with_parents(folder, 0755), ==, 0);
+    
+    for (guint i = 0; i < n_images; i++) {
+        g_autofree char *filename = g_strdup_printf("%s-%u.png", name, i);
+        g_autofree char *path = g_build_filename(folder, filename, NULL);
+        
+        g_autoptr(GError) error = NULL;
+        g_file_set_contents(path, reinterpret_cast<const char*>(PIXEL_PNG), sizeof(PIXEL_PNG), &error);
+        g_assert_no_error(error);
+    }
+    
+    return folder;
+}
+
+static void
+run_apply(WallySlideshowManager *manager, const char *day_folder, const char *night_folder)
+{
+    g_autoptr(WallyApplyJob) job = wally_apply_job_new(manager, day_folder, night_folder, 1800, 2.0);
+    
+    g_autoptr(GError) error = NULL;
+    wally_apply_job_run_sync(job, NULL, &error);
+    g_assert_no_error(error);
+}
+
+static void
+test_background_writes(void)
+{
+    g_autofree char *day_folder = make_folder("day", 3);
+    g_autofree char *night_folder = make_folder("night", 2);
+    g_autoptr(WallySlideshowManager) manager = wally_slideshow_manager_new();
+    WallyBackgroundWriter *writer = wally_background_writer_get_default();
+    
+    // Both slideshows and the picture options go out together
+    guint writes = wally_background_writer_get_write_count(writer);
+    run_apply(manager, day_folder, night_folder);
+    g_assert_cmpuint(wally_background_writer_get_write_count(writer), ==, writes + 1);
+    
+    g_autofree char *day_xml = wally_apply_job_build_xml_path(WALLY_APPLY_FOLDER_DAY);
+    g_autofree char *night_xml = wally_apply_job_build_xml_path(WALLY_APPLY_FOLDER_NIGHT);
+    g_assert_true(wally_slideshow_manager_is_wallpaper_applied(manager, day_xml, FALSE));
+    g_assert_true(wally_slideshow_manager_is_wallpaper_applied(manager, night_xml, TRUE));
+    
+    // The same folders again leave the settings alone
+    run_apply(manager, day_folder, night_folder);
+    g_assert_cmpuint(wally_background_writer_get_write_count(writer), ==, writes + 1);
+}
+
+int
+main(int argc, char *argv[])
+{
+    // The job imports into ~/Pictures, which has to be a scratch directory
+    g_test_init(&argc, &argv, G_TEST_OPTION_ISOLATE_DIRS, NULL);
+    
+    g_test_add_func("/apply-job/background-writes", test_background_writes);
+    
+    return g_test_run();
+}
@@ -0,0 +1,241 @@
+/*
+ * The power monitor against stand-in UPower, logind and screensaver services
+ * on a private bus, which serves as both the system and the session bus.
+ */
+#include "power-monitor.h"
+#include "dbus-fixture.h"
+
+static const char SERVICES_XML[] =
+    "<node>"
+    "  <interface name='org.freedesktop.UPower'>"
+    "    <property name='OnBattery' type='b' access='read'/>"
+    "  </interface>"
+    "  <interface name='org.freedesktop.login1.Session'>"
+    "    <property name='LockedHint' type='b' access='read'/>"
+    "  </interface>"
+    "  <interface name='org.gnome.ScreenSaver'>"
+    "    <method name='GetActive'>"
+    "      <arg name='active' type='b' direction='out'/>"
+    "    </method>"
+    "    <signal name='ActiveChanged'>"
+    "      <arg name='active' type='b'/>"
+    "    </signal>"
+    "  </interface>"
+    "</node>";
+
+typedef struct
+{
+    DBusFixture dbus;
+    GDBusNodeInfo *node_info;
+    
+    gboolean on_battery;
+    gboolean locked;
+    gboolean screensaver_active;
+    
+    guint changes;
+} Fixture;
+
+static GVariant *
+get_service_property(GDBusConnection *connection G_GNUC_UNUSED,
+                     const char *sender G_GNUC_UNUSED,
+                     const char *object_path G_GNUC_UNUSED,
+                     const char *interface_name G_GNUC_UNUSED,
+                     const char *property_name,
+                     GError **error G_GNUC_UNUSED,
+                     gpointer user_data)
+{
+    Fixture *fixture = static_cast<Fixture*>(user_data);
+    
+    if (g_str_equal(property_name, "OnBattery")) {
+        return g_variant_new_boolean(fixture->on_battery);
+    }
+    return g_variant_new_boolean(fixture->locked);
+}
+
+static void
+call_service_method(GDBusConnection *connection G_GNUC_UNUSED,
+                    const char *sender G_GNUC_UNUSED,
+                    const char *object_path G_GNUC_UNUSED,
+                    const char *interface_name G_GNUC_UNUSED,
+                    const char *method_name G_GNUC_UNUSED,
+                    GVariant *parameters G_GNUC_UNUSED,
+                    GDBusMethodInvocation *invocation,
+                    gpointer user_data)
+{
+    Fixture *fixture = static_cast<Fixture*>(user_data);
+    
+    g_dbus_method_invocation_return_value(invocation, g_variant_new("(b)", fixture->screensaver_active));
+}
+
+static const GDBusInterfaceVTable SERVICE_VTABLE = {
+    call_service_method,
+    get_service_property,
+    NULL,
+    {NULL},
+};
+
+static void
+own_name(GDBusConnection *connection, const char *name)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) reply = g_dbus_connection_call_sync(connection, "org.freedesktop.DBus",
+                                                            "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                                            "RequestName", g_variant_new("(su)", name, 0),
+                                                            G_VARIANT_TYPE("(u)"), G_DBUS_CALL_FLAGS_NONE, -1,
+                                                            NULL, &error);
+    g_assert_no_error(error);
+}
+
+static void
+export_service(Fixture *fixture, const char *name, const char *object_path, const char *interface_name)
+{
+    g_autoptr(GError) error = NULL;
+    GDBusInterfaceInfo *interface_info = g_dbus_node_info_lookup_interface(fixture->node_info, interface_name);
+    
+    g_dbus_connection_register_object(fixture->dbus.service, object_path, interface_info, &SERVICE_VTABLE,
+                                      fixture, NULL, &error);
+    g_assert_no_error(error);
+    own_name(fixture->dbus.service, name);
+}
+
+static void
+fixture_set_up(Fixture *fixture, gconstpointer user_data G_GNUC_UNUSED)
+{
+    dbus_fixture_set_up(&fixture->dbus);
+    fixture->node_info = g_dbus_node_info_new_for_xml(SERVICES_XML, NULL);
+    g_assert_nonnull(fixture->node_info);
+}
+
+static void
+fixture_tear_down(Fixture *fixture, gconstpointer user_data G_GNUC_UNUSED)
+{
+    g_clear_pointer(&fixture->node_info, g_dbus_node_info_unref);
+    dbus_fixture_tear_down(&fixture->dbus);
+}
+
+static void
+export_all_services(Fixture *fixture)
+{
+    export_service(fixture, "org.freedesktop.UPower", "/org/freedesktop/UPower", "org.freedesktop.UPower");
+    export_service(fixture, "org.freedesktop.login1", "/org/freedesktop/login1/session/auto",
+                   "org.freedesktop.login1.Session");
+    export_service(fixture, "org.gnome.ScreenSaver", "/org/gnome/ScreenSaver", "org.gnome.ScreenSaver");
+}
+
+static void
+on_changed(WallyPowerMonitor *monitor G_GNUC_UNUSED, Fixture *fixture)
+{
+    fixture->changes++;
+}
+
+// Runs the main loop until ::changed has been emitted @count times in all
+static void
+wait_for_changes(Fixture *fixture, guint count)
+{
+    dbus_fixture_wait_until([fixture, count] { return fixture->changes >= count; });
+}
+
+static void
+emit_properties_changed(Fixture *fixture, const char *object_path, const char *interface_name,
+                        const char *property_name, gboolean value)
+{
+    GVariantBuilder changed;
+    g_variant_builder_init(&changed, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add(&changed, "{sv}", property_name, g_variant_new_boolean(value));
+    
+    g_autoptr(GError) error = NULL;
+    g_dbus_connection_emit_signal(fixture->dbus.service, NULL, object_path, "org.freedesktop.DBus.Properties",
+                                  "PropertiesChanged",
+                                  g_variant_new("(sa{sv}as)", interface_name, &changed, NULL), &error);
+    g_assert_no_error(error);
+}
+
+static void
+test_no_services(Fixture *fixture, gconstpointer user_data G_GNUC_UNUSED)
+{
+    g_autoptr(WallyPowerMonitor) monitor = wally_power_monitor_new(fixture->dbus.client, fixture->dbus.client);
+    g_signal_connect(monitor, "changed", G_CALLBACK(on_changed), fixture);
+    
+    dbus_fixture_settle();
+    
+    g_assert_cmpuint(fixture->changes, ==, 0);
+    g_assert_false(wally_power_monitor_get_on_battery(monitor));
+    g_assert_false(wally_power_monitor_get_screen_off(monitor));
+}
+
+static void
+test_on_battery(Fixture *fixture, gconstpointer user_data G_GNUC_UNUSED)
+{
+    fixture->on_battery = TRUE;
+    export_all_services(fixture);
+    
+    g_autoptr(WallyPowerMonitor) monitor = wally_power_monitor_new(fixture->dbus.client, fixture->dbus.client);
+    g_signal_connect(monitor, "changed", G_CALLBACK(on_changed), fixture);
+    
+    wait_for_changes(fixture, 1);
+    g_assert_true(wally_power_monitor_get_on_battery(monitor));
+    g_assert_false(wally_power_monitor_get_screen_off(monitor));
+    
+    fixture->on_battery = FALSE;
+    emit_properties_changed(fixture, "/org/freedesktop/UPower", "org.freedesktop.UPower", "OnBattery", FALSE);
+    
+    wait_for_changes(fixture, 2);
+    g_assert_false(wally_power_monitor_get_on_battery(monitor));
+}
+
+static void
+test_locked(Fixture *fixture, gconstpointer user_data G_GNUC_UNUSED)
+{
+    export_all_services(fixture);
+    
+    g_autoptr(WallyPowerMonitor) monitor = wally_power_monitor_new(fixture->dbus.client, fixture->dbus.client);
+    g_signal_connect(monitor, "changed", G_CALLBACK(on_changed), fixture);
+    dbus_fixture_settle();
+    g_assert_false(wally_power_monitor_get_screen_off(monitor));
+    
+    guint changes = fixture->changes;
+    fixture->locked = TRUE;
+    emit_properties_changed(fixture, "/org/freedesktop/login1/session/auto", "org.freedesktop.login1.Session",
+                            "LockedHint", TRUE);
+    
+    wait_for_changes(fixture, changes + 1);
+    g_assert_true(wally_power_monitor_get_screen_off(monitor));
+    g_assert_false(wally_power_monitor_get_on_battery(monitor));
+}
+
+static void
+test_screensaver(Fixture *fixture, gconstpointer user_data G_GNUC_UNUSED)
+{
+    fixture->screensaver_active = TRUE;
+    export_all_services(fixture);
+    
+    // The state at startup comes from GetActive
+    g_autoptr(WallyPowerMonitor) monitor = wally_power_monitor_new(fixture->dbus.client, fixture->dbus.client);
+    g_signal_connect(monitor, "changed", G_CALLBACK(on_changed), fixture);
+    
+    wait_for_changes(fixture, 1);
+    g_assert_true(wally_power_monitor_get_screen_off(monitor));
+    
+    // Later ones from ActiveChanged
+    fixture->screensaver_active = FALSE;
+    g_autoptr(GError) error = NULL;
+    g_dbus_connection_emit_signal(fixture->dbus.service, NULL, "/org/gnome/ScreenSaver", "org.gnome.ScreenSaver",
+                                  "ActiveChanged", g_variant_new("(b)", FALSE), &error);
+    g_assert_no_error(error);
+    
+    wait_for_changes(fixture, 2);
+    g_assert_false(wally_power_monitor_get_screen_off(monitor));
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    
+    g_test_add("/power-monitor/no-services", Fixture, NULL, fixture_set_up, test_no_services, fixture_tear_down);
+    g_test_add("/power-monitor/on-battery", Fixture, NULL, fixture_set_up, test_on_battery, fixture_tear_down);
+    g_test_add("/power-monitor/locked", Fixture, NULL, fixture_set_up, test_locked, fixture_tear_down);
+    g_test_add("/power-monitor/screensaver", Fixture, NULL, fixture_set_up, test_screensaver, fixture_tear_down);
+    
+    return g_test_run();
+}
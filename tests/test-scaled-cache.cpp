@@ -0,0 +1,152 @@
+/*
+ * Downscaling to the screen size, for images shown the way they are stored
+ * and for ones an EXIF orientation turns on their side.
+ */
+#include "image-probe.h"
+#include "scaled-cache.h"
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#define SCREEN_WIDTH 384
+#define SCREEN_HEIGHT 216
+
+// A little-endian TIFF structure with a single Orientation tag of 6: the
+// image has to be turned a quarter clockwise to be upright
+static const guint8 EXIF_ROTATED[] = {
+    'E', 'x', 'i', 'f', 0, 0,
+    'I', 'I', '*', 0, 8, 0, 0, 0,
+    1, 0,
+    0x12, 0x01, 3, 0, 1, 0, 0, 0, 6, 0, 0, 0,
+    0, 0, 0, 0,
+};
+
+typedef struct
+{
+    char *dir;
+} Fixture;
+
+static void
+fixture_set_up(Fixture *fixture, gconstpointer user_data G_GNUC_UNUSED)
+{
+    g_autoptr(GError) error = NULL;
+    fixture->dir = g_dir_make_tmp("wally-scaled-cache-XXXXXX", &error);
+    g_assert_no_error(error);
+}
+
+static void
+fixture_tear_down(Fixture *fixture, gconstpointer user_data G_GNUC_UNUSED)
+{
+    g_autoptr(GDir) dir = g_dir_open(fixture->dir, 0, NULL);
+    const char *name;
+    while (dir != NULL && (name = g_dir_read_name(dir)) != NULL) {
+        g_autofree char *path = g_build_filename(fixture->dir, name, NULL);
+        g_unlink(path);
+    }
+    
+    g_rmdir(fixture->dir);
+    g_clear_pointer(&fixture->dir, g_free);
+}
+
+// Writes a grey JPEG of the given size, with @exif as an APP1 segment
+// straight after the start of image when it isn't NULL
+static char *
+write_jpeg(Fixture *fixture, const char *name, int width, int height, const guint8 *exif, gsize exif_length)
+{
+    g_autoptr(GdkPixbuf) pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+    gdk_pixbuf_fill(pixbuf, 0x808080ff);
+    
+    g_autoptr(GError) error = NULL;
+    g_autofree char *data = NULL;
+    gsize length = 0;
+    gdk_pixbuf_save_to_buffer(pixbuf, &data, &length, "jpeg", &error, NULL);
+    g_assert_no_error(error);
+    g_assert_cmpuint(length, >, 2);
+    
+    g_autoptr(GByteArray) file = g_byte_array_new();
+    g_byte_array_append(file, reinterpret_cast<const guint8*>(data), 2);
+    if (exif != NULL) {
+        guint8 segment[4] = {0xFF, 0xE1, (guint8)((exif_length + 2) >> 8), (guint8)(exif_length + 2)};
+        g_byte_array_append(file, segment, sizeof(segment));
+        g_byte_array_append(file, exif, exif_length);
+    }
+    g_byte_array_append(file, reinterpret_cast<const guint8*>(data) + 2, length - 2);
+    
+    char *path = g_build_filename(fixture->dir, name, NULL);
+    g_file_set_contents(path, reinterpret_cast<const char*>(file->data), file->len, &error);
+    g_assert_no_error(error);
+    
+    return path;
+}
+
+static void
+assert_scaled_size(Fixture *fixture, const char *source_path, int width, int height)
+{
+    g_autofree char *cache_path = g_build_filename(fixture->dir, "scaled.jpg", NULL);
+    
+    WallyScaleResult result;
+    g_autoptr(GError) error = NULL;
+    wally_scaled_cache_build(source_path, cache_path, SCREEN_WIDTH, SCREEN_HEIGHT, &result, &error);
+    g_assert_no_error(error);
+    g_assert_cmpint(result, ==, WALLY_SCALE_RESULT_SCALED);
+    
+    int scaled_width = 0;
+    int scaled_height = 0;
+    g_assert_nonnull(gdk_pixbuf_get_file_info(cache_path, &scaled_width, &scaled_height));
+    g_assert_cmpint(scaled_width, ==, width);
+    g_assert_cmpint(scaled_height, ==, height);
+}
+
+static void
+test_landscape(Fixture *fixture, gconstpointer user_data G_GNUC_UNUSED)
+{
+    g_autofree char *path = write_jpeg(fixture, "landscape.jpg", SCREEN_WIDTH * 2, SCREEN_HEIGHT * 2, NULL, 0);
+    
+    // Twice the screen both ways: halved, not left at twice its height
+    assert_scaled_size(fixture, path, SCREEN_WIDTH, SCREEN_HEIGHT);
+}
+
+static void
+test_rotated(Fixture *fixture, gconstpointer user_data G_GNUC_UNUSED)
+{
+    g_autofree char *path = write_jpeg(fixture, "rotated.jpg", SCREEN_HEIGHT * 2, SCREEN_WIDTH * 2,
+                                       EXIF_ROTATED, sizeof(EXIF_ROTATED));
+    
+    WallyImageInfo info;
+    g_autoptr(GError) error = NULL;
+    g_assert_true(wally_image_probe_file(path, &info, &error));
+    g_assert_no_error(error);
+    g_assert_cmpuint(info.width, ==, SCREEN_HEIGHT * 2);
+    g_assert_cmpuint(info.height, ==, SCREEN_WIDTH * 2);
+    g_assert_cmpuint(info.orientation, ==, 6);
+    
+    // Stored upright, shown on its side as a landscape twice the screen
+    assert_scaled_size(fixture, path, SCREEN_WIDTH, SCREEN_HEIGHT);
+}
+
+static void
+test_small(Fixture *fixture, gconstpointer user_data G_GNUC_UNUSED)
+{
+    g_autofree char *path = write_jpeg(fixture, "small.jpg", SCREEN_WIDTH, SCREEN_HEIGHT, NULL, 0);
+    g_autofree char *cache_path = g_build_filename(fixture->dir, "scaled.jpg", NULL);
+    
+    WallyScaleResult result;
+    g_autoptr(GError) error = NULL;
+    wally_scaled_cache_build(path, cache_path, SCREEN_WIDTH, SCREEN_HEIGHT, &result, &error);
+    g_assert_no_error(error);
+    g_assert_cmpint(result, ==, WALLY_SCALE_RESULT_NOT_NEEDED);
+    g_assert_false(g_file_test(cache_path, G_FILE_TEST_EXISTS));
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    
+    g_test_add("/scaled-cache/landscape", Fixture, NULL, fixture_set_up, test_landscape, fixture_tear_down);
+    g_test_add("/scaled-cache/rotated", Fixture, NULL, fixture_set_up, test_rotated, fixture_tear_down);
+    g_test_add("/scaled-cache/small", Fixture, NULL, fixture_set_up, test_small, fixture_tear_down);
+    
+    return g_test_run();
+}
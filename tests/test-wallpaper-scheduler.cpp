@@ -0,0 +1,278 @@
+/*
+ * The wallpaper scheduler's D-Bus interface, called over a private bus the
+ * way `wally --next` and friends call it. The background is written to the
+ * memory settings backend, against a stand-in of GNOME's schema.
+ */
+#include "wallpaper-scheduler.h"
+#include "background-writer.h"
+#include "dbus-fixture.h"
+#include "slideshow-writer.h"
+
+#include <glib/gstdio.h>
+
+#define OBJECT_PATH "/com/qomarhsn/wally/Scheduler"
+
+static const char *const DAY_FILES[] = {"/wallpapers/day-1.jpg", "/wallpapers/day-2.jpg", "/wallpapers/day-3.jpg"};
+static const char *const NIGHT_FILES[] = {"/wallpapers/night-1.jpg", "/wallpapers/night-2.jpg"};
+
+typedef struct
+{
+    DBusFixture dbus;
+    
+    char *tmp_dir;
+    char *day_xml;
+    char *night_xml;
+    
+    WallyPowerMonitor *power_monitor;
+    WallyWallpaperScheduler *scheduler;
+} Fixture;
+
+static char *
+write_slideshow(const char *tmp_dir, const char *name, const char *const *files, gsize n_files)
+{
+    g_autoptr(GError) error = NULL;
+    char *path = g_build_filename(tmp_dir, name, NULL);
+    
+    g_autoptr(WallySlideshowWriter) writer = wally_slideshow_writer_new(path, 1800, 2.0, NULL, &error);
+    g_assert_no_error(error);
+    for (gsize i = 0; i < n_files; i++) {
+        wally_slideshow_writer_add_file(writer, files[i], &error);
+        g_assert_no_error(error);
+    }
+    wally_slideshow_writer_finish(writer, &error);
+    g_assert_no_error(error);
+    
+    return path;
+}
+
+static void
+fixture_set_up(Fixture *fixture, gconstpointer user_data G_GNUC_UNUSED)
+{
+    dbus_fixture_set_up(&fixture->dbus);
+    
+    fixture->tmp_dir = g_dir_make_tmp("wally-test-XXXXXX", NULL);
+    g_assert_nonnull(fixture->tmp_dir);
+    fixture->day_xml = write_slideshow(fixture->tmp_dir, "day.xml", DAY_FILES, G_N_ELEMENTS(DAY_FILES));
+    fixture->night_xml = write_slideshow(fixture->tmp_dir, "night.xml", NIGHT_FILES, G_N_ELEMENTS(NIGHT_FILES));
+    
+    // Nothing answers for UPower or logind on the private bus, so the
+    // scheduler sees mains power and a screen that is on
+    fixture->power_monitor = wally_power_monitor_new(fixture->dbus.client, fixture->dbus.client);
+    fixture->scheduler = wally_wallpaper_scheduler_new(fixture->day_xml, fixture->night_xml);
+    wally_wallpaper_scheduler_set_power_monitor(fixture->scheduler, fixture->power_monitor);
+    
+    g_autoptr(GError) error = NULL;
+    wally_wallpaper_scheduler_export(fixture->scheduler, fixture->dbus.service, OBJECT_PATH, &error);
+    g_assert_no_error(error);
+}
+
+static void
+fixture_tear_down(Fixture *fixture, gconstpointer user_data G_GNUC_UNUSED)
+{
+    wally_wallpaper_scheduler_stop(fixture->scheduler);
+    wally_wallpaper_scheduler_unexport(fixture->scheduler);
+    g_clear_object(&fixture->scheduler);
+    g_clear_object(&fixture->power_monitor);
+    
+    g_unlink(fixture->day_xml);
+    g_unlink(fixture->night_xml);
+    g_rmdir(fixture->tmp_dir);
+    g_free(fixture->day_xml);
+    g_free(fixture->night_xml);
+    g_free(fixture->tmp_dir);
+    
+    dbus_fixture_tear_down(&fixture->dbus);
+}
+
+typedef struct
+{
+    gboolean done;
+    GVariant *reply;
+    GError *error;
+} CallResult;
+
+static void
+on_call_finished(GObject *source, GAsyncResult *result, gpointer user_data)
+{
+    CallResult *call = static_cast<CallResult*>(user_data);
+    
+    call->reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result, &call->error);
+    call->done = TRUE;
+}
+
+/*
+ * Calls @method_name on the scheduler. The scheduler answers from this
+ * thread's main loop, so the call is made asynchronously and the loop run
+ * until the reply is in.
+ */
+static GVariant *
+call_scheduler(Fixture *fixture, const char *method_name, GError **error)
+{
+    CallResult call = {FALSE, NULL, NULL};
+    g_dbus_connection_call(fixture->dbus.client, g_dbus_connection_get_unique_name(fixture->dbus.service),
+                           OBJECT_PATH, WALLY_SCHEDULER_DBUS_INTERFACE, method_name, NULL, NULL,
+                           G_DBUS_CALL_FLAGS_NONE, -1, NULL, on_call_finished, &call);
+    dbus_fixture_wait_until([&call] { return call.done; });
+    
+    if (call.error != NULL) {
+        g_propagate_error(error, call.error);
+    }
+    return call.reply;
+}
+
+static void
+call_method(Fixture *fixture, const char *method_name)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) reply = call_scheduler(fixture, method_name, &error);
+    g_assert_no_error(error);
+}
+
+static GVariant *
+get_status(Fixture *fixture)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) reply = call_scheduler(fixture, "Status", &error);
+    g_assert_no_error(error);
+    g_assert_true(g_variant_is_of_type(reply, G_VARIANT_TYPE("(a{sv})")));
+    
+    return g_variant_get_child_value(reply, 0);
+}
+
+static gboolean
+get_status_boolean(Fixture *fixture, const char *key)
+{
+    g_autoptr(GVariant) status = get_status(fixture);
+    gboolean value = FALSE;
+    g_assert_true(g_variant_lookup(status, key, "b", &value));
+    
+    return value;
+}
+
+static guint
+get_status_uint(Fixture *fixture, const char *key)
+{
+    g_autoptr(GVariant) status = get_status(fixture);
+    guint32 value = 0;
+    g_assert_true(g_variant_lookup(status, key, "u", &value));
+    
+    return value;
+}
+
+static char *
+get_status_string(Fixture *fixture, const char *key)
+{
+    g_autoptr(GVariant) status = get_status(fixture);
+    char *value = NULL;
+    g_assert_true(g_variant_lookup(status, key, "s", &value));
+    
+    return value;
+}
+
+// The day image the background points at, as a path
+static char *
+get_background_file(void)
+{
+    g_autofree char *uri = wally_background_writer_get_uri(wally_background_writer_get_default(), FALSE);
+    return g_filename_from_uri(uri, NULL, NULL);
+}
+
+static void
+start_scheduler(Fixture *fixture)
+{
+    g_autoptr(GError) error = NULL;
+    wally_wallpaper_scheduler_start(fixture->scheduler, &error);
+    g_assert_no_error(error);
+}
+
+static void
+test_not_running(Fixture *fixture, gconstpointer user_data G_GNUC_UNUSED)
+{
+    g_assert_false(get_status_boolean(fixture, "running"));
+    
+    const char *const methods[] = {"Next", "Previous", "Pause", "Resume"};
+    for (const char *method_name : methods) {
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GVariant) reply = call_scheduler(fixture, method_name, &error);
+        g_assert_null(reply);
+        g_assert_true(g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED));
+    }
+}
+
+static void
+test_status(Fixture *fixture, gconstpointer user_data G_GNUC_UNUSED)
+{
+    start_scheduler(fixture);
+    
+    g_assert_true(get_status_boolean(fixture, "running"));
+    g_assert_false(get_status_boolean(fixture, "paused"));
+    g_assert_false(get_status_boolean(fixture, "on-battery"));
+    g_assert_cmpuint(get_status_uint(fixture, "interval"), ==, 1800);
+    g_assert_cmpuint(get_status_uint(fixture, "day-count"), ==, G_N_ELEMENTS(DAY_FILES));
+    g_assert_cmpuint(get_status_uint(fixture, "night-count"), ==, G_N_ELEMENTS(NIGHT_FILES));
+    g_assert_cmpuint(get_status_uint(fixture, "day-position"), ==, 0);
+    
+    g_autofree char *day_file = get_status_string(fixture, "day-file");
+    g_assert_cmpstr(day_file, ==, DAY_FILES[0]);
+    g_autofree char *night_file = get_status_string(fixture, "night-file");
+    g_assert_cmpstr(night_file, ==, NIGHT_FILES[0]);
+}
+
+static void
+test_next_previous(Fixture *fixture, gconstpointer user_data G_GNUC_UNUSED)
+{
+    start_scheduler(fixture);
+    
+    call_method(fixture, "Next");
+    g_assert_cmpuint(get_status_uint(fixture, "day-position"), ==, 1);
+    g_assert_cmpuint(get_status_uint(fixture, "night-position"), ==, 1);
+    g_autofree char *next_file = get_background_file();
+    g_assert_cmpstr(next_file, ==, DAY_FILES[1]);
+    
+    call_method(fixture, "Previous");
+    g_assert_cmpuint(get_status_uint(fixture, "day-position"), ==, 0);
+    g_autofree char *previous_file = get_background_file();
+    g_assert_cmpstr(previous_file, ==, DAY_FILES[0]);
+    
+    // Going back from the first image wraps round to the last
+    call_method(fixture, "Previous");
+    g_assert_cmpuint(get_status_uint(fixture, "day-position"), ==, G_N_ELEMENTS(DAY_FILES) - 1);
+    g_assert_cmpuint(get_status_uint(fixture, "night-position"), ==, G_N_ELEMENTS(NIGHT_FILES) - 1);
+    g_autofree char *last_file = get_background_file();
+    g_assert_cmpstr(last_file, ==, DAY_FILES[G_N_ELEMENTS(DAY_FILES) - 1]);
+}
+
+static void
+test_pause_resume(Fixture *fixture, gconstpointer user_data G_GNUC_UNUSED)
+{
+    start_scheduler(fixture);
+    
+    call_method(fixture, "Pause");
+    g_assert_true(get_status_boolean(fixture, "paused"));
+    
+    // Stepping by hand still works while paused
+    call_method(fixture, "Next");
+    g_assert_cmpuint(get_status_uint(fixture, "day-position"), ==, 1);
+    g_assert_true(get_status_boolean(fixture, "paused"));
+    
+    call_method(fixture, "Resume");
+    g_assert_false(get_status_boolean(fixture, "paused"));
+    g_assert_cmpuint(get_status_uint(fixture, "day-position"), ==, 1);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    
+    g_test_add("/wallpaper-scheduler/not-running", Fixture, NULL,
+               fixture_set_up, test_not_running, fixture_tear_down);
+    g_test_add("/wallpaper-scheduler/status", Fixture, NULL,
+               fixture_set_up, test_status, fixture_tear_down);
+    g_test_add("/wallpaper-scheduler/next-previous", Fixture, NULL,
+               fixture_set_up, test_next_previous, fixture_tear_down);
+    g_test_add("/wallpaper-scheduler/pause-resume", Fixture, NULL,
+               fixture_set_up, test_pause_resume, fixture_tear_down);
+    
+    return g_test_run();
+}